@@ -35,13 +35,16 @@ LOCAL_SRC_FILES := \
 	$(MY_ROOT)/fitz/crypt_md5.c \
 	$(MY_ROOT)/fitz/crypt_sha2.c \
 	$(MY_ROOT)/fitz/dev_bbox.c \
+	$(MY_ROOT)/fitz/dev_cost.c \
 	$(MY_ROOT)/fitz/dev_list.c \
 	$(MY_ROOT)/fitz/dev_null.c \
+	$(MY_ROOT)/fitz/dev_profile.c \
 	$(MY_ROOT)/fitz/dev_text.c \
 	$(MY_ROOT)/fitz/dev_trace.c \
 	$(MY_ROOT)/fitz/doc_document.c \
 	$(MY_ROOT)/fitz/doc_link.c \
 	$(MY_ROOT)/fitz/doc_outline.c \
+	$(MY_ROOT)/fitz/doc_pipeline.c \
 	$(MY_ROOT)/fitz/filt_basic.c \
 	$(MY_ROOT)/fitz/filt_dctd.c \
 	$(MY_ROOT)/fitz/filt_faxd.c \
@@ -63,6 +66,7 @@ LOCAL_SRC_FILES := \
 	$(MY_ROOT)/fitz/stm_buffer.c \
 	$(MY_ROOT)/fitz/stm_open.c \
 	$(MY_ROOT)/fitz/stm_read.c \
+	$(MY_ROOT)/fitz/stm_zip.c \
 	$(MY_ROOT)/draw/draw_affine.c \
 	$(MY_ROOT)/draw/draw_blend.c \
 	$(MY_ROOT)/draw/draw_device.c \
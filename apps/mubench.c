@@ -0,0 +1,1270 @@
+/*
+ * mubench -- reproducible rendering benchmark
+ *
+ * Generates a fixed corpus of stress documents and renders documents
+ * at a set of resolutions and thread counts, printing one line of
+ * timing, memory and cache statistics per run.
+ */
+
+#include "fitz.h"
+#include "mupdf-internal.h"
+
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#define HAVE_PTHREADS
+#endif
+
+#define BENCH_VERSION 2
+#define MAX_LIST 16
+
+static float resolutions[MAX_LIST] = { 72, 150, 300 };
+static int nresolutions = 3;
+static int threads[MAX_LIST] = { 1, 2, 4 };
+static int nthreads = 3;
+static int iterations = 3;
+static int alphabits = 8;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mubench [options] [input files]\n"
+		"\t-g -\tgenerate the benchmark corpus into directory\n"
+		"\t-r -\tcomma separated list of resolutions (72,150,300)\n"
+		"\t-j -\tcomma separated list of thread counts (1,2,4)\n"
+		"\t-n -\tnumber of iterations per run (3)\n"
+		"\t-b -\tnumber of bits of antialiasing (0 to 8)\n");
+	exit(1);
+}
+
+static void die(char *msg, char *arg)
+{
+	fprintf(stderr, "mubench: %s '%s'\n", msg, arg);
+	exit(1);
+}
+
+static double now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart * 1000 / freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
+static int parselist(char *s, float *list)
+{
+	int n = 0;
+	char *item;
+	while ((item = fz_strsep(&s, ",")) != NULL && n < MAX_LIST)
+	{
+		if (*item)
+			list[n++] = atof(item);
+	}
+	return n;
+}
+
+/*
+ * Corpus generation.
+ *
+ * Every document is generated from a fixed seed with a private random
+ * number generator, so the corpus is byte for byte identical between
+ * runs and platforms.
+ */
+
+static unsigned int seed;
+
+static float frand(float lo, float hi)
+{
+	seed = seed * 1103515245 + 12345;
+	return lo + (hi - lo) * ((seed >> 8) & 0xffff) / 65536.0f;
+}
+
+static int irand(int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffff) % n;
+}
+
+typedef struct gbuf_s gbuf;
+
+struct gbuf_s
+{
+	char *data;
+	int len, cap;
+};
+
+static void gwrite(gbuf *b, const void *data, int len)
+{
+	if (len == 0)
+		return;
+	if (b->len + len > b->cap)
+	{
+		int cap = b->cap ? b->cap : 4096;
+		while (cap < b->len + len)
+			cap *= 2;
+		b->data = realloc(b->data, cap);
+		if (!b->data)
+			die("out of memory", "gbuf");
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void gprintf(gbuf *b, const char *fmt, ...)
+{
+	char tmp[1024];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(tmp, sizeof tmp, fmt, ap);
+	va_end(ap);
+	if (n < 0 || n >= (int)sizeof tmp)
+		die("formatted string too long", (char *)fmt);
+	gwrite(b, tmp, n);
+}
+
+static void gfree(gbuf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->cap = 0;
+}
+
+static void gdeflate(gbuf *out, unsigned char *data, int len)
+{
+	uLongf clen = compressBound(len);
+	unsigned char *cdata = malloc(clen);
+	if (!cdata || compress2(cdata, &clen, data, len, 6) != Z_OK)
+		die("cannot compress", "data");
+	gwrite(out, cdata, clen);
+	free(cdata);
+}
+
+static void gword(gbuf *b, int first, int count)
+{
+	int i, n = 2 + irand(8);
+	for (i = 0; i < n; i++)
+		gprintf(b, "%c", first + irand(count));
+}
+
+static void gcircle(gbuf *b, float x, float y, float r)
+{
+	float k = r * 0.5523f;
+	gprintf(b, "%.2f %.2f m\n", x + r, y);
+	gprintf(b, "%.2f %.2f %.2f %.2f %.2f %.2f c\n", x + r, y + k, x + k, y + r, x, y + r);
+	gprintf(b, "%.2f %.2f %.2f %.2f %.2f %.2f c\n", x - k, y + r, x - r, y + k, x - r, y);
+	gprintf(b, "%.2f %.2f %.2f %.2f %.2f %.2f c\n", x - r, y - k, x - k, y - r, x, y - r);
+	gprintf(b, "%.2f %.2f %.2f %.2f %.2f %.2f c h\n", x + k, y - r, x + r, y - k, x + r, y);
+}
+
+static void gblob(gbuf *b, float x, float y, float r)
+{
+	int i;
+	gprintf(b, "%.2f %.2f m\n", x + frand(-r, r), y + frand(-r, r));
+	for (i = 0; i < 4; i++)
+		gprintf(b, "%.2f %.2f %.2f %.2f %.2f %.2f c\n",
+			x + frand(-r, r), y + frand(-r, r),
+			x + frand(-r, r), y + frand(-r, r),
+			x + frand(-r, r), y + frand(-r, r));
+	gprintf(b, "h\n");
+}
+
+/* PDF writer */
+
+#define PDF_MAX_OBJ 512
+#define PDF_W 612
+#define PDF_H 792
+
+typedef struct genpdf_s genpdf;
+
+struct genpdf_s
+{
+	FILE *out;
+	long ofs[PDF_MAX_OBJ];
+	int count;
+};
+
+static int genpdf_new_num(genpdf *w)
+{
+	if (w->count + 1 >= PDF_MAX_OBJ)
+		die("too many objects", "pdf");
+	return ++w->count;
+}
+
+static void genpdf_obj(genpdf *w, int num, const char *fmt, ...)
+{
+	va_list ap;
+	w->ofs[num] = ftell(w->out);
+	fprintf(w->out, "%d 0 obj\n", num);
+	va_start(ap, fmt);
+	vfprintf(w->out, fmt, ap);
+	va_end(ap);
+	fprintf(w->out, "\nendobj\n");
+}
+
+static void genpdf_stream(genpdf *w, int num, char *dict, unsigned char *data, int len, int deflate)
+{
+	gbuf z = { 0 };
+	if (deflate)
+	{
+		gdeflate(&z, data, len);
+		data = (unsigned char *)z.data;
+		len = z.len;
+	}
+	w->ofs[num] = ftell(w->out);
+	fprintf(w->out, "%d 0 obj\n<<%s /Length %d%s>>\nstream\n", num, dict, len, deflate ? " /Filter /FlateDecode" : "");
+	fwrite(data, 1, len, w->out);
+	fprintf(w->out, "\nendstream\nendobj\n");
+	gfree(&z);
+}
+
+static genpdf *genpdf_begin(char *dir, char *name)
+{
+	char path[1024];
+	genpdf *w = calloc(1, sizeof *w);
+	sprintf(path, "%.1000s/%s", dir, name);
+	w->out = fopen(path, "wb");
+	if (!w->out)
+		die("cannot create", path);
+	fprintf(w->out, "%%PDF-1.4\n%%\xe2\xe3\xcf\xd3\n");
+	w->count = 2; /* catalog and page tree */
+	return w;
+}
+
+static void genpdf_end(genpdf *w, int *pages, int npages)
+{
+	long xref;
+	int i;
+
+	genpdf_obj(w, 1, "<</Type /Catalog /Pages 2 0 R>>");
+	w->ofs[2] = ftell(w->out);
+	fprintf(w->out, "2 0 obj\n<</Type /Pages /Count %d /Kids [", npages);
+	for (i = 0; i < npages; i++)
+		fprintf(w->out, " %d 0 R", pages[i]);
+	fprintf(w->out, "]>>\nendobj\n");
+
+	xref = ftell(w->out);
+	fprintf(w->out, "xref\n0 %d\n0000000000 65535 f \n", w->count + 1);
+	for (i = 1; i <= w->count; i++)
+		fprintf(w->out, "%010ld 00000 n \n", w->ofs[i]);
+	fprintf(w->out, "trailer\n<</Size %d /Root 1 0 R>>\nstartxref\n%ld\n%%%%EOF\n", w->count + 1, xref);
+	fclose(w->out);
+	free(w);
+}
+
+typedef void (genpdf_content_fn)(gbuf *b, int pageno);
+
+static void genpdf_pages(genpdf *w, char *resources, int npages, genpdf_content_fn *content)
+{
+	int pages[64];
+	int i;
+
+	for (i = 0; i < npages; i++)
+	{
+		gbuf b = { 0 };
+		int contents = genpdf_new_num(w);
+		content(&b, i);
+		genpdf_stream(w, contents, "", (unsigned char *)b.data, b.len, 1);
+		gfree(&b);
+		pages[i] = genpdf_new_num(w);
+		genpdf_obj(w, pages[i], "<</Type /Page /Parent 2 0 R /MediaBox [0 0 %d %d] /Resources %s /Contents %d 0 R>>",
+			PDF_W, PDF_H, resources, contents);
+	}
+	genpdf_end(w, pages, npages);
+}
+
+/* text-heavy: base 14 fonts, Tj and TJ */
+
+static void text_content(gbuf *b, int pageno)
+{
+	int line, k;
+	seed = 1000 + pageno;
+	gprintf(b, "BT\n");
+	for (line = 0; line < 70; line++)
+	{
+		if (line % 10 == 0)
+			gprintf(b, "%.2f %.2f %.2f rg\n", frand(0, 0.5f), frand(0, 0.5f), frand(0, 0.5f));
+		gprintf(b, "/F%d %d Tf 1 0 0 1 36 %.2f Tm\n", (line / 10) % 3, 7 + (line % 4), 756 - line * 10.5f);
+		if (line % 5 == 4)
+		{
+			gprintf(b, "[");
+			for (k = 0; k < 14; k++)
+			{
+				gprintf(b, "(");
+				gword(b, 'a', 26);
+				gprintf(b, ") %d ", -200 - irand(200));
+			}
+			gprintf(b, "] TJ\n");
+		}
+		else
+		{
+			gprintf(b, "(");
+			for (k = 0; k < 14; k++)
+			{
+				gword(b, 'a', 26);
+				gprintf(b, " ");
+			}
+			gprintf(b, ") Tj\n");
+		}
+	}
+	gprintf(b, "ET\n");
+}
+
+static void gen_text(char *dir)
+{
+	genpdf *w = genpdf_begin(dir, "text.pdf");
+	char *names[] = { "Helvetica", "Times-Roman", "Courier" };
+	char res[256];
+	int f[3], i;
+	for (i = 0; i < 3; i++)
+	{
+		f[i] = genpdf_new_num(w);
+		genpdf_obj(w, f[i], "<</Type /Font /Subtype /Type1 /BaseFont /%s /Encoding /WinAnsiEncoding>>", names[i]);
+	}
+	sprintf(res, "<</Font <</F0 %d 0 R /F1 %d 0 R /F2 %d 0 R>>>>", f[0], f[1], f[2]);
+	genpdf_pages(w, res, 6, text_content);
+}
+
+/* vector-heavy: curves, strokes, dashes, even-odd fills and clips */
+
+static void vector_content(gbuf *b, int pageno)
+{
+	int i, k;
+	seed = 2000 + pageno;
+	for (i = 0; i < 1200; i++)
+	{
+		float x = frand(0, PDF_W), y = frand(0, PDF_H), r = frand(5, 80);
+		switch (i % 6)
+		{
+		case 0:
+			gprintf(b, "%.2f %.2f %.2f rg\n", frand(0, 1), frand(0, 1), frand(0, 1));
+			gblob(b, x, y, r);
+			gprintf(b, "f\n");
+			break;
+		case 1:
+			gprintf(b, "%.2f %.2f %.2f rg\n%.2f %.2f m\n", frand(0, 1), frand(0, 1), frand(0, 1), x + r, y);
+			for (k = 1; k < 7; k++)
+				gprintf(b, "%.2f %.2f l\n", x + r * cos(k * 2.6927937f), y + r * sin(k * 2.6927937f));
+			gprintf(b, "h f*\n");
+			break;
+		case 2:
+			gprintf(b, "%.2f w %d J %d j [%.2f %.2f] 0 d %.2f %.2f %.2f RG\n",
+				frand(0.1f, 6), irand(3), irand(3), frand(1, 8), frand(1, 8),
+				frand(0, 1), frand(0, 1), frand(0, 1));
+			gblob(b, x, y, r);
+			gprintf(b, "S [] 0 d\n");
+			break;
+		case 3:
+			gprintf(b, "%.2f w %.2f %.2f %.2f rg %.2f %.2f %.2f RG\n", frand(0.5f, 3),
+				frand(0, 1), frand(0, 1), frand(0, 1),
+				frand(0, 1), frand(0, 1), frand(0, 1));
+			gblob(b, x, y, r);
+			gprintf(b, "B\n");
+			break;
+		case 4:
+			gprintf(b, "q\n");
+			gcircle(b, x, y, r);
+			gprintf(b, "W n %.2f %.2f %.2f rg\n", frand(0, 1), frand(0, 1), frand(0, 1));
+			gblob(b, x, y, r * 1.5f);
+			gprintf(b, "f Q\n");
+			break;
+		default:
+			gprintf(b, "%.2f %.2f %.2f rg %.2f %.2f %.2f %.2f re f\n",
+				frand(0, 1), frand(0, 1), frand(0, 1), x, y, r, frand(5, 80));
+			break;
+		}
+	}
+}
+
+static void gen_vector(char *dir)
+{
+	genpdf_pages(genpdf_begin(dir, "vector.pdf"), "<<>>", 4, vector_content);
+}
+
+/* transparency: constant alpha, blend modes, knockout groups, soft masks */
+
+static void transp_content(gbuf *b, int pageno)
+{
+	int i;
+	seed = 3000 + pageno;
+	for (i = 0; i < 150; i++)
+	{
+		gprintf(b, "q /GS%d gs %.2f %.2f %.2f rg\n", i % 4, frand(0, 1), frand(0, 1), frand(0, 1));
+		gcircle(b, frand(0, PDF_W), frand(0, PDF_H), frand(10, 90));
+		gprintf(b, "f Q\n");
+	}
+	for (i = 0; i < 20; i++)
+		gprintf(b, "q /GS%d gs 1 0 0 1 %.2f %.2f cm /Fm0 Do Q\n", i % 4, frand(-50, PDF_W - 100), frand(-50, PDF_H - 100));
+	gprintf(b, "q /GS4 gs 0 0.3 0.8 rg 36 36 540 720 re f Q\n");
+}
+
+static void gen_transp(char *dir)
+{
+	genpdf *w = genpdf_begin(dir, "transp.pdf");
+	gbuf b = { 0 };
+	char res[512];
+	int form, mask, shade, i;
+
+	form = genpdf_new_num(w);
+	seed = 3100;
+	for (i = 0; i < 12; i++)
+	{
+		gprintf(&b, "%.2f %.2f %.2f rg %.2f g\n", frand(0, 1), frand(0, 1), frand(0, 1), frand(0, 1));
+		gcircle(&b, frand(20, 130), frand(20, 130), frand(10, 50));
+		gprintf(&b, "f\n");
+	}
+	genpdf_stream(w, form, "/Type /XObject /Subtype /Form /BBox [0 0 150 150] "
+		"/Group <</S /Transparency /I true /K true>> /Resources <<>>",
+		(unsigned char *)b.data, b.len, 1);
+	gfree(&b);
+
+	shade = genpdf_new_num(w);
+	genpdf_obj(w, shade, "<</ShadingType 2 /ColorSpace /DeviceGray /Coords [0 0 %d %d] "
+		"/Function <</FunctionType 2 /Domain [0 1] /C0 [0] /C1 [1] /N 1>>>>", PDF_W, PDF_H);
+	mask = genpdf_new_num(w);
+	gprintf(&b, "/Sh0 sh\n");
+	sprintf(res, "/Type /XObject /Subtype /Form /BBox [0 0 %d %d] "
+		"/Group <</S /Transparency /CS /DeviceGray>> /Resources <</Shading <</Sh0 %d 0 R>>>>",
+		PDF_W, PDF_H, shade);
+	genpdf_stream(w, mask, res, (unsigned char *)b.data, b.len, 0);
+	gfree(&b);
+
+	sprintf(res, "<</ExtGState <<"
+		"/GS0 <</ca 0.5 /CA 0.5>> "
+		"/GS1 <</ca 0.7 /BM /Multiply>> "
+		"/GS2 <</ca 0.6 /BM /Screen>> "
+		"/GS3 <</ca 0.8 /BM /Difference>> "
+		"/GS4 <</SMask <</Type /Mask /S /Luminosity /G %d 0 R>>>>"
+		">> /XObject <</Fm0 %d 0 R>>>>", mask, form);
+	genpdf_pages(w, res, 3, transp_content);
+}
+
+/* big images: rgb, gray, cmyk and soft masked, scaled and rotated */
+
+static void image_samples(gbuf *b, int w, int h, int n, int pattern)
+{
+	unsigned char *row = malloc(w * n);
+	int x, y, k;
+	for (y = 0; y < h; y++)
+	{
+		for (x = 0; x < w; x++)
+			for (k = 0; k < n; k++)
+				row[x * n + k] = ((x * (k + 1) + y * (pattern + 2)) ^ ((x * y) >> (5 + k))) + irand(16);
+		gwrite(b, row, w * n);
+	}
+	free(row);
+}
+
+static void image_content(gbuf *b, int pageno)
+{
+	int i;
+	seed = 4000 + pageno;
+	for (i = 0; i < 12; i++)
+	{
+		float s = frand(60, 400), a = frand(0, 6.2831853f);
+		gprintf(b, "q %.2f %.2f %.2f %.2f %.2f %.2f cm /Im%d Do Q\n",
+			s * cos(a), s * sin(a), -s * 0.75f * sin(a), s * 0.75f * cos(a),
+			frand(100, PDF_W - 100), frand(100, PDF_H - 100), i % 4);
+	}
+}
+
+static void gen_image(char *dir)
+{
+	genpdf *w = genpdf_begin(dir, "image.pdf");
+	static const struct { int w, h, n; char *cs; } img[] = {
+		{ 1600, 1200, 3, "/DeviceRGB" },
+		{ 1024, 1024, 1, "/DeviceGray" },
+		{ 640, 640, 4, "/DeviceCMYK" },
+		{ 512, 512, 3, "/DeviceRGB" },
+	};
+	char dict[256], res[256];
+	int num[4], smask, i;
+
+	seed = 4100;
+	smask = genpdf_new_num(w);
+	{
+		gbuf b = { 0 };
+		image_samples(&b, 512, 512, 1, 7);
+		genpdf_stream(w, smask, "/Type /XObject /Subtype /Image /Width 512 /Height 512 "
+			"/ColorSpace /DeviceGray /BitsPerComponent 8", (unsigned char *)b.data, b.len, 1);
+		gfree(&b);
+	}
+	for (i = 0; i < 4; i++)
+	{
+		gbuf b = { 0 };
+		num[i] = genpdf_new_num(w);
+		image_samples(&b, img[i].w, img[i].h, img[i].n, i);
+		sprintf(dict, "/Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace %s /BitsPerComponent 8",
+			img[i].w, img[i].h, img[i].cs);
+		if (i == 3)
+			sprintf(dict + strlen(dict), " /SMask %d 0 R", smask);
+		genpdf_stream(w, num[i], dict, (unsigned char *)b.data, b.len, 1);
+		gfree(&b);
+	}
+	sprintf(res, "<</XObject <</Im0 %d 0 R /Im1 %d 0 R /Im2 %d 0 R /Im3 %d 0 R>>>>",
+		num[0], num[1], num[2], num[3]);
+	genpdf_pages(w, res, 3, image_content);
+}
+
+/* shadings: axial, radial with stitching functions, triangle meshes */
+
+static void shade_content(gbuf *b, int pageno)
+{
+	int i;
+	seed = 5000 + pageno;
+	gprintf(b, "q 0 0 %d %d re W n /Sh2 sh Q\n", PDF_W, PDF_H / 2);
+	for (i = 0; i < 30; i++)
+	{
+		float x = frand(0, PDF_W), y = frand(0, PDF_H), r = frand(20, 120);
+		gprintf(b, "q\n");
+		gcircle(b, x, y, r);
+		gprintf(b, "W n %.2f 0 0 %.2f %.2f %.2f cm /Sh%d sh Q\n", r, r, x, y, i % 2);
+	}
+	gprintf(b, "/Pattern cs /P0 scn 36 %d 540 300 re f\n", PDF_H / 2 + 50);
+}
+
+static void gen_shade(char *dir)
+{
+	genpdf *w = genpdf_begin(dir, "shade.pdf");
+	gbuf b = { 0 };
+	char res[256];
+	int axial, radial, mesh, pattern, x, y, k;
+
+	axial = genpdf_new_num(w);
+	genpdf_obj(w, axial, "<</ShadingType 2 /ColorSpace /DeviceRGB /Coords [-1 0 1 0] /Extend [true true] "
+		"/Function <</FunctionType 2 /Domain [0 1] /C0 [1 0 0] /C1 [0 0 1] /N 1>>>>");
+	radial = genpdf_new_num(w);
+	genpdf_obj(w, radial, "<</ShadingType 3 /ColorSpace /DeviceRGB /Coords [0.2 0.2 0 0 0 1] /Extend [false true] "
+		"/Function <</FunctionType 3 /Domain [0 1] /Bounds [0.5] /Encode [0 1 0 1] /Functions ["
+		"<</FunctionType 2 /Domain [0 1] /C0 [1 1 0] /C1 [0 1 0] /N 1>> "
+		"<</FunctionType 2 /Domain [0 1] /C0 [0 1 0] /C1 [0 0 0.5] /N 2>>]>>>>");
+
+	/* a free-form mesh of 20x20 cells, two triangles each */
+	mesh = genpdf_new_num(w);
+	seed = 5100;
+	for (y = 0; y < 20; y++)
+	{
+		for (x = 0; x < 20; x++)
+		{
+			static const int tri[6][2] = { {0,0}, {1,0}, {0,1}, {1,0}, {1,1}, {0,1} };
+			for (k = 0; k < 6; k++)
+			{
+				unsigned char v[8];
+				int vx = (x + tri[k][0]) * 65535 / 20;
+				int vy = (y + tri[k][1]) * 65535 / 20;
+				v[0] = 0;
+				v[1] = vx >> 8; v[2] = vx;
+				v[3] = vy >> 8; v[4] = vy;
+				v[5] = (x + tri[k][0]) * 12;
+				v[6] = (y + tri[k][1]) * 12;
+				v[7] = irand(256);
+				gwrite(&b, v, 8);
+			}
+		}
+	}
+	sprintf(res, "/ShadingType 4 /ColorSpace /DeviceRGB /BitsPerCoordinate 16 /BitsPerComponent 8 "
+		"/BitsPerFlag 8 /Decode [0 %d 0 %d 0 1 0 1 0 1]", PDF_W, PDF_H / 2);
+	genpdf_stream(w, mesh, res, (unsigned char *)b.data, b.len, 1);
+	gfree(&b);
+
+	pattern = genpdf_new_num(w);
+	genpdf_obj(w, pattern, "<</PatternType 2 /Matrix [270 0 0 150 306 %d] /Shading %d 0 R>>", PDF_H / 2 + 200, radial);
+
+	sprintf(res, "<</Shading <</Sh0 %d 0 R /Sh1 %d 0 R /Sh2 %d 0 R>> /Pattern <</P0 %d 0 R>>>>",
+		axial, radial, mesh, pattern);
+	genpdf_pages(w, res, 3, shade_content);
+}
+
+/* type 3 fonts: cached uncoloured glyphs and coloured glyphs */
+
+static void type3_content(gbuf *b, int pageno)
+{
+	int line, k;
+	seed = 6000 + pageno;
+	gprintf(b, "BT\n");
+	for (line = 0; line < 50; line++)
+	{
+		gprintf(b, "%.2f %.2f %.2f rg /T%d %d Tf 1 0 0 1 36 %.2f Tm [",
+			frand(0, 0.6f), frand(0, 0.6f), frand(0, 0.6f),
+			line % 2, 8 + line % 8, 760 - line * 14.5f);
+		for (k = 0; k < 10; k++)
+		{
+			gprintf(b, "(");
+			gword(b, 'a', 26);
+			gprintf(b, ") -600 ");
+		}
+		gprintf(b, "] TJ\n");
+	}
+	gprintf(b, "ET\n");
+}
+
+static void gen_type3(char *dir)
+{
+	genpdf *w = genpdf_begin(dir, "type3.pdf");
+	char res[128];
+	int font[2], f, k, i;
+
+	for (f = 0; f < 2; f++)
+	{
+		gbuf procs = { 0 }, diffs = { 0 }, widths = { 0 };
+		for (k = 0; k < 26; k++)
+		{
+			gbuf b = { 0 };
+			int num = genpdf_new_num(w);
+			int sides = 3 + k % 5;
+			if (f == 0)
+				gprintf(&b, "600 0 0 0 600 800 d1\n");
+			else
+				gprintf(&b, "600 0 d0\n%.2f %.2f %.2f rg\n", (k % 3) * 0.4f, (k % 5) * 0.2f, (k % 7) * 0.14f);
+			gprintf(&b, "%.2f 400 m\n", 300 + 250.0f);
+			for (i = 1; i < sides; i++)
+				gprintf(&b, "%.2f %.2f l\n", 300 + 250 * cos(i * 6.2831853f / sides), 400 + 250 * sin(i * 6.2831853f / sides));
+			gprintf(&b, "h\n");
+			gcircle(&b, 300, 400, 40 + k * 4);
+			gprintf(&b, "f*\n");
+			genpdf_stream(w, num, "", (unsigned char *)b.data, b.len, 0);
+			gfree(&b);
+			gprintf(&procs, "/%c %d 0 R ", 'a' + k, num);
+			gprintf(&diffs, "/%c ", 'a' + k);
+			gprintf(&widths, "600 ");
+		}
+		gwrite(&procs, "", 1);
+		gwrite(&diffs, "", 1);
+		gwrite(&widths, "", 1);
+		font[f] = genpdf_new_num(w);
+		genpdf_obj(w, font[f], "<</Type /Font /Subtype /Type3 /FontBBox [0 0 600 800] "
+			"/FontMatrix [0.001 0 0 0.001 0 0] /CharProcs <<%s>> "
+			"/Encoding <</Type /Encoding /Differences [97 %s]>> "
+			"/FirstChar 97 /LastChar 122 /Widths [%s] /Resources <<>>>>",
+			procs.data, diffs.data, widths.data);
+		gfree(&procs);
+		gfree(&diffs);
+		gfree(&widths);
+	}
+	sprintf(res, "<</Font <</T0 %d 0 R /T1 %d 0 R>>>>", font[0], font[1]);
+	genpdf_pages(w, res, 3, type3_content);
+}
+
+/* Zip writer for XPS and CBZ; entries are stored uncompressed */
+
+typedef struct zipw_s zipw;
+
+struct zipw_s
+{
+	FILE *out;
+	gbuf central;
+	int count;
+};
+
+static void put16(gbuf *b, int v)
+{
+	unsigned char x[2];
+	x[0] = v; x[1] = v >> 8;
+	gwrite(b, x, 2);
+}
+
+static void put32(gbuf *b, unsigned long v)
+{
+	unsigned char x[4];
+	x[0] = v; x[1] = v >> 8; x[2] = v >> 16; x[3] = v >> 24;
+	gwrite(b, x, 4);
+}
+
+static zipw *zip_begin(char *dir, char *name)
+{
+	char path[1024];
+	zipw *z = calloc(1, sizeof *z);
+	sprintf(path, "%.1000s/%s", dir, name);
+	z->out = fopen(path, "wb");
+	if (!z->out)
+		die("cannot create", path);
+	return z;
+}
+
+static void zip_add(zipw *z, char *name, void *data, int len)
+{
+	gbuf h = { 0 };
+	unsigned long crc = crc32(0, data, len);
+	int namelen = strlen(name);
+	long ofs = ftell(z->out);
+
+	put32(&h, 0x04034b50);
+	put16(&h, 10); put16(&h, 0); put16(&h, 0); /* version, flags, method */
+	put16(&h, 0); put16(&h, 0x21); /* 1980-01-01 */
+	put32(&h, crc); put32(&h, len); put32(&h, len);
+	put16(&h, namelen); put16(&h, 0);
+	gwrite(&h, name, namelen);
+	fwrite(h.data, 1, h.len, z->out);
+	fwrite(data, 1, len, z->out);
+	gfree(&h);
+
+	put32(&z->central, 0x02014b50);
+	put16(&z->central, 20); put16(&z->central, 10); put16(&z->central, 0); put16(&z->central, 0);
+	put16(&z->central, 0); put16(&z->central, 0x21);
+	put32(&z->central, crc); put32(&z->central, len); put32(&z->central, len);
+	put16(&z->central, namelen); put16(&z->central, 0); put16(&z->central, 0);
+	put16(&z->central, 0); put16(&z->central, 0); put32(&z->central, 0);
+	put32(&z->central, ofs);
+	gwrite(&z->central, name, namelen);
+	z->count++;
+}
+
+static void zip_end(zipw *z)
+{
+	gbuf e = { 0 };
+	long ofs = ftell(z->out);
+	fwrite(z->central.data, 1, z->central.len, z->out);
+	put32(&e, 0x06054b50);
+	put16(&e, 0); put16(&e, 0);
+	put16(&e, z->count); put16(&e, z->count);
+	put32(&e, z->central.len); put32(&e, ofs);
+	put16(&e, 0);
+	fwrite(e.data, 1, e.len, z->out);
+	gfree(&e);
+	gfree(&z->central);
+	fclose(z->out);
+	free(z);
+}
+
+static void png_chunk(gbuf *b, char *type, unsigned char *data, int len)
+{
+	unsigned long crc = crc32(crc32(0, (unsigned char *)type, 4), data, len);
+	unsigned char x[4];
+	x[0] = len >> 24; x[1] = len >> 16; x[2] = len >> 8; x[3] = len;
+	gwrite(b, x, 4);
+	gwrite(b, type, 4);
+	gwrite(b, data, len);
+	x[0] = crc >> 24; x[1] = crc >> 16; x[2] = crc >> 8; x[3] = crc;
+	gwrite(b, x, 4);
+}
+
+static void gen_png(gbuf *png, int w, int h, int pattern)
+{
+	static const unsigned char sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	unsigned char ihdr[13] = { 0 };
+	gbuf samples = { 0 }, raw = { 0 }, idat = { 0 };
+	int y;
+
+	image_samples(&samples, w, h, 3, pattern);
+	for (y = 0; y < h; y++)
+	{
+		gwrite(&raw, "", 1); /* no filter */
+		gwrite(&raw, samples.data + y * w * 3, w * 3);
+	}
+	gdeflate(&idat, (unsigned char *)raw.data, raw.len);
+
+	ihdr[0] = w >> 24; ihdr[1] = w >> 16; ihdr[2] = w >> 8; ihdr[3] = w;
+	ihdr[4] = h >> 24; ihdr[5] = h >> 16; ihdr[6] = h >> 8; ihdr[7] = h;
+	ihdr[8] = 8; ihdr[9] = 2; /* 8-bit rgb */
+	gwrite(png, sig, 8);
+	png_chunk(png, "IHDR", ihdr, 13);
+	png_chunk(png, "IDAT", (unsigned char *)idat.data, idat.len);
+	png_chunk(png, "IEND", NULL, 0);
+	gfree(&samples);
+	gfree(&raw);
+	gfree(&idat);
+}
+
+/* XPS: solid and gradient brushes, glyphs and image brushes */
+
+static void xps_color(gbuf *b, int alpha)
+{
+	gprintf(b, "#%02X%02X%02X%02X", alpha, irand(256), irand(256), irand(256));
+}
+
+static void xps_page(gbuf *b, int pageno)
+{
+	int i, k;
+	seed = 7000 + pageno;
+	gprintf(b, "<FixedPage xmlns=\"http://schemas.microsoft.com/xps/2005/06\" Width=\"816\" Height=\"1056\" xml:lang=\"en-US\">\n");
+	for (i = 0; i < 300; i++)
+	{
+		float x = frand(0, 816), y = frand(0, 1056), r = frand(10, 90);
+		gprintf(b, "<Path Data=\"M %.2f,%.2f", x + frand(-r, r), y + frand(-r, r));
+		for (k = 0; k < 3; k++)
+			gprintf(b, " C %.2f,%.2f %.2f,%.2f %.2f,%.2f", x + frand(-r, r), y + frand(-r, r),
+				x + frand(-r, r), y + frand(-r, r), x + frand(-r, r), y + frand(-r, r));
+		gprintf(b, " Z\"");
+		if (i % 7 == 0)
+		{
+			gprintf(b, "><Path.Fill><LinearGradientBrush MappingMode=\"Absolute\" StartPoint=\"%.2f,%.2f\" EndPoint=\"%.2f,%.2f\">"
+				"<LinearGradientBrush.GradientStops><GradientStop Color=\"", x - r, y, x + r, y);
+			xps_color(b, 255);
+			gprintf(b, "\" Offset=\"0\"/><GradientStop Color=\"");
+			xps_color(b, 255);
+			gprintf(b, "\" Offset=\"1\"/></LinearGradientBrush.GradientStops></LinearGradientBrush></Path.Fill></Path>\n");
+		}
+		else if (i % 11 == 0)
+		{
+			gprintf(b, "><Path.Fill><RadialGradientBrush MappingMode=\"Absolute\" Center=\"%.2f,%.2f\" GradientOrigin=\"%.2f,%.2f\" RadiusX=\"%.2f\" RadiusY=\"%.2f\">"
+				"<RadialGradientBrush.GradientStops><GradientStop Color=\"", x, y, x, y, r, r);
+			xps_color(b, 255);
+			gprintf(b, "\" Offset=\"0\"/><GradientStop Color=\"");
+			xps_color(b, 128);
+			gprintf(b, "\" Offset=\"1\"/></RadialGradientBrush.GradientStops></RadialGradientBrush></Path.Fill></Path>\n");
+		}
+		else if (i % 5 == 0)
+		{
+			gprintf(b, " Stroke=\"");
+			xps_color(b, 255);
+			gprintf(b, "\" StrokeThickness=\"%.2f\"/>\n", frand(0.5f, 5));
+		}
+		else
+		{
+			gprintf(b, " Fill=\"");
+			xps_color(b, 64 + irand(192));
+			gprintf(b, "\"/>\n");
+		}
+	}
+	for (i = 0; i < 8; i++)
+	{
+		float x = frand(0, 700), y = frand(0, 950), s = frand(50, 300);
+		gprintf(b, "<Path Data=\"M %.2f,%.2f L %.2f,%.2f %.2f,%.2f %.2f,%.2f Z\"><Path.Fill>"
+			"<ImageBrush ImageSource=\"/Resources/image.png\" Viewbox=\"0,0,400,300\" ViewboxUnits=\"Absolute\" "
+			"Viewport=\"%.2f,%.2f,%.2f,%.2f\" ViewportUnits=\"Absolute\"/></Path.Fill></Path>\n",
+			x, y, x + s, y, x + s, y + s * 0.75f, x, y + s * 0.75f, x, y, s, s * 0.75f);
+	}
+	for (i = 0; i < 60; i++)
+	{
+		gprintf(b, "<Glyphs FontUri=\"/Resources/font.ttf\" FontRenderingEmSize=\"%.2f\" OriginX=\"%.2f\" OriginY=\"%.2f\" Fill=\"",
+			frand(8, 24), frand(0, 500), 20 + i * 17.0f);
+		xps_color(b, 255);
+		gprintf(b, "\" UnicodeString=\"");
+		for (k = 0; k < 8; k++)
+		{
+			gword(b, 'a', 26);
+			gprintf(b, " ");
+		}
+		gprintf(b, "\"/>\n");
+	}
+	gprintf(b, "</FixedPage>\n");
+}
+
+static void gen_xps(char *dir)
+{
+	zipw *z = zip_begin(dir, "paths.xps");
+	gbuf b = { 0 };
+	unsigned char *font;
+	unsigned int len;
+	char name[64];
+	int i;
+
+	gprintf(&b, "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+		"<Default Extension=\"fdseq\" ContentType=\"application/vnd.ms-package.xps-fixeddocumentsequence+xml\"/>"
+		"<Default Extension=\"fdoc\" ContentType=\"application/vnd.ms-package.xps-fixeddocument+xml\"/>"
+		"<Default Extension=\"fpage\" ContentType=\"application/vnd.ms-package.xps-fixedpage+xml\"/>"
+		"<Default Extension=\"png\" ContentType=\"image/png\"/>"
+		"<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+		"<Default Extension=\"ttf\" ContentType=\"application/vnd.ms-opentype\"/></Types>");
+	zip_add(z, "[Content_Types].xml", b.data, b.len);
+	b.len = 0;
+	gprintf(&b, "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+		"<Relationship Type=\"http://schemas.microsoft.com/xps/2005/06/fixedrepresentation\" "
+		"Target=\"/FixedDocumentSequence.fdseq\" Id=\"R0\"/></Relationships>");
+	zip_add(z, "_rels/.rels", b.data, b.len);
+	b.len = 0;
+	gprintf(&b, "<FixedDocumentSequence xmlns=\"http://schemas.microsoft.com/xps/2005/06\">"
+		"<DocumentReference Source=\"/Documents/1/FixedDocument.fdoc\"/></FixedDocumentSequence>");
+	zip_add(z, "FixedDocumentSequence.fdseq", b.data, b.len);
+	b.len = 0;
+	gprintf(&b, "<FixedDocument xmlns=\"http://schemas.microsoft.com/xps/2005/06\">");
+	for (i = 0; i < 3; i++)
+		gprintf(&b, "<PageContent Source=\"Pages/%d.fpage\"/>", i + 1);
+	gprintf(&b, "</FixedDocument>");
+	zip_add(z, "Documents/1/FixedDocument.fdoc", b.data, b.len);
+	b.len = 0;
+
+	font = pdf_lookup_substitute_font(0, 0, 0, 0, &len);
+	zip_add(z, "Resources/font.ttf", font, len);
+	seed = 7100;
+	gen_png(&b, 400, 300, 3);
+	zip_add(z, "Resources/image.png", b.data, b.len);
+	b.len = 0;
+
+	for (i = 0; i < 3; i++)
+	{
+		xps_page(&b, i);
+		sprintf(name, "Documents/1/Pages/%d.fpage", i + 1);
+		zip_add(z, name, b.data, b.len);
+		b.len = 0;
+	}
+	gfree(&b);
+	zip_end(z);
+}
+
+/* CBZ: large png pages */
+
+static void gen_cbz(char *dir)
+{
+	zipw *z = zip_begin(dir, "comic.cbz");
+	gbuf b = { 0 };
+	char name[32];
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		seed = 8000 + i;
+		gen_png(&b, 1100, 1600, i);
+		sprintf(name, "page%02d.png", i + 1);
+		zip_add(z, name, b.data, b.len);
+		b.len = 0;
+	}
+	gfree(&b);
+	zip_end(z);
+}
+
+static void generate(char *dir)
+{
+	gen_text(dir);
+	gen_vector(dir);
+	gen_transp(dir);
+	gen_image(dir);
+	gen_shade(dir);
+	gen_type3(dir);
+	gen_xps(dir);
+	gen_cbz(dir);
+}
+
+/*
+ * Instrumented allocator: tracks the peak heap use of a run.
+ */
+
+typedef struct bench_header_s bench_header;
+
+struct bench_header_s
+{
+	size_t size;
+	size_t pad; /* keep 16 byte alignment */
+};
+
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fz_mutex[FZ_LOCK_MAX];
+
+static void bench_lock(void *user, int lock)
+{
+	pthread_mutex_lock(&fz_mutex[lock]);
+}
+
+static void bench_unlock(void *user, int lock)
+{
+	pthread_mutex_unlock(&fz_mutex[lock]);
+}
+
+static fz_locks_context bench_locks = { NULL, bench_lock, bench_unlock };
+#endif
+
+static void heap_account(size_t add, size_t sub)
+{
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&heap_mutex);
+#endif
+	heap_current += add;
+	heap_current -= sub;
+	if (heap_current > heap_peak)
+		heap_peak = heap_current;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&heap_mutex);
+#endif
+}
+
+static void *bench_malloc(void *user, unsigned int size)
+{
+	bench_header *h = malloc(sizeof *h + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	heap_account(size, 0);
+	return h + 1;
+}
+
+static void *bench_realloc(void *user, void *old, unsigned int size)
+{
+	bench_header *h = old ? (bench_header *)old - 1 : NULL;
+	size_t oldsize = h ? h->size : 0;
+	h = realloc(h, sizeof *h + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	heap_account(size, oldsize);
+	return h + 1;
+}
+
+static void bench_free(void *user, void *ptr)
+{
+	bench_header *h;
+	if (!ptr)
+		return;
+	h = (bench_header *)ptr - 1;
+	heap_account(0, h->size);
+	free(h);
+}
+
+static fz_alloc_context bench_alloc = { NULL, bench_malloc, bench_realloc, bench_free };
+
+/*
+ * Benchmark runs.
+ *
+ * Each iteration runs the document through fz_run_pipeline, which
+ * interprets and renders the pages on worker threads, each with its
+ * own copy of the document and its own store and glyph cache. The
+ * latency of a page runs from when a worker starts on it until it is
+ * delivered, in page order, to the main thread.
+ */
+
+typedef struct bench_run_s bench_run;
+
+struct bench_run_s
+{
+	float resolution;
+	fz_context *ctxs[MAX_LIST]; /* worker contexts of this iteration */
+	fz_profile *profs[MAX_LIST]; /* one per worker, for all iterations */
+	int nctxs;
+	double *latency;
+	int nlatency;
+	int errors;
+};
+
+typedef struct bench_page_s bench_page;
+
+struct bench_page_s
+{
+	fz_pixmap *pix;
+	double start;
+};
+
+static fz_device *bench_begin(fz_context *ctx, void *arg, fz_document *doc, fz_page *page, int number, fz_matrix *ctm, void **result)
+{
+	bench_run *run = arg;
+	bench_page *p;
+	fz_bbox bbox;
+	float zoom = run->resolution / 72;
+	int k;
+
+	/* Count the cache hits of each worker in a profile of its own */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (k = 0; k < run->nctxs && run->ctxs[k] != ctx; k++)
+		;
+	if (k == run->nctxs)
+		run->ctxs[run->nctxs++] = ctx;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_begin_profile(ctx, run->profs[k]);
+
+	p = fz_malloc_struct(ctx, bench_page);
+	p->start = now();
+	*result = p;
+
+	*ctm = fz_scale(zoom, zoom);
+	bbox = fz_round_rect(fz_transform_rect(*ctm, fz_bound_page(doc, page)));
+	p->pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb, bbox);
+	fz_clear_pixmap_with_value(ctx, p->pix, 255);
+	return fz_new_draw_device(ctx, p->pix);
+}
+
+static void bench_deliver(fz_context *ctx, void *arg, int number, void *result, int ok)
+{
+	bench_run *run = arg;
+	bench_page *p = result;
+
+	if (ok && p)
+		run->latency[run->nlatency++] = now() - p->start;
+	else
+		run->errors++;
+
+	if (p)
+	{
+		fz_drop_pixmap(ctx, p->pix);
+		fz_free(ctx, p);
+	}
+}
+
+static int cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double percentile(double *v, int n, int p)
+{
+	int i = (n * p + 99) / 100 - 1;
+	if (n == 0)
+		return 0;
+	return v[CLAMP(i, 0, n - 1)];
+}
+
+static void add_profile(fz_profile *sum, fz_profile *prof)
+{
+	sum->store_hits += prof->store_hits;
+	sum->store_misses += prof->store_misses;
+	sum->glyph_hits += prof->glyph_hits;
+	sum->glyph_misses += prof->glyph_misses;
+}
+
+static void bench_document(char *filename, float resolution, int nworkers)
+{
+	fz_context *ctx;
+	fz_document *doc = NULL;
+	fz_profile total;
+	bench_run run;
+	double wall = 0;
+	int count = 0, errors = 0;
+	int k, iter;
+	char *name;
+	long rss = 0;
+
+	memset(&run, 0, sizeof run);
+	memset(&total, 0, sizeof total);
+	run.resolution = resolution;
+
+	heap_peak = heap_current;
+
+#ifdef HAVE_PTHREADS
+	ctx = fz_new_context(&bench_alloc, &bench_locks, FZ_STORE_DEFAULT);
+#else
+	ctx = fz_new_context(&bench_alloc, NULL, FZ_STORE_DEFAULT);
+	nworkers = 1;
+#endif
+	if (!ctx)
+		die("cannot initialise context for", filename);
+
+	fz_set_aa_level(ctx, alphabits);
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		for (k = 0; k < nworkers; k++)
+			run.profs[k] = fz_new_profile(ctx);
+
+		doc = fz_open_document(ctx, filename);
+		count = fz_count_pages(doc);
+		fz_close_document(doc);
+		doc = NULL;
+		run.latency = fz_malloc_array(ctx, count * iterations + 1, sizeof(double));
+
+		for (iter = 0; iter < iterations; iter++)
+		{
+			double start = now();
+			run.nctxs = 0;
+			fz_run_pipeline(ctx, filename, NULL, 0, -1, nworkers, bench_begin, bench_deliver, &run, NULL);
+			/* If the pages ran serially, they were profiled on ctx */
+			fz_end_profile(ctx);
+			wall += now() - start;
+		}
+
+		for (k = 0; k < nworkers; k++)
+			add_profile(&total, run.profs[k]);
+		errors = run.errors;
+	}
+	fz_always(ctx)
+	{
+		fz_close_document(doc);
+		for (k = 0; k < nworkers; k++)
+			fz_free_profile(ctx, run.profs[k]);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "mubench: cannot benchmark '%s'\n", filename);
+		errors = -1;
+	}
+
+#ifndef _WIN32
+	{
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			rss = usage.ru_maxrss;
+	}
+#endif
+
+	name = strrchr(filename, '/');
+	name = name ? name + 1 : filename;
+
+	if (errors < 0)
+	{
+		printf("%s %g %d error\n", name, resolution, nworkers);
+	}
+	else
+	{
+		qsort(run.latency, run.nlatency, sizeof(double), cmpdouble);
+		printf("%s %g %d %d %d %.1f %.2f %.2f %.2f %.2f %.2f %ld %ld %d %d %d %d %d\n",
+			name, resolution, nworkers, count, iterations, wall,
+			wall > 0 ? run.nlatency * 1000 / wall : 0,
+			percentile(run.latency, run.nlatency, 50),
+			percentile(run.latency, run.nlatency, 90),
+			percentile(run.latency, run.nlatency, 99),
+			run.nlatency ? run.latency[run.nlatency - 1] : 0,
+			(long)(heap_peak / 1024), rss,
+			total.store_hits, total.store_misses,
+			total.glyph_hits, total.glyph_misses, errors);
+	}
+	fflush(stdout);
+
+	fz_free(ctx, run.latency);
+	fz_free_context(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	char *gendir = NULL;
+	float list[MAX_LIST];
+	int c, i, r, t;
+
+	while ((c = fz_getopt(argc, argv, "g:r:j:n:b:")) != -1)
+	{
+		switch (c)
+		{
+		case 'g': gendir = fz_optarg; break;
+		case 'r': nresolutions = parselist(fz_optarg, resolutions); break;
+		case 'j':
+			nthreads = parselist(fz_optarg, list);
+			for (i = 0; i < nthreads; i++)
+				threads[i] = CLAMP((int)list[i], 1, MAX_LIST);
+			break;
+		case 'n': iterations = MAX(1, atoi(fz_optarg)); break;
+		case 'b': alphabits = atoi(fz_optarg); break;
+		default: usage(); break;
+		}
+	}
+
+	if (gendir)
+	{
+		generate(gendir);
+		if (fz_optind == argc)
+			return 0;
+	}
+
+	if (fz_optind == argc || nresolutions == 0 || nthreads == 0)
+		usage();
+
+#ifdef HAVE_PTHREADS
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_init(&fz_mutex[i], NULL);
+#endif
+
+	printf("mubench %d\n", BENCH_VERSION);
+	printf("document dpi threads pages iterations wall_ms pages_per_s p50_ms p90_ms p99_ms max_ms "
+		"peak_heap_kb peak_rss_kb store_hits store_misses glyph_hits glyph_misses errors\n");
+
+	for (i = fz_optind; i < argc; i++)
+		for (r = 0; r < nresolutions; r++)
+			for (t = 0; t < nthreads; t++)
+				bench_document(argv[i], resolutions[r], threads[t]);
+
+	return 0;
+}
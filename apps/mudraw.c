@@ -26,12 +26,23 @@ static int showoutline = 0;
 static int savealpha = 0;
 static int uselist = 1;
 static int alphabits = 8;
+static int aa_specified = 0;
+static int analytic = 0;
 static float gamma_value = 1;
 static int invert = 0;
 static int width = 0;
 static int height = 0;
 static int fit = 0;
 static int fax = 0;
+static int bandheight = 0;
+static int thumbnail = 0;
+static int showcost = 0;
+static int showalloc = 0;
+static int streamtext = 0;
+static char *batchlist = NULL;
+static float budget = 0;
+static int profile_format = -1;
+static fz_profile *profile = NULL;
 
 static fz_text_sheet *sheet = NULL;
 static fz_colorspace *colorspace;
@@ -56,11 +67,19 @@ static void usage(void)
 		"\t-f -\tfit width and/or height exactly (ignore aspect)\n"
 		"\t-a\tsave alpha channel (only pam and png)\n"
 		"\t-b -\tnumber of bits of antialiasing (0 to 8)\n"
+		"\t-A\tuse exact area coverage antialiasing\n"
+		"\t-B -\trender in bands of this many rows (not fax)\n"
 		"\t-g\trender in grayscale\n"
 		"\t-m\tshow timing information\n"
+		"\t-E\tshow estimated render time and memory\n"
+		"\t-D -\trender budget in ms (degrade quality to fit)\n"
+		"\t-P -\tprint a per page profile report (json or csv)\n"
+		"\t-M\tshow allocation statistics\n"
 		"\t-t\tshow text (-tt for xml, -ttt for more verbose xml)\n"
+		"\t-S\tstream text lines as they are found, without page layout\n"
 		"\t-x\tshow display list\n"
 		"\t-d\tdisable use of display list\n"
+		"\t-T\tthumbnail mode: use embedded thumbnails, else draft render\n"
 		"\t-5\tshow md5 checksums\n"
 		"\t-R -\trotate clockwise by given number of degrees\n"
 		"\t    \tappend '>' to rotate only pages with width > height (e.g. -R '90>')\n"
@@ -68,6 +87,8 @@ static void usage(void)
 		"\t-G gamma\tgamma correct output\n"
 		"\t-I\tinvert output\n"
 		"\t-l\tprint outline\n"
+		"\t-L -\tread more documents to process from a file (- for stdin),\n"
+		"\t    \tone name per line; documents that fail are skipped\n"
 		"\tpages\tcomma separated list of ranges\n");
 	exit(1);
 }
@@ -86,6 +107,121 @@ static int gettime(void)
 	return (now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000;
 }
 
+static void drawbands(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_bbox bbox, int draft, char *buf)
+{
+	fz_band_writer *wri = NULL;
+	fz_pixmap *pix = NULL;
+	fz_device *dev = NULL;
+	fz_display_list *ownlist = NULL;
+	fz_bbox band;
+	fz_md5 md5;
+	int format = -1;
+
+	fz_var(wri);
+	fz_var(pix);
+	fz_var(dev);
+	fz_var(ownlist);
+
+	if (buf)
+	{
+		if (strstr(output, ".pgm") || strstr(output, ".ppm") || strstr(output, ".pnm"))
+			format = FZ_BAND_PNM;
+		else if (strstr(output, ".pam"))
+			format = FZ_BAND_PAM;
+		else if (strstr(output, ".png"))
+			format = FZ_BAND_PNG;
+		else if (strstr(output, ".pbm"))
+			format = FZ_BAND_PBM;
+	}
+
+	fz_md5_init(&md5);
+
+	fz_try(ctx)
+	{
+		if (format >= 0)
+			wri = fz_new_band_writer(ctx, buf, format, colorspace, bbox.x1 - bbox.x0, bbox.y1 - bbox.y0, savealpha);
+
+		/* Without a display list every band would interpret the page
+		 * (or decode the thumbnail) again, so record it once here. */
+		if (!list && bbox.y1 - bbox.y0 > bandheight)
+		{
+			ownlist = fz_new_display_list(ctx);
+			dev = fz_new_list_device(ctx, ownlist);
+			if (!thumbnail || !fz_run_page_thumbnail(doc, page, dev, fz_identity, NULL))
+				fz_run_page(doc, page, dev, fz_identity, NULL);
+			fz_free_device(dev);
+			dev = NULL;
+			list = ownlist;
+		}
+
+		band = bbox;
+		for (band.y0 = bbox.y0; band.y0 < bbox.y1; band.y0 = band.y1)
+		{
+			band.y1 = MIN(band.y0 + bandheight, bbox.y1);
+
+			pix = fz_new_pixmap_with_bbox(ctx, colorspace, band);
+			if (savealpha)
+				fz_clear_pixmap(ctx, pix);
+			else
+				fz_clear_pixmap_with_value(ctx, pix, 255);
+
+			dev = draft ? fz_new_draw_device_draft(ctx, pix) : fz_new_draw_device(ctx, pix);
+			if (profile)
+				dev = fz_new_profile_device(ctx, profile, dev, band);
+			if (list)
+				fz_run_display_list(list, dev, ctm, band, NULL);
+			else if (!thumbnail || !fz_run_page_thumbnail(doc, page, dev, ctm, NULL))
+				fz_run_page(doc, page, dev, ctm, NULL);
+			fz_free_device(dev);
+			dev = NULL;
+
+			if (invert)
+				fz_invert_pixmap(ctx, pix);
+			if (gamma_value != 1)
+				fz_gamma_pixmap(ctx, pix, gamma_value);
+			if (savealpha)
+				fz_unmultiply_pixmap(ctx, pix);
+
+			if (wri)
+				fz_write_band(ctx, wri, pix);
+			if (showmd5)
+				fz_md5_update(&md5, fz_pixmap_samples(ctx, pix), fz_pixmap_width(ctx, pix) * fz_pixmap_height(ctx, pix) * fz_pixmap_components(ctx, pix));
+
+			fz_drop_pixmap(ctx, pix);
+			pix = NULL;
+		}
+
+		if (wri)
+		{
+			fz_band_writer *w = wri;
+			wri = NULL;
+			fz_close_band_writer(ctx, w);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free_display_list(ctx, ownlist);
+	}
+	fz_catch(ctx)
+	{
+		fz_free_device(dev);
+		fz_drop_pixmap(ctx, pix);
+		fz_free_band_writer(ctx, wri);
+		fz_rethrow(ctx);
+	}
+
+	if (showmd5)
+	{
+		unsigned char digest[16];
+		int i;
+
+		fz_md5_final(&md5, digest);
+		printf(" ");
+		for (i = 0; i < 16; i++)
+			printf("%02x", digest[i]);
+	}
+}
+
 static int isrange(char *s)
 {
 	while (*s)
@@ -97,6 +233,11 @@ static int isrange(char *s)
 	return 1;
 }
 
+static void textsink(fz_context *ctx, void *arg, fz_text_line *line)
+{
+	fz_print_text_line(ctx, arg, line);
+}
+
 static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 {
 	fz_page *page;
@@ -112,6 +253,12 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 		start = gettime();
 	}
 
+	if (profile)
+	{
+		fz_reset_profile(ctx, profile);
+		fz_begin_profile(ctx, profile);
+	}
+
 	fz_try(ctx)
 	{
 		page = fz_load_page(doc, pagenum - 1);
@@ -171,15 +318,26 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 
 		fz_try(ctx)
 		{
-			text = fz_new_text_page(ctx, fz_bound_page(doc, page));
-			dev = fz_new_text_device(ctx, sheet, text);
+			if (streamtext)
+			{
+				dev = fz_new_text_sink_device(ctx, sheet, textsink, stdout);
+			}
+			else
+			{
+				text = fz_new_text_page(ctx, fz_bound_page(doc, page));
+				dev = fz_new_text_device(ctx, sheet, text);
+			}
 			if (list)
 				fz_run_display_list(list, dev, fz_identity, fz_infinite_bbox, NULL);
 			else
 				fz_run_page(doc, page, dev, fz_identity, NULL);
 			fz_free_device(dev);
 			dev = NULL;
-			if (showtext == TEXT_XML)
+			if (streamtext)
+			{
+				printf("\f\n");
+			}
+			else if (showtext == TEXT_XML)
 			{
 				fz_print_text_page_xml(ctx, stdout, text);
 			}
@@ -204,10 +362,10 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 		fz_free_text_page(ctx, text);
 	}
 
-	if (showmd5 || showtime)
+	if (showmd5 || showtime || showcost)
 		printf("page %s %d", filename, pagenum);
 
-	if (output || showmd5 || showtime)
+	if (output || showmd5 || showtime || showcost || profile)
 	{
 		float zoom;
 		fz_matrix ctm;
@@ -218,6 +376,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 		float pagewh_ratio = 1.0;
 		int w, h;
 		float scale_for_fax = 1.0;
+		int draft = thumbnail;
 
 		fz_var(pix);
 
@@ -319,78 +478,141 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 		}
 		bbox = fz_round_rect(bounds2);
 
-		/* TODO: banded rendering and multi-page ppm */
-
-		fz_try(ctx)
+		if (showcost || budget > 0)
 		{
-			pix = fz_new_pixmap_with_bbox(ctx, colorspace, bbox);
+			fz_render_cost cost;
+			int aa = alphabits;
 
-			if (savealpha)
-				fz_clear_pixmap(ctx, pix);
-			else
-				fz_clear_pixmap_with_value(ctx, pix, 255);
+			fz_try(ctx)
+			{
+				dev = fz_new_cost_device(ctx, &cost, bbox, colorspace);
+				if (list)
+					fz_run_display_list(list, dev, ctm, bbox, NULL);
+				else
+					fz_run_page(doc, page, dev, ctm, NULL);
+				fz_free_device(dev);
+				dev = NULL;
+			}
+			fz_catch(ctx)
+			{
+				fz_free_device(dev);
+				fz_free_display_list(ctx, list);
+				fz_free_page(doc, page);
+				fz_rethrow(ctx);
+			}
 
-			dev = fz_new_draw_device(ctx, pix);
-			if (list)
-				fz_run_display_list(list, dev, ctm, bbox, NULL);
-			else
-				fz_run_page(doc, page, dev, ctm, NULL);
-			fz_free_device(dev);
-			dev = NULL;
+			if (budget > 0)
+			{
+				if (fz_fit_render_budget(&cost, budget, &aa))
+					draft = 1;
+				fz_set_aa_level(ctx, aa);
+			}
 
-			if (invert)
-				fz_invert_pixmap(ctx, pix);
-			if (gamma_value != 1)
-				fz_gamma_pixmap(ctx, pix, gamma_value);
+			if (showcost)
+			{
+				printf(" est %.0fms %.0fk", cost.time, cost.memory / 1024);
+				if (budget > 0 && draft)
+					printf(" (draft, aa %d)", aa);
+			}
+		}
 
-			if (savealpha)
-				fz_unmultiply_pixmap(ctx, pix);
+		/* TODO: multi-page ppm */
 
+		if (!output && !showmd5 && !showtime && !profile)
+		{
+			/* only estimating the cost */
+		}
+		else if (bandheight > 0 && !fax)
+		{
+			char buf[512];
 			if (output)
+				sprintf(buf, output, pagenum);
+			fz_try(ctx)
+			{
+				drawbands(ctx, doc, page, list, ctm, bbox, draft, output ? buf : NULL);
+			}
+			fz_catch(ctx)
 			{
-				char buf[512];
-				if (fax)
-					sprintf(buf, output);
+				fz_free_display_list(ctx, list);
+				fz_free_page(doc, page);
+				fz_rethrow(ctx);
+			}
+		}
+		else
+		{
+			fz_try(ctx)
+			{
+				pix = fz_new_pixmap_with_bbox(ctx, colorspace, bbox);
+
+				if (savealpha)
+					fz_clear_pixmap(ctx, pix);
 				else
-					sprintf(buf, output, pagenum);
-				if (strstr(output, ".pgm") || strstr(output, ".ppm") || strstr(output, ".pnm"))
-					fz_write_pnm(ctx, pix, buf);
-				else if (strstr(output, ".pam"))
-					fz_write_pam(ctx, pix, buf, savealpha);
-				else if (strstr(output, ".png"))
-					fz_write_png(ctx, pix, buf, savealpha);
-				else if (strstr(output, ".pbm")) {
-					fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
-					fz_write_pbm(ctx, bit, buf);
-					fz_drop_bitmap(ctx, bit);
+					fz_clear_pixmap_with_value(ctx, pix, 255);
+
+				dev = draft ? fz_new_draw_device_draft(ctx, pix) : fz_new_draw_device(ctx, pix);
+				if (profile)
+					dev = fz_new_profile_device(ctx, profile, dev, bbox);
+				if (list)
+					fz_run_display_list(list, dev, ctm, bbox, NULL);
+				else if (!thumbnail || !fz_run_page_thumbnail(doc, page, dev, ctm, NULL))
+					fz_run_page(doc, page, dev, ctm, NULL);
+				fz_free_device(dev);
+				dev = NULL;
+
+				if (invert)
+					fz_invert_pixmap(ctx, pix);
+				if (gamma_value != 1)
+					fz_gamma_pixmap(ctx, pix, gamma_value);
+
+				if (savealpha)
+					fz_unmultiply_pixmap(ctx, pix);
+
+				if (output)
+				{
+					char buf[512];
+					if (fax)
+						sprintf(buf, output);
+					else
+						sprintf(buf, output, pagenum);
+					if (strstr(output, ".pgm") || strstr(output, ".ppm") || strstr(output, ".pnm"))
+						fz_write_pnm(ctx, pix, buf);
+					else if (strstr(output, ".pam"))
+						fz_write_pam(ctx, pix, buf, savealpha);
+					else if (strstr(output, ".png"))
+						fz_write_png(ctx, pix, buf, savealpha);
+					else if (strstr(output, ".pbm")) {
+						fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
+						fz_write_pbm(ctx, bit, buf);
+						fz_drop_bitmap(ctx, bit);
+					}
+					else if (fax) {
+						fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
+						fz_write_tiff(ctx, bit, buf, pagenum, pages);
+						fz_drop_bitmap(ctx, bit);
+					}
 				}
-				else if (fax) {
-					fz_bitmap *bit = fz_halftone_pixmap(ctx, pix, NULL);
-					fz_write_tiff(ctx, bit, buf, pagenum, pages);
-					fz_drop_bitmap(ctx, bit);
+
+				if (showmd5)
+				{
+					unsigned char digest[16];
+					int i;
+
+					fz_md5_pixmap(pix, digest);
+					printf(" ");
+					for (i = 0; i < 16; i++)
+						printf("%02x", digest[i]);
 				}
-			}
 
-			if (showmd5)
+				fz_drop_pixmap(ctx, pix);
+			}
+			fz_catch(ctx)
 			{
-				unsigned char digest[16];
-				int i;
-
-				fz_md5_pixmap(pix, digest);
-				printf(" ");
-				for (i = 0; i < 16; i++)
-					printf("%02x", digest[i]);
+				fz_free_device(dev);
+				fz_drop_pixmap(ctx, pix);
+				fz_free_display_list(ctx, list);
+				fz_free_page(doc, page);
+				fz_rethrow(ctx);
 			}
-
-			fz_drop_pixmap(ctx, pix);
-		}
-		fz_catch(ctx)
-		{
-			fz_free_device(dev);
-			fz_drop_pixmap(ctx, pix);
-			fz_free_display_list(ctx, list);
-			fz_free_page(doc, page);
-			fz_rethrow(ctx);
 		}
 	}
 
@@ -420,9 +642,17 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, int pages)
 		printf(" %dms", diff);
 	}
 
-	if (showmd5 || showtime)
+	if (showmd5 || showtime || showcost)
 		printf("\n");
 
+	if (profile)
+	{
+		char label[1024];
+		fz_end_profile(ctx);
+		sprintf(label, "%.1000s:%d", filename, pagenum);
+		fz_print_profile(ctx, stdout, profile, profile_format, label);
+	}
+
 	fz_flush_warnings(ctx);
 }
 
@@ -474,6 +704,102 @@ static void drawoutline(fz_context *ctx, fz_document *doc)
 	fz_free_outline(ctx, outline);
 }
 
+static void drawfile(fz_context *ctx, char *password, char *range)
+{
+	fz_document *doc = NULL;
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, filename);
+	}
+	fz_catch(ctx)
+	{
+		fz_throw(ctx, "cannot open document: %s", filename);
+	}
+
+	fz_try(ctx)
+	{
+		if (fz_needs_password(doc))
+			if (!fz_authenticate_password(doc, password))
+				fz_throw(ctx, "cannot authenticate password: %s", filename);
+
+		if (showxml || showtext == TEXT_XML)
+			printf("<document name=\"%s\">\n", filename);
+
+		if (showoutline)
+			drawoutline(ctx, doc);
+
+		if (showtext || showxml || showtime || showmd5 || showcost || profile || output)
+			drawrange(ctx, doc, range);
+
+		if (showxml || showtext == TEXT_XML)
+			printf("</document>\n");
+	}
+	fz_always(ctx)
+	{
+		fz_close_document(doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void drawbatch(fz_context *ctx, char *password, char *listname)
+{
+	char name[4096];
+	FILE *list;
+	int n;
+
+	list = strcmp(listname, "-") ? fopen(listname, "r") : stdin;
+	if (!list)
+		fz_throw(ctx, "cannot open document list: %s", listname);
+
+	fz_try(ctx)
+	{
+		while (fgets(name, sizeof name, list))
+		{
+			n = strlen(name);
+			while (n > 0 && (name[n-1] == '\n' || name[n-1] == '\r'))
+				name[--n] = 0;
+			if (n == 0)
+				continue;
+
+			/* Styles keep their fonts alive; only HTML output needs the
+			 * sheet to outlive the document. */
+			if (sheet && showtext != TEXT_HTML)
+			{
+				fz_free_text_sheet(ctx, sheet);
+				sheet = NULL;
+				sheet = fz_new_text_sheet(ctx);
+			}
+
+			filename = name;
+			fz_try(ctx)
+			{
+				drawfile(ctx, password, "1-");
+			}
+			fz_catch(ctx)
+			{
+				fz_warn(ctx, "skipping document: %s", name);
+			}
+			fflush(stdout);
+		}
+	}
+	fz_always(ctx)
+	{
+		filename = NULL;
+		if (list != stdin)
+			fclose(list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 #ifdef MUPDF_COMBINED_EXE
 int draw_main(int argc, char **argv)
 #else
@@ -482,13 +808,11 @@ int main(int argc, char **argv)
 {
 	char *password = "";
 	int grayscale = 0;
-	fz_document *doc = NULL;
+	char *range;
 	int c;
 	fz_context *ctx;
 
-	fz_var(doc);
-
-	while ((c = fz_getopt(argc, argv, "lo:p:r:R:ab:dgmtx5G:Iw:h:f")) != -1)
+	while ((c = fz_getopt(argc, argv, "lo:p:r:R:aAb:B:dgmtx5G:Iw:h:fTED:P:MSL:")) != -1)
 	{
 		switch (c)
 		{
@@ -502,14 +826,30 @@ int main(int argc, char **argv)
 				rotation_condition = strchr(fz_optarg, '<') ? 2 : 0;
 			break;
 		case 'a': savealpha = 1; break;
-		case 'b': alphabits = atoi(fz_optarg); break;
+		case 'b': alphabits = atoi(fz_optarg); aa_specified = 1; break;
+		case 'A': analytic = 1; break;
+		case 'B': bandheight = atoi(fz_optarg); break;
 		case 'l': showoutline++; break;
 		case 'm': showtime++; break;
+		case 'E': showcost++; break;
+		case 'M': showalloc++; break;
+		case 'D': budget = atof(fz_optarg); break;
+		case 'P':
+			if (!strcmp(fz_optarg, "json"))
+				profile_format = FZ_PROFILE_JSON;
+			else if (!strcmp(fz_optarg, "csv"))
+				profile_format = FZ_PROFILE_CSV;
+			else
+				usage();
+			break;
 		case 't': showtext++; break;
+		case 'S': streamtext = 1; break;
+		case 'L': batchlist = fz_optarg; break;
 		case 'x': showxml++; break;
 		case '5': showmd5++; break;
 		case 'g': grayscale++; break;
 		case 'd': uselist = 0; break;
+		case 'T': thumbnail = 1; uselist = 0; break;
 		case 'G': gamma_value = atof(fz_optarg); break;
 		case 'w': width = atof(fz_optarg); break;
 		case 'h': height = atof(fz_optarg); break;
@@ -519,13 +859,16 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (fz_optind == argc)
+	if (fz_optind == argc && !batchlist)
 		usage();
 
+	if (streamtext)
+		showtext = TEXT_PLAIN;
+
 	if (output && strstr(output, ".fax"))
 		fax = 1;
 
-	if (!showtext && !showxml && !showtime && !showmd5 && !showoutline && !output)
+	if (!showtext && !showxml && !showtime && !showmd5 && !showcost && profile_format < 0 && !showoutline && !output)
 	{
 		printf("nothing to do\n");
 		exit(0);
@@ -538,8 +881,19 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* Thumbnails are small; coarse antialiasing is good enough */
+	if (thumbnail && !aa_specified)
+		alphabits = 2;
+
 	fz_set_aa_level(ctx, alphabits);
 
+	if (showalloc && !fz_enable_alloc_stats(ctx))
+		fprintf(stderr, "cannot enable allocation statistics\n");
+
+	if (profile_format >= 0)
+		profile = fz_new_profile(ctx);
+	fz_set_aa_analytic(ctx, analytic);
+
 	colorspace = fz_device_rgb;
 	if (output && strstr(output, ".pgm"))
 		colorspace = fz_device_gray;
@@ -581,44 +935,18 @@ int main(int argc, char **argv)
 		while (fz_optind < argc)
 		{
 			filename = argv[fz_optind++];
-
-			fz_try(ctx)
-			{
-				doc = fz_open_document(ctx, filename);
-			}
-			fz_catch(ctx)
-			{
-				fz_throw(ctx, "cannot open document: %s", filename);
-			}
-
-			if (fz_needs_password(doc))
-				if (!fz_authenticate_password(doc, password))
-					fz_throw(ctx, "cannot authenticate password: %s", filename);
-
-			if (showxml || showtext == TEXT_XML)
-				printf("<document name=\"%s\">\n", filename);
-
-			if (showoutline)
-				drawoutline(ctx, doc);
-
-			if (showtext || showxml || showtime || showmd5 || output)
-			{
-				if (fz_optind == argc || !isrange(argv[fz_optind]))
-					drawrange(ctx, doc, "1-");
-				if (fz_optind < argc && isrange(argv[fz_optind]))
-					drawrange(ctx, doc, argv[fz_optind++]);
-			}
-
-			if (showxml || showtext == TEXT_XML)
-				printf("</document>\n");
-
-			fz_close_document(doc);
-			doc = NULL;
+			range = "1-";
+			if (fz_optind < argc && isrange(argv[fz_optind]))
+				range = argv[fz_optind++];
+			drawfile(ctx, password, range);
 		}
+
+		if (batchlist)
+			drawbatch(ctx, password, batchlist);
 	}
 	fz_catch(ctx)
 	{
-		fz_close_document(doc);
+		/* error already reported */
 	}
 
 	if (showtext == TEXT_HTML)
@@ -629,7 +957,7 @@ int main(int argc, char **argv)
 		printf("</style>\n");
 	}
 
-	if (showtext)
+	if (sheet)
 		fz_free_text_sheet(ctx, sheet);
 
 	if (showtime)
@@ -640,6 +968,10 @@ int main(int argc, char **argv)
 		printf("slowest page %d: %dms\n", timing.maxpage, timing.max);
 	}
 
+	if (showalloc)
+		fz_print_alloc_stats(ctx, stdout);
+
+	fz_free_profile(ctx, profile);
 	fz_free_context(ctx);
 	return 0;
 }
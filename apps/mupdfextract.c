@@ -2,17 +2,34 @@
  * pdfextract -- the ultimate way to extract images and fonts from pdfs
  */
 
-#include "mupdf.h"
+#include "fitz.h"
+#include "mupdf-internal.h"
 
-static pdf_document *doc = NULL;
-static fz_context *ctx = NULL;
+#ifndef _WIN32
+#include <pthread.h>
+#define HAVE_PTHREADS
+#endif
+
+#define MAX_THREADS 64
+
+static char *infile = NULL;
+static char *password = "";
 static int dorgb = 0;
+static int dodecode = 0;
+static int nthreads = 1;
+
+static int *objects = NULL;
+static int nobjects = 0;
+static int nextobject = 0;
 
 static void usage(void)
 {
 	fprintf(stderr, "usage: pdfextract [options] file.pdf [object numbers]\n");
 	fprintf(stderr, "\t-p\tpassword\n");
-	fprintf(stderr, "\t-r\tconvert images to rgb\n");
+	fprintf(stderr, "\t-r\tconvert images to rgb (implies -d)\n");
+	fprintf(stderr, "\t-d\tdecode all images, instead of saving jpeg, jpx,\n");
+	fprintf(stderr, "\t\tjbig2 and fax images in their own formats\n");
+	fprintf(stderr, "\t-j\tnumber of threads to extract with\n");
 	exit(1);
 }
 
@@ -28,29 +45,229 @@ static int isfontdesc(pdf_obj *obj)
 	return pdf_is_name(type) && !strcmp(pdf_to_name(type), "FontDescriptor");
 }
 
-static void saveimage(int num)
+static char *lastfilter(pdf_obj *dict)
+{
+	pdf_obj *filter = pdf_dict_getsa(dict, "Filter", "F");
+	if (pdf_is_array(filter))
+		filter = pdf_array_get(filter, pdf_array_len(filter) - 1);
+	return pdf_is_name(filter) ? pdf_to_name(filter) : "";
+}
+
+static void writebuffer(fz_context *ctx, char *name, fz_buffer *buf)
+{
+	unsigned char *data;
+	FILE *f;
+	int n, len;
+
+	f = fopen(name, "wb");
+	if (!f)
+		fz_throw(ctx, "cannot create file '%s'", name);
+
+	len = fz_buffer_storage(ctx, buf, &data);
+	n = fwrite(data, 1, len, f);
+
+	if (fclose(f) < 0 || n < len)
+		fz_throw(ctx, "cannot write file '%s'", name);
+}
+
+static void put16(FILE *f, int v)
+{
+	putc(v & 0xff, f);
+	putc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, int v)
+{
+	put16(f, v & 0xffff);
+	put16(f, (v >> 16) & 0xffff);
+}
+
+static void puttag(FILE *f, int tag, int type, int value)
+{
+	put16(f, tag);
+	put16(f, type);
+	put32(f, 1);
+	if (type == 3)
+	{
+		put16(f, value);
+		put16(f, 0);
+	}
+	else
+		put32(f, value);
+}
+
+/*
+ * Wrap CCITT fax data in a single strip TIFF file. BlackIs1 and an
+ * inverting Decode array map onto the photometric interpretation.
+ */
+static void writefax(fz_context *ctx, char *name, fz_buffer *buf, pdf_image_params *params, int height, int invert)
 {
-	fz_image *image;
-	fz_pixmap *img;
+	unsigned char *data;
+	FILE *f;
+	int n, len;
+	int g4 = params->u.fax.k < 0;
+
+	f = fopen(name, "wb");
+	if (!f)
+		fz_throw(ctx, "cannot create file '%s'", name);
+
+	len = fz_buffer_storage(ctx, buf, &data);
+
+	fwrite("II*\0", 1, 4, f);
+	put32(f, 8 + len + (len & 1));
+	n = fwrite(data, 1, len, f);
+	if (len & 1)
+		putc(0, f);
+
+	put16(f, 10);
+	puttag(f, 256, 4, params->u.fax.columns); /* ImageWidth */
+	puttag(f, 257, 4, height); /* ImageLength */
+	puttag(f, 258, 3, 1); /* BitsPerSample */
+	puttag(f, 259, 3, g4 ? 4 : 3); /* Compression */
+	puttag(f, 262, 3, params->u.fax.bi1 ^ invert); /* PhotometricInterpretation */
+	puttag(f, 273, 4, 8); /* StripOffsets */
+	puttag(f, 277, 3, 1); /* SamplesPerPixel */
+	puttag(f, 278, 4, height); /* RowsPerStrip */
+	puttag(f, 279, 4, len); /* StripByteCounts */
+	if (g4)
+		puttag(f, 293, 4, 0); /* T6Options */
+	else
+		puttag(f, 292, 4, (params->u.fax.k > 0 ? 1 : 0) | (params->u.fax.eba ? 4 : 0)); /* T4Options */
+	put32(f, 0);
+
+	if (fclose(f) < 0 || n < len)
+		fz_throw(ctx, "cannot write file '%s'", name);
+}
+
+/*
+ * Save the image data as it is stored, without decoding, for the
+ * filters whose data is a file format in its own right. Returns 0
+ * if the image needs to be decoded instead.
+ */
+static int saverawimage(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int num)
+{
+	pdf_image_params params;
+	pdf_obj *decode, *obj;
+	fz_buffer *buf = NULL;
+	fz_buffer *globals = NULL;
+	char *s = lastfilter(dict);
+	char name[32];
+	int saved = 1;
+
+	fz_var(buf);
+	fz_var(globals);
+
+	memset(&params, 0, sizeof params);
+
+	fz_try(ctx)
+	{
+		if (!strcmp(s, "DCTDecode") || !strcmp(s, "DCT"))
+		{
+			buf = pdf_load_image_stream(doc, num, 0, &params);
+			sprintf(name, "img-%04d.jpg", num);
+			printf("extracting image %s\n", name);
+			writebuffer(ctx, name, buf);
+		}
+		else if (!strcmp(s, "JPXDecode"))
+		{
+			/* JPX data is left alone by the filter chain */
+			unsigned char *data;
+			int len;
+			buf = pdf_load_stream(doc, num, 0);
+			len = fz_buffer_storage(ctx, buf, &data);
+			if (len >= 8 && !memcmp(data, "\0\0\0\x0cjP  ", 8))
+				sprintf(name, "img-%04d.jp2", num);
+			else
+				sprintf(name, "img-%04d.j2k", num);
+			printf("extracting image %s\n", name);
+			writebuffer(ctx, name, buf);
+		}
+		else if (!strcmp(s, "JBIG2Decode") && pdf_array_len(pdf_dict_getsa(dict, "Filter", "F")) <= 1)
+		{
+			/* An embedded stream and its globals, as jbig2dec -e takes them */
+			buf = pdf_load_raw_stream(doc, num, 0);
+			sprintf(name, "img-%04d.jb2e", num);
+			printf("extracting image %s\n", name);
+			writebuffer(ctx, name, buf);
+
+			obj = pdf_dict_getsa(dict, "DecodeParms", "DP");
+			if (pdf_is_array(obj))
+				obj = pdf_array_get(obj, 0);
+			obj = pdf_dict_gets(obj, "JBIG2Globals");
+			if (obj)
+			{
+				globals = pdf_load_stream(doc, pdf_to_num(obj), pdf_to_gen(obj));
+				sprintf(name, "img-%04d.jb2g", num);
+				writebuffer(ctx, name, globals);
+			}
+		}
+		else if (!strcmp(s, "CCITTFaxDecode") || !strcmp(s, "CCF"))
+		{
+			buf = pdf_load_image_stream(doc, num, 0, &params);
+			/* TIFF cannot describe byte aligned Group 4 data */
+			if (params.type != PDF_IMAGE_FAX || (params.u.fax.k < 0 && params.u.fax.eba))
+				saved = 0;
+			else
+			{
+				int height = pdf_to_int(pdf_dict_getsa(dict, "Height", "H"));
+				decode = pdf_dict_getsa(dict, "Decode", "D");
+				sprintf(name, "img-%04d.tif", num);
+				printf("extracting image %s\n", name);
+				writefax(ctx, name, buf, &params, height, pdf_to_real(pdf_array_get(decode, 0)) == 1);
+			}
+		}
+		else
+			saved = 0;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, globals);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return saved;
+}
+
+static void saveimage(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int num)
+{
+	fz_image *image = NULL;
+	fz_pixmap *img = NULL;
 	pdf_obj *ref;
 	char name[32];
 
-	ref = pdf_new_indirect(ctx, num, 0, doc);
+	if (!dodecode && saverawimage(ctx, doc, dict, num))
+		return;
 
-	/* TODO: detect DCTD and save as jpeg */
+	fz_var(image);
+	fz_var(img);
 
-	image = pdf_load_image(doc, ref);
-	img = fz_image_to_pixmap(ctx, image, 0, 0);
-	fz_drop_image(ctx, image);
+	ref = pdf_new_indirect(ctx, num, 0, doc);
 
-	sprintf(name, "img-%04d", num);
-	fz_write_pixmap(ctx, img, name, dorgb);
+	fz_try(ctx)
+	{
+		image = pdf_load_image(doc, ref);
+		img = fz_image_to_pixmap(ctx, image, 0, 0);
 
-	fz_drop_pixmap(ctx, img);
-	pdf_drop_obj(ref);
+		sprintf(name, "img-%04d", num);
+		fz_write_pixmap(ctx, img, name, dorgb);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image(ctx, image);
+		fz_drop_pixmap(ctx, img);
+		pdf_drop_obj(ref);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
-static void savefont(pdf_obj *dict, int num)
+static void savefont(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int num)
 {
 	char name[1024];
 	char *subtype;
@@ -58,10 +275,7 @@ static void savefont(pdf_obj *dict, int num)
 	pdf_obj *stream = NULL;
 	pdf_obj *obj;
 	char *ext = "";
-	FILE *f;
 	char *fontname = "font";
-	int n, len;
-	unsigned char *data;
 
 	obj = pdf_dict_gets(dict, "FontName");
 	if (obj)
@@ -107,57 +321,165 @@ static void savefont(pdf_obj *dict, int num)
 
 	buf = pdf_load_stream(doc, pdf_to_num(stream), pdf_to_gen(stream));
 
-	sprintf(name, "%s-%04d.%s", fontname, num, ext);
+	sprintf(name, "%.1000s-%04d.%s", fontname, num, ext);
 	printf("extracting font %s\n", name);
 
-	f = fopen(name, "wb");
-	if (!f)
-		fz_throw(ctx, "Error creating font file");
+	fz_try(ctx)
+	{
+		writebuffer(ctx, name, buf);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
 
-	len = fz_buffer_storage(ctx, buf, &data);
-	n = fwrite(data, 1, len, f);
-	if (n < len)
-		fz_throw(ctx, "Error writing font file");
+static void showobject(fz_context *ctx, pdf_document *doc, int num)
+{
+	pdf_obj *obj;
 
-	if (fclose(f) < 0)
-		fz_throw(ctx, "Error closing font file");
+	obj = pdf_load_object(doc, num, 0);
 
-	fz_drop_buffer(ctx, buf);
+	fz_try(ctx)
+	{
+		if (isimage(obj))
+			saveimage(ctx, doc, obj, num);
+		else if (isfontdesc(obj))
+			savefont(ctx, doc, obj, num);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(obj);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
-static void showobject(int num)
+static pdf_document *opendocument(fz_context *ctx)
 {
-	pdf_obj *obj;
+	pdf_document *doc = pdf_open_document(ctx, infile);
+	if (pdf_needs_password(doc))
+	{
+		if (!pdf_authenticate_password(doc, password))
+		{
+			pdf_close_document(doc);
+			fz_throw(ctx, "cannot authenticate password: %s", infile);
+		}
+	}
+	return doc;
+}
 
-	if (!doc)
-		fz_throw(ctx, "no file specified");
+/*
+ * Objects are handed out one at a time from a shared list, so that
+ * threads that draw a few large images do not hold up the others.
+ */
 
-	obj = pdf_load_object(doc, num, 0);
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fz_mutex[FZ_LOCK_MAX];
+
+static void extract_lock(void *user, int lock)
+{
+	pthread_mutex_lock(&fz_mutex[lock]);
+}
+
+static void extract_unlock(void *user, int lock)
+{
+	pthread_mutex_unlock(&fz_mutex[lock]);
+}
 
-	if (isimage(obj))
-		saveimage(num);
-	else if (isfontdesc(obj))
-		savefont(obj, num);
+static fz_locks_context extract_locks = { NULL, extract_lock, extract_unlock };
+#endif
 
-	pdf_drop_obj(obj);
+static int takeobject(void)
+{
+	int num = -1;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&work_mutex);
+#endif
+	if (nextobject < nobjects)
+		num = objects[nextobject++];
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&work_mutex);
+#endif
+	return num;
 }
 
+static void extract(fz_context *ctx, pdf_document *doc)
+{
+	int num;
+
+	while ((num = takeobject()) >= 0)
+	{
+		fz_try(ctx)
+		{
+			showobject(ctx, doc, num);
+		}
+		fz_catch(ctx)
+		{
+			fz_warn(ctx, "cannot extract object %d", num);
+		}
+	}
+}
+
+#ifdef HAVE_PTHREADS
+/* Each thread reads the file through its own document */
+static void *extractthread(void *arg)
+{
+	fz_context *ctx = arg;
+	pdf_document *doc = NULL;
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		doc = opendocument(ctx);
+		extract(ctx, doc);
+	}
+	fz_always(ctx)
+	{
+		pdf_close_document(doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "extraction thread failed");
+	}
+
+	fz_flush_warnings(ctx);
+	return NULL;
+}
+#endif
+
 #ifdef MUPDF_COMBINED_EXE
 int pdfextract_main(int argc, char **argv)
 #else
 int main(int argc, char **argv)
 #endif
 {
-	char *infile;
-	char *password = "";
+	fz_locks_context *locks = NULL;
+	pdf_document *doc;
+	fz_context *ctx;
 	int c, o;
+#ifdef HAVE_PTHREADS
+	fz_context *workers[MAX_THREADS];
+	pthread_t tid[MAX_THREADS];
+	int i;
+#endif
 
-	while ((c = fz_getopt(argc, argv, "p:r")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:rdj:")) != -1)
 	{
 		switch (c)
 		{
 		case 'p': password = fz_optarg; break;
-		case 'r': dorgb++; break;
+		case 'r': dorgb++; dodecode++; break;
+		case 'd': dodecode++; break;
+		case 'j': nthreads = CLAMP(atoi(fz_optarg), 1, MAX_THREADS); break;
 		default: usage(); break;
 		}
 	}
@@ -167,32 +489,74 @@ int main(int argc, char **argv)
 
 	infile = argv[fz_optind++];
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+#ifdef HAVE_PTHREADS
+	if (nthreads > 1)
+	{
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			pthread_mutex_init(&fz_mutex[i], NULL);
+		locks = &extract_locks;
+	}
+#else
+	if (nthreads > 1)
+	{
+		fprintf(stderr, "threads are not supported on this platform\n");
+		nthreads = 1;
+	}
+#endif
+
+	ctx = fz_new_context(NULL, locks, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
 		exit(1);
 	}
 
-	doc = pdf_open_document(ctx, infile);
-	if (pdf_needs_password(doc))
-		if (!pdf_authenticate_password(doc, password))
-			fz_throw(ctx, "cannot authenticate password: %s", infile);
+	doc = opendocument(ctx);
 
 	if (fz_optind == argc)
 	{
-		for (o = 0; o < pdf_count_objects(doc); o++)
-			showobject(o);
+		nobjects = pdf_count_objects(doc);
+		objects = fz_malloc_array(ctx, nobjects, sizeof(*objects));
+		for (o = 0; o < nobjects; o++)
+			objects[o] = o;
 	}
 	else
 	{
+		objects = fz_malloc_array(ctx, argc - fz_optind, sizeof(*objects));
 		while (fz_optind < argc)
 		{
-			showobject(atoi(argv[fz_optind]));
+			objects[nobjects++] = atoi(argv[fz_optind]);
 			fz_optind++;
 		}
 	}
 
+#ifdef HAVE_PTHREADS
+	/* Each worker has a store of its own, as the store is keyed on
+	 * objects of the worker's own document. */
+	for (i = 0; i < nthreads - 1; i++)
+	{
+		workers[i] = fz_clone_context_private(ctx, fz_store_limit(ctx) / nthreads);
+		if (!workers[i] || pthread_create(&tid[i], NULL, extractthread, workers[i]))
+		{
+			fprintf(stderr, "cannot start extraction thread\n");
+			fz_free_context(workers[i]);
+			break;
+		}
+	}
+	nthreads = i + 1;
+#endif
+
+	extract(ctx, doc);
+
+#ifdef HAVE_PTHREADS
+	for (i = 0; i < nthreads - 1; i++)
+	{
+		pthread_join(tid[i], NULL);
+		fz_free_context(workers[i]);
+	}
+#endif
+
+	fz_free(ctx, objects);
 	pdf_close_document(doc);
 	fz_flush_warnings(ctx);
 	fz_free_context(ctx);
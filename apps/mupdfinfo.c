@@ -39,7 +39,7 @@ struct info
 		} crypt;
 		struct {
 			pdf_obj *obj;
-			fz_rect *bbox;
+			fz_rect bbox;
 		} dim;
 		struct {
 			pdf_obj *obj;
@@ -74,80 +74,190 @@ struct info
 	} u;
 };
 
-static struct info *dim = NULL;
-static int dims = 0;
-static struct info *font = NULL;
-static int fonts = 0;
-static struct info *image = NULL;
-static int images = 0;
-static struct info *shading = NULL;
-static int shadings = 0;
-static struct info *pattern = NULL;
-static int patterns = 0;
-static struct info *form = NULL;
-static int forms = 0;
-static struct info *psobj = NULL;
-static int psobjs = 0;
+/*
+ * Each kind of resource is gathered into an array that grows
+ * geometrically, with an open addressed hash table of indices into
+ * it to find the resources that have been seen before.
+ */
 
-void closexref(void)
+struct infoslot
 {
-	int i;
-	if (xref)
-	{
-		pdf_close_document(xref);
-		xref = NULL;
-	}
+	unsigned int hash;
+	int index; /* index into list plus one, 0 for an empty slot */
+};
 
-	if (dim)
-	{
-		for (i = 0; i < dims; i++)
-			fz_free(ctx, dim[i].u.dim.bbox);
-		fz_free(ctx, dim);
-		dim = NULL;
-		dims = 0;
-	}
+struct infoset
+{
+	int len, cap;
+	struct info *list;
+	int tcap;
+	struct infoslot *table;
+};
 
-	if (font)
-	{
-		fz_free(ctx, font);
-		font = NULL;
-		fonts = 0;
-	}
+typedef int (infocmp)(struct info *a, struct info *b);
 
-	if (image)
-	{
-		fz_free(ctx, image);
-		image = NULL;
-		images = 0;
-	}
+static struct infoset dims;
+static struct infoset fonts;
+static struct infoset images;
+static struct infoset shadings;
+static struct infoset patterns;
+static struct infoset forms;
+static struct infoset psobjs;
+static struct infoset rsrcs;
+
+static int json = 0;
+static int jsonfiles = 0;
 
-	if (shading)
+static void
+growinfoset(struct infoset *set)
+{
+	struct infoslot *old = set->table;
+	int oldcap = set->tcap;
+	int i, pos, mask;
+
+	set->tcap = MAX(64, set->tcap * 2);
+	set->table = fz_malloc_array(ctx, set->tcap, sizeof(struct infoslot));
+	memset(set->table, 0, set->tcap * sizeof(struct infoslot));
+
+	mask = set->tcap - 1;
+	for (i = 0; i < oldcap; i++)
 	{
-		fz_free(ctx, shading);
-		shading = NULL;
-		shadings = 0;
+		if (!old[i].index)
+			continue;
+		for (pos = old[i].hash & mask; set->table[pos].index; pos = (pos + 1) & mask)
+			;
+		set->table[pos] = old[i];
 	}
 
-	if (pattern)
+	fz_free(ctx, old);
+}
+
+/* Add a copy of info to the set, unless cmp finds it there already */
+static int
+addinfo(struct infoset *set, struct info *info, unsigned int hash, infocmp *cmp)
+{
+	int pos, mask, k;
+
+	if ((set->len + 1) * 2 > set->tcap)
+		growinfoset(set);
+
+	mask = set->tcap - 1;
+	for (pos = hash & mask; (k = set->table[pos].index) != 0; pos = (pos + 1) & mask)
+		if (set->table[pos].hash == hash && !cmp(&set->list[k - 1], info))
+			return 0;
+
+	if (set->len == set->cap)
 	{
-		fz_free(ctx, pattern);
-		pattern = NULL;
-		patterns = 0;
+		int new_cap = MAX(16, set->cap * 2);
+		set->list = fz_resize_array(ctx, set->list, new_cap, sizeof(struct info));
+		set->cap = new_cap;
 	}
 
-	if (form)
+	set->list[set->len++] = *info;
+	set->table[pos].hash = hash;
+	set->table[pos].index = set->len;
+	return 1;
+}
+
+static void
+clearinfoset(struct infoset *set)
+{
+	fz_free(ctx, set->list);
+	fz_free(ctx, set->table);
+	memset(set, 0, sizeof *set);
+}
+
+static unsigned int
+hashname(char *s)
+{
+	unsigned int h = 0;
+	while (*s)
+		h = h * 31 + (unsigned char)*s++;
+	return h;
+}
+
+/* Consistent with pdf_objcmp: objects that compare equal hash equal */
+static unsigned int
+hashobj(pdf_obj *obj)
+{
+	unsigned int h;
+	int i, n;
+
+	if (pdf_is_indirect(obj))
+		return pdf_to_num(obj) * 31 + pdf_to_gen(obj);
+
+	/* Direct dictionaries hash on their keys and references */
+	n = pdf_dict_len(obj);
+	h = n;
+	for (i = 0; i < n; i++)
 	{
-		fz_free(ctx, form);
-		form = NULL;
-		forms = 0;
+		pdf_obj *val = pdf_dict_get_val(obj, i);
+		h = h * 31 + hashname(pdf_to_name(pdf_dict_get_key(obj, i)));
+		if (pdf_is_indirect(val))
+			h = h * 31 + pdf_to_num(val);
 	}
+	return h;
+}
+
+static int
+cmpobj(struct info *a, struct info *b)
+{
+	return pdf_objcmp(a->u.info.obj, b->u.info.obj);
+}
+
+/* Resource dictionaries are told apart by reference, or by identity
+ * when they are direct objects. */
+static unsigned int
+hashref(pdf_obj *obj)
+{
+	if (pdf_is_indirect(obj))
+		return hashobj(obj);
+	return (unsigned int)((size_t)obj >> 4);
+}
+
+static int
+cmpref(struct info *a, struct info *b)
+{
+	pdf_obj *x = a->u.info.obj;
+	pdf_obj *y = b->u.info.obj;
+	if (pdf_is_indirect(x) && pdf_is_indirect(y))
+		return pdf_objcmp(x, y);
+	return x != y;
+}
+
+static unsigned int
+hashrect(fz_rect *rect)
+{
+	unsigned char *s = (unsigned char *)rect;
+	unsigned int h = 0;
+	int i;
+	for (i = 0; i < (int)sizeof *rect; i++)
+		h = h * 31 + s[i];
+	return h;
+}
+
+static int
+cmprect(struct info *a, struct info *b)
+{
+	return memcmp(&a->u.dim.bbox, &b->u.dim.bbox, sizeof (fz_rect));
+}
 
-	if (psobj)
+void closexref(void)
+{
+	if (xref)
 	{
-		fz_free(ctx, psobj);
-		psobj = NULL;
-		psobjs = 0;
+		pdf_close_document(xref);
+		xref = NULL;
 	}
+
+	clearinfoset(&dims);
+	clearinfoset(&fonts);
+	clearinfoset(&images);
+	clearinfoset(&shadings);
+	clearinfoset(&patterns);
+	clearinfoset(&forms);
+	clearinfoset(&psobjs);
+	clearinfoset(&rsrcs);
 }
 
 static void
@@ -161,7 +271,8 @@ infousage(void)
 		"\t-m\tlist dimensions\n"
 		"\t-p\tlist patterns\n"
 		"\t-s\tlist shadings\n"
-		"\t-x\tlist form and postscript xobjects\n");
+		"\t-x\tlist form and postscript xobjects\n"
+		"\t-j\tprint the information as json\n");
 	exit(1);
 }
 
@@ -192,33 +303,20 @@ showglobalinfo(void)
 static void
 gatherdimensions(int page, pdf_obj *pageref, pdf_obj *pageobj)
 {
-	fz_rect bbox;
+	struct info info;
 	pdf_obj *obj;
-	int j;
 
 	obj = pdf_dict_gets(pageobj, "MediaBox");
 	if (!pdf_is_array(obj))
 		return;
 
-	bbox = pdf_to_rect(ctx, obj);
-
-	for (j = 0; j < dims; j++)
-		if (!memcmp(dim[j].u.dim.bbox, &bbox, sizeof (fz_rect)))
-			break;
-
-	if (j < dims)
-		return;
-
-	dim = fz_resize_array(ctx, dim, dims+1, sizeof(struct info));
-	dims++;
+	memset(&info, 0, sizeof info);
+	info.page = page;
+	info.pageref = pageref;
+	info.pageobj = pageobj;
+	info.u.dim.bbox = pdf_to_rect(ctx, obj);
 
-	dim[dims - 1].page = page;
-	dim[dims - 1].pageref = pageref;
-	dim[dims - 1].pageobj = pageobj;
-	dim[dims - 1].u.dim.bbox = fz_malloc(ctx, sizeof(fz_rect));
-	memcpy(dim[dims - 1].u.dim.bbox, &bbox, sizeof (fz_rect));
-
-	return;
+	addinfo(&dims, &info, hashrect(&info.u.dim.bbox), cmprect);
 }
 
 static void
@@ -233,7 +331,7 @@ gatherfonts(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		pdf_obj *subtype = NULL;
 		pdf_obj *basefont = NULL;
 		pdf_obj *name = NULL;
-		int k;
+		struct info info;
 
 		fontdict = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(fontdict))
@@ -247,22 +345,14 @@ gatherfonts(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		if (!basefont || pdf_is_null(basefont))
 			name = pdf_dict_gets(fontdict, "Name");
 
-		for (k = 0; k < fonts; k++)
-			if (!pdf_objcmp(font[k].u.font.obj, fontdict))
-				break;
-
-		if (k < fonts)
-			continue;
-
-		font = fz_resize_array(ctx, font, fonts+1, sizeof(struct info));
-		fonts++;
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.font.obj = fontdict;
+		info.u.font.subtype = subtype;
+		info.u.font.name = basefont ? basefont : name;
 
-		font[fonts - 1].page = page;
-		font[fonts - 1].pageref = pageref;
-		font[fonts - 1].pageobj = pageobj;
-		font[fonts - 1].u.font.obj = fontdict;
-		font[fonts - 1].u.font.subtype = subtype;
-		font[fonts - 1].u.font.name = basefont ? basefont : name;
+		addinfo(&fonts, &info, hashobj(fontdict), cmpobj);
 	}
 }
 
@@ -282,7 +372,7 @@ gatherimages(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		pdf_obj *filter = NULL;
 		pdf_obj *cs = NULL;
 		pdf_obj *altcs;
-		int k;
+		struct info info;
 
 		imagedict = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(imagedict))
@@ -316,26 +406,18 @@ gatherimages(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		height = pdf_dict_gets(imagedict, "Height");
 		bpc = pdf_dict_gets(imagedict, "BitsPerComponent");
 
-		for (k = 0; k < images; k++)
-			if (!pdf_objcmp(image[k].u.image.obj, imagedict))
-				break;
-
-		if (k < images)
-			continue;
-
-		image = fz_resize_array(ctx, image, images+1, sizeof(struct info));
-		images++;
-
-		image[images - 1].page = page;
-		image[images - 1].pageref = pageref;
-		image[images - 1].pageobj = pageobj;
-		image[images - 1].u.image.obj = imagedict;
-		image[images - 1].u.image.width = width;
-		image[images - 1].u.image.height = height;
-		image[images - 1].u.image.bpc = bpc;
-		image[images - 1].u.image.filter = filter;
-		image[images - 1].u.image.cs = cs;
-		image[images - 1].u.image.altcs = altcs;
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.image.obj = imagedict;
+		info.u.image.width = width;
+		info.u.image.height = height;
+		info.u.image.bpc = bpc;
+		info.u.image.filter = filter;
+		info.u.image.cs = cs;
+		info.u.image.altcs = altcs;
+
+		addinfo(&images, &info, hashobj(imagedict), cmpobj);
 	}
 }
 
@@ -353,7 +435,7 @@ gatherforms(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		pdf_obj *group;
 		pdf_obj *groupsubtype;
 		pdf_obj *reference;
-		int k;
+		struct info info;
 
 		xobjdict = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(xobjdict))
@@ -374,22 +456,14 @@ gatherforms(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		groupsubtype = pdf_dict_gets(group, "S");
 		reference = pdf_dict_gets(xobjdict, "Ref");
 
-		for (k = 0; k < forms; k++)
-			if (!pdf_objcmp(form[k].u.form.obj, xobjdict))
-				break;
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.form.obj = xobjdict;
+		info.u.form.groupsubtype = groupsubtype;
+		info.u.form.reference = reference;
 
-		if (k < forms)
-			continue;
-
-		form = fz_resize_array(ctx, form, forms+1, sizeof(struct info));
-		forms++;
-
-		form[forms - 1].page = page;
-		form[forms - 1].pageref = pageref;
-		form[forms - 1].pageobj = pageobj;
-		form[forms - 1].u.form.obj = xobjdict;
-		form[forms - 1].u.form.groupsubtype = groupsubtype;
-		form[forms - 1].u.form.reference = reference;
+		addinfo(&forms, &info, hashobj(xobjdict), cmpobj);
 	}
 }
 
@@ -404,7 +478,7 @@ gatherpsobjs(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		pdf_obj *xobjdict;
 		pdf_obj *type;
 		pdf_obj *subtype;
-		int k;
+		struct info info;
 
 		xobjdict = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(xobjdict))
@@ -419,20 +493,13 @@ gatherpsobjs(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 			(strcmp(pdf_to_name(type), "Form") || strcmp(pdf_to_name(subtype), "PS")))
 			continue;
 
-		for (k = 0; k < psobjs; k++)
-			if (!pdf_objcmp(psobj[k].u.form.obj, xobjdict))
-				break;
-
-		if (k < psobjs)
-			continue;
-
-		psobj = fz_resize_array(ctx, psobj, psobjs+1, sizeof(struct info));
-		psobjs++;
+		memset(&info, 0, sizeof info);
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.form.obj = xobjdict;
 
-		psobj[psobjs - 1].page = page;
-		psobj[psobjs - 1].pageref = pageref;
-		psobj[psobjs - 1].pageobj = pageobj;
-		psobj[psobjs - 1].u.form.obj = xobjdict;
+		addinfo(&psobjs, &info, hashobj(xobjdict), cmpobj);
 	}
 }
 
@@ -446,7 +513,7 @@ gathershadings(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 	{
 		pdf_obj *shade;
 		pdf_obj *type;
-		int k;
+		struct info info;
 
 		shade = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(shade))
@@ -462,21 +529,13 @@ gathershadings(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 			type = NULL;
 		}
 
-		for (k = 0; k < shadings; k++)
-			if (!pdf_objcmp(shading[k].u.shading.obj, shade))
-				break;
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.shading.obj = shade;
+		info.u.shading.type = type;
 
-		if (k < shadings)
-			continue;
-
-		shading = fz_resize_array(ctx, shading, shadings+1, sizeof(struct info));
-		shadings++;
-
-		shading[shadings - 1].page = page;
-		shading[shadings - 1].pageref = pageref;
-		shading[shadings - 1].pageobj = pageobj;
-		shading[shadings - 1].u.shading.obj = shade;
-		shading[shadings - 1].u.shading.type = type;
+		addinfo(&shadings, &info, hashobj(shade), cmpobj);
 	}
 }
 
@@ -493,7 +552,7 @@ gatherpatterns(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 		pdf_obj *paint = NULL;
 		pdf_obj *tiling = NULL;
 		pdf_obj *shading = NULL;
-		int k;
+		struct info info;
 
 		patterndict = pdf_dict_get_val(dict, i);
 		if (!pdf_is_dict(patterndict))
@@ -530,24 +589,16 @@ gatherpatterns(int page, pdf_obj *pageref, pdf_obj *pageobj, pdf_obj *dict)
 			shading = pdf_dict_gets(patterndict, "Shading");
 		}
 
-		for (k = 0; k < patterns; k++)
-			if (!pdf_objcmp(pattern[k].u.pattern.obj, patterndict))
-				break;
+		info.page = page;
+		info.pageref = pageref;
+		info.pageobj = pageobj;
+		info.u.pattern.obj = patterndict;
+		info.u.pattern.type = type;
+		info.u.pattern.paint = paint;
+		info.u.pattern.tiling = tiling;
+		info.u.pattern.shading = shading;
 
-		if (k < patterns)
-			continue;
-
-		pattern = fz_resize_array(ctx, pattern, patterns+1, sizeof(struct info));
-		patterns++;
-
-		pattern[patterns - 1].page = page;
-		pattern[patterns - 1].pageref = pageref;
-		pattern[patterns - 1].pageobj = pageobj;
-		pattern[patterns - 1].u.pattern.obj = patterndict;
-		pattern[patterns - 1].u.pattern.type = type;
-		pattern[patterns - 1].u.pattern.paint = paint;
-		pattern[patterns - 1].u.pattern.tiling = tiling;
-		pattern[patterns - 1].u.pattern.shading = shading;
+		addinfo(&patterns, &info, hashobj(patterndict), cmpobj);
 	}
 }
 
@@ -561,6 +612,7 @@ gatherresourceinfo(int page, pdf_obj *rsrc)
 	pdf_obj *shade;
 	pdf_obj *pattern;
 	pdf_obj *subrsrc;
+	struct info info;
 	int i;
 
 	pageobj = xref->page_objs[page-1];
@@ -569,6 +621,14 @@ gatherresourceinfo(int page, pdf_obj *rsrc)
 	if (!pageobj)
 		fz_throw(ctx, "cannot retrieve info from page %d", page);
 
+	/* Resources that have been gathered before hold nothing new */
+	if (!rsrc)
+		return;
+	memset(&info, 0, sizeof info);
+	info.u.info.obj = rsrc;
+	if (!addinfo(&rsrcs, &info, hashref(rsrc), cmpref))
+		return;
+
 	font = pdf_dict_gets(rsrc, "Font");
 	if (font)
 	{
@@ -651,55 +711,55 @@ printinfo(char *filename, int show, int page)
 
 #define PAGE_FMT "\t% 5d (% 7d %1d R): "
 
-	if (show & DIMENSIONS && dims > 0)
+	if (show & DIMENSIONS && dims.len > 0)
 	{
-		printf("Mediaboxes (%d):\n", dims);
-		for (i = 0; i < dims; i++)
+		printf("Mediaboxes (%d):\n", dims.len);
+		for (i = 0; i < dims.len; i++)
 		{
 			printf(PAGE_FMT "[ %g %g %g %g ]\n",
-				dim[i].page,
-				pdf_to_num(dim[i].pageref), pdf_to_gen(dim[i].pageref),
-				dim[i].u.dim.bbox->x0,
-				dim[i].u.dim.bbox->y0,
-				dim[i].u.dim.bbox->x1,
-				dim[i].u.dim.bbox->y1);
+				dims.list[i].page,
+				pdf_to_num(dims.list[i].pageref), pdf_to_gen(dims.list[i].pageref),
+				dims.list[i].u.dim.bbox.x0,
+				dims.list[i].u.dim.bbox.y0,
+				dims.list[i].u.dim.bbox.x1,
+				dims.list[i].u.dim.bbox.y1);
 		}
 		printf("\n");
 	}
 
-	if (show & FONTS && fonts > 0)
+	if (show & FONTS && fonts.len > 0)
 	{
-		printf("Fonts (%d):\n", fonts);
-		for (i = 0; i < fonts; i++)
+		printf("Fonts (%d):\n", fonts.len);
+		for (i = 0; i < fonts.len; i++)
 		{
 			printf(PAGE_FMT "%s '%s' (%d %d R)\n",
-				font[i].page,
-				pdf_to_num(font[i].pageref), pdf_to_gen(font[i].pageref),
-				pdf_to_name(font[i].u.font.subtype),
-				pdf_to_name(font[i].u.font.name),
-				pdf_to_num(font[i].u.font.obj), pdf_to_gen(font[i].u.font.obj));
+				fonts.list[i].page,
+				pdf_to_num(fonts.list[i].pageref), pdf_to_gen(fonts.list[i].pageref),
+				pdf_to_name(fonts.list[i].u.font.subtype),
+				pdf_to_name(fonts.list[i].u.font.name),
+				pdf_to_num(fonts.list[i].u.font.obj), pdf_to_gen(fonts.list[i].u.font.obj));
 		}
 		printf("\n");
 	}
 
-	if (show & IMAGES && images > 0)
+	if (show & IMAGES && images.len > 0)
 	{
-		printf("Images (%d):\n", images);
-		for (i = 0; i < images; i++)
+		printf("Images (%d):\n", images.len);
+		for (i = 0; i < images.len; i++)
 		{
 			char *cs = NULL;
 			char *altcs = NULL;
 
 			printf(PAGE_FMT "[ ",
-				image[i].page,
-				pdf_to_num(image[i].pageref), pdf_to_gen(image[i].pageref));
+				images.list[i].page,
+				pdf_to_num(images.list[i].pageref), pdf_to_gen(images.list[i].pageref));
 
-			if (pdf_is_array(image[i].u.image.filter))
+			if (pdf_is_array(images.list[i].u.image.filter))
 			{
-				int n = pdf_array_len(image[i].u.image.filter);
+				int n = pdf_array_len(images.list[i].u.image.filter);
 				for (j = 0; j < n; j++)
 				{
-					pdf_obj *obj = pdf_array_get(image[i].u.image.filter, j);
+					pdf_obj *obj = pdf_array_get(images.list[i].u.image.filter, j);
 					char *filter = fz_strdup(ctx, pdf_to_name(obj));
 
 					if (strstr(filter, "Decode"))
@@ -707,13 +767,13 @@ printinfo(char *filename, int show, int page)
 
 					printf("%s%s",
 							filter,
-							j == pdf_array_len(image[i].u.image.filter) - 1 ? "" : " ");
+							j == pdf_array_len(images.list[i].u.image.filter) - 1 ? "" : " ");
 					fz_free(ctx, filter);
 				}
 			}
-			else if (image[i].u.image.filter)
+			else if (images.list[i].u.image.filter)
 			{
-				pdf_obj *obj = image[i].u.image.filter;
+				pdf_obj *obj = images.list[i].u.image.filter;
 				char *filter = fz_strdup(ctx, pdf_to_name(obj));
 
 				if (strstr(filter, "Decode"))
@@ -725,9 +785,9 @@ printinfo(char *filename, int show, int page)
 			else
 				printf("Raw");
 
-			if (image[i].u.image.cs)
+			if (images.list[i].u.image.cs)
 			{
-				cs = fz_strdup(ctx, pdf_to_name(image[i].u.image.cs));
+				cs = fz_strdup(ctx, pdf_to_name(images.list[i].u.image.cs));
 
 				if (!strncmp(cs, "Device", 6))
 				{
@@ -744,9 +804,9 @@ printinfo(char *filename, int show, int page)
 				if (strstr(cs, "Separation"))
 					fz_strlcpy(cs, "Sep", 4);
 			}
-			if (image[i].u.image.altcs)
+			if (images.list[i].u.image.altcs)
 			{
-				altcs = fz_strdup(ctx, pdf_to_name(image[i].u.image.altcs));
+				altcs = fz_strdup(ctx, pdf_to_name(images.list[i].u.image.altcs));
 
 				if (!strncmp(altcs, "Device", 6))
 				{
@@ -765,13 +825,13 @@ printinfo(char *filename, int show, int page)
 			}
 
 			printf(" ] %dx%d %dbpc %s%s%s (%d %d R)\n",
-				pdf_to_int(image[i].u.image.width),
-				pdf_to_int(image[i].u.image.height),
-				image[i].u.image.bpc ? pdf_to_int(image[i].u.image.bpc) : 1,
-				image[i].u.image.cs ? cs : "ImageMask",
-				image[i].u.image.altcs ? " " : "",
-				image[i].u.image.altcs ? altcs : "",
-				pdf_to_num(image[i].u.image.obj), pdf_to_gen(image[i].u.image.obj));
+				pdf_to_int(images.list[i].u.image.width),
+				pdf_to_int(images.list[i].u.image.height),
+				images.list[i].u.image.bpc ? pdf_to_int(images.list[i].u.image.bpc) : 1,
+				images.list[i].u.image.cs ? cs : "ImageMask",
+				images.list[i].u.image.altcs ? " " : "",
+				images.list[i].u.image.altcs ? altcs : "",
+				pdf_to_num(images.list[i].u.image.obj), pdf_to_gen(images.list[i].u.image.obj));
 
 			fz_free(ctx, cs);
 			fz_free(ctx, altcs);
@@ -779,10 +839,10 @@ printinfo(char *filename, int show, int page)
 		printf("\n");
 	}
 
-	if (show & SHADINGS && shadings > 0)
+	if (show & SHADINGS && shadings.len > 0)
 	{
-		printf("Shading patterns (%d):\n", shadings);
-		for (i = 0; i < shadings; i++)
+		printf("Shading patterns (%d):\n", shadings.len);
+		for (i = 0; i < shadings.len; i++)
 		{
 			char *shadingtype[] =
 			{
@@ -797,20 +857,20 @@ printinfo(char *filename, int show, int page)
 			};
 
 			printf(PAGE_FMT "%s (%d %d R)\n",
-				shading[i].page,
-				pdf_to_num(shading[i].pageref), pdf_to_gen(shading[i].pageref),
-				shadingtype[pdf_to_int(shading[i].u.shading.type)],
-				pdf_to_num(shading[i].u.shading.obj), pdf_to_gen(shading[i].u.shading.obj));
+				shadings.list[i].page,
+				pdf_to_num(shadings.list[i].pageref), pdf_to_gen(shadings.list[i].pageref),
+				shadingtype[pdf_to_int(shadings.list[i].u.shading.type)],
+				pdf_to_num(shadings.list[i].u.shading.obj), pdf_to_gen(shadings.list[i].u.shading.obj));
 		}
 		printf("\n");
 	}
 
-	if (show & PATTERNS && patterns > 0)
+	if (show & PATTERNS && patterns.len > 0)
 	{
-		printf("Patterns (%d):\n", patterns);
-		for (i = 0; i < patterns; i++)
+		printf("Patterns (%d):\n", patterns.len);
+		for (i = 0; i < patterns.len; i++)
 		{
-			if (pdf_to_int(pattern[i].u.pattern.type) == 1)
+			if (pdf_to_int(patterns.list[i].u.pattern.type) == 1)
 			{
 				char *painttype[] =
 				{
@@ -827,55 +887,323 @@ printinfo(char *filename, int show, int page)
 				};
 
 				printf(PAGE_FMT "Tiling %s %s (%d %d R)\n",
-						pattern[i].page,
-						pdf_to_num(pattern[i].pageref), pdf_to_gen(pattern[i].pageref),
-						painttype[pdf_to_int(pattern[i].u.pattern.paint)],
-						tilingtype[pdf_to_int(pattern[i].u.pattern.tiling)],
-						pdf_to_num(pattern[i].u.pattern.obj), pdf_to_gen(pattern[i].u.pattern.obj));
+						patterns.list[i].page,
+						pdf_to_num(patterns.list[i].pageref), pdf_to_gen(patterns.list[i].pageref),
+						painttype[pdf_to_int(patterns.list[i].u.pattern.paint)],
+						tilingtype[pdf_to_int(patterns.list[i].u.pattern.tiling)],
+						pdf_to_num(patterns.list[i].u.pattern.obj), pdf_to_gen(patterns.list[i].u.pattern.obj));
 			}
 			else
 			{
 				printf(PAGE_FMT "Shading %d %d R (%d %d R)\n",
-						pattern[i].page,
-						pdf_to_num(pattern[i].pageref), pdf_to_gen(pattern[i].pageref),
-						pdf_to_num(pattern[i].u.pattern.shading), pdf_to_gen(pattern[i].u.pattern.shading),
-						pdf_to_num(pattern[i].u.pattern.obj), pdf_to_gen(pattern[i].u.pattern.obj));
+						patterns.list[i].page,
+						pdf_to_num(patterns.list[i].pageref), pdf_to_gen(patterns.list[i].pageref),
+						pdf_to_num(patterns.list[i].u.pattern.shading), pdf_to_gen(patterns.list[i].u.pattern.shading),
+						pdf_to_num(patterns.list[i].u.pattern.obj), pdf_to_gen(patterns.list[i].u.pattern.obj));
 			}
 		}
 		printf("\n");
 	}
 
-	if (show & XOBJS && forms > 0)
+	if (show & XOBJS && forms.len > 0)
 	{
-		printf("Form xobjects (%d):\n", forms);
-		for (i = 0; i < forms; i++)
+		printf("Form xobjects (%d):\n", forms.len);
+		for (i = 0; i < forms.len; i++)
 		{
 			printf(PAGE_FMT "Form%s%s%s%s (%d %d R)\n",
-				form[i].page,
-				pdf_to_num(form[i].pageref), pdf_to_gen(form[i].pageref),
-				form[i].u.form.groupsubtype ? " " : "",
-				form[i].u.form.groupsubtype ? pdf_to_name(form[i].u.form.groupsubtype) : "",
-				form[i].u.form.groupsubtype ? " Group" : "",
-				form[i].u.form.reference ? " Reference" : "",
-				pdf_to_num(form[i].u.form.obj), pdf_to_gen(form[i].u.form.obj));
+				forms.list[i].page,
+				pdf_to_num(forms.list[i].pageref), pdf_to_gen(forms.list[i].pageref),
+				forms.list[i].u.form.groupsubtype ? " " : "",
+				forms.list[i].u.form.groupsubtype ? pdf_to_name(forms.list[i].u.form.groupsubtype) : "",
+				forms.list[i].u.form.groupsubtype ? " Group" : "",
+				forms.list[i].u.form.reference ? " Reference" : "",
+				pdf_to_num(forms.list[i].u.form.obj), pdf_to_gen(forms.list[i].u.form.obj));
 		}
 		printf("\n");
 	}
 
-	if (show & XOBJS && psobjs > 0)
+	if (show & XOBJS && psobjs.len > 0)
 	{
-		printf("Postscript xobjects (%d):\n", psobjs);
-		for (i = 0; i < psobjs; i++)
+		printf("Postscript xobjects (%d):\n", psobjs.len);
+		for (i = 0; i < psobjs.len; i++)
 		{
 			printf(PAGE_FMT "(%d %d R)\n",
-				psobj[i].page,
-				pdf_to_num(psobj[i].pageref), pdf_to_gen(psobj[i].pageref),
-				pdf_to_num(psobj[i].u.form.obj), pdf_to_gen(psobj[i].u.form.obj));
+				psobjs.list[i].page,
+				pdf_to_num(psobjs.list[i].pageref), pdf_to_gen(psobjs.list[i].pageref),
+				pdf_to_num(psobjs.list[i].u.form.obj), pdf_to_gen(psobjs.list[i].u.form.obj));
 		}
 		printf("\n");
 	}
 }
 
+/* Length of the well-formed UTF-8 sequence at s, or 0 */
+static int
+utf8len(unsigned char *s)
+{
+	int n, i;
+
+	if (s[0] >= 0xc2 && s[0] <= 0xdf)
+		n = 2;
+	else if (s[0] >= 0xe0 && s[0] <= 0xef)
+		n = 3;
+	else if (s[0] >= 0xf0 && s[0] <= 0xf4)
+		n = 4;
+	else
+		return 0;
+	for (i = 1; i < n; i++)
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+	return n;
+}
+
+/* Names and file names are arbitrary bytes. Bytes that are not part of
+ * well-formed UTF-8 are escaped as the Latin-1 character of the same
+ * value, so that the output is always valid JSON. */
+static void
+jsonstring(char *s)
+{
+	int c, n;
+
+	putchar('"');
+	while (*s)
+	{
+		c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else if (c >= 0x80)
+		{
+			n = utf8len((unsigned char *)s);
+			if (n == 0)
+				printf("\\u%04x", c);
+			else
+			{
+				fwrite(s, 1, n, stdout);
+				s += n;
+				continue;
+			}
+		}
+		else
+			putchar(c);
+		s++;
+	}
+	putchar('"');
+}
+
+/* JSON has no NaN or infinity */
+static void
+jsonnumber(float f)
+{
+	if (isnan(f) || f > FLT_MAX || f < -FLT_MAX)
+		fputs("null", stdout);
+	else
+		printf("%g", f);
+}
+
+static void
+jsonvalue(pdf_obj *obj)
+{
+	if (pdf_is_string(obj))
+	{
+		char *s = pdf_to_utf8(ctx, obj);
+		jsonstring(s);
+		fz_free(ctx, s);
+	}
+	else if (pdf_is_name(obj))
+		jsonstring(pdf_to_name(obj));
+	else if (pdf_is_int(obj))
+		printf("%d", pdf_to_int(obj));
+	else if (pdf_is_real(obj))
+		jsonnumber(pdf_to_real(obj));
+	else if (pdf_is_bool(obj))
+		fputs(pdf_to_bool(obj) ? "true" : "false", stdout);
+	else
+		fputs("null", stdout);
+}
+
+static void
+jsonname(char *key, pdf_obj *obj)
+{
+	printf(", \"%s\": ", key);
+	if (pdf_is_name(obj))
+		jsonstring(pdf_to_name(obj));
+	else
+		printf("null");
+}
+
+static void
+jsonref(char *key, pdf_obj *obj)
+{
+	printf(", \"%s\": ", key);
+	if (pdf_is_indirect(obj))
+		printf("\"%d %d R\"", pdf_to_num(obj), pdf_to_gen(obj));
+	else
+		printf("null");
+}
+
+static void
+jsonint(char *key, pdf_obj *obj)
+{
+	printf(", \"%s\": ", key);
+	if (obj)
+		printf("%d", pdf_to_int(obj));
+	else
+		printf("null");
+}
+
+static void
+jsonlist(char *name, struct infoset *set, int last, void (*item)(struct info *info))
+{
+	int i;
+
+	printf("\t\"%s\": [", name);
+	for (i = 0; i < set->len; i++)
+	{
+		printf(i ? ",\n\t\t" : "\n\t\t");
+		printf("{ \"page\": %d", set->list[i].page);
+		jsonref("pageref", set->list[i].pageref);
+		item(&set->list[i]);
+		printf(" }");
+	}
+	printf(set->len ? "\n\t]" : "]");
+	printf(last ? "\n" : ",\n");
+}
+
+static void
+jsondim(struct info *info)
+{
+	fz_rect *r = &info->u.dim.bbox;
+	fputs(", \"box\": [", stdout);
+	jsonnumber(r->x0);
+	fputs(", ", stdout);
+	jsonnumber(r->y0);
+	fputs(", ", stdout);
+	jsonnumber(r->x1);
+	fputs(", ", stdout);
+	jsonnumber(r->y1);
+	fputs("]", stdout);
+}
+
+static void
+jsonfont(struct info *info)
+{
+	jsonname("subtype", info->u.font.subtype);
+	jsonname("name", info->u.font.name);
+	jsonref("ref", info->u.font.obj);
+}
+
+static void
+jsonimage(struct info *info)
+{
+	pdf_obj *filter = info->u.image.filter;
+	int i, n;
+
+	printf(", \"filters\": [");
+	if (pdf_is_array(filter))
+	{
+		n = pdf_array_len(filter);
+		for (i = 0; i < n; i++)
+		{
+			if (i)
+				printf(", ");
+			jsonvalue(pdf_array_get(filter, i));
+		}
+	}
+	else if (filter)
+		jsonvalue(filter);
+	printf("]");
+
+	jsonint("width", info->u.image.width);
+	jsonint("height", info->u.image.height);
+	printf(", \"bpc\": %d", info->u.image.bpc ? pdf_to_int(info->u.image.bpc) : 1);
+	jsonname("colorspace", info->u.image.cs);
+	jsonname("altcolorspace", info->u.image.altcs);
+	jsonref("ref", info->u.image.obj);
+}
+
+static void
+jsonshading(struct info *info)
+{
+	jsonint("type", info->u.shading.type);
+	jsonref("ref", info->u.shading.obj);
+}
+
+static void
+jsonpattern(struct info *info)
+{
+	jsonint("type", info->u.pattern.type);
+	jsonint("paint", info->u.pattern.paint);
+	jsonint("tiling", info->u.pattern.tiling);
+	jsonref("shading", info->u.pattern.shading);
+	jsonref("ref", info->u.pattern.obj);
+}
+
+static void
+jsonform(struct info *info)
+{
+	jsonname("group", info->u.form.groupsubtype);
+	printf(", \"reference\": %s", info->u.form.reference ? "true" : "false");
+	jsonref("ref", info->u.form.obj);
+}
+
+static void
+jsonpsobj(struct info *info)
+{
+	jsonref("ref", info->u.form.obj);
+}
+
+static void
+printjson(char *filename, int show)
+{
+	pdf_obj *obj;
+	int i, n, left;
+
+	printf(jsonfiles++ ? ",\n{\n" : "{\n");
+
+	printf("\t\"file\": ");
+	jsonstring(filename);
+	printf(",\n\t\"version\": \"%d.%d\",\n", xref->version / 10, xref->version % 10);
+	printf("\t\"pages\": %d,\n", pagecount);
+	printf("\t\"encrypted\": %s,\n", pdf_dict_gets(xref->trailer, "Encrypt") ? "true" : "false");
+
+	printf("\t\"info\": {");
+	obj = pdf_dict_gets(xref->trailer, "Info");
+	n = pdf_dict_len(obj);
+	for (i = 0; i < n; i++)
+	{
+		printf(i ? ",\n\t\t" : "\n\t\t");
+		jsonvalue(pdf_dict_get_key(obj, i));
+		printf(": ");
+		jsonvalue(pdf_dict_get_val(obj, i));
+	}
+	printf(n ? "\n\t}" : "}");
+
+	left = show;
+	if (left)
+		printf(",\n");
+	else
+		printf("\n");
+
+	if (show & DIMENSIONS)
+		jsonlist("mediaboxes", &dims, !(left &= ~DIMENSIONS), jsondim);
+	if (show & FONTS)
+		jsonlist("fonts", &fonts, !(left &= ~FONTS), jsonfont);
+	if (show & IMAGES)
+		jsonlist("images", &images, !(left &= ~IMAGES), jsonimage);
+	if (show & SHADINGS)
+		jsonlist("shadings", &shadings, !(left &= ~SHADINGS), jsonshading);
+	if (show & PATTERNS)
+		jsonlist("patterns", &patterns, !(left &= ~PATTERNS), jsonpattern);
+	if (show & XOBJS)
+	{
+		jsonlist("forms", &forms, 0, jsonform);
+		jsonlist("psobjs", &psobjs, 1, jsonpsobj);
+	}
+
+	printf("}");
+}
+
 static void
 showinfo(char *filename, int show, char *pagelist)
 {
@@ -916,14 +1244,14 @@ showinfo(char *filename, int show, char *pagelist)
 		if (spage > pagecount)
 			spage = pagecount;
 
-		if (allpages)
+		if (allpages && !json)
 			printf("Retrieving info from pages %d-%d...\n", spage, epage);
 		if (spage >= 1)
 		{
 			for (page = spage; page <= epage; page++)
 			{
 				gatherpageinfo(page);
-				if (!allpages)
+				if (!allpages && !json)
 				{
 					printf("Page %d:\n", page);
 					printinfo(filename, show, page);
@@ -935,7 +1263,7 @@ showinfo(char *filename, int show, char *pagelist)
 		spec = fz_strsep(&pagelist, ",");
 	}
 
-	if (allpages)
+	if (allpages && !json)
 		printinfo(filename, show, -1);
 }
 
@@ -963,7 +1291,7 @@ int main(int argc, char **argv)
 	int show = ALL;
 	int c;
 
-	while ((c = fz_getopt(argc, argv, "mfispxd:")) != -1)
+	while ((c = fz_getopt(argc, argv, "mfispxjd:")) != -1)
 	{
 		switch (c)
 		{
@@ -973,6 +1301,7 @@ int main(int argc, char **argv)
 		case 's': if (show == ALL) show = SHADINGS; else show |= SHADINGS; break;
 		case 'p': if (show == ALL) show = PATTERNS; else show |= PATTERNS; break;
 		case 'x': if (show == ALL) show = XOBJS; else show |= XOBJS; break;
+		case 'j': json = 1; break;
 		case 'd': password = fz_optarg; break;
 		default:
 			infousage();
@@ -990,28 +1319,32 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (json)
+		printf("[\n");
+
 	state = NO_FILE_OPENED;
 	while (fz_optind < argc)
 	{
 		if (state == NO_FILE_OPENED || !arg_is_page_range(argv[fz_optind]))
 		{
 			if (state == NO_INFO_GATHERED)
-			{
 				showinfo(filename, show, "1-");
-				closexref();
-			}
 
+			if (json && xref)
+				printjson(filename, show);
 			closexref();
 
 			filename = argv[fz_optind];
-			printf("%s:\n", filename);
+			if (!json)
+				printf("%s:\n", filename);
 			xref = pdf_open_document(ctx, filename);
 			if (pdf_needs_password(xref))
 				if (!pdf_authenticate_password(xref, password))
 					fz_throw(ctx, "cannot authenticate password: %s", filename);
 			pagecount = pdf_count_pages(xref);
 
-			showglobalinfo();
+			if (!json)
+				showglobalinfo();
 			state = NO_INFO_GATHERED;
 		}
 		else
@@ -1026,7 +1359,12 @@ int main(int argc, char **argv)
 	if (state == NO_INFO_GATHERED)
 		showinfo(filename, show, "1-");
 
+	if (json && xref)
+		printjson(filename, show);
 	closexref();
+
+	if (json)
+		printf("\n]\n");
 	fz_free_context(ctx);
 	return 0;
 }
@@ -5,6 +5,13 @@
 
 #include <ctype.h> /* for tolower() */
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #define ZOOMSTEP 1.142857
 #define BEYOND_THRESHHOLD 40
 
@@ -16,6 +23,9 @@ enum panning
 };
 
 static void pdfapp_showpage(pdfapp_t *app, int loadpage, int drawpage, int repaint);
+static void pdfapp_prefetch_start(pdfapp_t *app, char *filename, char *password);
+static void pdfapp_prefetch_stop(pdfapp_t *app);
+static void pdfapp_freepage(pdfapp_t *app);
 
 static void pdfapp_warn(pdfapp_t *app, const char *fmt, ...)
 {
@@ -98,6 +108,10 @@ void pdfapp_open(pdfapp_t *app, char *filename, int reload)
 	{
 		app->doc = fz_open_document(ctx, filename);
 
+		/* Pages are run again as they are revisited */
+		if (pdf_specifics(app->doc))
+			pdf_set_compile_contents(pdf_specifics(app->doc), 1);
+
 		if (fz_needs_password(app->doc))
 		{
 			int okay = fz_authenticate_password(app->doc, password);
@@ -144,26 +158,16 @@ void pdfapp_open(pdfapp_t *app, char *filename, int reload)
 		app->pany = 0;
 	}
 
+	pdfapp_prefetch_start(app, filename, password);
+
 	pdfapp_showpage(app, 1, 1, 1);
 }
 
 void pdfapp_close(pdfapp_t *app)
 {
-	if (app->page_list)
-		fz_free_display_list(app->ctx, app->page_list);
-	app->page_list = NULL;
-
-	if (app->page_text)
-		fz_free_text_page(app->ctx, app->page_text);
-	app->page_text = NULL;
-
-	if (app->page_sheet)
-		fz_free_text_sheet(app->ctx, app->page_sheet);
-	app->page_sheet = NULL;
+	pdfapp_prefetch_stop(app);
 
-	if (app->page_links)
-		fz_drop_link(app->ctx, app->page_links);
-	app->page_links = NULL;
+	pdfapp_freepage(app);
 
 	if (app->doctitle)
 		fz_free(app->ctx, app->doctitle);
@@ -177,10 +181,6 @@ void pdfapp_close(pdfapp_t *app)
 		fz_free_outline(app->ctx, app->outline);
 	app->outline = NULL;
 
-	if (app->page)
-		fz_free_page(app->doc, app->page);
-	app->page = NULL;
-
 	if (app->doc)
 	{
 		fz_close_document(app->doc);
@@ -190,14 +190,30 @@ void pdfapp_close(pdfapp_t *app)
 	fz_flush_warnings(app->ctx);
 }
 
-static fz_matrix pdfapp_viewctm(pdfapp_t *app)
+static fz_matrix pdfapp_viewctm_at(int resolution, int rotate)
 {
 	fz_matrix ctm;
-	ctm = fz_scale(app->resolution/72.0f, app->resolution/72.0f);
-	ctm = fz_concat(ctm, fz_rotate(app->rotate));
+	ctm = fz_scale(resolution/72.0f, resolution/72.0f);
+	ctm = fz_concat(ctm, fz_rotate(rotate));
 	return ctm;
 }
 
+static fz_matrix pdfapp_viewctm(pdfapp_t *app)
+{
+	return pdfapp_viewctm_at(app->resolution, app->rotate);
+}
+
+static fz_colorspace *pdfapp_colorspace(int grayscale)
+{
+	if (grayscale)
+		return fz_device_gray;
+#ifdef _WIN32
+	return fz_device_bgr;
+#else
+	return fz_device_rgb;
+#endif
+}
+
 static void pdfapp_panview(pdfapp_t *app, int newx, int newy)
 {
 	int image_w = fz_pixmap_width(app->ctx, app->image);
@@ -225,10 +241,479 @@ static void pdfapp_panview(pdfapp_t *app, int newx, int newy)
 	app->pany = newy;
 }
 
-static void pdfapp_loadpage(pdfapp_t *app)
+/*
+ * Background rendering of the pages around the current one.
+ *
+ * A worker thread opens its own copy of the document on a private
+ * clone of the context (documents may only be used from one thread,
+ * and nothing loaded from one may reach another thread) and renders
+ * the next and previous pages at the current view into a small LRU of
+ * pixmaps. Only the finished pixmaps cross over. The main thread
+ * pauses the worker, aborting the page it is on through its cookie,
+ * while it does work of its own, and hands it the new view when done.
+ */
+
+#define PREFETCH_CACHE 4
+#define PREFETCH_STORE (32 << 20)
+
+static const int prefetch_order[] = { 1, -1, 2 };
+
+typedef struct pdfapp_view_s pdfapp_view_t;
+typedef struct pdfapp_cached_s pdfapp_cached_t;
+
+struct pdfapp_view_s
 {
-	fz_device *mdev;
+	int pageno;
+	int resolution;
+	int rotate;
+	int grayscale;
+	int invert;
+};
+
+struct pdfapp_cached_s
+{
+	pdfapp_view_t view;
+	fz_pixmap *image; /* NULL if the page failed to render */
+	int used;
+};
+
+struct pdfapp_prefetch_s
+{
+	fz_context *ctx;
+	fz_document *doc;
+	char *filename;
+	char *password;
+	int pagecount;
+	fz_cookie cookie;
+
+	/* Shared with the worker, under the lock */
+	pdfapp_view_t want;
+	int paused;
+	int quit;
+	int clock;
+	pdfapp_cached_t cache[PREFETCH_CACHE];
+
+	/* The view app->image was drawn at; main thread only */
+	pdfapp_view_t shown;
+
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	HANDLE wake;
+	HANDLE thread;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t thread;
+#endif
+};
+
+#ifdef _WIN32
+
+static int prefetch_init(pdfapp_prefetch_t *p)
+{
+	/* Only the worker ever waits, so an auto-reset event will do */
+	p->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!p->wake)
+		return -1;
+	InitializeCriticalSection(&p->lock);
+	return 0;
+}
+
+static void prefetch_fin(pdfapp_prefetch_t *p)
+{
+	DeleteCriticalSection(&p->lock);
+	CloseHandle(p->wake);
+}
+
+static void prefetch_lock(pdfapp_prefetch_t *p)
+{
+	EnterCriticalSection(&p->lock);
+}
+
+static void prefetch_unlock(pdfapp_prefetch_t *p)
+{
+	LeaveCriticalSection(&p->lock);
+}
+
+static void prefetch_wait(pdfapp_prefetch_t *p)
+{
+	LeaveCriticalSection(&p->lock);
+	WaitForSingleObject(p->wake, INFINITE);
+	EnterCriticalSection(&p->lock);
+}
+
+static void prefetch_signal(pdfapp_prefetch_t *p)
+{
+	SetEvent(p->wake);
+}
+
+static DWORD WINAPI prefetch_thread(LPVOID arg);
+
+static int prefetch_spawn(pdfapp_prefetch_t *p)
+{
+	p->thread = CreateThread(NULL, 0, prefetch_thread, p, 0, NULL);
+	return p->thread ? 0 : -1;
+}
+
+static void prefetch_join(pdfapp_prefetch_t *p)
+{
+	WaitForSingleObject(p->thread, INFINITE);
+	CloseHandle(p->thread);
+}
+
+#else
+
+static int prefetch_init(pdfapp_prefetch_t *p)
+{
+	if (pthread_mutex_init(&p->lock, NULL))
+		return -1;
+	if (pthread_cond_init(&p->wake, NULL))
+	{
+		pthread_mutex_destroy(&p->lock);
+		return -1;
+	}
+	return 0;
+}
+
+static void prefetch_fin(pdfapp_prefetch_t *p)
+{
+	pthread_cond_destroy(&p->wake);
+	pthread_mutex_destroy(&p->lock);
+}
+
+static void prefetch_lock(pdfapp_prefetch_t *p)
+{
+	pthread_mutex_lock(&p->lock);
+}
+
+static void prefetch_unlock(pdfapp_prefetch_t *p)
+{
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void prefetch_wait(pdfapp_prefetch_t *p)
+{
+	pthread_cond_wait(&p->wake, &p->lock);
+}
+
+static void prefetch_signal(pdfapp_prefetch_t *p)
+{
+	pthread_cond_signal(&p->wake);
+}
+
+static void *prefetch_thread(void *arg);
+
+static int prefetch_spawn(pdfapp_prefetch_t *p)
+{
+	return pthread_create(&p->thread, NULL, prefetch_thread, p) ? -1 : 0;
+}
+
+static void prefetch_join(pdfapp_prefetch_t *p)
+{
+	pthread_join(p->thread, NULL);
+}
+
+#endif
+
+static int prefetch_sameview(pdfapp_view_t *a, pdfapp_view_t *b)
+{
+	return a->pageno == b->pageno && a->resolution == b->resolution &&
+		a->rotate == b->rotate && a->grayscale == b->grayscale &&
+		a->invert == b->invert;
+}
+
+static pdfapp_cached_t *prefetch_find(pdfapp_prefetch_t *p, pdfapp_view_t *view)
+{
+	int i;
+	for (i = 0; i < PREFETCH_CACHE; i++)
+		if (p->cache[i].view.pageno && prefetch_sameview(&p->cache[i].view, view))
+			return &p->cache[i];
+	return NULL;
+}
+
+/* Takes ownership of image. Called with the lock held. */
+static void prefetch_insert(fz_context *ctx, pdfapp_prefetch_t *p, pdfapp_view_t *view, fz_pixmap *image)
+{
+	pdfapp_cached_t *slot = prefetch_find(p, view);
+	int i;
+
+	if (!slot)
+	{
+		slot = &p->cache[0];
+		for (i = 1; i < PREFETCH_CACHE; i++)
+			if (p->cache[i].used < slot->used)
+				slot = &p->cache[i];
+	}
+	if (slot->image)
+		fz_drop_pixmap(ctx, slot->image);
+	slot->view = *view;
+	slot->image = image;
+	slot->used = ++p->clock;
+}
+
+static void prefetch_drop(fz_context *ctx, pdfapp_cached_t *slot)
+{
+	if (slot->image)
+		fz_drop_pixmap(ctx, slot->image);
+	memset(slot, 0, sizeof *slot);
+}
+
+/* Pick the nearest page around the one on screen that is not yet in
+ * the cache. Called with the lock held. */
+static int prefetch_pick(pdfapp_prefetch_t *p, pdfapp_view_t *view)
+{
+	int i;
+
+	if (p->paused || p->want.pageno == 0)
+		return 0;
+	for (i = 0; i < nelem(prefetch_order); i++)
+	{
+		*view = p->want;
+		view->pageno += prefetch_order[i];
+		if (view->pageno < 1 || view->pageno > p->pagecount)
+			continue;
+		if (!prefetch_find(p, view))
+			return 1;
+	}
+	return 0;
+}
+
+/* Runs on the worker thread, without the lock. */
+static fz_pixmap *prefetch_render(pdfapp_prefetch_t *p, pdfapp_view_t *view)
+{
+	fz_context *ctx = p->ctx;
+	fz_page *page = NULL;
+	fz_device *dev = NULL;
+	fz_pixmap *image = NULL;
+	fz_matrix ctm;
+	fz_bbox bbox;
+
+	fz_var(page);
+	fz_var(dev);
+	fz_var(image);
+
+	fz_try(ctx)
+	{
+		ctm = pdfapp_viewctm_at(view->resolution, view->rotate);
+		page = fz_load_page(p->doc, view->pageno - 1);
+		bbox = fz_round_rect(fz_transform_rect(ctm, fz_bound_page(p->doc, page)));
+		image = fz_new_pixmap_with_bbox(ctx, pdfapp_colorspace(view->grayscale), bbox);
+		fz_clear_pixmap_with_value(ctx, image, 255);
+		dev = fz_new_draw_device(ctx, image);
+		fz_run_page(p->doc, page, dev, ctm, &p->cookie);
+		if (view->invert)
+			fz_invert_pixmap(ctx, image);
+	}
+	fz_always(ctx)
+	{
+		fz_free_device(dev);
+		fz_free_page(p->doc, page);
+	}
+	fz_catch(ctx)
+	{
+		if (image)
+			fz_drop_pixmap(ctx, image);
+		image = NULL;
+	}
+	fz_flush_warnings(ctx);
+	return image;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI prefetch_thread(LPVOID arg)
+#else
+static void *prefetch_thread(void *arg)
+#endif
+{
+	pdfapp_prefetch_t *p = arg;
+	fz_context *ctx = p->ctx;
+	pdfapp_view_t view;
+	fz_pixmap *image;
+	int opened = 0;
+
+	fz_var(opened);
+
+	fz_try(ctx)
+	{
+		p->doc = fz_open_document(ctx, p->filename);
+		if (pdf_specifics(p->doc))
+			pdf_set_compile_contents(pdf_specifics(p->doc), 1);
+		if (fz_needs_password(p->doc) && !fz_authenticate_password(p->doc, p->password))
+			fz_throw(ctx, "cannot authenticate password");
+		opened = 1;
+	}
+	fz_catch(ctx)
+	{
+		/* Nothing gets rendered ahead, and that is all */
+	}
+
+	prefetch_lock(p);
+	if (!opened)
+		p->quit = 1;
+	while (!p->quit)
+	{
+		if (!prefetch_pick(p, &view))
+		{
+			prefetch_wait(p);
+			continue;
+		}
+		p->cookie.abort = 0;
+		prefetch_unlock(p);
+
+		image = prefetch_render(p, &view);
+
+		prefetch_lock(p);
+		/* An aborted page is incomplete; a failed one is remembered
+		 * so that it is not tried again. */
+		if (p->cookie.abort)
+		{
+			if (image)
+				fz_drop_pixmap(ctx, image);
+		}
+		else
+			prefetch_insert(ctx, p, &view, image);
+	}
+	prefetch_unlock(p);
+	return 0;
+}
+
+static void pdfapp_prefetch_start(pdfapp_t *app, char *filename, char *password)
+{
+	fz_context *ctx = app->ctx;
+	pdfapp_prefetch_t *p;
+
+	/* Without locks the context cannot be cloned; just don't prefetch */
+	p = fz_malloc_no_throw(ctx, sizeof *p);
+	if (!p)
+		return;
+	memset(p, 0, sizeof *p);
+	p->ctx = fz_clone_context_private(ctx, PREFETCH_STORE);
+	if (!p->ctx)
+	{
+		fz_free(ctx, p);
+		return;
+	}
+
+	fz_try(ctx)
+	{
+		p->filename = fz_strdup(ctx, filename);
+		p->password = fz_strdup(ctx, password);
+		p->pagecount = app->pagecount;
+		p->paused = 1;
+		if (prefetch_init(p))
+			fz_throw(ctx, "cannot create lock");
+		if (prefetch_spawn(p))
+		{
+			prefetch_fin(p);
+			fz_throw(ctx, "cannot create thread");
+		}
+		app->prefetch = p;
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, p->filename);
+		fz_free(ctx, p->password);
+		fz_free_context(p->ctx);
+		fz_free(ctx, p);
+	}
+}
+
+static void pdfapp_prefetch_stop(pdfapp_t *app)
+{
+	pdfapp_prefetch_t *p = app->prefetch;
+	int i;
+
+	if (!p)
+		return;
+
+	prefetch_lock(p);
+	p->quit = 1;
+	p->cookie.abort = 1;
+	prefetch_signal(p);
+	prefetch_unlock(p);
+	prefetch_join(p);
+	prefetch_fin(p);
+
+	for (i = 0; i < PREFETCH_CACHE; i++)
+		prefetch_drop(app->ctx, &p->cache[i]);
+	fz_close_document(p->doc);
+	fz_free_context(p->ctx);
+	fz_free(app->ctx, p->filename);
+	fz_free(app->ctx, p->password);
+	fz_free(app->ctx, p);
+	app->prefetch = NULL;
+}
+
+/* Get the worker out of the way while the main thread is busy. */
+static void pdfapp_prefetch_pause(pdfapp_t *app)
+{
+	pdfapp_prefetch_t *p = app->prefetch;
+	if (!p)
+		return;
+	prefetch_lock(p);
+	p->paused = 1;
+	p->cookie.abort = 1;
+	prefetch_unlock(p);
+}
+
+static void pdfapp_currentview(pdfapp_t *app, pdfapp_view_t *view)
+{
+	view->pageno = app->pageno;
+	view->resolution = app->resolution;
+	view->rotate = app->rotate;
+	view->grayscale = app->grayscale;
+	view->invert = app->invert;
+}
+
+/* Let the worker render around the page now on screen. */
+static void pdfapp_prefetch_resume(pdfapp_t *app)
+{
+	pdfapp_prefetch_t *p = app->prefetch;
+	if (!p)
+		return;
+	prefetch_lock(p);
+	pdfapp_currentview(app, &p->want);
+	p->paused = 0;
+	prefetch_signal(p);
+	prefetch_unlock(p);
+}
 
+/* Take the pixmap for the current view out of the cache, if there. */
+static fz_pixmap *pdfapp_prefetch_take(pdfapp_t *app)
+{
+	pdfapp_prefetch_t *p = app->prefetch;
+	pdfapp_cached_t *slot;
+	pdfapp_view_t view;
+	fz_pixmap *image = NULL;
+
+	if (!p)
+		return NULL;
+	pdfapp_currentview(app, &view);
+	prefetch_lock(p);
+	slot = prefetch_find(p, &view);
+	if (slot && slot->image)
+	{
+		image = slot->image;
+		slot->image = NULL;
+		prefetch_drop(app->ctx, slot);
+	}
+	prefetch_unlock(p);
+	return image;
+}
+
+/* Keep the pixmap going off screen, for flipping back to it. */
+static void pdfapp_prefetch_keep(pdfapp_t *app)
+{
+	pdfapp_prefetch_t *p = app->prefetch;
+	if (!p || !app->image || !p->shown.pageno)
+		return;
+	prefetch_lock(p);
+	prefetch_insert(app->ctx, p, &p->shown, fz_keep_pixmap(app->ctx, app->image));
+	prefetch_unlock(p);
+}
+
+static void pdfapp_freepage(pdfapp_t *app)
+{
 	if (app->page_list)
 		fz_free_display_list(app->ctx, app->page_list);
 	if (app->page_text)
@@ -245,6 +730,14 @@ static void pdfapp_loadpage(pdfapp_t *app)
 	app->page_sheet = NULL;
 	app->page_links = NULL;
 	app->page = NULL;
+}
+
+static void pdfapp_loadpage(pdfapp_t *app)
+{
+	fz_device *mdev;
+	fz_device *tdev;
+
+	pdfapp_freepage(app);
 
 	fz_try(app->ctx)
 	{
@@ -258,6 +751,13 @@ static void pdfapp_loadpage(pdfapp_t *app)
 
 		app->page_bbox = fz_bound_page(app->doc, app->page);
 		app->page_links = fz_load_links(app->doc, app->page);
+
+		/* Extract text */
+		app->page_sheet = fz_new_text_sheet(app->ctx);
+		app->page_text = fz_new_text_page(app->ctx, app->page_bbox);
+		tdev = fz_new_text_device(app->ctx, app->page_sheet, app->page_text);
+		fz_run_display_list(app->page_list, tdev, fz_identity, fz_infinite_bbox, NULL);
+		fz_free_device(tdev);
 	}
 	fz_catch(app->ctx)
 	{
@@ -265,33 +765,65 @@ static void pdfapp_loadpage(pdfapp_t *app)
 	}
 }
 
+/* A page shown straight from the prefetch cache is only loaded once
+ * something needs its contents. */
+static void pdfapp_needpage(pdfapp_t *app)
+{
+	if (!app->page_list)
+	{
+		pdfapp_prefetch_pause(app);
+		pdfapp_loadpage(app);
+		pdfapp_prefetch_resume(app);
+	}
+}
+
+/* Hovering and clicking only need the links, which are cheap to load
+ * without running the page. */
+static void pdfapp_needlinks(pdfapp_t *app)
+{
+	if (!app->page)
+	{
+		pdfapp_prefetch_pause(app);
+		fz_try(app->ctx)
+		{
+			app->page = fz_load_page(app->doc, app->pageno - 1);
+			app->page_bbox = fz_bound_page(app->doc, app->page);
+			app->page_links = fz_load_links(app->doc, app->page);
+		}
+		fz_catch(app->ctx)
+		{
+			pdfapp_warn(app, "cannot load links");
+		}
+		pdfapp_prefetch_resume(app);
+	}
+}
+
 #define MAX_TITLE 256
 
 static void pdfapp_showpage(pdfapp_t *app, int loadpage, int drawpage, int repaint)
 {
 	char buf[MAX_TITLE];
 	fz_device *idev;
-	fz_device *tdev;
-	fz_colorspace *colorspace;
+	fz_pixmap *image;
 	fz_matrix ctm;
 	fz_bbox bbox;
 
 	wincursor(app, WAIT);
 
+	pdfapp_prefetch_pause(app);
+
 	if (loadpage)
 	{
-		pdfapp_loadpage(app);
+		/* When drawing, the page may come from the prefetch cache,
+		 * in which case loading it is put off until it is needed. */
+		if (drawpage)
+			pdfapp_freepage(app);
+		else
+			pdfapp_loadpage(app);
 
 		/* Zero search hit position */
 		app->hit = -1;
 		app->hitlen = 0;
-
-		/* Extract text */
-		app->page_sheet = fz_new_text_sheet(app->ctx);
-		app->page_text = fz_new_text_page(app->ctx, app->page_bbox);
-		tdev = fz_new_text_device(app->ctx, app->page_sheet, app->page_text);
-		fz_run_display_list(app->page_list, tdev, fz_identity, fz_infinite_bbox, NULL);
-		fz_free_device(tdev);
 	}
 
 	if (drawpage)
@@ -312,27 +844,31 @@ static void pdfapp_showpage(pdfapp_t *app, int loadpage, int drawpage, int repai
 			sprintf(buf, "%s%s", app->doctitle, buf2);
 		wintitle(app, buf);
 
-		ctm = pdfapp_viewctm(app);
-		bbox = fz_round_rect(fz_transform_rect(ctm, app->page_bbox));
+		/* Draw, unless the worker already did */
+		image = pdfapp_prefetch_take(app);
+		if (!image)
+		{
+			if (!app->page_list)
+				pdfapp_loadpage(app);
+			ctm = pdfapp_viewctm(app);
+			bbox = fz_round_rect(fz_transform_rect(ctm, app->page_bbox));
+			image = fz_new_pixmap_with_bbox(app->ctx, pdfapp_colorspace(app->grayscale), bbox);
+			fz_clear_pixmap_with_value(app->ctx, image, 255);
+			idev = fz_new_draw_device(app->ctx, image);
+			fz_run_display_list(app->page_list, idev, ctm, bbox, NULL);
+			fz_free_device(idev);
+			if (app->invert)
+				fz_invert_pixmap(app->ctx, image);
+		}
 
-		/* Draw */
 		if (app->image)
+		{
+			pdfapp_prefetch_keep(app);
 			fz_drop_pixmap(app->ctx, app->image);
-		if (app->grayscale)
-			colorspace = fz_device_gray;
-		else
-#ifdef _WIN32
-			colorspace = fz_device_bgr;
-#else
-			colorspace = fz_device_rgb;
-#endif
-		app->image = fz_new_pixmap_with_bbox(app->ctx, colorspace, bbox);
-		fz_clear_pixmap_with_value(app->ctx, app->image, 255);
-		idev = fz_new_draw_device(app->ctx, app->image);
-		fz_run_display_list(app->page_list, idev, ctm, bbox, NULL);
-		fz_free_device(idev);
-		if (app->invert)
-			fz_invert_pixmap(app->ctx, app->image);
+		}
+		app->image = image;
+		if (app->prefetch)
+			pdfapp_currentview(app, &app->prefetch->shown);
 	}
 
 	if (repaint)
@@ -360,6 +896,8 @@ static void pdfapp_showpage(pdfapp_t *app, int loadpage, int drawpage, int repai
 		wincursor(app, ARROW);
 	}
 
+	pdfapp_prefetch_resume(app);
+
 	fz_flush_warnings(app->ctx);
 }
 
@@ -501,6 +1039,8 @@ static void pdfapp_searchforward(pdfapp_t *app, enum panning *panto)
 
 	wincursor(app, WAIT);
 
+	pdfapp_needpage(app);
+
 	startpage = app->pageno;
 
 	do
@@ -550,6 +1090,8 @@ static void pdfapp_searchbackward(pdfapp_t *app, enum panning *panto)
 
 	wincursor(app, WAIT);
 
+	pdfapp_needpage(app);
+
 	startpage = app->pageno;
 
 	do
@@ -956,6 +1498,8 @@ void pdfapp_onmouse(pdfapp_t *app, int x, int y, int btn, int modifiers, int sta
 	fz_matrix ctm;
 	fz_point p;
 
+	pdfapp_needlinks(app);
+
 	p.x = x - app->panx + rect.x0;
 	p.y = y - app->pany + rect.y0;
 
@@ -1125,7 +1669,7 @@ void pdfapp_oncopy(pdfapp_t *app, unsigned short *ucsbuf, int ucslen)
 {
 	fz_bbox hitbox;
 	fz_matrix ctm;
-	fz_text_page *page = app->page_text;
+	fz_text_page *page;
 	fz_text_block *block;
 	fz_text_line *line;
 	fz_text_span *span;
@@ -1137,6 +1681,9 @@ void pdfapp_oncopy(pdfapp_t *app, unsigned short *ucsbuf, int ucslen)
 	int y0 = app->selr.y0;
 	int y1 = app->selr.y1;
 
+	pdfapp_needpage(app);
+	page = app->page_text;
+
 	ctm = pdfapp_viewctm(app);
 
 	p = 0;
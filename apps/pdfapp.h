@@ -13,6 +13,7 @@
 #define MAXRES 300
 
 typedef struct pdfapp_s pdfapp_t;
+typedef struct pdfapp_prefetch_s pdfapp_prefetch_t;
 
 enum { ARROW, HAND, WAIT };
 
@@ -57,6 +58,9 @@ struct pdfapp_s
 	fz_text_sheet *page_sheet;
 	fz_link *page_links;
 
+	/* pages rendered ahead in the background */
+	pdfapp_prefetch_t *prefetch;
+
 	/* snapback history */
 	int hist[256];
 	int histlen;
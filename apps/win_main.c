@@ -22,6 +22,21 @@
 #define ID_ABOUT	0x1000
 #define ID_DOCINFO	0x1001
 
+/* pdfapp renders pages ahead on a second thread, which needs locks */
+static CRITICAL_SECTION fz_mutex[FZ_LOCK_MAX];
+
+static void winlock(void *user, int lock)
+{
+	EnterCriticalSection(&fz_mutex[lock]);
+}
+
+static void winunlock(void *user, int lock)
+{
+	LeaveCriticalSection(&fz_mutex[lock]);
+}
+
+static fz_locks_context winlocks = { NULL, winlock, winunlock };
+
 static HWND hwndframe = NULL;
 static HWND hwndview = NULL;
 static HDC hdc;
@@ -828,9 +843,13 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShow
 	char argv0[256];
 	MSG msg;
 	int code;
+	int i;
 	fz_context *ctx;
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		InitializeCriticalSection(&fz_mutex[i]);
+
+	ctx = fz_new_context(NULL, &winlocks, FZ_STORE_DEFAULT);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
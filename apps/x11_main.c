@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 
 #define mupdf_icon_bitmap_16_width 16
 #define mupdf_icon_bitmap_16_height 16
@@ -93,6 +94,21 @@ static int closing = 0;
 static int reloading = 0;
 static int showingpage = 0;
 
+/* pdfapp renders pages ahead on a second thread, which needs locks */
+static pthread_mutex_t fz_mutex[FZ_LOCK_MAX];
+
+static void winlock(void *user, int lock)
+{
+	pthread_mutex_lock(&fz_mutex[lock]);
+}
+
+static void winunlock(void *user, int lock)
+{
+	pthread_mutex_unlock(&fz_mutex[lock]);
+}
+
+static fz_locks_context winlocks = { NULL, winlock, winunlock };
+
 /*
  * Dialog boxes
  */
@@ -614,7 +630,10 @@ int main(int argc, char **argv)
 	struct timeval tmo;
 	struct timeval *timeout;
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	for (c = 0; c < FZ_LOCK_MAX; c++)
+		pthread_mutex_init(&fz_mutex[c], NULL);
+
+	ctx = fz_new_context(NULL, &winlocks, FZ_STORE_DEFAULT);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
@@ -1,14 +1,8 @@
 #include "fitz-internal.h"
 #include "mucbz.h"
 
-#include <zlib.h>
-
 #include <ctype.h> /* for tolower */
 
-#define ZIP_LOCAL_FILE_SIG 0x04034b50
-#define ZIP_CENTRAL_DIRECTORY_SIG 0x02014b50
-#define ZIP_END_OF_CENTRAL_DIRECTORY_SIG 0x06054b50
-
 #define DPI 72.0f
 
 static void cbz_init_document(cbz_document *doc);
@@ -25,7 +19,17 @@ struct cbz_image_s
 {
 	fz_image base;
 	int xres, yres;
-	fz_pixmap *pix;
+	int is_jpeg;
+	fz_buffer *buffer; /* undecoded image file */
+};
+
+typedef struct cbz_image_key_s cbz_image_key;
+
+struct cbz_image_key_s
+{
+	int refs;
+	fz_image *image;
+	int factor;
 };
 
 struct cbz_page_s
@@ -38,7 +42,7 @@ typedef struct cbz_entry_s cbz_entry;
 struct cbz_entry_s
 {
 	char *name;
-	int offset;
+	int index;
 };
 
 struct cbz_document_s
@@ -46,133 +50,11 @@ struct cbz_document_s
 	fz_document super;
 
 	fz_context *ctx;
-	fz_stream *file;
-	int entry_count;
-	cbz_entry *entry;
+	fz_zip_archive *zip;
 	int page_count;
-	int *page;
+	cbz_entry *page;
 };
 
-static inline int getshort(fz_stream *file)
-{
-	int a = fz_read_byte(file);
-	int b = fz_read_byte(file);
-	return a | b << 8;
-}
-
-static inline int getlong(fz_stream *file)
-{
-	int a = fz_read_byte(file);
-	int b = fz_read_byte(file);
-	int c = fz_read_byte(file);
-	int d = fz_read_byte(file);
-	return a | b << 8 | c << 16 | d << 24;
-}
-
-static void *
-cbz_zip_alloc_items(void *ctx, unsigned int items, unsigned int size)
-{
-	return fz_malloc_array(ctx, items, size);
-}
-
-static void
-cbz_zip_free(void *ctx, void *ptr)
-{
-	fz_free(ctx, ptr);
-}
-
-static unsigned char *
-cbz_read_zip_entry(cbz_document *doc, int offset, int *sizep)
-{
-	fz_context *ctx = doc->ctx;
-	fz_stream *file = doc->file;
-	int sig, method, namelength, extralength;
-	unsigned long csize, usize;
-	unsigned char *cdata;
-	int code;
-
-	fz_seek(file, offset, 0);
-
-	sig = getlong(doc->file);
-	if (sig != ZIP_LOCAL_FILE_SIG)
-		fz_throw(ctx, "wrong zip local file signature (0x%x)", sig);
-
-	(void) getshort(doc->file); /* version */
-	(void) getshort(doc->file); /* general */
-	method = getshort(doc->file);
-	(void) getshort(doc->file); /* file time */
-	(void) getshort(doc->file); /* file date */
-	(void) getlong(doc->file); /* crc-32 */
-	csize = getlong(doc->file); /* csize */
-	usize = getlong(doc->file); /* usize */
-	namelength = getshort(doc->file);
-	extralength = getshort(doc->file);
-
-	fz_seek(file, namelength + extralength, 1);
-
-	cdata = fz_malloc(ctx, csize);
-	fz_try(ctx)
-	{
-		fz_read(file, cdata, csize);
-	}
-	fz_catch(ctx)
-	{
-		fz_free(ctx, cdata);
-		fz_rethrow(ctx);
-	}
-
-	if (method == 0)
-	{
-		*sizep = usize;
-		return cdata;
-	}
-
-	if (method == 8)
-	{
-		unsigned char *udata = fz_malloc(ctx, usize);
-		z_stream stream;
-
-		memset(&stream, 0, sizeof stream);
-		stream.zalloc = cbz_zip_alloc_items;
-		stream.zfree = cbz_zip_free;
-		stream.opaque = ctx;
-		stream.next_in = cdata;
-		stream.avail_in = csize;
-		stream.next_out = udata;
-		stream.avail_out = usize;
-
-		fz_try(ctx)
-		{
-			code = inflateInit2(&stream, -15);
-			if (code != Z_OK)
-				fz_throw(ctx, "zlib inflateInit2 error: %s", stream.msg);
-			code = inflate(&stream, Z_FINISH);
-			if (code != Z_STREAM_END) {
-				inflateEnd(&stream);
-				fz_throw(ctx, "zlib inflate error: %s", stream.msg);
-			}
-			code = inflateEnd(&stream);
-			if (code != Z_OK)
-				fz_throw(ctx, "zlib inflateEnd error: %s", stream.msg);
-		}
-		fz_always(ctx)
-		{
-			fz_free(ctx, cdata);
-		}
-		fz_catch(ctx)
-		{
-			fz_free(ctx, udata);
-			fz_rethrow(ctx);
-		}
-
-		*sizep = usize;
-		return udata;
-	}
-
-	fz_throw(ctx, "unknown zip method: %d", method);
-	return NULL; /* not reached */
-}
-
 static int
 cbz_compare_entries(const void *a_, const void *b_)
 {
@@ -182,106 +64,32 @@ cbz_compare_entries(const void *a_, const void *b_)
 }
 
 static void
-cbz_read_zip_dir_imp(cbz_document *doc, int startoffset)
+cbz_read_page_list(cbz_document *doc)
 {
 	fz_context *ctx = doc->ctx;
-	fz_stream *file = doc->file;
-	int sig, offset, count;
-	int namesize, metasize, commentsize;
+	int count = fz_count_zip_entries(doc->zip);
+	char *name;
 	int i, k;
 
-	fz_seek(file, startoffset, 0);
-
-	sig = getlong(file);
-	if (sig != ZIP_END_OF_CENTRAL_DIRECTORY_SIG)
-		fz_throw(ctx, "wrong zip end of central directory signature (0x%x)", sig);
-
-	(void) getshort(file); /* this disk */
-	(void) getshort(file); /* start disk */
-	(void) getshort(file); /* entries in this disk */
-	count = getshort(file); /* entries in central directory disk */
-	(void) getlong(file); /* size of central directory */
-	offset = getlong(file); /* offset to central directory */
-
-	doc->entry = fz_calloc(ctx, count, sizeof(cbz_entry));
-	doc->entry_count = count;
-
-	fz_seek(file, offset, 0);
-
-	for (i = 0; i < count; i++)
-	{
-		cbz_entry *entry = doc->entry + i;
-
-		sig = getlong(doc->file);
-		if (sig != ZIP_CENTRAL_DIRECTORY_SIG)
-			fz_throw(doc->ctx, "wrong zip central directory signature (0x%x)", sig);
-
-		(void) getshort(file); /* version made by */
-		(void) getshort(file); /* version to extract */
-		(void) getshort(file); /* general */
-		(void) getshort(file); /* method */
-		(void) getshort(file); /* last mod file time */
-		(void) getshort(file); /* last mod file date */
-		(void) getlong(file); /* crc-32 */
-		(void) getlong(file); /* csize */
-		(void) getlong(file); /* usize */
-		namesize = getshort(file);
-		metasize = getshort(file);
-		commentsize = getshort(file);
-		(void) getshort(file); /* disk number start */
-		(void) getshort(file); /* int file atts */
-		(void) getlong(file); /* ext file atts */
-		entry->offset = getlong(file);
-
-		entry->name = fz_malloc(ctx, namesize + 1);
-		fz_read(file, (unsigned char *)entry->name, namesize);
-		entry->name[namesize] = 0;
-
-		fz_seek(file, metasize, 1);
-		fz_seek(file, commentsize, 1);
-	}
-
-	qsort(doc->entry, count, sizeof(cbz_entry), cbz_compare_entries);
-
 	doc->page_count = 0;
-	doc->page = fz_malloc_array(ctx, count, sizeof(int));
+	doc->page = fz_malloc_array(ctx, count, sizeof(cbz_entry));
 
 	for (i = 0; i < count; i++)
-		for (k = 0; cbz_ext_list[k]; k++)
-			if (strstr(doc->entry[i].name, cbz_ext_list[k]))
-				doc->page[doc->page_count++] = i;
-}
-
-static void
-cbz_read_zip_dir(cbz_document *doc)
-{
-	fz_stream *file = doc->file;
-	unsigned char buf[512];
-	int filesize, back, maxback;
-	int i, n;
-
-	fz_seek(file, 0, 2);
-	filesize = fz_tell(file);
-
-	maxback = MIN(filesize, 0xFFFF + sizeof buf);
-	back = MIN(maxback, sizeof buf);
-
-	while (back < maxback)
 	{
-		fz_seek(file, filesize - back, 0);
-		n = fz_read(file, buf, sizeof buf);
-		for (i = n - 4; i > 0; i--)
+		name = fz_zip_entry_name(doc->zip, i);
+		for (k = 0; cbz_ext_list[k]; k++)
 		{
-			if (!memcmp(buf + i, "PK\5\6", 4))
+			if (strstr(name, cbz_ext_list[k]))
 			{
-				cbz_read_zip_dir_imp(doc, filesize - back + i);
-				return;
+				doc->page[doc->page_count].name = name;
+				doc->page[doc->page_count].index = i;
+				doc->page_count++;
+				break;
 			}
 		}
-		back += sizeof buf - 4;
 	}
 
-	fz_throw(doc->ctx, "cannot find end of central directory");
+	qsort(doc->page, doc->page_count, sizeof(cbz_entry), cbz_compare_entries);
 }
 
 cbz_document *
@@ -293,15 +101,14 @@ cbz_open_document_with_stream(fz_stream *file)
 	doc = fz_malloc_struct(ctx, cbz_document);
 	cbz_init_document(doc);
 	doc->ctx = ctx;
-	doc->file = fz_keep_stream(file);
-	doc->entry_count = 0;
-	doc->entry = NULL;
+	doc->zip = NULL;
 	doc->page_count = 0;
 	doc->page = NULL;
 
 	fz_try(ctx)
 	{
-		cbz_read_zip_dir(doc);
+		doc->zip = fz_open_zip_archive(ctx, file);
+		cbz_read_page_list(doc);
 	}
 	fz_catch(ctx)
 	{
@@ -336,13 +143,9 @@ cbz_open_document(fz_context *ctx, char *filename)
 void
 cbz_close_document(cbz_document *doc)
 {
-	int i;
 	fz_context *ctx = doc->ctx;
-	for (i = 0; i < doc->entry_count; i++)
-		fz_free(ctx, doc->entry[i].name);
-	fz_free(ctx, doc->entry);
 	fz_free(ctx, doc->page);
-	fz_close(doc->file);
+	fz_close_zip_archive(ctx, doc->zip);
 	fz_free(ctx, doc);
 }
 
@@ -352,6 +155,70 @@ cbz_count_pages(cbz_document *doc)
 	return doc->page_count;
 }
 
+static int
+cbz_make_hash_image_key(fz_store_hash *hash, void *key_)
+{
+	cbz_image_key *key = (cbz_image_key *)key_;
+
+	hash->u.pi.ptr = key->image;
+	hash->u.pi.i = key->factor;
+	return 1;
+}
+
+static void *
+cbz_keep_image_key(fz_context *ctx, void *key_)
+{
+	cbz_image_key *key = (cbz_image_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+cbz_drop_image_key(fz_context *ctx, void *key_)
+{
+	cbz_image_key *key = (cbz_image_key *)key_;
+	int drop;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+	{
+		fz_drop_image(ctx, key->image);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+cbz_cmp_image_key(void *k0_, void *k1_)
+{
+	cbz_image_key *k0 = (cbz_image_key *)k0_;
+	cbz_image_key *k1 = (cbz_image_key *)k1_;
+
+	return k0->image != k1->image || k0->factor != k1->factor;
+}
+
+static void
+cbz_debug_image(void *key_)
+{
+	cbz_image_key *key = (cbz_image_key *)key_;
+
+	printf("(cbz image %d x %d sf=%d) ", key->image->w, key->image->h, key->factor);
+}
+
+static fz_store_type cbz_image_store_type =
+{
+	cbz_make_hash_image_key,
+	cbz_keep_image_key,
+	cbz_drop_image_key,
+	cbz_cmp_image_key,
+	cbz_debug_image
+};
+
 static void
 cbz_free_image(fz_context *ctx, fz_storable *image_)
 {
@@ -359,65 +226,151 @@ cbz_free_image(fz_context *ctx, fz_storable *image_)
 
 	if (image == NULL)
 		return;
-	fz_drop_pixmap(ctx, image->pix);
+	fz_drop_buffer(ctx, image->buffer);
+	fz_drop_colorspace(ctx, image->base.colorspace);
 	fz_free(ctx, image);
 }
 
 static fz_pixmap *
-cbz_image_to_pixmap(fz_context *ctx, fz_image *image_, int x, int w)
+cbz_image_to_pixmap(fz_context *ctx, fz_image *image_, int w, int h)
 {
 	cbz_image *image = (cbz_image *)image_;
+	fz_pixmap *tile, *existing_tile;
+	cbz_image_key key, *keyp = NULL;
+	int factor;
+
+	/* Ensure our expectations for tile size are reasonable */
+	if (w > image->base.w)
+		w = image->base.w;
+	if (h > image->base.h)
+		h = image->base.h;
+
+	/* What is our ideal factor? */
+	if (w == 0 || h == 0)
+		factor = 1;
+	else
+		for (factor=1; image->base.w/(2*factor) >= w && image->base.h/(2*factor) >= h && factor < 8; factor *= 2);
+
+	/* Can we find any suitable tiles in the cache? */
+	key.refs = 1;
+	key.image = &image->base;
+	key.factor = factor;
+	do
+	{
+		tile = fz_find_item(ctx, fz_free_pixmap_imp, &key, &cbz_image_store_type);
+		if (tile)
+			return tile;
+		key.factor >>= 1;
+	}
+	while (key.factor > 0);
+
+	/* We need to make a new one. JPEGs subsample in the IDCT; PNGs have
+	 * to be decoded in full, but only the reduced copy is kept. */
+	if (image->is_jpeg)
+		tile = fz_load_jpeg_scaled(ctx, image->buffer->data, image->buffer->len, factor);
+	else
+	{
+		tile = fz_load_png(ctx, image->buffer->data, image->buffer->len);
+		fz_subsample_pixmap(ctx, tile, factor);
+	}
 
-	return fz_keep_pixmap(ctx, image->pix);
+	/* Now we try to cache the pixmap. Any failure here will just result
+	 * in us not caching. */
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, cbz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image(ctx, &image->base);
+		keyp->factor = factor;
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &cbz_image_store_type);
+		if (existing_tile)
+		{
+			/* We already have a tile. This must have been produced by a
+			 * racing thread. We'll throw away ours and use that one. */
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			cbz_drop_image_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return tile;
 }
 
+static cbz_image *
+cbz_load_image(fz_context *ctx, fz_buffer *buf)
+{
+	cbz_image *image;
+	fz_colorspace *colorspace;
+	int w, h, xres, yres, is_jpeg = 0;
+
+	if (buf->len >= 2 && buf->data[0] == 0xff && buf->data[1] == 0xd8)
+	{
+		fz_load_jpeg_info(ctx, buf->data, buf->len, &w, &h, &xres, &yres, &colorspace);
+		is_jpeg = 1;
+	}
+	else if (buf->len >= 8 && memcmp(buf->data, "\211PNG\r\n\032\n", 8) == 0)
+	{
+		fz_load_png_info(ctx, buf->data, buf->len, &w, &h, &xres, &yres, &colorspace);
+	}
+	else
+		fz_throw(ctx, "unknown image format");
+
+	image = fz_malloc_struct(ctx, cbz_image);
+	FZ_INIT_STORABLE(&image->base, 1, cbz_free_image);
+	image->base.w = w;
+	image->base.h = h;
+	image->base.colorspace = fz_keep_colorspace(ctx, colorspace);
+	image->base.get_pixmap = cbz_image_to_pixmap;
+	image->xres = xres;
+	image->yres = yres;
+	image->is_jpeg = is_jpeg;
+	image->buffer = fz_keep_buffer(ctx, buf);
+
+	return image;
+}
 
 cbz_page *
 cbz_load_page(cbz_document *doc, int number)
 {
 	fz_context *ctx = doc->ctx;
-	unsigned char *data = NULL;
+	fz_buffer *buf = NULL;
 	cbz_page *page = NULL;
-	cbz_image *image = NULL;
-	fz_pixmap *pixmap = NULL;
 	int size;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
-	number = doc->page[number];
+	number = doc->page[number].index;
 
-	fz_var(data);
+	fz_var(buf);
 	fz_var(page);
-	fz_var(image);
-	fz_var(pixmap);
 	fz_try(ctx)
 	{
 		page = fz_malloc_struct(ctx, cbz_page);
 		page->image = NULL;
 
-		data = cbz_read_zip_entry(doc, doc->entry[number].offset, &size);
-
-		if (data[0] == 0xff && data[1] == 0xd8)
-			pixmap = fz_load_jpeg(ctx, data, size);
-		else if (memcmp(data, "\211PNG\r\n\032\n", 8) == 0)
-			pixmap = fz_load_png(ctx, data, size);
-		else
-			fz_throw(ctx, "unknown image format");
-
-		image = fz_malloc_struct(ctx, cbz_image);
-		FZ_INIT_STORABLE(&image->base, 1, cbz_free_image);
-		image->base.w = pixmap->w;
-		image->base.h = pixmap->h;
-		image->base.get_pixmap = cbz_image_to_pixmap;
-		image->xres = pixmap->xres;
-		image->yres = pixmap->yres;
-		image->pix = pixmap;
-		page->image = image;
+		/* Only the compressed image file is kept with the page; it is
+		 * decoded on demand at the resolution it is drawn at. */
+		size = fz_zip_entry_size(doc->zip, number);
+		buf = fz_new_buffer(ctx, size);
+		buf->len = fz_read_zip_entry(ctx, doc->zip, number, buf->data, size);
+		if (buf->len != size)
+			fz_throw(ctx, "truncated zip entry '%s'", fz_zip_entry_name(doc->zip, number));
+
+		page->image = cbz_load_image(ctx, buf);
 	}
 	fz_always(ctx)
 	{
-		fz_free(ctx, data);
+		fz_drop_buffer(ctx, buf);
 	}
 	fz_catch(ctx)
 	{
@@ -518,6 +471,7 @@ cbz_init_document(cbz_document *doc)
 	doc->super.load_links = NULL;
 	doc->super.bound_page = cbz_bound_page_shim;
 	doc->super.run_page = cbz_run_page_shim;
+	doc->super.load_thumbnail = NULL;
 	doc->super.free_page = cbz_free_page_shim;
 	doc->super.meta = cbz_meta;
 }
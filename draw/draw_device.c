@@ -5,6 +5,11 @@
 #define VSUBPIX 5.0
 
 #define STACK_SIZE 96
+#define POOL_SIZE 16
+
+/* In draft mode, shadings and soft masks that cover fewer device pixels
+ * than this are skipped. */
+#define DRAFT_MIN_AREA 64
 
 /* Enable the following to attempt to support knockout and/or isolated
  * blending groups. */
@@ -17,9 +22,17 @@ typedef struct fz_draw_device_s fz_draw_device;
 
 enum {
 	FZ_DRAWDEV_FLAGS_TYPE3 = 1,
+	FZ_DRAWDEV_FLAGS_DRAFT = 2,
 };
 
 typedef struct fz_draw_state_s fz_draw_state;
+typedef struct fz_draw_buffer_s fz_draw_buffer;
+
+struct fz_draw_buffer_s {
+	unsigned char *samples;
+	unsigned int size;
+	fz_pixmap *pixmap;
+};
 
 struct fz_draw_state_s {
 	fz_bbox scissor;
@@ -32,6 +45,7 @@ struct fz_draw_state_s {
 	fz_matrix ctm;
 	float xstep, ystep;
 	fz_rect area;
+	fz_bbox draft_mask; /* bounds of a soft mask skipped in draft mode */
 };
 
 struct fz_draw_device_s
@@ -42,6 +56,12 @@ struct fz_draw_device_s
 	int top;
 	fz_draw_state *stack;
 	int stack_max;
+	fz_scale_cache *cache_x;
+	fz_scale_cache *cache_y;
+	int pool_len;
+	fz_draw_buffer pool[POOL_SIZE];
+	int lent_len, lent_max;
+	fz_draw_buffer *lent;
 	fz_draw_state init_stack[STACK_SIZE];
 };
 
@@ -107,6 +127,126 @@ push_stack(fz_draw_device *dev)
 	return state;
 }
 
+/*
+ * The clip, group, mask and tile buffers are taken from a small pool of
+ * sample buffers kept by the device, rather than being malloced and freed
+ * for every push and pop. Requests are rounded up to a size class (an
+ * eighth of a power of two), and a free buffer is only reused for a
+ * request of at least half its size. Pixmaps made here do not own their
+ * samples; fz_draw_drop_pixmap hands the samples back to the pool.
+ */
+
+static unsigned int
+fz_draw_buffer_class(unsigned int size)
+{
+	unsigned int step = 512;
+
+	while (step < (size >> 3))
+		step <<= 1;
+	return (size + step - 1) & ~(step - 1);
+}
+
+static void
+fz_draw_empty_pool(fz_draw_device *dev)
+{
+	while (dev->pool_len > 0)
+		fz_free(dev->ctx, dev->pool[--dev->pool_len].samples);
+}
+
+static fz_pixmap *
+fz_draw_new_pixmap(fz_draw_device *dev, fz_colorspace *colorspace, fz_bbox bbox)
+{
+	fz_context *ctx = dev->ctx;
+	int n = colorspace ? colorspace->n + 1 : 1;
+	int w = bbox.x1 - bbox.x0;
+	int h = bbox.y1 - bbox.y0;
+	unsigned int size;
+	fz_draw_buffer buf;
+	int i, best = -1;
+
+	if (w <= 0 || h <= 0 || w > INT_MAX / n || h > INT_MAX / (w * n))
+		return fz_new_pixmap_with_bbox(ctx, colorspace, bbox);
+	size = (unsigned int)w * h * n;
+
+	for (i = 0; i < dev->pool_len; i++)
+		if (dev->pool[i].size >= size && dev->pool[i].size / 2 <= size)
+			if (best < 0 || dev->pool[i].size < dev->pool[best].size)
+				best = i;
+
+	if (best >= 0)
+	{
+		buf = dev->pool[best];
+		dev->pool[best] = dev->pool[--dev->pool_len];
+	}
+	else
+	{
+		buf.size = fz_draw_buffer_class(size);
+		buf.samples = fz_malloc_no_throw(ctx, buf.size);
+		if (!buf.samples)
+		{
+			fz_draw_empty_pool(dev);
+			buf.samples = fz_malloc(ctx, buf.size);
+		}
+	}
+
+	fz_try(ctx)
+	{
+		if (dev->lent_len == dev->lent_max)
+		{
+			int max = dev->lent_max ? dev->lent_max * 2 : 16;
+			dev->lent = fz_resize_array(ctx, dev->lent, max, sizeof(fz_draw_buffer));
+			dev->lent_max = max;
+		}
+		buf.pixmap = fz_new_pixmap_with_bbox_and_data(ctx, colorspace, bbox, buf.samples);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, buf.samples);
+		fz_rethrow(ctx);
+	}
+	dev->lent[dev->lent_len++] = buf;
+
+	return buf.pixmap;
+}
+
+static void
+fz_draw_drop_pixmap(fz_draw_device *dev, fz_pixmap *pix)
+{
+	fz_context *ctx = dev->ctx;
+	fz_draw_buffer buf;
+	int i;
+
+	if (!pix)
+		return;
+
+	for (i = dev->lent_len - 1; i >= 0; i--)
+		if (dev->lent[i].pixmap == pix)
+			break;
+	if (i < 0)
+	{
+		fz_drop_pixmap(ctx, pix);
+		return;
+	}
+	buf = dev->lent[i];
+	dev->lent[i] = dev->lent[--dev->lent_len];
+
+	/* If someone else still holds the pixmap, it keeps the samples */
+	if (pix->storable.refs > 1)
+	{
+		pix->free_samples = 1;
+		fz_drop_pixmap(ctx, pix);
+		return;
+	}
+	fz_drop_pixmap(ctx, pix);
+
+	if (dev->pool_len == POOL_SIZE)
+	{
+		fz_free(ctx, dev->pool[0].samples);
+		dev->pool[0] = dev->pool[--dev->pool_len];
+	}
+	dev->pool[dev->pool_len++] = buf;
+}
+
 static fz_draw_state *
 fz_knockout_begin(fz_draw_device *dev)
 {
@@ -123,7 +263,7 @@ fz_knockout_begin(fz_draw_device *dev)
 
 	bbox = fz_pixmap_bbox(dev->ctx, state->dest);
 	bbox = fz_intersect_bbox(bbox, state->scissor);
-	dest = fz_new_pixmap_with_bbox(dev->ctx, state->dest->colorspace, bbox);
+	dest = fz_draw_new_pixmap(dev, state->dest->colorspace, bbox);
 
 	if (isolated)
 	{
@@ -154,7 +294,7 @@ fz_knockout_begin(fz_draw_device *dev)
 	}
 	else
 	{
-		shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		shape = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
@@ -206,12 +346,12 @@ static void fz_knockout_end(fz_draw_device *dev)
 	else
 		fz_blend_pixmap(state[0].dest, state[1].dest, 255, blendmode, isolated, state[1].shape);
 
-	fz_drop_pixmap(dev->ctx, state[1].dest);
+	fz_draw_drop_pixmap(dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, 255);
-		fz_drop_pixmap(dev->ctx, state[1].shape);
+		fz_draw_drop_pixmap(dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(dev->ctx, state[0].dest, " to get ");
@@ -334,17 +474,33 @@ fz_draw_clip_path(fz_device *devp, fz_path *path, fz_rect *rect, int even_odd, f
 	fz_bbox bbox;
 	fz_draw_state *state = push_stack(dev);
 	fz_colorspace *model = state->dest->colorspace;
+	fz_rect r;
+	int is_rect;
 
 	fz_reset_gel(dev->gel, state->scissor);
-	fz_flatten_fill_path(dev->gel, path, ctm, flatness);
-	fz_sort_gel(dev->gel);
+	is_rect = fz_is_rect_path(path, ctm, &r);
+	if (is_rect)
+	{
+		/* Only the sides matter; this gives the same bbox as
+		 * flattening the whole path would. */
+		fz_insert_gel(dev->gel, r.x0, r.y0, r.x0, r.y1);
+		fz_insert_gel(dev->gel, r.x1, r.y1, r.x1, r.y0);
+	}
+	else
+	{
+		fz_flatten_fill_path(dev->gel, path, ctm, flatness);
+		fz_sort_gel(dev->gel);
+		is_rect = fz_is_rect_gel(dev->gel);
+	}
 
 	bbox = fz_bound_gel(dev->gel);
 	bbox = fz_intersect_bbox(bbox, state->scissor);
 	if (rect)
 		bbox = fz_intersect_bbox(bbox, fz_bbox_covering_rect(*rect));
 
-	if (fz_is_empty_rect(bbox) || fz_is_rect_gel(dev->gel))
+	/* A rectangle just narrows the scissor; no mask is needed, and
+	 * there is nothing to composite when the clip is popped. */
+	if (fz_is_empty_rect(bbox) || is_rect)
 	{
 		state[1].scissor = bbox;
 		state[1].mask = NULL;
@@ -354,13 +510,13 @@ fz_draw_clip_path(fz_device *devp, fz_path *path, fz_rect *rect, int even_odd, f
 		return;
 	}
 
-	state[1].mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+	state[1].mask = fz_draw_new_pixmap(dev, NULL, bbox);
 	fz_clear_pixmap(dev->ctx, state[1].mask);
-	state[1].dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+	state[1].dest = fz_draw_new_pixmap(dev, model, bbox);
 	fz_clear_pixmap(dev->ctx, state[1].dest);
 	if (state[1].shape)
 	{
-		state[1].shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		state[1].shape = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, state[1].shape);
 	}
 
@@ -399,13 +555,13 @@ fz_draw_clip_stroke_path(fz_device *devp, fz_path *path, fz_rect *rect, fz_strok
 	if (rect)
 		bbox = fz_intersect_bbox(bbox, fz_bbox_covering_rect(*rect));
 
-	state[1].mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+	state[1].mask = fz_draw_new_pixmap(dev, NULL, bbox);
 	fz_clear_pixmap(dev->ctx, state[1].mask);
-	state[1].dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+	state[1].dest = fz_draw_new_pixmap(dev, model, bbox);
 	fz_clear_pixmap(dev->ctx, state[1].dest);
 	if (state->shape)
 	{
-		state[1].shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		state[1].shape = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, state[1].shape);
 	}
 
@@ -600,13 +756,13 @@ fz_draw_clip_text(fz_device *devp, fz_text *text, fz_matrix ctm, int accumulate)
 
 	if (accumulate == 0 || accumulate == 1)
 	{
-		mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		mask = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, mask);
-		dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+		dest = fz_draw_new_pixmap(dev, model, bbox);
 		fz_clear_pixmap(dev->ctx, dest);
 		if (state->shape)
 		{
-			shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+			shape = fz_draw_new_pixmap(dev, NULL, bbox);
 			fz_clear_pixmap(dev->ctx, shape);
 		}
 		else
@@ -673,13 +829,13 @@ fz_draw_clip_stroke_text(fz_device *devp, fz_text *text, fz_stroke_state *stroke
 	bbox = fz_bbox_covering_rect(fz_bound_text(dev->ctx, text, ctm));
 	bbox = fz_intersect_bbox(bbox, state->scissor);
 
-	mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+	mask = fz_draw_new_pixmap(dev, NULL, bbox);
 	fz_clear_pixmap(dev->ctx, mask);
-	dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+	dest = fz_draw_new_pixmap(dev, model, bbox);
 	fz_clear_pixmap(dev->ctx, dest);
 	if (state->shape)
 	{
-		shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		shape = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, shape);
 	}
 	else
@@ -748,6 +904,9 @@ fz_draw_fill_shade(fz_device *devp, fz_shade *shade, fz_matrix ctm, float alpha)
 	if (fz_is_empty_rect(bbox))
 		return;
 
+	if ((dev->flags & FZ_DRAWDEV_FLAGS_DRAFT) && (bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0) < DRAFT_MIN_AREA)
+		return;
+
 	if (!model)
 	{
 		fz_warn(dev->ctx, "cannot render shading directly to an alpha mask");
@@ -762,11 +921,11 @@ fz_draw_fill_shade(fz_device *devp, fz_shade *shade, fz_matrix ctm, float alpha)
 
 	if (alpha < 1)
 	{
-		dest = fz_new_pixmap_with_bbox(dev->ctx, state->dest->colorspace, bbox);
+		dest = fz_draw_new_pixmap(dev, state->dest->colorspace, bbox);
 		fz_clear_pixmap(dev->ctx, dest);
 		if (shape)
 		{
-			shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+			shape = fz_draw_new_pixmap(dev, NULL, bbox);
 			fz_clear_pixmap(dev->ctx, shape);
 		}
 	}
@@ -810,11 +969,11 @@ fz_draw_fill_shade(fz_device *devp, fz_shade *shade, fz_matrix ctm, float alpha)
 	if (alpha < 1)
 	{
 		fz_paint_pixmap(state->dest, dest, alpha * 255);
-		fz_drop_pixmap(dev->ctx, dest);
+		fz_draw_drop_pixmap(dev, dest);
 		if (shape)
 		{
 			fz_paint_pixmap(state->shape, shape, alpha * 255);
-			fz_drop_pixmap(dev->ctx, shape);
+			fz_draw_drop_pixmap(dev, shape);
 		}
 	}
 
@@ -822,9 +981,185 @@ fz_draw_fill_shade(fz_device *devp, fz_shade *shade, fz_matrix ctm, float alpha)
 		fz_knockout_end(dev);
 }
 
+/*
+	Scaled images are kept in the store, keyed on the image, the
+	colorspace they were converted to before scaling, the size of the
+	decoded pixmap that was scaled (which depends on the subsampling),
+	the size they were scaled to and the subpixel offset. Redrawing a
+	page at the same zoom then reuses them rather than scaling again.
+*/
+typedef struct fz_scaled_image_key_s fz_scaled_image_key;
+
+struct fz_scaled_image_key_s {
+	int refs;
+	fz_image *image;
+	fz_colorspace *colorspace;
+	int src_w, src_h;
+	float w, h;
+	float fx, fy;
+};
+
+static int
+fz_make_hash_scaled_image_key(fz_store_hash *hash, void *key_)
+{
+	fz_scaled_image_key *key = (fz_scaled_image_key *)key_;
+
+	hash->u.ppf.ptr0 = key->image;
+	hash->u.ppf.ptr1 = key->colorspace;
+	hash->u.ppf.f[0] = key->w;
+	hash->u.ppf.f[1] = key->h;
+	hash->u.ppf.f[2] = key->fx;
+	hash->u.ppf.f[3] = key->fy;
+	hash->u.ppf.i[0] = key->src_w;
+	hash->u.ppf.i[1] = key->src_h;
+	return 1;
+}
+
+static void *
+fz_keep_scaled_image_key(fz_context *ctx, void *key_)
+{
+	fz_scaled_image_key *key = (fz_scaled_image_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+fz_drop_scaled_image_key(fz_context *ctx, void *key_)
+{
+	fz_scaled_image_key *key = (fz_scaled_image_key *)key_;
+	int drop;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+	{
+		fz_drop_image(ctx, key->image);
+		fz_drop_colorspace(ctx, key->colorspace);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_scaled_image_key(void *k0_, void *k1_)
+{
+	fz_scaled_image_key *k0 = (fz_scaled_image_key *)k0_;
+	fz_scaled_image_key *k1 = (fz_scaled_image_key *)k1_;
+
+	return k0->image != k1->image || k0->colorspace != k1->colorspace ||
+		k0->src_w != k1->src_w || k0->src_h != k1->src_h ||
+		k0->w != k1->w || k0->h != k1->h || k0->fx != k1->fx || k0->fy != k1->fy;
+}
+
+static void
+fz_debug_scaled_image(void *key_)
+{
+	fz_scaled_image_key *key = (fz_scaled_image_key *)key_;
+
+	printf("(scaled image %d x %d from %d x %d to %g x %g) ", key->image->w, key->image->h, key->src_w, key->src_h, key->w, key->h);
+}
+
+static fz_store_type fz_scaled_image_store_type =
+{
+	fz_make_hash_scaled_image_key,
+	fz_keep_scaled_image_key,
+	fz_drop_scaled_image_key,
+	fz_cmp_scaled_image_key,
+	fz_debug_scaled_image
+};
+
+/* In draft mode, accept one more level of subsampling than the output
+ * needs when decoding. Only the decode is coarser; the image is still
+ * scaled to its full size on the page. */
+static fz_pixmap *
+fz_draw_image_to_pixmap(fz_draw_device *dev, fz_image *image, int dx, int dy)
+{
+	if (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT)
+		return fz_image_to_pixmap(dev->ctx, image, (dx + 1) / 2, (dy + 1) / 2);
+	return fz_image_to_pixmap(dev->ctx, image, dx, dy);
+}
+
+static fz_pixmap *
+fz_scale_image_stored(fz_draw_device *dev, fz_image *image, fz_pixmap *pixmap, fz_matrix *m, fz_bbox *clip)
+{
+	fz_context *ctx = dev->ctx;
+	fz_scaled_image_key stack_key;
+	fz_scaled_image_key *key;
+	fz_pixmap *scaled, *existing;
+	fz_bbox bbox;
+	float ex, ey;
+
+	/* Only whole images can be reused, so anything that the clip would
+	 * cut down is scaled directly. So is anything drawn in draft mode,
+	 * which a full quality render must not pick up. */
+	bbox = fz_bbox_covering_rect(fz_transform_rect(*m, fz_unit_rect));
+	if (!image || (dev->flags & FZ_DRAWDEV_FLAGS_DRAFT) || (clip && (bbox.x0 < clip->x0 || bbox.y0 < clip->y0 || bbox.x1 > clip->x1 || bbox.y1 > clip->y1)))
+	{
+		scaled = fz_scale_pixmap_cached(ctx, pixmap, m->e, m->f, m->a, m->d, clip, dev->cache_x, dev->cache_y);
+		if (scaled)
+		{
+			m->e = scaled->x;
+			m->f = scaled->y;
+		}
+		return scaled;
+	}
+
+	ex = floorf(m->e);
+	ey = floorf(m->f);
+	stack_key.refs = 1;
+	stack_key.image = image;
+	stack_key.colorspace = pixmap->colorspace;
+	stack_key.src_w = pixmap->w;
+	stack_key.src_h = pixmap->h;
+	stack_key.w = m->a;
+	stack_key.h = m->d;
+	stack_key.fx = m->e - ex;
+	stack_key.fy = m->f - ey;
+
+	scaled = fz_find_item(ctx, fz_free_pixmap_imp, &stack_key, &fz_scaled_image_store_type);
+	if (!scaled)
+	{
+		scaled = fz_scale_pixmap_cached(ctx, pixmap, stack_key.fx, stack_key.fy, m->a, m->d, NULL, dev->cache_x, dev->cache_y);
+		if (!scaled)
+			return NULL;
+
+		fz_try(ctx)
+		{
+			key = fz_malloc_struct(ctx, fz_scaled_image_key);
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, scaled);
+			fz_rethrow(ctx);
+		}
+		*key = stack_key;
+		key->image = fz_keep_image(ctx, image);
+		key->colorspace = fz_keep_colorspace(ctx, pixmap->colorspace);
+		existing = fz_store_item(ctx, key, scaled, fz_pixmap_size(ctx, scaled), &fz_scaled_image_store_type);
+		if (existing)
+		{
+			/* Another thread got there first; use theirs. */
+			fz_drop_pixmap(ctx, scaled);
+			scaled = existing;
+		}
+		fz_drop_scaled_image_key(ctx, key);
+	}
+
+	/* The stored pixmap is shared, so the offset is applied to the
+	 * matrix rather than to the pixmap. */
+	m->e = ex + scaled->x;
+	m->f = ey + scaled->y;
+	return scaled;
+}
+
 static fz_pixmap *
-fz_transform_pixmap(fz_context *ctx, fz_pixmap *image, fz_matrix *ctm, int x, int y, int dx, int dy, int gridfit, fz_bbox *clip)
+fz_transform_pixmap(fz_draw_device *dev, fz_image *image, fz_pixmap *pixmap, fz_matrix *ctm, int x, int y, int dx, int dy, int gridfit, fz_bbox *clip)
 {
+	fz_context *ctx = dev->ctx;
 	fz_pixmap *scaled;
 
 	if (ctm->a != 0 && ctm->b == 0 && ctm->c == 0 && ctm->d != 0)
@@ -833,13 +1168,13 @@ fz_transform_pixmap(fz_context *ctx, fz_pixmap *image, fz_matrix *ctm, int x, in
 		fz_matrix m = *ctm;
 		if (gridfit)
 			fz_gridfit_matrix(&m);
-		scaled = fz_scale_pixmap(ctx, image, m.e, m.f, m.a, m.d, clip);
+		scaled = fz_scale_image_stored(dev, image, pixmap, &m, clip);
 		if (!scaled)
 			return NULL;
 		ctm->a = scaled->w;
 		ctm->d = scaled->h;
-		ctm->e = scaled->x;
-		ctm->f = scaled->y;
+		ctm->e = m.e;
+		ctm->f = m.f;
 		return scaled;
 	}
 
@@ -857,7 +1192,7 @@ fz_transform_pixmap(fz_context *ctx, fz_pixmap *image, fz_matrix *ctm, int x, in
 			rclip.x1 = clip->y1;
 			rclip.y1 = clip->x1;
 		}
-		scaled = fz_scale_pixmap(ctx, image, m.f, m.e, m.b, m.c, (clip ? &rclip : 0));
+		scaled = fz_scale_pixmap_cached(ctx, pixmap, m.f, m.e, m.b, m.c, (clip ? &rclip : 0), dev->cache_x, dev->cache_y);
 		if (!scaled)
 			return NULL;
 		ctm->b = scaled->w;
@@ -870,7 +1205,7 @@ fz_transform_pixmap(fz_context *ctx, fz_pixmap *image, fz_matrix *ctm, int x, in
 	/* Downscale, non rectilinear case */
 	if (dx > 0 && dy > 0)
 	{
-		scaled = fz_scale_pixmap(ctx, image, 0, 0, (float)dx, (float)dy, NULL);
+		scaled = fz_scale_pixmap_cached(ctx, pixmap, 0, 0, (float)dx, (float)dy, NULL, dev->cache_x, dev->cache_y);
 		return scaled;
 	}
 
@@ -907,8 +1242,7 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, fz_matrix ctm, float alpha)
 
 	dx = sqrtf(ctm.a * ctm.a + ctm.b * ctm.b);
 	dy = sqrtf(ctm.c * ctm.c + ctm.d * ctm.d);
-
-	pixmap = fz_image_to_pixmap(ctx, image, dx, dy);
+	pixmap = fz_draw_image_to_pixmap(dev, image, dx, dy);
 	orig_pixmap = pixmap;
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -934,14 +1268,14 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, fz_matrix ctm, float alpha)
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
 			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(ctx, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			scaled = fz_transform_pixmap(dev, image, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
 				if (dx < 1)
 					dx = 1;
 				if (dy < 1)
 					dy = 1;
-				scaled = fz_scale_pixmap(ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL);
+				scaled = fz_scale_pixmap_cached(ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL, dev->cache_x, dev->cache_y);
 			}
 			if (scaled)
 				pixmap = scaled;
@@ -1003,7 +1337,7 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, fz_matrix ctm,
 
 	dx = sqrtf(ctm.a * ctm.a + ctm.b * ctm.b);
 	dy = sqrtf(ctm.c * ctm.c + ctm.d * ctm.d);
-	pixmap = fz_image_to_pixmap(ctx, image, dx, dy);
+	pixmap = fz_draw_image_to_pixmap(dev, image, dx, dy);
 	orig_pixmap = pixmap;
 
 	fz_try(ctx)
@@ -1014,14 +1348,14 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, fz_matrix ctm,
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
 			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(dev->ctx, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			scaled = fz_transform_pixmap(dev, image, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
 				if (dx < 1)
 					dx = 1;
 				if (dy < 1)
 					dy = 1;
-				scaled = fz_scale_pixmap(dev->ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL);
+				scaled = fz_scale_pixmap_cached(dev->ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL, dev->cache_x, dev->cache_y);
 			}
 			if (scaled)
 				pixmap = scaled;
@@ -1094,33 +1428,33 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, fz_rect *rect, fz_matr
 
 	dx = sqrtf(ctm.a * ctm.a + ctm.b * ctm.b);
 	dy = sqrtf(ctm.c * ctm.c + ctm.d * ctm.d);
-	pixmap = fz_image_to_pixmap(ctx, image, dx, dy);
+	pixmap = fz_draw_image_to_pixmap(dev, image, dx, dy);
 	orig_pixmap = pixmap;
 
 	fz_try(ctx)
 	{
-		mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		mask = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, mask);
 
-		dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+		dest = fz_draw_new_pixmap(dev, model, bbox);
 		fz_clear_pixmap(dev->ctx, dest);
 		if (state->shape)
 		{
-			shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+			shape = fz_draw_new_pixmap(dev, NULL, bbox);
 			fz_clear_pixmap(dev->ctx, shape);
 		}
 
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
 			int gridfit = !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(dev->ctx, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			scaled = fz_transform_pixmap(dev, image, pixmap, &ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
 				if (dx < 1)
 					dx = 1;
 				if (dy < 1)
 					dy = 1;
-				scaled = fz_scale_pixmap(dev->ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL);
+				scaled = fz_scale_pixmap_cached(dev->ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL, dev->cache_x, dev->cache_y);
 			}
 			if (scaled)
 				pixmap = scaled;
@@ -1135,9 +1469,9 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, fz_rect *rect, fz_matr
 	}
 	fz_catch(ctx)
 	{
-		fz_drop_pixmap(ctx, shape);
-		fz_drop_pixmap(ctx, dest);
-		fz_drop_pixmap(ctx, mask);
+		fz_draw_drop_pixmap(dev, shape);
+		fz_draw_drop_pixmap(dev, dest);
+		fz_draw_drop_pixmap(dev, mask);
 		fz_rethrow(ctx);
 	}
 
@@ -1181,10 +1515,10 @@ fz_draw_pop_clip(fz_device *devp)
 		if (state[0].shape != state[1].shape)
 		{
 			fz_paint_pixmap_with_mask(state[0].shape, state[1].shape, state[1].mask);
-			fz_drop_pixmap(dev->ctx, state[1].shape);
+			fz_draw_drop_pixmap(dev, state[1].shape);
 		}
-		fz_drop_pixmap(dev->ctx, state[1].mask);
-		fz_drop_pixmap(dev->ctx, state[1].dest);
+		fz_draw_drop_pixmap(dev, state[1].mask);
+		fz_draw_drop_pixmap(dev, state[1].dest);
 #ifdef DUMP_GROUP_BLENDS
 		fz_dump_blend(dev->ctx, state[0].dest, " to get ");
 		if (state[0].shape)
@@ -1211,7 +1545,17 @@ fz_draw_begin_mask(fz_device *devp, fz_rect rect, int luminosity, fz_colorspace
 
 	bbox = fz_bbox_covering_rect(rect);
 	bbox = fz_intersect_bbox(bbox, state->scissor);
-	dest = fz_new_pixmap_with_bbox(dev->ctx, fz_device_gray, bbox);
+
+	if ((dev->flags & FZ_DRAWDEV_FLAGS_DRAFT) && (bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0) < DRAFT_MIN_AREA)
+	{
+		/* Throw the mask contents away, and treat the mask as a
+		 * plain rectangular clip in end_mask. */
+		state[1].scissor = fz_empty_bbox;
+		state[1].draft_mask = bbox;
+		return;
+	}
+
+	dest = fz_draw_new_pixmap(dev, fz_device_gray, bbox);
 	if (state->shape)
 	{
 		/* FIXME: If we ever want to support AIS true, then we
@@ -1265,6 +1609,15 @@ fz_draw_end_mask(fz_device *devp)
 		return;
 	}
 	state = &dev->stack[dev->top-1];
+
+	/* A mask skipped in draft mode draws into no buffer of its own */
+	if (state[1].dest == state[0].dest)
+	{
+		state[1].scissor = state[1].draft_mask;
+		state[1].mask = NULL;
+		return;
+	}
+
 	/* pop soft mask buffer */
 	luminosity = state[1].luminosity;
 
@@ -1274,18 +1627,18 @@ fz_draw_end_mask(fz_device *devp)
 	/* convert to alpha mask */
 	temp = fz_alpha_from_gray(dev->ctx, state[1].dest, luminosity);
 	if (state[1].dest != state[0].dest)
-		fz_drop_pixmap(dev->ctx, state[1].dest);
+		fz_draw_drop_pixmap(dev, state[1].dest);
 	state[1].dest = NULL;
 	if (state[1].shape != state[0].shape)
-		fz_drop_pixmap(dev->ctx, state[1].shape);
+		fz_draw_drop_pixmap(dev, state[1].shape);
 	state[1].shape = NULL;
 	if (state[1].mask != state[0].mask)
-		fz_drop_pixmap(dev->ctx, state[1].mask);
+		fz_draw_drop_pixmap(dev, state[1].mask);
 	state[1].mask = NULL;
 
 	/* create new dest scratch buffer */
 	bbox = fz_pixmap_bbox(ctx, temp);
-	dest = fz_new_pixmap_with_bbox(dev->ctx, state->dest->colorspace, bbox);
+	dest = fz_draw_new_pixmap(dev, state->dest->colorspace, bbox);
 	fz_clear_pixmap(dev->ctx, dest);
 
 	/* push soft mask as clip mask */
@@ -1296,7 +1649,7 @@ fz_draw_end_mask(fz_device *devp)
 	 * clip mask when we pop. So create a new shape now. */
 	if (state[0].shape)
 	{
-		state[1].shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+		state[1].shape = fz_draw_new_pixmap(dev, NULL, bbox);
 		fz_clear_pixmap(dev->ctx, state[1].shape);
 	}
 	state[1].scissor = bbox;
@@ -1318,7 +1671,7 @@ fz_draw_begin_group(fz_device *devp, fz_rect rect, int isolated, int knockout, i
 	state = push_stack(dev);
 	bbox = fz_bbox_covering_rect(rect);
 	bbox = fz_intersect_bbox(bbox, state->scissor);
-	dest = fz_new_pixmap_with_bbox(ctx, model, bbox);
+	dest = fz_draw_new_pixmap(dev, model, bbox);
 
 #ifndef ATTEMPT_KNOCKOUT_AND_ISOLATED
 	knockout = 0;
@@ -1344,12 +1697,12 @@ fz_draw_begin_group(fz_device *devp, fz_rect rect, int isolated, int knockout, i
 	{
 		fz_try(ctx)
 		{
-			shape = fz_new_pixmap_with_bbox(ctx, NULL, bbox);
+			shape = fz_draw_new_pixmap(dev, NULL, bbox);
 			fz_clear_pixmap(dev->ctx, shape);
 		}
 		fz_catch(ctx)
 		{
-			fz_drop_pixmap(ctx, dest);
+			fz_draw_drop_pixmap(dev, dest);
 			fz_rethrow(ctx);
 		}
 	}
@@ -1407,12 +1760,12 @@ fz_draw_end_group(fz_device *devp)
 	else
 		fz_blend_pixmap(state[0].dest, state[1].dest, alpha * 255, blendmode, isolated, state[1].shape);
 
-	fz_drop_pixmap(dev->ctx, state[1].dest);
+	fz_draw_drop_pixmap(dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, alpha * 255);
-		fz_drop_pixmap(dev->ctx, state[1].shape);
+		fz_draw_drop_pixmap(dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(dev->ctx, state[0].dest, " to get ");
@@ -1451,7 +1804,7 @@ fz_draw_begin_tile(fz_device *devp, fz_rect area, fz_rect view, float xstep, flo
 	 * assert(bbox.x0 > state->dest->x || bbox.x1 < state->dest->x + state->dest->w ||
 	 *	bbox.y0 > state->dest->y || bbox.y1 < state->dest->y + state->dest->h);
 	 */
-	dest = fz_new_pixmap_with_bbox(dev->ctx, model, bbox);
+	dest = fz_draw_new_pixmap(dev, model, bbox);
 	fz_clear_pixmap(ctx, dest);
 	shape = state[0].shape;
 	if (shape)
@@ -1459,12 +1812,12 @@ fz_draw_begin_tile(fz_device *devp, fz_rect area, fz_rect view, float xstep, flo
 		fz_var(shape);
 		fz_try(ctx)
 		{
-			shape = fz_new_pixmap_with_bbox(dev->ctx, NULL, bbox);
+			shape = fz_draw_new_pixmap(dev, NULL, bbox);
 			fz_clear_pixmap(ctx, shape);
 		}
 		fz_catch(ctx)
 		{
-			fz_drop_pixmap(ctx, dest);
+			fz_draw_drop_pixmap(dev, dest);
 			fz_rethrow(ctx);
 		}
 	}
@@ -1547,8 +1900,8 @@ fz_draw_end_tile(fz_device *devp)
 		}
 	}
 
-	fz_drop_pixmap(dev->ctx, state[1].dest);
-	fz_drop_pixmap(dev->ctx, state[1].shape);
+	fz_draw_drop_pixmap(dev, state[1].dest);
+	fz_draw_drop_pixmap(dev, state[1].shape);
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(dev->ctx, state[0].dest, " to get ");
 	if (state[0].shape)
@@ -1574,17 +1927,24 @@ fz_draw_free_user(fz_device *devp)
 		do
 		{
 			if (state[1].mask != state[0].mask)
-				fz_drop_pixmap(ctx, state[1].mask);
+				fz_draw_drop_pixmap(dev, state[1].mask);
 			if (state[1].dest != state[0].dest)
-				fz_drop_pixmap(ctx, state[1].dest);
+				fz_draw_drop_pixmap(dev, state[1].dest);
 			if (state[1].shape != state[0].shape)
-				fz_drop_pixmap(ctx, state[1].shape);
+				fz_draw_drop_pixmap(dev, state[1].shape);
 			state--;
 		}
 		while(--dev->top > 0);
 	}
 	if (dev->stack != &dev->init_stack[0])
 		fz_free(ctx, dev->stack);
+	/* Anything still lent out takes its samples with it */
+	while (dev->lent_len > 0)
+		dev->lent[--dev->lent_len].pixmap->free_samples = 1;
+	fz_free(ctx, dev->lent);
+	fz_draw_empty_pool(dev);
+	fz_free_scale_cache(ctx, dev->cache_x);
+	fz_free_scale_cache(ctx, dev->cache_y);
 	fz_free_gel(dev->gel);
 	fz_free(ctx, dev);
 }
@@ -1599,6 +1959,8 @@ fz_new_draw_device(fz_context *ctx, fz_pixmap *dest)
 	fz_try(ctx)
 	{
 		ddev->gel = fz_new_gel(ctx);
+		ddev->cache_x = fz_new_scale_cache(ctx);
+		ddev->cache_y = fz_new_scale_cache(ctx);
 		ddev->flags = 0;
 		ddev->ctx = ctx;
 		ddev->top = 0;
@@ -1617,6 +1979,8 @@ fz_new_draw_device(fz_context *ctx, fz_pixmap *dest)
 	}
 	fz_catch(ctx)
 	{
+		fz_free_scale_cache(ctx, ddev->cache_x);
+		fz_free_scale_cache(ctx, ddev->cache_y);
 		fz_free_gel(ddev->gel);
 		fz_free(ctx, ddev);
 		fz_rethrow(ctx);
@@ -1669,6 +2033,15 @@ fz_new_draw_device_with_bbox(fz_context *ctx, fz_pixmap *dest, fz_bbox clip)
 	return dev;
 }
 
+fz_device *
+fz_new_draw_device_draft(fz_context *ctx, fz_pixmap *dest)
+{
+	fz_device *dev = fz_new_draw_device(ctx, dest);
+	fz_draw_device *ddev = dev->user;
+	ddev->flags |= FZ_DRAWDEV_FLAGS_DRAFT;
+	return dev;
+}
+
 fz_device *
 fz_new_draw_device_type3(fz_context *ctx, fz_pixmap *dest)
 {
@@ -21,12 +21,14 @@ struct fz_aa_context_s
 	int vscale;
 	int scale;
 	int bits;
+	int analytic;
 };
 
 void fz_new_aa_context(fz_context *ctx)
 {
-#ifndef AA_BITS
 	ctx->aa = fz_malloc_struct(ctx, fz_aa_context);
+	ctx->aa->analytic = 0;
+#ifndef AA_BITS
 	ctx->aa->hscale = 17;
 	ctx->aa->vscale = 15;
 	ctx->aa->scale = 256;
@@ -49,10 +51,8 @@ void fz_copy_aa_context(fz_context *dst, fz_context *src)
 
 void fz_free_aa_context(fz_context *ctx)
 {
-#ifndef AA_BITS
 	fz_free(ctx, ctx->aa);
 	ctx->aa = NULL;
-#endif
 }
 
 #ifdef AA_BITS
@@ -138,6 +138,18 @@ fz_set_aa_level(fz_context *ctx, int level)
 #endif
 }
 
+int
+fz_aa_analytic(fz_context *ctx)
+{
+	return ctx->aa->analytic;
+}
+
+void
+fz_set_aa_analytic(fz_context *ctx, int analytic)
+{
+	ctx->aa->analytic = !!analytic;
+}
+
 /*
  * Global Edge List -- list of straight path segments for scan conversion
  *
@@ -156,6 +168,23 @@ struct fz_edge_s
 	int xdir, ydir; /* -1 or +1 */
 };
 
+/*
+ * When analytic anti-aliasing is selected, the gel also keeps the
+ * clipped path segments at full precision, and scan conversion computes
+ * the exact area of each pixel covered (see fz_scan_convert_analytic).
+ * The sub-sampled edges are still built, since they give the bbox and
+ * rectangle test that the draw device relies on.
+ */
+
+typedef struct fz_segment_s fz_segment;
+
+struct fz_segment_s
+{
+	float x0, y0, x1, y1;
+	float dxdy;
+	int dir;
+};
+
 struct fz_gel_s
 {
 	fz_bbox clip;
@@ -164,6 +193,13 @@ struct fz_gel_s
 	fz_edge *edges;
 	int acap, alen;
 	fz_edge **active;
+	int analytic;
+	fz_rect sclip;
+	fz_rect sbox;
+	int scap, slen;
+	fz_segment *segs;
+	int sacap, salen;
+	fz_segment **sactive;
 	fz_context *ctx;
 };
 
@@ -190,6 +226,12 @@ fz_new_gel(fz_context *ctx)
 		gel->acap = 64;
 		gel->alen = 0;
 		gel->active = fz_malloc_array(ctx, gel->acap, sizeof(fz_edge*));
+
+		gel->analytic = 0;
+		gel->scap = gel->slen = 0;
+		gel->segs = NULL;
+		gel->sacap = gel->salen = 0;
+		gel->sactive = NULL;
 	}
 	fz_catch(ctx)
 	{
@@ -211,18 +253,29 @@ fz_reset_gel(fz_gel *gel, fz_bbox clip)
 	{
 		gel->clip.x0 = gel->clip.y0 = BBOX_MAX;
 		gel->clip.x1 = gel->clip.y1 = BBOX_MIN;
+		gel->sclip.x0 = gel->sclip.y0 = BBOX_MIN;
+		gel->sclip.x1 = gel->sclip.y1 = BBOX_MAX;
 	}
 	else {
 		gel->clip.x0 = clip.x0 * fz_aa_hscale;
 		gel->clip.x1 = clip.x1 * fz_aa_hscale;
 		gel->clip.y0 = clip.y0 * fz_aa_vscale;
 		gel->clip.y1 = clip.y1 * fz_aa_vscale;
+		gel->sclip.x0 = clip.x0;
+		gel->sclip.x1 = clip.x1;
+		gel->sclip.y0 = clip.y0;
+		gel->sclip.y1 = clip.y1;
 	}
 
 	gel->bbox.x0 = gel->bbox.y0 = BBOX_MAX;
 	gel->bbox.x1 = gel->bbox.y1 = BBOX_MIN;
 
+	gel->sbox.x0 = gel->sbox.y0 = BBOX_MAX;
+	gel->sbox.x1 = gel->sbox.y1 = BBOX_MIN;
+
 	gel->len = 0;
+	gel->slen = 0;
+	gel->analytic = ctxaa->analytic && fz_aa_bits > 0;
 }
 
 void
@@ -230,6 +283,8 @@ fz_free_gel(fz_gel *gel)
 {
 	if (gel == NULL)
 		return;
+	fz_free(gel->ctx, gel->sactive);
+	fz_free(gel->ctx, gel->segs);
 	fz_free(gel->ctx, gel->active);
 	fz_free(gel->ctx, gel->edges);
 	fz_free(gel->ctx, gel);
@@ -344,6 +399,91 @@ fz_insert_gel_raw(fz_gel *gel, int x0, int y0, int x1, int y1)
 	}
 }
 
+static void
+fz_insert_segment(fz_gel *gel, float x0, float y0, float x1, float y1, int dir)
+{
+	fz_segment *seg;
+
+	if (y0 >= y1)
+		return;
+
+	x0 = CLAMP(x0, gel->sclip.x0, gel->sclip.x1);
+	x1 = CLAMP(x1, gel->sclip.x0, gel->sclip.x1);
+
+	if (x0 < gel->sbox.x0) gel->sbox.x0 = x0;
+	if (x0 > gel->sbox.x1) gel->sbox.x1 = x0;
+	if (x1 < gel->sbox.x0) gel->sbox.x0 = x1;
+	if (x1 > gel->sbox.x1) gel->sbox.x1 = x1;
+	if (y0 < gel->sbox.y0) gel->sbox.y0 = y0;
+	if (y1 > gel->sbox.y1) gel->sbox.y1 = y1;
+
+	if (gel->slen == gel->scap) {
+		int new_cap = gel->scap + 512;
+		gel->segs = fz_resize_array(gel->ctx, gel->segs, new_cap, sizeof(fz_segment));
+		gel->scap = new_cap;
+	}
+
+	seg = &gel->segs[gel->slen++];
+	seg->x0 = x0;
+	seg->y0 = y0;
+	seg->x1 = x1;
+	seg->y1 = y1;
+	seg->dxdy = (x1 - x0) / (y1 - y0);
+	seg->dir = dir;
+}
+
+static void
+fz_insert_gel_analytic(fz_gel *gel, float x0, float y0, float x1, float y1)
+{
+	fz_rect *clip = &gel->sclip;
+	float split[2], t;
+	int dir, n, i;
+
+	if (y0 == y1)
+		return;
+
+	if (y0 > y1) {
+		dir = -1;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+	}
+	else
+		dir = 1;
+
+	if (y1 <= clip->y0 || y0 >= clip->y1)
+		return;
+	if (y0 < clip->y0) {
+		x0 += (x1 - x0) * (clip->y0 - y0) / (y1 - y0);
+		y0 = clip->y0;
+	}
+	if (y1 > clip->y1) {
+		x1 = x0 + (x1 - x0) * (clip->y1 - y0) / (y1 - y0);
+		y1 = clip->y1;
+	}
+
+	/* Split where the segment crosses the left or right of the clip;
+	 * the pieces outside are clamped onto the clip edge so that they
+	 * still contribute their winding. */
+	n = 0;
+	if ((x0 < clip->x0) != (x1 < clip->x0))
+		split[n++] = y0 + (y1 - y0) * (clip->x0 - x0) / (x1 - x0);
+	if ((x0 > clip->x1) != (x1 > clip->x1))
+		split[n++] = y0 + (y1 - y0) * (clip->x1 - x0) / (x1 - x0);
+	if (n == 2 && split[0] > split[1]) {
+		t = split[0]; split[0] = split[1]; split[1] = t;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		float sy = CLAMP(split[i], y0, y1);
+		float sx = x0 + (x1 - x0) * (sy - y0) / (y1 - y0);
+		fz_insert_segment(gel, x0, y0, sx, sy, dir);
+		x0 = sx;
+		y0 = sy;
+	}
+	fz_insert_segment(gel, x0, y0, x1, y1, dir);
+}
+
 void
 fz_insert_gel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
 {
@@ -351,6 +491,9 @@ fz_insert_gel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
 	int d, v;
 	fz_aa_context *ctxaa = gel->ctx->aa;
 
+	if (gel->analytic)
+		fz_insert_gel_analytic(gel, fx0, fy0, fx1, fy1);
+
 	fx0 = floorf(fx0 * fz_aa_hscale);
 	fx1 = floorf(fx1 * fz_aa_hscale);
 	fy0 = floorf(fy0 * fz_aa_vscale);
@@ -404,6 +547,42 @@ fz_insert_gel(fz_gel *gel, float fx0, float fy0, float fx1, float fy1)
 	fz_insert_gel_raw(gel, x0, y0, x1, y1);
 }
 
+static void
+fz_sort_segments(fz_gel *gel)
+{
+	fz_segment *a = gel->segs;
+	int n = gel->slen;
+
+	int h, i, k;
+	fz_segment t;
+
+	h = 1;
+	if (n < 14) {
+		h = 1;
+	}
+	else {
+		while (h < n)
+			h = 3 * h + 1;
+		h /= 3;
+		h /= 3;
+	}
+
+	while (h > 0)
+	{
+		for (i = 0; i < n; i++) {
+			t = a[i];
+			k = i - h;
+			while (k >= 0 && a[k].y0 > t.y0) {
+				a[k + h] = a[k];
+				k -= h;
+			}
+			a[k + h] = t;
+		}
+
+		h /= 3;
+	}
+}
+
 void
 fz_sort_gel(fz_gel *gel)
 {
@@ -413,6 +592,13 @@ fz_sort_gel(fz_gel *gel)
 	int h, i, k;
 	fz_edge t;
 
+	/* Analytic scan conversion only looks at the segments */
+	if (gel->analytic)
+	{
+		fz_sort_segments(gel);
+		return;
+	}
+
 	h = 1;
 	if (n < 14) {
 		h = 1;
@@ -713,6 +899,166 @@ fz_scan_convert_aa(fz_gel *gel, int eofill, fz_bbox clip,
 	fz_free(ctx, alphas);
 }
 
+/*
+ * Analytic anti-aliased scan conversion.
+ *
+ * Each segment adds the signed area it covers to an accumulation row,
+ * touching only the cells it passes through and the one after; a running
+ * sum along the row then gives the exact coverage of every pixel, with
+ * the interior of a shape filled in by the carry. Only the span between
+ * the first and last touched cells of each row is painted.
+ */
+
+static inline void add_line_analytic(float * restrict acc, float xa, float xb, float d, int *lo, int *hi)
+{
+	float x0 = MIN(xa, xb);
+	float x1 = MAX(xa, xb);
+	int x0i = (int)x0;
+	int x1i = (int)ceilf(x1);
+
+	if (x1i <= x0i + 1)
+	{
+		/* entirely within one cell */
+		float xmf = 0.5f * (xa + xb) - x0i;
+		acc[x0i] += d - d * xmf;
+		acc[x0i + 1] += d * xmf;
+		x1i = x0i + 1;
+	}
+	else
+	{
+		float s = 1.0f / (x1 - x0);
+		float x0f = x0 - x0i;
+		float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+		float x1f = x1 - x1i + 1;
+		float am = 0.5f * s * x1f * x1f;
+		acc[x0i] += d * a0;
+		if (x1i == x0i + 2)
+			acc[x0i + 1] += d * (1 - a0 - am);
+		else
+		{
+			float a1 = s * (1.5f - x0f);
+			int xi;
+			acc[x0i + 1] += d * (a1 - a0);
+			for (xi = x0i + 2; xi < x1i - 1; xi++)
+				acc[xi] += d * s;
+			acc[x1i - 1] += d * (1 - a1 - (x1i - x0i - 3) * s - am);
+		}
+		acc[x1i] += d * am;
+	}
+
+	if (x0i < *lo)
+		*lo = x0i;
+	if (x1i > *hi)
+		*hi = x1i;
+}
+
+static inline void undelta_analytic(unsigned char * restrict out, float * restrict in, int n, int eofill)
+{
+	float d = 0;
+	float v;
+	while (n--)
+	{
+		d += *in;
+		*in++ = 0;
+		v = fabsf(d);
+		if (eofill)
+		{
+			v = fmodf(v, 2);
+			if (v > 1)
+				v = 2 - v;
+		}
+		else if (v > 1)
+			v = 1;
+		*out++ = (unsigned char)(v * 255 + 0.5f);
+	}
+}
+
+static void
+fz_scan_convert_analytic(fz_gel *gel, int eofill, fz_bbox clip,
+	fz_pixmap *dst, unsigned char *color)
+{
+	unsigned char *alphas;
+	float *acc;
+	fz_segment *seg;
+	int y, e, i, lo, hi, x0, x1;
+	float ya, yb, xofs;
+	fz_context *ctx = gel->ctx;
+
+	int xmin = (int)floorf(gel->sbox.x0);
+	int xmax = (int)floorf(gel->sbox.x1) + 1;
+	int n = xmax - xmin + 2;
+
+	if (gel->slen == 0)
+		return;
+
+	alphas = fz_malloc_no_throw(ctx, n);
+	acc = fz_malloc_no_throw(ctx, n * sizeof(float));
+	if (gel->slen > gel->sacap)
+	{
+		fz_segment **newactive = fz_resize_array_no_throw(ctx, gel->sactive, gel->slen, sizeof(fz_segment*));
+		if (newactive)
+		{
+			gel->sactive = newactive;
+			gel->sacap = gel->slen;
+		}
+	}
+	if (alphas == NULL || acc == NULL || gel->sacap < gel->slen)
+	{
+		fz_free(ctx, alphas);
+		fz_free(ctx, acc);
+		fz_throw(ctx, "scan conversion failed (malloc failure)");
+	}
+	memset(acc, 0, n * sizeof(float));
+
+	xofs = xmin;
+	gel->salen = 0;
+	e = 0;
+	y = (int)floorf(gel->segs[0].y0);
+	if (y < clip.y0)
+		y = clip.y0;
+
+	while ((gel->salen > 0 || e < gel->slen) && y < clip.y1)
+	{
+		if (gel->salen == 0 && gel->segs[e].y0 >= y + 1)
+			y = (int)floorf(gel->segs[e].y0);
+		while (e < gel->slen && gel->segs[e].y0 < y + 1)
+			gel->sactive[gel->salen++] = &gel->segs[e++];
+
+		lo = n;
+		hi = -1;
+		i = 0;
+		while (i < gel->salen)
+		{
+			seg = gel->sactive[i];
+			ya = MAX(seg->y0, y);
+			yb = MIN(seg->y1, y + 1);
+			if (ya < yb)
+				add_line_analytic(acc,
+					seg->x0 + (ya - seg->y0) * seg->dxdy - xofs,
+					seg->x0 + (yb - seg->y0) * seg->dxdy - xofs,
+					(yb - ya) * seg->dir, &lo, &hi);
+			if (seg->y1 <= y + 1)
+				gel->sactive[i] = gel->sactive[--gel->salen];
+			else
+				i++;
+		}
+
+		if (lo <= hi)
+		{
+			undelta_analytic(alphas + lo, acc + lo, hi - lo + 1, eofill);
+			x0 = MAX(lo + xmin, clip.x0);
+			x1 = MIN(hi + xmin + 1, clip.x1);
+			if (x0 < x1)
+				blit_aa(dst, x0, y, alphas + x0 - xmin, x1 - x0, color);
+		}
+
+		y++;
+	}
+
+	fz_free(ctx, acc);
+	fz_free(ctx, alphas);
+}
+
 /*
  * Sharp (not anti-aliased) scan conversion
  */
@@ -799,7 +1145,9 @@ fz_scan_convert(fz_gel *gel, int eofill, fz_bbox clip,
 {
 	fz_aa_context *ctxaa = gel->ctx->aa;
 
-	if (fz_aa_bits > 0)
+	if (gel->analytic)
+		fz_scan_convert_analytic(gel, eofill, clip, dst, color);
+	else if (fz_aa_bits > 0)
 		fz_scan_convert_aa(gel, eofill, clip, dst, color);
 	else
 		fz_scan_convert_sharp(gel, eofill, clip, dst, color);
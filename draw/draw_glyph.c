@@ -110,6 +110,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix ctm, fz_color
 	fz_glyph_key key;
 	fz_pixmap *val;
 	float size = fz_matrix_expansion(ctm);
+	int tag;
 
 	cache = ctx->glyph_cache;
 
@@ -137,8 +138,13 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix ctm, fz_color
 	{
 		fz_keep_pixmap(ctx, val);
 		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		if (ctx->profile)
+			ctx->profile->glyph_hits++;
 		return val;
 	}
+	if (ctx->profile)
+		ctx->profile->glyph_misses++;
+	tag = fz_set_alloc_tag(ctx, FZ_ALLOC_GLYPH);
 
 	ctm.e = floorf(ctm.e) + key.e / 256.0f;
 	ctm.f = floorf(ctm.f) + key.f / 256.0f;
@@ -173,6 +179,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix ctm, fz_color
 	fz_catch(ctx)
 	{
 		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		fz_set_alloc_tag(ctx, tag);
 		fz_rethrow(ctx);
 	}
 
@@ -203,5 +210,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix ctm, fz_color
 	}
 
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_set_alloc_tag(ctx, tag);
 	return val;
 }
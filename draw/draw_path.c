@@ -66,6 +66,100 @@ bezier(fz_gel *gel, fz_matrix *ctm, float flatness,
 	bezier(gel, ctm, flatness, xabcd, yabcd, xbcd, ybcd, xcd, ycd, xd, yd, depth + 1);
 }
 
+#define MAX_RECT_POINTS 16
+
+/*
+	Spot paths that fill exactly an axis aligned rectangle once
+	transformed, so that clipping to them can be done by narrowing the
+	scissor. The path must be a single subpath of lines, each of which
+	runs along an edge of its bbox, going round it once.
+*/
+int
+fz_is_rect_path(fz_path *path, fz_matrix ctm, fz_rect *rect)
+{
+	fz_point p[MAX_RECT_POINTS];
+	fz_rect r;
+	float x, y, area;
+	int i = 0;
+	int n = 0;
+	int k;
+
+	if (!fz_is_rectilinear(ctm))
+		return 0;
+	/* drop the rounding noise left by rotating through 90 degrees */
+	if (fabsf(ctm.b) < FLT_EPSILON && fabsf(ctm.c) < FLT_EPSILON)
+		ctm.b = ctm.c = 0;
+	else
+		ctm.a = ctm.d = 0;
+
+	while (i < path->len)
+	{
+		switch (path->items[i++].k)
+		{
+		case FZ_MOVETO:
+			if (i != 1)
+				return 0;
+			/* fallthrough */
+		case FZ_LINETO:
+			if (n == MAX_RECT_POINTS)
+				return 0;
+			x = path->items[i++].v;
+			y = path->items[i++].v;
+			p[n].x = ctm.a * x + ctm.c * y + ctm.e;
+			p[n].y = ctm.b * x + ctm.d * y + ctm.f;
+			n++;
+			break;
+		case FZ_CLOSE_PATH:
+			if (i != path->len)
+				return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	if (n < 4)
+		return 0;
+
+	r.x0 = r.x1 = p[0].x;
+	r.y0 = r.y1 = p[0].y;
+	for (k = 1; k < n; k++)
+	{
+		r.x0 = MIN(r.x0, p[k].x);
+		r.y0 = MIN(r.y0, p[k].y);
+		r.x1 = MAX(r.x1, p[k].x);
+		r.y1 = MAX(r.y1, p[k].y);
+	}
+	if (r.x0 == r.x1 || r.y0 == r.y1)
+		return 0;
+
+	/* every side along the bbox, and the winding +/-1 all over it */
+	area = 0;
+	for (k = 0; k < n; k++)
+	{
+		fz_point *a = &p[k];
+		fz_point *b = &p[(k + 1) % n];
+		if (a->x == b->x)
+		{
+			if (a->x != r.x0 && a->x != r.x1)
+				return 0;
+		}
+		else if (a->y == b->y)
+		{
+			if (a->y != r.y0 && a->y != r.y1)
+				return 0;
+		}
+		else
+			return 0;
+		area += (a->x - p[0].x) * (b->y - p[0].y) - (b->x - p[0].x) * (a->y - p[0].y);
+	}
+	area = fabsf(area) / 2;
+	if (fabsf(area - (r.x1 - r.x0) * (r.y1 - r.y0)) > (r.x1 - r.x0) * (r.y1 - r.y0) / 2)
+		return 0;
+
+	*rect = r;
+	return 1;
+}
+
 void
 fz_flatten_fill_path(fz_gel *gel, fz_path *path, fz_matrix ctm, float flatness)
 {
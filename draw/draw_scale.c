@@ -31,6 +31,19 @@ and then positioning it at (frac(x),frac(y)).
 #endif
 #endif
 
+/* On x86 we use SSE2 versions of the row scalers whenever the compiler is
+ * targeting SSE2 (always the case for x86-64). Define FZ_NO_SIMD to use
+ * the plain C versions instead. */
+#if !defined(ARCH_ARM) && !defined(FZ_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARCH_X86_SSE2
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#endif
+#endif
+
 #ifdef DEBUG_SCALING
 #ifdef WIN32
 #include <windows.h>
@@ -540,6 +553,110 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 	return weights;
 }
 
+/*
+Building the weights is a significant part of the cost of scaling small
+images, and pages frequently draw many images at the same size (tiles,
+icons, repeated logos) or redraw the same image at the same zoom. A scale
+cache holds the last few weight tables that were built for one direction,
+so that these can be reused rather than recalculated. A cache belongs to a
+single thread (typically it lives in a draw device), so no locking is
+required.
+*/
+
+#define FZ_SCALE_CACHE_SIZE 4
+
+typedef struct fz_scale_cache_entry_s fz_scale_cache_entry;
+
+struct fz_scale_cache_entry_s
+{
+	int src_w;
+	float x;
+	float dst_w;
+	fz_scale_filter *filter;
+	int vertical;
+	int dst_w_int;
+	int patch_l;
+	int patch_r;
+	int n;
+	int flip;
+	fz_weights *weights;
+};
+
+struct fz_scale_cache_s
+{
+	int next;
+	fz_scale_cache_entry entry[FZ_SCALE_CACHE_SIZE];
+};
+
+fz_scale_cache *
+fz_new_scale_cache(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_scale_cache);
+}
+
+void
+fz_free_scale_cache(fz_context *ctx, fz_scale_cache *cache)
+{
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < FZ_SCALE_CACHE_SIZE; i++)
+		fz_free(ctx, cache->entry[i].weights);
+	fz_free(ctx, cache);
+}
+
+static fz_weights *
+make_weights_cached(fz_context *ctx, fz_scale_cache *cache, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip)
+{
+	fz_scale_cache_entry *entry;
+	fz_weights *weights;
+	int i;
+
+	if (!cache)
+		return make_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, patch_l, patch_r, n, flip);
+
+	for (i = 0; i < FZ_SCALE_CACHE_SIZE; i++)
+	{
+		entry = &cache->entry[i];
+		if (entry->weights &&
+			entry->src_w == src_w &&
+			entry->x == x &&
+			entry->dst_w == dst_w &&
+			entry->filter == filter &&
+			entry->vertical == vertical &&
+			entry->dst_w_int == dst_w_int &&
+			entry->patch_l == patch_l &&
+			entry->patch_r == patch_r &&
+			entry->n == n &&
+			entry->flip == flip)
+		{
+			DBUG(("reusing cached weights %d\n", i));
+			return entry->weights;
+		}
+	}
+
+	weights = make_weights(ctx, src_w, x, dst_w, filter, vertical, dst_w_int, patch_l, patch_r, n, flip);
+
+	/* Replace the entries in round robin order */
+	entry = &cache->entry[cache->next];
+	cache->next = (cache->next + 1) % FZ_SCALE_CACHE_SIZE;
+	fz_free(ctx, entry->weights);
+	entry->src_w = src_w;
+	entry->x = x;
+	entry->dst_w = dst_w;
+	entry->filter = filter;
+	entry->vertical = vertical;
+	entry->dst_w_int = dst_w_int;
+	entry->patch_l = patch_l;
+	entry->patch_r = patch_r;
+	entry->n = n;
+	entry->flip = flip;
+	entry->weights = weights;
+
+	return weights;
+}
+
 static void
 scale_row_to_temp(int *dst, unsigned char *src, fz_weights *weights)
 {
@@ -853,6 +970,222 @@ scale_row_from_temp(unsigned char *dst, int *src, fz_weights *weights, int width
 	);
 }
 
+#elif defined(ARCH_X86_SSE2)
+
+/* SSE2 has no 32 bit multiply (that arrives with SSE4.1), so we multiply
+ * the even and odd lanes separately and interleave the low halves. */
+static inline __m128i
+mul_epi32_lo(__m128i a, __m128i b)
+{
+#ifdef __SSE4_1__
+	return _mm_mullo_epi32(a, b);
+#else
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+#endif
+}
+
+/* The weights are always small enough (at most 256 or so in magnitude) to
+ * be packed into 16 bits, so we can use pmaddwd to multiply 8 samples by
+ * 8 weights and sum them in pairs in one go. */
+
+static void
+scale_row_to_temp1(int *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 1);
+	step = 1;
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = zero;
+		int val;
+
+		min = &src[*contrib++];
+		len = *contrib++;
+		while (len >= 8)
+		{
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((__m128i *)contrib), _mm_loadu_si128((__m128i *)(contrib+4)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 8;
+			len -= 8;
+		}
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+		val = _mm_cvtsi128_si32(acc);
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = val;
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp2(int *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 2);
+	step = 2;
+	if (weights->flip)
+	{
+		dst += 2*(weights->count-1);
+		step = -2;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = zero;
+		int c1, c2;
+
+		min = &src[2 * *contrib++];
+		len = *contrib++;
+		while (len >= 4)
+		{
+			/* g0 a0 g1 a1 g2 a2 g3 a3 -> g0 g1 a0 a1 g2 g3 a2 a3 */
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = _mm_loadu_si128((__m128i *)contrib);
+			s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3,1,2,0));
+			s = _mm_shufflehi_epi16(s, _MM_SHUFFLE(3,1,2,0));
+			/* w0 w1 w2 w3 -> w0 w1 w0 w1 w2 w3 w2 w3 */
+			w = _mm_packs_epi32(w, w);
+			w = _mm_unpacklo_epi32(w, w);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 4;
+			len -= 4;
+		}
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		c1 = _mm_cvtsi128_si32(acc);
+		c2 = _mm_cvtsi128_si32(_mm_srli_si128(acc, 4));
+		while (len-- > 0)
+		{
+			c1 += *min++ * *contrib;
+			c2 += *min++ * *contrib++;
+		}
+		dst[0] = c1;
+		dst[1] = c2;
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp4(int *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 4);
+	step = 4;
+	if (weights->flip)
+	{
+		dst += 4*(weights->count-1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = zero;
+
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		while (len >= 2)
+		{
+			/* r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1 */
+			__m128i s = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)min), zero);
+			__m128i w = _mm_set1_epi32((contrib[1] << 16) | (contrib[0] & 0xffff));
+			s = _mm_unpacklo_epi16(s, _mm_srli_si128(s, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 2;
+			len -= 2;
+		}
+		if (len > 0)
+		{
+			int v;
+			__m128i s;
+			memcpy(&v, min, 4);
+			s = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+			s = _mm_unpacklo_epi16(s, zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, _mm_set1_epi32(*contrib & 0xffff)));
+			contrib++;
+		}
+		_mm_storeu_si128((__m128i *)dst, acc);
+		dst += step;
+	}
+}
+
+static void
+scale_row_from_temp(unsigned char *dst, int *src, fz_weights *weights, int width, int row)
+{
+	int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	/* Do 4 output samples at a time */
+	for (x=width; x >= 4; x -= 4)
+	{
+		int *min = src;
+		__m128i val = _mm_set1_epi32(1<<15);
+		int len2 = len;
+		int *contrib2 = contrib;
+		int out;
+
+		while (len2-- > 0)
+		{
+			__m128i s = _mm_loadu_si128((__m128i *)min);
+			val = _mm_add_epi32(val, mul_epi32_lo(s, _mm_set1_epi32(*contrib2++)));
+			min += width;
+		}
+		/* >>16 then clamp to 0..255 by saturating packs */
+		val = _mm_srai_epi32(val, 16);
+		val = _mm_packs_epi32(val, val);
+		val = _mm_packus_epi16(val, val);
+		out = _mm_cvtsi128_si32(val);
+		memcpy(dst, &out, 4);
+		dst += 4;
+		src += 4;
+	}
+	for (; x > 0; x--)
+	{
+		int *min = src;
+		int val = 0;
+		int len2 = len;
+		int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		val = (val+(1<<15))>>16;
+		if (val < 0)
+			val = 0;
+		else if (val > 255)
+			val = 255;
+		*dst++ = val;
+		src++;
+	}
+}
+
 #else
 
 static void
@@ -1196,6 +1529,12 @@ scale_single_col(unsigned char *dst, unsigned char *src, fz_weights *weights, in
 
 fz_pixmap *
 fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_bbox *clip)
+{
+	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
+}
+
+fz_pixmap *
+fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_bbox *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
 {
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
@@ -1332,20 +1671,22 @@ fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, floa
 			contrib_cols = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_cols = make_weights(ctx, src->w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x);
+			contrib_cols = make_weights_cached(ctx, cache_x, src->w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x);
 #ifdef SINGLE_PIXEL_SPECIALS
 		if (src->h == 1)
 			contrib_rows = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_rows = make_weights(ctx, src->h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y);
+			contrib_rows = make_weights_cached(ctx, cache_y, src->h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y);
 
 		output = fz_new_pixmap(ctx, src->colorspace, patch.x1 - patch.x0, patch.y1 - patch.y0);
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, contrib_cols);
-		fz_free(ctx, contrib_rows);
+		if (!cache_x)
+			fz_free(ctx, contrib_cols);
+		if (!cache_y)
+			fz_free(ctx, contrib_rows);
 		fz_rethrow(ctx);
 	}
 	output->x = dst_x_int;
@@ -1388,8 +1729,10 @@ fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, floa
 		fz_catch(ctx)
 		{
 			fz_drop_pixmap(ctx, output);
-			fz_free(ctx, contrib_cols);
-			fz_free(ctx, contrib_rows);
+			if (!cache_x)
+				fz_free(ctx, contrib_cols);
+			if (!cache_y)
+				fz_free(ctx, contrib_rows);
 			fz_rethrow(ctx);
 		}
 		switch (src->n)
@@ -1434,7 +1777,9 @@ fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, floa
 	}
 
 cleanup:
-	fz_free(ctx, contrib_rows);
-	fz_free(ctx, contrib_cols);
+	if (!cache_y)
+		fz_free(ctx, contrib_rows);
+	if (!cache_x)
+		fz_free(ctx, contrib_cols);
 	return output;
 }
@@ -6,6 +6,8 @@ fz_free_context(fz_context *ctx)
 	if (!ctx)
 		return;
 
+	fz_disable_alloc_stats(ctx);
+
 	/* Other finalisation calls go here (in reverse order) */
 	fz_drop_glyph_cache_context(ctx);
 	fz_drop_store_context(ctx);
@@ -114,6 +116,30 @@ fz_clone_context(fz_context *ctx)
 	return fz_clone_context_internal(ctx);
 }
 
+fz_context *
+fz_clone_context_private(fz_context *ctx, unsigned int max_store)
+{
+	fz_context *new_ctx = fz_clone_context(ctx);
+
+	if (new_ctx == NULL)
+		return NULL;
+	fz_drop_store_context(new_ctx);
+	new_ctx->store = NULL;
+	fz_drop_glyph_cache_context(new_ctx);
+	new_ctx->glyph_cache = NULL;
+	fz_try(new_ctx)
+	{
+		fz_new_store_context(new_ctx, max_store);
+		fz_new_glyph_cache_context(new_ctx);
+	}
+	fz_catch(new_ctx)
+	{
+		fz_free_context(new_ctx);
+		return NULL;
+	}
+	return new_ctx;
+}
+
 fz_context *
 fz_clone_context_internal(fz_context *ctx)
 {
@@ -1,16 +1,27 @@
 #include "fitz-internal.h"
 
+static void stats_add(fz_context *ctx, void *p, unsigned int size);
+static void stats_remove(fz_context *ctx, void *p);
+
 static void *
 do_scavenging_malloc(fz_context *ctx, unsigned int size)
 {
 	void *p;
 	int phase = 0;
 
+	if (ctx->profile)
+	{
+		ctx->profile->allocs++;
+		ctx->profile->alloc_bytes += size;
+	}
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		p = ctx->alloc->malloc(ctx->alloc->user, size);
 		if (p != NULL)
 		{
+			if (ctx->alloc_stats)
+				stats_add(ctx, p, size);
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
 			return p;
 		}
@@ -26,11 +37,23 @@ do_scavenging_realloc(fz_context *ctx, void *p, unsigned int size)
 	void *q;
 	int phase = 0;
 
+	if (ctx->profile)
+	{
+		ctx->profile->allocs++;
+		ctx->profile->alloc_bytes += size;
+	}
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	do {
 		q = ctx->alloc->realloc(ctx->alloc->user, p, size);
 		if (q != NULL)
 		{
+			if (ctx->alloc_stats)
+			{
+				if (p)
+					stats_remove(ctx, p);
+				stats_add(ctx, q, size);
+			}
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
 			return q;
 		}
@@ -178,6 +201,8 @@ void
 fz_free(fz_context *ctx, void *p)
 {
 	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (ctx->alloc_stats && p)
+		stats_remove(ctx, p);
 	ctx->alloc->free(ctx->alloc->user, p);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
@@ -201,6 +226,342 @@ fz_strdup_no_throw(fz_context *ctx, char *s)
 	return ns;
 }
 
+/*
+ * Allocation statistics.
+ *
+ * The size and tag of every live block are kept in an open addressing
+ * table keyed on the block address, so that frees can be charged back.
+ * The table belongs to a single context and is only touched with the
+ * alloc lock held; it is allocated straight from the allocator so that
+ * it does not account for itself.
+ */
+
+typedef struct fz_alloc_record_s fz_alloc_record;
+
+struct fz_alloc_record_s
+{
+	void *ptr;
+	unsigned int size;
+	int tag;
+};
+
+struct fz_alloc_stats_context_s
+{
+	fz_alloc_stats stats;
+	fz_alloc_record *table;
+	int cap, load;
+};
+
+static inline unsigned int
+ptr_hash(void *p, int cap)
+{
+	return (unsigned int)(((size_t)p >> 4) * 2654435761u) & (cap - 1);
+}
+
+static int
+stats_grow(fz_context *ctx, fz_alloc_stats_context *as)
+{
+	fz_alloc_record *old = as->table;
+	int oldcap = as->cap;
+	int cap = oldcap ? oldcap * 2 : 4096;
+	unsigned int pos;
+	int i;
+
+	as->table = ctx->alloc->malloc(ctx->alloc->user, cap * sizeof(fz_alloc_record));
+	if (!as->table)
+	{
+		as->table = old;
+		return 0;
+	}
+	memset(as->table, 0, cap * sizeof(fz_alloc_record));
+	as->cap = cap;
+	for (i = 0; i < oldcap; i++)
+	{
+		if (!old[i].ptr)
+			continue;
+		pos = ptr_hash(old[i].ptr, cap);
+		while (as->table[pos].ptr)
+			pos = (pos + 1) & (cap - 1);
+		as->table[pos] = old[i];
+	}
+	if (old)
+		ctx->alloc->free(ctx->alloc->user, old);
+	return 1;
+}
+
+static void
+stats_add(fz_context *ctx, void *p, unsigned int size)
+{
+	fz_alloc_stats_context *as = ctx->alloc_stats;
+	fz_alloc_stats *st = &as->stats;
+	int tag = ctx->alloc_tag;
+	unsigned int limit = 16;
+	unsigned int pos;
+	int cls = 0;
+
+	while (size > limit && cls < FZ_ALLOC_SIZE_CLASSES - 1)
+	{
+		limit <<= 2;
+		cls++;
+	}
+	st->size_class[cls]++;
+	st->count[tag]++;
+	st->total[tag] += size;
+
+	/* If the table cannot grow the block is counted but not tracked */
+	if (as->load * 2 >= as->cap && !stats_grow(ctx, as))
+		return;
+
+	pos = ptr_hash(p, as->cap);
+	while (as->table[pos].ptr)
+		pos = (pos + 1) & (as->cap - 1);
+	as->table[pos].ptr = p;
+	as->table[pos].size = size;
+	as->table[pos].tag = tag;
+	as->load++;
+
+	st->live[tag] += size;
+	st->current += size;
+	if (st->current > st->peak)
+		st->peak = st->current;
+}
+
+static void
+stats_remove(fz_context *ctx, void *p)
+{
+	fz_alloc_stats_context *as = ctx->alloc_stats;
+	fz_alloc_record *table = as->table;
+	int mask = as->cap - 1;
+	unsigned int pos, next, home;
+
+	if (!table)
+		return;
+
+	pos = ptr_hash(p, as->cap);
+	while (table[pos].ptr != p)
+	{
+		if (!table[pos].ptr)
+			return; /* not ours */
+		pos = (pos + 1) & mask;
+	}
+
+	as->stats.live[table[pos].tag] -= table[pos].size;
+	as->stats.current -= table[pos].size;
+	as->load--;
+
+	/* Shift back any following records that probed past this slot */
+	next = pos;
+	while (1)
+	{
+		next = (next + 1) & mask;
+		if (!table[next].ptr)
+			break;
+		home = ptr_hash(table[next].ptr, as->cap);
+		if (((next - home) & mask) >= ((next - pos) & mask))
+		{
+			table[pos] = table[next];
+			pos = next;
+		}
+	}
+	table[pos].ptr = NULL;
+}
+
+int
+fz_enable_alloc_stats(fz_context *ctx)
+{
+	fz_alloc_stats_context *as;
+
+	if (ctx->alloc_stats)
+	{
+		/* Restart the counters from the blocks that are still live */
+		fz_alloc_stats *st;
+		int i;
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		as = ctx->alloc_stats;
+		st = &as->stats;
+		memset(st, 0, sizeof *st);
+		for (i = 0; i < as->cap; i++)
+		{
+			if (as->table[i].ptr)
+			{
+				st->live[as->table[i].tag] += as->table[i].size;
+				st->current += as->table[i].size;
+			}
+		}
+		st->peak = st->current;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return 1;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	as = ctx->alloc->malloc(ctx->alloc->user, sizeof *as);
+	if (as)
+	{
+		memset(as, 0, sizeof *as);
+		ctx->alloc_stats = as;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return as != NULL;
+}
+
+void
+fz_disable_alloc_stats(fz_context *ctx)
+{
+	fz_alloc_stats_context *as = ctx->alloc_stats;
+
+	if (!as)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	ctx->alloc_stats = NULL;
+	if (as->table)
+		ctx->alloc->free(ctx->alloc->user, as->table);
+	ctx->alloc->free(ctx->alloc->user, as);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+fz_alloc_stats *
+fz_get_alloc_stats(fz_context *ctx)
+{
+	return ctx->alloc_stats ? &ctx->alloc_stats->stats : NULL;
+}
+
+int
+fz_set_alloc_tag(fz_context *ctx, int tag)
+{
+	int old = ctx->alloc_tag;
+	if (tag >= 0 && tag < FZ_ALLOC_TAGS)
+		ctx->alloc_tag = tag;
+	return old;
+}
+
+void
+fz_print_alloc_stats(fz_context *ctx, FILE *out)
+{
+	static const char *tags[FZ_ALLOC_TAGS] = {
+		"other", "document", "interpret", "draw", "glyph", "image", "arena"
+	};
+	fz_alloc_stats *st = fz_get_alloc_stats(ctx);
+	unsigned int limit = 16;
+	int i;
+
+	if (!st)
+		return;
+	fprintf(out, "allocations: peak %.0fk, live %.0fk\n", st->peak / 1024, st->current / 1024);
+	for (i = 0; i < FZ_ALLOC_TAGS; i++)
+		if (st->count[i])
+			fprintf(out, "\t%-10s %8d blocks %10.0fk total %10.0fk live\n",
+				tags[i], st->count[i], st->total[i] / 1024, st->live[i] / 1024);
+	for (i = 0; i < FZ_ALLOC_SIZE_CLASSES; i++, limit <<= 2)
+	{
+		if (i < FZ_ALLOC_SIZE_CLASSES - 1)
+			fprintf(out, "\t<= %-7u %8d blocks\n", limit, st->size_class[i]);
+		else
+			fprintf(out, "\t>  %-7u %8d blocks\n", limit >> 2, st->size_class[i]);
+	}
+}
+
+/*
+ * Arenas.
+ */
+
+#define ARENA_BLOCK_SIZE (64 << 10)
+#define ARENA_ALIGN (sizeof(double) - 1)
+
+typedef struct fz_arena_block_s fz_arena_block;
+
+struct fz_arena_block_s
+{
+	fz_arena_block *next;
+	unsigned int used, size;
+};
+
+struct fz_arena_s
+{
+	fz_arena_block *head;
+	unsigned int block_size;
+};
+
+#define ARENA_HEADER ((sizeof(fz_arena_block) + ARENA_ALIGN) & ~ARENA_ALIGN)
+
+fz_arena *
+fz_new_arena(fz_context *ctx, unsigned int block_size)
+{
+	fz_arena *arena = fz_malloc_struct(ctx, fz_arena);
+	arena->head = NULL;
+	arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+	return arena;
+}
+
+void *
+fz_arena_alloc(fz_context *ctx, fz_arena *arena, unsigned int size)
+{
+	fz_arena_block *block = arena->head;
+	char *p;
+
+	size = (size + ARENA_ALIGN) & ~ARENA_ALIGN;
+	if (!block || block->used + size > block->size)
+	{
+		unsigned int bsize = MAX(arena->block_size, size + ARENA_HEADER);
+		int tag = fz_set_alloc_tag(ctx, FZ_ALLOC_ARENA);
+		block = fz_malloc_no_throw(ctx, bsize);
+		fz_set_alloc_tag(ctx, tag);
+		if (!block)
+			fz_throw(ctx, "arena allocation of %u bytes failed", size);
+		block->used = ARENA_HEADER;
+		block->size = bsize;
+		/* Keep a partly used block in front if the new one is an outsize one */
+		if (arena->head && bsize > arena->block_size)
+		{
+			block->next = arena->head->next;
+			arena->head->next = block;
+		}
+		else
+		{
+			block->next = arena->head;
+			arena->head = block;
+		}
+	}
+	p = (char *)block + block->used;
+	block->used += size;
+	return p;
+}
+
+void
+fz_reset_arena(fz_context *ctx, fz_arena *arena)
+{
+	fz_arena_block *block, *next, *keep = NULL;
+
+	for (block = arena->head; block; block = next)
+	{
+		next = block->next;
+		if (!keep && block->size == arena->block_size)
+			keep = block;
+		else
+			fz_free(ctx, block);
+	}
+	if (keep)
+	{
+		keep->next = NULL;
+		keep->used = ARENA_HEADER;
+	}
+	arena->head = keep;
+}
+
+void
+fz_free_arena(fz_context *ctx, fz_arena *arena)
+{
+	fz_arena_block *block, *next;
+
+	if (!arena)
+		return;
+	for (block = arena->head; block; block = next)
+	{
+		next = block->next;
+		fz_free(ctx, block);
+	}
+	fz_free(ctx, arena);
+}
+
 static void *
 fz_malloc_default(void *opaque, unsigned int size)
 {
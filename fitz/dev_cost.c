@@ -0,0 +1,406 @@
+#include "fitz-internal.h"
+
+/*
+ * Rough per-operation costs of the draw device in nanoseconds, with 8
+ * bits of antialiasing, fitted to timings of an optimised build. They
+ * are meant to rank pages and to decide when to degrade rendering; a
+ * single estimate may be off by a factor of two or more (for example
+ * when an image cannot be decoded at a reduced size).
+ */
+#define COST_PAGE 250000.0f /* per page, for pixmap and device setup */
+#define COST_OBJECT 600.0f /* per path, text, shading or image object */
+#define COST_SEGMENT 900.0f /* per path segment after flattening */
+#define COST_GLYPH 330.0f /* per glyph, assuming the glyph cache is warm */
+#define COST_FILL 5.0f /* per pixel covered by a path, glyph or shading */
+#define COST_DECODE 5.0f /* per image sample decoded */
+#define COST_CONVERT 10.0f /* per image sample converted to another colorspace */
+#define COST_PAINT 20.0f /* per pixel of a painted image */
+#define COST_GROUP 3.0f /* per pixel of a clip mask, soft mask or group */
+#define COST_CLEAR 0.2f /* per pixel of the page */
+
+#define STACK_SIZE 96
+
+typedef struct fz_cost_device_s fz_cost_device;
+
+struct fz_cost_device_s
+{
+	fz_context *ctx;
+	fz_render_cost *cost;
+	fz_bbox bbox;
+	fz_colorspace *colorspace;
+	int n;
+	int top;
+	float stack[STACK_SIZE];
+	float stack_area;
+	float max_stack_area;
+	fz_hash_table *seen; /* images already counted as decoded */
+};
+
+static float
+bbox_area(fz_cost_device *cdev, fz_rect rect)
+{
+	fz_bbox bbox = fz_intersect_bbox(fz_bbox_covering_rect(rect), cdev->bbox);
+	if (fz_is_empty_bbox(bbox))
+		return 0;
+	return (float)(bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0);
+}
+
+/* Mirror the draw device stack: every clip, mask and group may allocate
+ * a pixmap (and a mask) of its area until it is popped again. */
+static void
+push_area(fz_cost_device *cdev, float area)
+{
+	if (area > 0)
+	{
+		cdev->cost->groups++;
+		cdev->cost->group_area += area;
+	}
+	if (cdev->top < STACK_SIZE)
+		cdev->stack[cdev->top] = area;
+	cdev->top++;
+	cdev->stack_area += area;
+	if (cdev->stack_area > cdev->max_stack_area)
+		cdev->max_stack_area = cdev->stack_area;
+}
+
+static void
+pop_area(fz_cost_device *cdev)
+{
+	if (cdev->top == 0)
+		return;
+	cdev->top--;
+	if (cdev->top < STACK_SIZE)
+		cdev->stack_area -= cdev->stack[cdev->top];
+}
+
+static void
+count_path(fz_render_cost *cost, fz_path *path, fz_matrix ctm, int edges)
+{
+	int split = 2 + (int)sqrtf(fz_matrix_expansion(ctm));
+	int i = 0;
+
+	cost->paths++;
+	while (i < path->len)
+	{
+		switch (path->items[i++].k)
+		{
+		case FZ_MOVETO:
+		case FZ_LINETO:
+			cost->segments += edges;
+			i += 2;
+			break;
+		case FZ_CURVETO:
+			/* curves flatten into more edges the larger they are drawn */
+			cost->segments += split * edges;
+			i += 6;
+			break;
+		case FZ_CLOSE_PATH:
+			break;
+		}
+	}
+}
+
+static void
+count_text(fz_cost_device *cdev, fz_text *text, fz_matrix ctm)
+{
+	fz_render_cost *cost = cdev->cost;
+	cost->texts++;
+	cost->glyphs += text->len;
+	cost->fill_area += bbox_area(cdev, fz_bound_text(cdev->ctx, text, ctm));
+}
+
+static void
+count_image(fz_cost_device *cdev, fz_image *image, fz_matrix ctm)
+{
+	fz_render_cost *cost = cdev->cost;
+	float area = bbox_area(cdev, fz_transform_rect(ctm, fz_unit_rect));
+	int w, h, factor;
+
+	cost->images++;
+	cost->image_area += area;
+	if (area == 0 || image->w == 0 || image->h == 0)
+		return;
+
+	/* Every use converts the decoded image to our colorspace. Mirror
+	 * the subsampling factor asked for when the image is decoded. */
+	if (image->colorspace && image->colorspace != cdev->colorspace)
+	{
+		w = sqrtf(ctm.a * ctm.a + ctm.b * ctm.b);
+		h = sqrtf(ctm.c * ctm.c + ctm.d * ctm.d);
+		for (factor = 1; image->w/(2*factor) >= w && image->h/(2*factor) >= h && factor < 8; factor *= 2);
+		cost->convert_samples += ((float)image->w / factor) * ((float)image->h / factor);
+	}
+
+	/* Not every decoder can subsample, so assume the whole image is
+	 * decoded; but decoded images are kept in the store, so only once */
+	if (!cdev->seen)
+		cdev->seen = fz_new_hash_table(cdev->ctx, 37, sizeof(fz_image *), -1);
+	if (fz_hash_find(cdev->ctx, cdev->seen, &image))
+		return;
+	fz_hash_insert(cdev->ctx, cdev->seen, &image, image);
+	cost->decode_samples += (float)image->w * image->h;
+}
+
+static void
+fz_cost_fill_path(fz_device *dev, fz_path *path, int even_odd, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_cost_device *cdev = dev->user;
+	count_path(cdev->cost, path, ctm, 1);
+	cdev->cost->fill_area += bbox_area(cdev, fz_bound_path(dev->ctx, path, NULL, ctm));
+}
+
+static void
+fz_cost_stroke_path(fz_device *dev, fz_path *path, fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_cost_device *cdev = dev->user;
+	/* stroking outlines each flattened segment with (at least) two edges */
+	count_path(cdev->cost, path, ctm, 2);
+	cdev->cost->fill_area += bbox_area(cdev, fz_bound_path(dev->ctx, path, stroke, ctm));
+}
+
+static void
+fz_cost_clip_path(fz_device *dev, fz_path *path, fz_rect *rect, int even_odd, fz_matrix ctm)
+{
+	fz_cost_device *cdev = dev->user;
+	fz_rect r;
+	count_path(cdev->cost, path, ctm, 1);
+	if (fz_is_rect_path(path, ctm, &r))
+		push_area(cdev, 0);
+	else
+		push_area(cdev, bbox_area(cdev, fz_bound_path(dev->ctx, path, NULL, ctm)));
+}
+
+static void
+fz_cost_clip_stroke_path(fz_device *dev, fz_path *path, fz_rect *rect, fz_stroke_state *stroke, fz_matrix ctm)
+{
+	fz_cost_device *cdev = dev->user;
+	count_path(cdev->cost, path, ctm, 2);
+	push_area(cdev, bbox_area(cdev, fz_bound_path(dev->ctx, path, stroke, ctm)));
+}
+
+static void
+fz_cost_fill_text(fz_device *dev, fz_text *text, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	count_text(dev->user, text, ctm);
+}
+
+static void
+fz_cost_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	count_text(dev->user, text, ctm);
+}
+
+static void
+fz_cost_clip_text(fz_device *dev, fz_text *text, fz_matrix ctm, int accumulate)
+{
+	fz_cost_device *cdev = dev->user;
+	count_text(cdev, text, ctm);
+	/* accumulated clip text extends the clip pushed by the first call */
+	if (accumulate == 0 || accumulate == 1)
+		push_area(cdev, bbox_area(cdev, fz_bound_text(dev->ctx, text, ctm)));
+}
+
+static void
+fz_cost_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, fz_matrix ctm)
+{
+	fz_cost_device *cdev = dev->user;
+	count_text(cdev, text, ctm);
+	push_area(cdev, bbox_area(cdev, fz_bound_text(dev->ctx, text, ctm)));
+}
+
+static void
+fz_cost_fill_shade(fz_device *dev, fz_shade *shade, fz_matrix ctm, float alpha)
+{
+	fz_cost_device *cdev = dev->user;
+	cdev->cost->shades++;
+	cdev->cost->fill_area += bbox_area(cdev, fz_bound_shade(dev->ctx, shade, ctm));
+}
+
+static void
+fz_cost_fill_image(fz_device *dev, fz_image *image, fz_matrix ctm, float alpha)
+{
+	count_image(dev->user, image, ctm);
+}
+
+static void
+fz_cost_fill_image_mask(fz_device *dev, fz_image *image, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	count_image(dev->user, image, ctm);
+}
+
+static void
+fz_cost_clip_image_mask(fz_device *dev, fz_image *image, fz_rect *rect, fz_matrix ctm)
+{
+	fz_cost_device *cdev = dev->user;
+	count_image(cdev, image, ctm);
+	push_area(cdev, bbox_area(cdev, fz_transform_rect(ctm, fz_unit_rect)));
+}
+
+static void
+fz_cost_pop_clip(fz_device *dev)
+{
+	pop_area(dev->user);
+}
+
+static void
+fz_cost_begin_mask(fz_device *dev, fz_rect rect, int luminosity, fz_colorspace *colorspace, float *bc)
+{
+	fz_cost_device *cdev = dev->user;
+	push_area(cdev, bbox_area(cdev, rect));
+}
+
+static void
+fz_cost_begin_group(fz_device *dev, fz_rect rect, int isolated, int knockout, int blendmode, float alpha)
+{
+	fz_cost_device *cdev = dev->user;
+	push_area(cdev, bbox_area(cdev, rect));
+}
+
+static void
+fz_cost_end_group(fz_device *dev)
+{
+	pop_area(dev->user);
+}
+
+static void
+fz_cost_begin_tile(fz_device *dev, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm)
+{
+	fz_cost_device *cdev = dev->user;
+	push_area(cdev, bbox_area(cdev, fz_transform_rect(ctm, view)));
+}
+
+static void
+fz_cost_end_tile(fz_device *dev)
+{
+	pop_area(dev->user);
+}
+
+static void
+fz_cost_free_user(fz_device *dev)
+{
+	fz_cost_device *cdev = dev->user;
+	fz_render_cost *cost = cdev->cost;
+
+	/* destination, one pixmap and mask per open clip or group, and the
+	 * decoded images (which the store keeps alive while we draw) */
+	cost->memory = (cost->page_area + cdev->max_stack_area * 2) * (cdev->n + 1);
+	cost->memory += cost->decode_samples * (cdev->n + 1);
+	cost->time = fz_estimate_render_time(cost, 0, fz_aa_level(cdev->ctx));
+
+	if (cdev->seen)
+		fz_free_hash(cdev->ctx, cdev->seen);
+	fz_free(cdev->ctx, cdev);
+}
+
+fz_device *
+fz_new_cost_device(fz_context *ctx, fz_render_cost *cost, fz_bbox bbox, fz_colorspace *colorspace)
+{
+	fz_device *dev;
+	fz_cost_device *cdev = fz_malloc_struct(ctx, fz_cost_device);
+
+	memset(cost, 0, sizeof *cost);
+	if (!fz_is_empty_bbox(bbox))
+		cost->page_area = (float)(bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0);
+	cdev->ctx = ctx;
+	cdev->cost = cost;
+	cdev->bbox = bbox;
+	cdev->colorspace = colorspace;
+	cdev->n = colorspace ? colorspace->n : 0;
+
+	fz_try(ctx)
+	{
+		dev = fz_new_device(ctx, cdev);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cdev);
+		fz_rethrow(ctx);
+	}
+
+	dev->free_user = fz_cost_free_user;
+
+	dev->fill_path = fz_cost_fill_path;
+	dev->stroke_path = fz_cost_stroke_path;
+	dev->clip_path = fz_cost_clip_path;
+	dev->clip_stroke_path = fz_cost_clip_stroke_path;
+
+	dev->fill_text = fz_cost_fill_text;
+	dev->stroke_text = fz_cost_stroke_text;
+	dev->clip_text = fz_cost_clip_text;
+	dev->clip_stroke_text = fz_cost_clip_stroke_text;
+
+	dev->fill_shade = fz_cost_fill_shade;
+	dev->fill_image = fz_cost_fill_image;
+	dev->fill_image_mask = fz_cost_fill_image_mask;
+	dev->clip_image_mask = fz_cost_clip_image_mask;
+
+	dev->pop_clip = fz_cost_pop_clip;
+	dev->begin_mask = fz_cost_begin_mask;
+	dev->begin_group = fz_cost_begin_group;
+	dev->end_group = fz_cost_end_group;
+	dev->begin_tile = fz_cost_begin_tile;
+	dev->end_tile = fz_cost_end_tile;
+
+	return dev;
+}
+
+/* Fraction of the full cost of edge and fill work at each level of
+ * antialiasing; the subsampling grids in draw_edge.c shrink with the
+ * level, but scan conversion still has to visit every pixel. */
+static float
+aa_scale(int bits)
+{
+	if (bits > 6)
+		return 1;
+	if (bits > 4)
+		return 0.85f;
+	if (bits > 2)
+		return 0.7f;
+	if (bits > 0)
+		return 0.65f;
+	return 0.2f;
+}
+
+float
+fz_estimate_render_time(fz_render_cost *cost, int draft, int aa_bits)
+{
+	float aa = aa_scale(aa_bits);
+	float ns;
+
+	ns = COST_PAGE;
+	ns += COST_OBJECT * (cost->paths + cost->texts + cost->images + cost->shades);
+	ns += COST_SEGMENT * aa * cost->segments;
+	ns += COST_GLYPH * cost->glyphs;
+	ns += COST_FILL * aa * cost->fill_area;
+	ns += COST_DECODE * cost->decode_samples;
+	/* draft devices ask for one more level of image subsampling */
+	ns += COST_CONVERT * cost->convert_samples / (draft ? 4 : 1);
+	ns += COST_PAINT * cost->image_area;
+	ns += COST_GROUP * cost->group_area;
+	ns += COST_CLEAR * cost->page_area;
+
+	return ns / 1000000;
+}
+
+int
+fz_fit_render_budget(fz_render_cost *cost, float budget, int *aa_bits)
+{
+	int bits = *aa_bits;
+
+	if (fz_estimate_render_time(cost, 0, bits) <= budget)
+		return 0;
+
+	/* Degrade image resolution first, then antialiasing */
+	while (bits > 0 && fz_estimate_render_time(cost, 1, bits) > budget)
+		bits -= 2;
+	if (bits < 0)
+		bits = 0;
+
+	*aa_bits = bits;
+	return 1;
+}
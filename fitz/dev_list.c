@@ -582,8 +582,8 @@ fz_free_display_list(fz_context *ctx, fz_display_list *list)
 	fz_free(ctx, list);
 }
 
-void
-fz_run_display_list(fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_bbox scissor, fz_cookie *cookie)
+static void
+run_display_list(fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_bbox scissor, fz_cookie *cookie)
 {
 	fz_display_node *node;
 	fz_matrix ctm;
@@ -748,3 +748,23 @@ visible:
 		}
 	}
 }
+
+void
+fz_run_display_list(fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_bbox scissor, fz_cookie *cookie)
+{
+	fz_context *ctx = dev->ctx;
+	int tag = fz_set_alloc_tag(ctx, FZ_ALLOC_DRAW);
+
+	fz_try(ctx)
+	{
+		run_display_list(list, dev, top_ctm, scissor, cookie);
+	}
+	fz_always(ctx)
+	{
+		fz_set_alloc_tag(ctx, tag);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
@@ -0,0 +1,495 @@
+#include "fitz-internal.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static const char *fz_profile_call_names[FZ_PROFILE_CALLS] =
+{
+	"fill_path", "stroke_path", "clip_path", "clip_stroke_path",
+	"fill_text", "stroke_text", "clip_text", "clip_stroke_text", "ignore_text",
+	"fill_shade", "fill_image", "fill_image_mask", "clip_image_mask",
+	"pop_clip", "begin_mask", "end_mask", "begin_group", "end_group",
+	"begin_tile", "end_tile"
+};
+
+/* Microseconds from an arbitrary epoch */
+static double
+profile_clock(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart * 1000000 / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000.0 + now.tv_usec;
+#endif
+}
+
+fz_profile *
+fz_new_profile(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_profile);
+}
+
+void
+fz_free_profile(fz_context *ctx, fz_profile *prof)
+{
+	if (!prof)
+		return;
+	if (ctx->profile == prof)
+		ctx->profile = NULL;
+	fz_free(ctx, prof);
+}
+
+void
+fz_reset_profile(fz_context *ctx, fz_profile *prof)
+{
+	memset(prof, 0, sizeof *prof);
+}
+
+void
+fz_begin_profile(fz_context *ctx, fz_profile *prof)
+{
+	ctx->profile = prof;
+}
+
+void
+fz_end_profile(fz_context *ctx)
+{
+	ctx->profile = NULL;
+}
+
+static void
+profile_mark(fz_profile *prof, fz_profile_mark *mark)
+{
+	mark->pixels = prof->pixels;
+	mark->alloc_bytes = prof->alloc_bytes;
+	mark->time = profile_clock();
+}
+
+void
+fz_profile_start(fz_context *ctx, fz_profile_mark *mark)
+{
+	profile_mark(ctx->profile, mark);
+}
+
+static void
+profile_stop(fz_profile *prof, fz_profile_entry *entry, fz_profile_mark *mark)
+{
+	entry->count++;
+	entry->time += profile_clock() - mark->time;
+	entry->pixels += prof->pixels - mark->pixels;
+	entry->alloc_bytes += prof->alloc_bytes - mark->alloc_bytes;
+}
+
+void
+fz_profile_stop_operator(fz_context *ctx, fz_profile_mark *mark, char *name)
+{
+	fz_profile *prof = ctx->profile;
+	unsigned int h = 0;
+	char *s;
+	int i;
+
+	for (s = name; *s; s++)
+		h = h * 31 + (unsigned char)*s;
+	i = h % FZ_PROFILE_OPERATORS;
+
+	/* open addressing; operator names are few, so the table never fills
+	 * in practice, but lump any overflow into the last slot we probed */
+	while (prof->op[i].name[0] && strcmp(prof->op[i].name, name))
+	{
+		if (++i == FZ_PROFILE_OPERATORS)
+			i = 0;
+		if (i == h % FZ_PROFILE_OPERATORS)
+			break;
+	}
+	if (!prof->op[i].name[0])
+		fz_strlcpy(prof->op[i].name, name, sizeof prof->op[i].name);
+
+	profile_stop(prof, &prof->op[i].entry, mark);
+}
+
+/* Profiling device: forwards every call to the target device and
+ * records what it cost. */
+
+typedef struct fz_profile_device_s fz_profile_device;
+
+struct fz_profile_device_s
+{
+	fz_profile *prof;
+	fz_device *target;
+	fz_bbox bbox;
+};
+
+static void
+profile_begin(fz_device *dev, fz_profile_mark *mark, fz_rect rect)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_bbox bbox = fz_intersect_bbox(fz_bbox_covering_rect(rect), pdev->bbox);
+
+	profile_mark(pdev->prof, mark);
+	if (!fz_is_empty_bbox(bbox))
+		pdev->prof->pixels += (double)(bbox.x1 - bbox.x0) * (bbox.y1 - bbox.y0);
+}
+
+static void
+profile_end(fz_device *dev, fz_profile_mark *mark, int call)
+{
+	fz_profile_device *pdev = dev->user;
+	profile_stop(pdev->prof, &pdev->prof->call[call], mark);
+}
+
+static void
+fz_profile_fill_path(fz_device *dev, fz_path *path, int even_odd, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_path(dev->ctx, path, NULL, ctm));
+	fz_fill_path(pdev->target, path, even_odd, ctm, colorspace, color, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_FILL_PATH);
+}
+
+static void
+fz_profile_stroke_path(fz_device *dev, fz_path *path, fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_path(dev->ctx, path, stroke, ctm));
+	fz_stroke_path(pdev->target, path, stroke, ctm, colorspace, color, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_STROKE_PATH);
+}
+
+static void
+fz_profile_clip_path(fz_device *dev, fz_path *path, fz_rect *rect, int even_odd, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_path(dev->ctx, path, NULL, ctm));
+	fz_clip_path(pdev->target, path, rect, even_odd, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_CLIP_PATH);
+}
+
+static void
+fz_profile_clip_stroke_path(fz_device *dev, fz_path *path, fz_rect *rect, fz_stroke_state *stroke, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_path(dev->ctx, path, stroke, ctm));
+	fz_clip_stroke_path(pdev->target, path, rect, stroke, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_CLIP_STROKE_PATH);
+}
+
+static void
+fz_profile_fill_text(fz_device *dev, fz_text *text, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_text(dev->ctx, text, ctm));
+	fz_fill_text(pdev->target, text, ctm, colorspace, color, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_FILL_TEXT);
+}
+
+static void
+fz_profile_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_text(dev->ctx, text, ctm));
+	fz_stroke_text(pdev->target, text, stroke, ctm, colorspace, color, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_STROKE_TEXT);
+}
+
+static void
+fz_profile_clip_text(fz_device *dev, fz_text *text, fz_matrix ctm, int accumulate)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_text(dev->ctx, text, ctm));
+	fz_clip_text(pdev->target, text, ctm, accumulate);
+	profile_end(dev, &mark, FZ_PROFILE_CLIP_TEXT);
+}
+
+static void
+fz_profile_clip_stroke_text(fz_device *dev, fz_text *text, fz_stroke_state *stroke, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_text(dev->ctx, text, ctm));
+	fz_clip_stroke_text(pdev->target, text, stroke, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_CLIP_STROKE_TEXT);
+}
+
+static void
+fz_profile_ignore_text(fz_device *dev, fz_text *text, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_empty_rect);
+	fz_ignore_text(pdev->target, text, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_IGNORE_TEXT);
+}
+
+static void
+fz_profile_fill_shade(fz_device *dev, fz_shade *shade, fz_matrix ctm, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_bound_shade(dev->ctx, shade, ctm));
+	fz_fill_shade(pdev->target, shade, ctm, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_FILL_SHADE);
+}
+
+static void
+fz_profile_fill_image(fz_device *dev, fz_image *image, fz_matrix ctm, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_transform_rect(ctm, fz_unit_rect));
+	fz_fill_image(pdev->target, image, ctm, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_FILL_IMAGE);
+}
+
+static void
+fz_profile_fill_image_mask(fz_device *dev, fz_image *image, fz_matrix ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_transform_rect(ctm, fz_unit_rect));
+	fz_fill_image_mask(pdev->target, image, ctm, colorspace, color, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_FILL_IMAGE_MASK);
+}
+
+static void
+fz_profile_clip_image_mask(fz_device *dev, fz_image *image, fz_rect *rect, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_transform_rect(ctm, fz_unit_rect));
+	fz_clip_image_mask(pdev->target, image, rect, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_CLIP_IMAGE_MASK);
+}
+
+static void
+fz_profile_pop_clip(fz_device *dev)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_empty_rect);
+	fz_pop_clip(pdev->target);
+	profile_end(dev, &mark, FZ_PROFILE_POP_CLIP);
+}
+
+static void
+fz_profile_begin_mask(fz_device *dev, fz_rect rect, int luminosity, fz_colorspace *colorspace, float *bc)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, rect);
+	fz_begin_mask(pdev->target, rect, luminosity, colorspace, bc);
+	profile_end(dev, &mark, FZ_PROFILE_BEGIN_MASK);
+}
+
+static void
+fz_profile_end_mask(fz_device *dev)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_empty_rect);
+	fz_end_mask(pdev->target);
+	profile_end(dev, &mark, FZ_PROFILE_END_MASK);
+}
+
+static void
+fz_profile_begin_group(fz_device *dev, fz_rect rect, int isolated, int knockout, int blendmode, float alpha)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, rect);
+	fz_begin_group(pdev->target, rect, isolated, knockout, blendmode, alpha);
+	profile_end(dev, &mark, FZ_PROFILE_BEGIN_GROUP);
+}
+
+static void
+fz_profile_end_group(fz_device *dev)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_empty_rect);
+	fz_end_group(pdev->target);
+	profile_end(dev, &mark, FZ_PROFILE_END_GROUP);
+}
+
+static void
+fz_profile_begin_tile(fz_device *dev, fz_rect area, fz_rect view, float xstep, float ystep, fz_matrix ctm)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_transform_rect(ctm, area));
+	fz_begin_tile(pdev->target, area, view, xstep, ystep, ctm);
+	profile_end(dev, &mark, FZ_PROFILE_BEGIN_TILE);
+}
+
+static void
+fz_profile_end_tile(fz_device *dev)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_profile_mark mark;
+	profile_begin(dev, &mark, fz_empty_rect);
+	fz_end_tile(pdev->target);
+	profile_end(dev, &mark, FZ_PROFILE_END_TILE);
+}
+
+static void
+fz_profile_free_user(fz_device *dev)
+{
+	fz_profile_device *pdev = dev->user;
+	fz_free_device(pdev->target);
+	fz_free(dev->ctx, pdev);
+}
+
+fz_device *
+fz_new_profile_device(fz_context *ctx, fz_profile *prof, fz_device *target, fz_bbox bbox)
+{
+	fz_device *dev;
+	fz_profile_device *pdev = fz_malloc_struct(ctx, fz_profile_device);
+
+	pdev->prof = prof;
+	pdev->target = target;
+	pdev->bbox = bbox;
+
+	fz_try(ctx)
+	{
+		dev = fz_new_device(ctx, pdev);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, pdev);
+		fz_rethrow(ctx);
+	}
+
+	/* The interpreters look at these to decide what to send us */
+	dev->hints = target->hints;
+	dev->flags = target->flags;
+
+	dev->free_user = fz_profile_free_user;
+
+	dev->fill_path = fz_profile_fill_path;
+	dev->stroke_path = fz_profile_stroke_path;
+	dev->clip_path = fz_profile_clip_path;
+	dev->clip_stroke_path = fz_profile_clip_stroke_path;
+
+	dev->fill_text = fz_profile_fill_text;
+	dev->stroke_text = fz_profile_stroke_text;
+	dev->clip_text = fz_profile_clip_text;
+	dev->clip_stroke_text = fz_profile_clip_stroke_text;
+	dev->ignore_text = fz_profile_ignore_text;
+
+	dev->fill_shade = fz_profile_fill_shade;
+	dev->fill_image = fz_profile_fill_image;
+	dev->fill_image_mask = fz_profile_fill_image_mask;
+	dev->clip_image_mask = fz_profile_clip_image_mask;
+
+	dev->pop_clip = fz_profile_pop_clip;
+
+	dev->begin_mask = fz_profile_begin_mask;
+	dev->end_mask = fz_profile_end_mask;
+	dev->begin_group = fz_profile_begin_group;
+	dev->end_group = fz_profile_end_group;
+
+	dev->begin_tile = fz_profile_begin_tile;
+	dev->end_tile = fz_profile_end_tile;
+
+	return dev;
+}
+
+/* Reports */
+
+static void
+print_entry_json(FILE *out, const char *name, fz_profile_entry *e, int first)
+{
+	fprintf(out, "%s\n\t\t\"%s\": {\"count\": %d, \"time\": %.0f, \"pixels\": %.0f, \"alloc\": %.0f}",
+		first ? "" : ",", name, e->count, e->time, e->pixels, e->alloc_bytes);
+}
+
+static void
+print_entry_csv(FILE *out, char *label, const char *kind, const char *name, fz_profile_entry *e)
+{
+	fprintf(out, "%s,%s,%s,%d,%.0f,%.0f,%.0f\n",
+		label, kind, name, e->count, e->time, e->pixels, e->alloc_bytes);
+}
+
+void
+fz_print_profile(fz_context *ctx, FILE *out, fz_profile *prof, int format, char *label)
+{
+	int i, first;
+
+	if (format == FZ_PROFILE_CSV)
+	{
+		for (i = 0; i < FZ_PROFILE_CALLS; i++)
+			if (prof->call[i].count)
+				print_entry_csv(out, label, "device", fz_profile_call_names[i], &prof->call[i]);
+		for (i = 0; i < FZ_PROFILE_OPERATORS; i++)
+			if (prof->op[i].entry.count)
+				print_entry_csv(out, label, "operator", prof->op[i].name, &prof->op[i].entry);
+		fprintf(out, "%s,store,hits,%d,,,\n", label, prof->store_hits);
+		fprintf(out, "%s,store,misses,%d,,,\n", label, prof->store_misses);
+		fprintf(out, "%s,glyphcache,hits,%d,,,\n", label, prof->glyph_hits);
+		fprintf(out, "%s,glyphcache,misses,%d,,,\n", label, prof->glyph_misses);
+		fprintf(out, "%s,alloc,total,%d,,,%.0f\n", label, prof->allocs, prof->alloc_bytes);
+		return;
+	}
+
+	fprintf(out, "{\n\t\"label\": \"");
+	for (i = 0; label[i]; i++)
+	{
+		if (label[i] == '"' || label[i] == '\\')
+			fputc('\\', out);
+		fputc(label[i], out);
+	}
+	fprintf(out, "\",\n\t\"device\": {");
+	for (first = 1, i = 0; i < FZ_PROFILE_CALLS; i++)
+		if (prof->call[i].count)
+		{
+			print_entry_json(out, fz_profile_call_names[i], &prof->call[i], first);
+			first = 0;
+		}
+	fprintf(out, "\n\t},\n\t\"operators\": {");
+	for (first = 1, i = 0; i < FZ_PROFILE_OPERATORS; i++)
+		if (prof->op[i].entry.count)
+		{
+			/* operator names are PDF keywords; quote the unusual ones */
+			char name[sizeof prof->op[i].name * 2];
+			char *s = prof->op[i].name, *d = name;
+			while (*s)
+			{
+				if (*s == '"' || *s == '\\')
+					*d++ = '\\';
+				*d++ = *s++;
+			}
+			*d = 0;
+			print_entry_json(out, name, &prof->op[i].entry, first);
+			first = 0;
+		}
+	fprintf(out, "\n\t},\n");
+	fprintf(out, "\t\"store\": {\"hits\": %d, \"misses\": %d},\n", prof->store_hits, prof->store_misses);
+	fprintf(out, "\t\"glyphcache\": {\"hits\": %d, \"misses\": %d},\n", prof->glyph_hits, prof->glyph_misses);
+	fprintf(out, "\t\"alloc\": {\"count\": %d, \"bytes\": %.0f}\n", prof->allocs, prof->alloc_bytes);
+	fprintf(out, "}\n");
+}
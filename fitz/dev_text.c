@@ -4,16 +4,44 @@
 #define SPACE_DIST 0.2f
 #define PARAGRAPH_DIST 0.5f
 
+#define GRID_STEP 16.0f
+#define GRID_MAX 4096
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_ADVANCES_H
 
 typedef struct fz_text_device_s fz_text_device;
+typedef struct fz_text_grid_s fz_text_grid;
+typedef struct fz_text_grid_cell_s fz_text_grid_cell;
+
+/*
+ * Blocks are indexed in rows by the bottom edge of their bbox, which
+ * is what a new line is compared against when looking for the block
+ * it continues.
+ */
+struct fz_text_grid_cell_s
+{
+	int len, cap;
+	int *blocks;
+};
+
+struct fz_text_grid_s
+{
+	float y0;
+	int n;
+	fz_text_grid_cell *cells;
+	int len, cap;
+	int *cell_of;
+};
 
 struct fz_text_device_s
 {
 	fz_text_sheet *sheet;
 	fz_text_page *page;
+	fz_text_grid grid;
+	fz_text_sink_fn *sink;
+	void *sink_arg;
 	fz_text_line cur_line;
 	fz_text_span cur_span;
 	fz_point point;
@@ -102,22 +130,28 @@ fz_new_text_page(fz_context *ctx, fz_rect mediabox)
 	return page;
 }
 
+static void
+free_line(fz_context *ctx, fz_text_line *line)
+{
+	fz_text_span *span;
+	for (span = line->spans; span < line->spans + line->len; span++)
+	{
+		fz_free(ctx, span->text);
+	}
+	fz_free(ctx, line->spans);
+}
+
 void
 fz_free_text_page(fz_context *ctx, fz_text_page *page)
 {
 	fz_text_block *block;
 	fz_text_line *line;
-	fz_text_span *span;
+	if (!page)
+		return;
 	for (block = page->blocks; block < page->blocks + page->len; block++)
 	{
 		for (line = block->lines; line < block->lines + block->len; line++)
-		{
-			for (span = line->spans; span < line->spans + line->len; span++)
-			{
-				fz_free(ctx, span->text);
-			}
-			fz_free(ctx, line->spans);
-		}
+			free_line(ctx, line);
 		fz_free(ctx, block->lines);
 	}
 	fz_free(ctx, page->blocks);
@@ -184,24 +218,144 @@ append_line(fz_context *ctx, fz_text_block *block, fz_text_line *line)
 	block->lines[block->len++] = *line;
 }
 
+static int
+grid_cell(fz_text_grid *grid, float y)
+{
+	float f = (y - grid->y0) / GRID_STEP;
+	if (!(f > 0))
+		return 0;
+	if (f >= grid->n - 1)
+		return grid->n - 1;
+	return (int)f;
+}
+
+static void
+grid_add(fz_context *ctx, fz_text_grid *grid, int cell, int block)
+{
+	fz_text_grid_cell *c = &grid->cells[cell];
+	if (c->len == c->cap)
+	{
+		int new_cap = MAX(8, c->cap * 2);
+		c->blocks = fz_resize_array(ctx, c->blocks, new_cap, sizeof(*c->blocks));
+		c->cap = new_cap;
+	}
+	c->blocks[c->len++] = block;
+}
+
+static void
+grid_remove(fz_text_grid *grid, int cell, int block)
+{
+	fz_text_grid_cell *c = &grid->cells[cell];
+	int i;
+	for (i = 0; i < c->len; i++)
+	{
+		if (c->blocks[i] == block)
+		{
+			c->blocks[i] = c->blocks[--c->len];
+			return;
+		}
+	}
+}
+
+/* Bring the index up to date with the blocks on the page */
+static void
+grid_sync(fz_context *ctx, fz_text_grid *grid, fz_text_page *page)
+{
+	if (!grid->cells)
+	{
+		float h = (page->mediabox.y1 - page->mediabox.y0) / GRID_STEP;
+		grid->y0 = page->mediabox.y0;
+		grid->n = h > 0 && h < GRID_MAX ? (int)h + 2 : 1;
+		grid->cells = fz_malloc_array(ctx, grid->n, sizeof(*grid->cells));
+		memset(grid->cells, 0, grid->n * sizeof(*grid->cells));
+	}
+
+	while (grid->len < page->len)
+	{
+		int cell = grid_cell(grid, page->blocks[grid->len].bbox.y1);
+		if (grid->len == grid->cap)
+		{
+			int new_cap = MAX(16, grid->cap * 2);
+			grid->cell_of = fz_resize_array(ctx, grid->cell_of, new_cap, sizeof(*grid->cell_of));
+			grid->cap = new_cap;
+		}
+		grid_add(ctx, grid, cell, grid->len);
+		grid->cell_of[grid->len++] = cell;
+	}
+}
+
+/* Move a block whose bbox has changed to its new row */
+static void
+grid_update(fz_context *ctx, fz_text_grid *grid, fz_text_page *page, int block)
+{
+	int cell;
+
+	if (block >= grid->len)
+	{
+		grid_sync(ctx, grid, page);
+		return;
+	}
+
+	cell = grid_cell(grid, page->blocks[block].bbox.y1);
+	if (cell != grid->cell_of[block])
+	{
+		grid_add(ctx, grid, cell, block);
+		grid_remove(grid, grid->cell_of[block], block);
+		grid->cell_of[block] = cell;
+	}
+}
+
+static void
+grid_free(fz_context *ctx, fz_text_grid *grid)
+{
+	int i;
+	for (i = 0; i < grid->n; i++)
+		fz_free(ctx, grid->cells[i].blocks);
+	fz_free(ctx, grid->cells);
+	fz_free(ctx, grid->cell_of);
+}
+
 static fz_text_block *
-lookup_block_for_line(fz_context *ctx, fz_text_page *page, fz_text_line *line)
+lookup_block_for_line(fz_context *ctx, fz_text_device *dev, fz_text_line *line)
 {
+	fz_text_page *page = dev->page;
+	fz_text_grid *grid = &dev->grid;
 	float size = line->len > 0 && line->spans[0].len > 0 ? line->spans[0].style->size : 1;
-	int i;
+	int best = page->len;
+	int i, k, start, end;
 
-	for (i = 0; i < page->len; i++)
+	grid_sync(ctx, grid, page);
+
+	/* Only rows that can hold a block ending within reach of the line,
+	 * padded by one row either side against rounding. Of the blocks
+	 * that match, take the earliest, as a linear scan would. */
+	start = MAX(grid_cell(grid, line->bbox.y0 - size * PARAGRAPH_DIST) - 1, 0);
+	end = MIN(grid_cell(grid, line->bbox.y0 + size * 1.5f) + 1, grid->n - 1);
+
+	for (k = start; k <= end; k++)
 	{
-		fz_text_block *block = page->blocks + i;
-		float w = block->bbox.x1 - block->bbox.x0;
-		float dx = line->bbox.x0 - block->bbox.x0;
-		float dy = line->bbox.y0 - block->bbox.y1;
-		if (dy > -size * 1.5f && dy < size * PARAGRAPH_DIST)
-			if (line->bbox.x0 <= block->bbox.x1 && line->bbox.x1 >= block->bbox.x0)
-				if (ABS(dx) < w / 2)
-					return block;
+		fz_text_grid_cell *cell = &grid->cells[k];
+		for (i = 0; i < cell->len; i++)
+		{
+			fz_text_block *block;
+			float w, dx, dy;
+
+			if (cell->blocks[i] >= best)
+				continue;
+			block = page->blocks + cell->blocks[i];
+			w = block->bbox.x1 - block->bbox.x0;
+			dx = line->bbox.x0 - block->bbox.x0;
+			dy = line->bbox.y0 - block->bbox.y1;
+			if (dy > -size * 1.5f && dy < size * PARAGRAPH_DIST)
+				if (line->bbox.x0 <= block->bbox.x1 && line->bbox.x1 >= block->bbox.x0)
+					if (ABS(dx) < w / 2)
+						best = cell->blocks[i];
+		}
 	}
 
+	if (best < page->len)
+		return page->blocks + best;
+
 	if (page->len == page->cap)
 	{
 		int new_cap = MAX(16, page->cap * 2);
@@ -218,11 +372,34 @@ lookup_block_for_line(fz_context *ctx, fz_text_page *page, fz_text_line *line)
 }
 
 static void
-insert_line(fz_context *ctx, fz_text_page *page, fz_text_line *line)
+insert_line(fz_context *ctx, fz_text_device *dev, fz_text_line *line)
 {
+	fz_text_block *block;
 	if (line->len == 0)
 		return;
-	append_line(ctx, lookup_block_for_line(ctx, page, line), line);
+
+	/* A sink takes each line as it is finished; nothing is kept */
+	if (dev->sink)
+	{
+		fz_try(ctx)
+		{
+			dev->sink(ctx, dev->sink_arg, line);
+		}
+		fz_always(ctx)
+		{
+			free_line(ctx, line);
+			init_line(ctx, line);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
+		}
+		return;
+	}
+
+	block = lookup_block_for_line(ctx, dev, line);
+	append_line(ctx, block, line);
+	grid_update(ctx, &dev->grid, dev->page, block - dev->page->blocks);
 }
 
 static fz_rect
@@ -239,7 +416,7 @@ static void
 fz_flush_text_line(fz_context *ctx, fz_text_device *dev, fz_text_style *style)
 {
 	append_span(ctx, &dev->cur_line, &dev->cur_span);
-	insert_line(ctx, dev->page, &dev->cur_line);
+	insert_line(ctx, dev, &dev->cur_line);
 	init_span(ctx, &dev->cur_span, style);
 	init_line(ctx, &dev->cur_line);
 }
@@ -511,7 +688,8 @@ fz_text_free_user(fz_device *dev)
 	fz_text_device *tdev = dev->user;
 
 	append_span(ctx, &tdev->cur_line, &tdev->cur_span);
-	insert_line(ctx, tdev->page, &tdev->cur_line);
+	insert_line(ctx, tdev, &tdev->cur_line);
+	grid_free(ctx, &tdev->grid);
 
 	/* TODO: smart sorting of blocks in reading order */
 	/* TODO: unicode NFC normalization */
@@ -520,14 +698,16 @@ fz_text_free_user(fz_device *dev)
 	fz_free(dev->ctx, tdev);
 }
 
-fz_device *
-fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page)
+static fz_device *
+new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page, fz_text_sink_fn *sink, void *arg)
 {
 	fz_device *dev;
 
 	fz_text_device *tdev = fz_malloc_struct(ctx, fz_text_device);
 	tdev->sheet = sheet;
 	tdev->page = page;
+	tdev->sink = sink;
+	tdev->sink_arg = arg;
 	tdev->point.x = -1;
 	tdev->point.y = -1;
 	tdev->lastchar = ' ';
@@ -546,6 +726,18 @@ fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page)
 	return dev;
 }
 
+fz_device *
+fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page)
+{
+	return new_text_device(ctx, sheet, page, NULL, NULL);
+}
+
+fz_device *
+fz_new_text_sink_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_sink_fn *sink, void *arg)
+{
+	return new_text_device(ctx, sheet, NULL, sink, arg);
+}
+
 /* XML, HTML and plain-text output */
 
 static int font_is_bold(fz_font *font)
@@ -725,30 +917,44 @@ fz_print_text_page_xml(fz_context *ctx, FILE *out, fz_text_page *page)
 }
 
 void
-fz_print_text_page(fz_context *ctx, FILE *out, fz_text_page *page)
+fz_print_text_line(fz_context *ctx, FILE *out, fz_text_line *line)
 {
-	fz_text_block *block;
-	fz_text_line *line;
 	fz_text_span *span;
 	fz_text_char *ch;
-	char utf[10];
-	int i, n;
+	char buf[256];
+	int n = 0;
 
-	for (block = page->blocks; block < page->blocks + page->len; block++)
+	/* Encode into a local buffer rather than going through stdio a
+	 * byte at a time; most characters take the one byte path. */
+	for (span = line->spans; span < line->spans + line->len; span++)
 	{
-		for (line = block->lines; line < block->lines + block->len; line++)
+		for (ch = span->text; ch < span->text + span->len; ch++)
 		{
-			for (span = line->spans; span < line->spans + line->len; span++)
+			if (n > (int)sizeof buf - 8)
 			{
-				for (ch = span->text; ch < span->text + span->len; ch++)
-				{
-					n = fz_runetochar(utf, ch->c);
-					for (i = 0; i < n; i++)
-						putc(utf[i], out);
-				}
+				fwrite(buf, 1, n, out);
+				n = 0;
 			}
-			fprintf(out, "\n");
+			if ((unsigned int)ch->c < 0x80)
+				buf[n++] = ch->c;
+			else
+				n += fz_runetochar(buf + n, ch->c);
 		}
-		fprintf(out, "\n");
+	}
+	buf[n++] = '\n';
+	fwrite(buf, 1, n, out);
+}
+
+void
+fz_print_text_page(fz_context *ctx, FILE *out, fz_text_page *page)
+{
+	fz_text_block *block;
+	fz_text_line *line;
+
+	for (block = page->blocks; block < page->blocks + page->len; block++)
+	{
+		for (line = block->lines; line < block->lines + block->len; line++)
+			fz_print_text_line(ctx, out, line);
+		putc('\n', out);
 	}
 }
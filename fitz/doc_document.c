@@ -23,8 +23,8 @@ static inline int fz_strcasecmp(char *a, char *b)
 	return fz_tolower(*a) - fz_tolower(*b);
 }
 
-fz_document *
-fz_open_document(fz_context *ctx, char *filename)
+static fz_document *
+open_document(fz_context *ctx, char *filename)
 {
 	char *ext = strrchr(filename, '.');
 	if (ext && (!fz_strcasecmp(ext, ".xps") || !fz_strcasecmp(ext, ".rels")))
@@ -45,6 +45,26 @@ fz_open_document(fz_context *ctx, char *filename)
 #endif
 }
 
+fz_document *
+fz_open_document(fz_context *ctx, char *filename)
+{
+	fz_document *doc;
+	int tag = fz_set_alloc_tag(ctx, FZ_ALLOC_DOCUMENT);
+	fz_try(ctx)
+	{
+		doc = open_document(ctx, filename);
+	}
+	fz_always(ctx)
+	{
+		fz_set_alloc_tag(ctx, tag);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+	return doc;
+}
+
 void
 fz_close_document(fz_document *doc)
 {
@@ -111,8 +131,61 @@ fz_bound_page(fz_document *doc, fz_page *page)
 void
 fz_run_page(fz_document *doc, fz_page *page, fz_device *dev, fz_matrix transform, fz_cookie *cookie)
 {
-	if (doc && doc->run_page && page)
+	fz_context *ctx;
+	int tag;
+
+	if (!doc || !doc->run_page || !page)
+		return;
+
+	ctx = dev->ctx;
+	tag = fz_set_alloc_tag(ctx, FZ_ALLOC_INTERPRET);
+	fz_try(ctx)
+	{
 		doc->run_page(doc, page, dev, transform, cookie);
+	}
+	fz_always(ctx)
+	{
+		fz_set_alloc_tag(ctx, tag);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+int
+fz_run_page_thumbnail(fz_document *doc, fz_page *page, fz_device *dev, fz_matrix transform, fz_cookie *cookie)
+{
+	fz_context *ctx;
+	fz_image *image;
+	fz_rect bounds;
+	fz_matrix ctm;
+
+	if (!doc || !doc->load_thumbnail || !page)
+		return 0;
+	image = doc->load_thumbnail(doc, page);
+	if (!image)
+		return 0;
+
+	ctx = dev->ctx;
+	fz_try(ctx)
+	{
+		bounds = fz_bound_page(doc, page);
+		ctm = fz_scale(bounds.x1 - bounds.x0, bounds.y1 - bounds.y0);
+		ctm = fz_concat(ctm, fz_translate(bounds.x0, bounds.y0));
+		ctm = fz_concat(ctm, transform);
+		fz_fill_image(dev, image, ctm, 1);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image(ctx, image);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return 1;
 }
 
 void
@@ -0,0 +1,508 @@
+#include "fitz-internal.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <pthread.h>
+#endif
+
+/* How many pages each worker may run ahead of delivery */
+#define PIPELINE_AHEAD 2
+#define PIPELINE_MAX_WORKERS 64
+
+/* How often (in ms) the delivering thread checks the cookie */
+#define PIPELINE_POLL 50
+
+typedef struct fz_pipeline_s fz_pipeline;
+typedef struct fz_pipeline_slot_s fz_pipeline_slot;
+typedef struct fz_pipeline_worker_s fz_pipeline_worker;
+
+struct fz_pipeline_slot_s
+{
+	int done;
+	int ok;
+	void *result;
+};
+
+struct fz_pipeline_worker_s
+{
+	fz_pipeline *pipe;
+	fz_context *ctx;
+	fz_document *doc;
+	fz_cookie cookie;
+	int started;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+struct fz_pipeline_s
+{
+	int first;
+	int count;
+	int next;
+	int delivered;
+	int window;
+	int running;
+	int abort;
+	fz_pipeline_begin_fn *begin;
+	void *arg;
+	fz_pipeline_slot *slots;
+#ifdef _WIN32
+	CRITICAL_SECTION mutex;
+	HANDLE cond;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+/* Just enough threading for the pipeline. Waits with a timeout of 0
+ * wait for a signal; on Windows every wait is a poll, so a lost
+ * wakeup only costs latency. */
+
+#ifdef _WIN32
+
+static int
+pipeline_init_lock(fz_pipeline *pipe)
+{
+	pipe->cond = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!pipe->cond)
+		return -1;
+	InitializeCriticalSection(&pipe->mutex);
+	return 0;
+}
+
+static void
+pipeline_fin_lock(fz_pipeline *pipe)
+{
+	DeleteCriticalSection(&pipe->mutex);
+	CloseHandle(pipe->cond);
+}
+
+static void
+pipeline_lock(fz_pipeline *pipe)
+{
+	EnterCriticalSection(&pipe->mutex);
+}
+
+static void
+pipeline_unlock(fz_pipeline *pipe)
+{
+	LeaveCriticalSection(&pipe->mutex);
+}
+
+static void
+pipeline_wait(fz_pipeline *pipe, int ms)
+{
+	LeaveCriticalSection(&pipe->mutex);
+	WaitForSingleObject(pipe->cond, ms > 0 ? ms : 10);
+	EnterCriticalSection(&pipe->mutex);
+}
+
+static void
+pipeline_signal(fz_pipeline *pipe)
+{
+	SetEvent(pipe->cond);
+}
+
+static DWORD WINAPI pipeline_thread(LPVOID worker);
+
+static int
+pipeline_start(fz_pipeline_worker *w)
+{
+	w->thread = CreateThread(NULL, 0, pipeline_thread, w, 0, NULL);
+	return w->thread ? 0 : -1;
+}
+
+static void
+pipeline_join(fz_pipeline_worker *w)
+{
+	WaitForSingleObject(w->thread, INFINITE);
+	CloseHandle(w->thread);
+}
+
+#else
+
+static int
+pipeline_init_lock(fz_pipeline *pipe)
+{
+	if (pthread_mutex_init(&pipe->mutex, NULL))
+		return -1;
+	if (pthread_cond_init(&pipe->cond, NULL))
+	{
+		pthread_mutex_destroy(&pipe->mutex);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+pipeline_fin_lock(fz_pipeline *pipe)
+{
+	pthread_cond_destroy(&pipe->cond);
+	pthread_mutex_destroy(&pipe->mutex);
+}
+
+static void
+pipeline_lock(fz_pipeline *pipe)
+{
+	pthread_mutex_lock(&pipe->mutex);
+}
+
+static void
+pipeline_unlock(fz_pipeline *pipe)
+{
+	pthread_mutex_unlock(&pipe->mutex);
+}
+
+static void
+pipeline_wait(fz_pipeline *pipe, int ms)
+{
+	struct timeval now;
+	struct timespec until;
+
+	if (ms <= 0)
+	{
+		pthread_cond_wait(&pipe->cond, &pipe->mutex);
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	until.tv_sec = now.tv_sec + ms / 1000;
+	until.tv_nsec = (now.tv_usec + (ms % 1000) * 1000) * 1000;
+	if (until.tv_nsec >= 1000000000)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&pipe->cond, &pipe->mutex, &until);
+}
+
+static void
+pipeline_signal(fz_pipeline *pipe)
+{
+	pthread_cond_broadcast(&pipe->cond);
+}
+
+static void *pipeline_thread(void *worker);
+
+static int
+pipeline_start(fz_pipeline_worker *w)
+{
+	return pthread_create(&w->thread, NULL, pipeline_thread, w) ? -1 : 0;
+}
+
+static void
+pipeline_join(fz_pipeline_worker *w)
+{
+	pthread_join(w->thread, NULL);
+}
+
+#endif
+
+static fz_document *
+pipeline_open(fz_context *ctx, char *filename, char *password)
+{
+	fz_document *doc = fz_open_document(ctx, filename);
+	if (fz_needs_password(doc) && !fz_authenticate_password(doc, password ? password : ""))
+	{
+		fz_close_document(doc);
+		fz_throw(ctx, "cannot authenticate password: %s", filename);
+	}
+	return doc;
+}
+
+/* Run one page through the device the caller makes for it. Returns 1
+ * if the page ran to completion. */
+static int
+pipeline_run_page(fz_context *ctx, fz_pipeline *pipe, fz_document *doc, int number, void **result, fz_cookie *cookie)
+{
+	fz_page *page = NULL;
+	fz_device *dev = NULL;
+	fz_matrix ctm = fz_identity;
+	int ok = 0;
+
+	fz_var(page);
+	fz_var(dev);
+	fz_var(ok);
+
+	*result = NULL;
+	fz_try(ctx)
+	{
+		page = fz_load_page(doc, number);
+		dev = pipe->begin(ctx, pipe->arg, doc, page, number, &ctm, result);
+		fz_run_page(doc, page, dev, ctm, cookie);
+		ok = !(cookie && cookie->abort);
+	}
+	fz_always(ctx)
+	{
+		fz_free_device(dev);
+		fz_free_page(doc, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "cannot run page %d", number + 1);
+	}
+	return ok;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+pipeline_thread(LPVOID worker)
+#else
+static void *
+pipeline_thread(void *worker)
+#endif
+{
+	fz_pipeline_worker *w = worker;
+	fz_pipeline *pipe = w->pipe;
+	void *result;
+	int i, ok;
+
+	pipeline_lock(pipe);
+	while (!pipe->abort && pipe->next < pipe->count)
+	{
+		if (pipe->next >= pipe->delivered + pipe->window)
+		{
+			pipeline_wait(pipe, 0);
+			continue;
+		}
+		i = pipe->next++;
+		pipeline_unlock(pipe);
+
+		ok = pipeline_run_page(w->ctx, pipe, w->doc, pipe->first + i, &result, &w->cookie);
+
+		pipeline_lock(pipe);
+		pipe->slots[i].result = result;
+		pipe->slots[i].ok = ok;
+		pipe->slots[i].done = 1;
+		pipeline_signal(pipe);
+	}
+	pipe->running--;
+	pipeline_signal(pipe);
+	pipeline_unlock(pipe);
+	return 0;
+}
+
+/* One page at a time on the calling thread. run_ctx and doc may belong
+ * to a worker that could not be started. */
+static int
+pipeline_serial(fz_context *ctx, fz_context *run_ctx, fz_document *doc, fz_pipeline *pipe, fz_pipeline_deliver_fn *deliver, fz_cookie *cookie)
+{
+	void *result;
+	int i, ok, failed = pipe->count;
+
+	for (i = 0; i < pipe->count; i++)
+	{
+		if (cookie && cookie->abort)
+			break;
+		ok = pipeline_run_page(run_ctx, pipe, doc, pipe->first + i, &result, cookie);
+		deliver(ctx, pipe->arg, pipe->first + i, result, ok);
+		if (ok)
+			failed--;
+		/* The page shared the cookie, put our own progress back */
+		if (cookie)
+		{
+			cookie->progress = i + 1;
+			cookie->progress_max = pipe->count;
+		}
+	}
+	return failed;
+}
+
+static int
+pipeline_clamp(fz_pipeline *pipe, fz_document *doc, int first, int last)
+{
+	int n = fz_count_pages(doc);
+	if (last < 0 || last >= n)
+		last = n - 1;
+	if (first < 0)
+		first = 0;
+	pipe->first = first;
+	pipe->count = last >= first ? last - first + 1 : 0;
+	return pipe->count;
+}
+
+int
+fz_run_pipeline(fz_context *ctx, char *filename, char *password, int first, int last, int workers, fz_pipeline_begin_fn *begin, fz_pipeline_deliver_fn *deliver, void *arg, fz_cookie *cookie)
+{
+	fz_pipeline pipe = { 0 };
+	fz_pipeline_worker *w = NULL;
+	fz_document *doc = NULL;
+	unsigned int limit;
+	int i, n = 0, failed = 0, locked = 0;
+
+	pipe.begin = begin;
+	pipe.arg = arg;
+
+	if (workers > PIPELINE_MAX_WORKERS)
+		workers = PIPELINE_MAX_WORKERS;
+
+	if (workers <= 1 || (w = fz_calloc_no_throw(ctx, workers, sizeof *w)) == NULL)
+	{
+		doc = pipeline_open(ctx, filename, password);
+		fz_try(ctx)
+		{
+			pipeline_clamp(&pipe, doc, first, last);
+			if (cookie)
+			{
+				cookie->progress = 0;
+				cookie->progress_max = pipe.count;
+			}
+			failed = pipeline_serial(ctx, ctx, doc, &pipe, deliver, cookie);
+		}
+		fz_always(ctx)
+		{
+			fz_close_document(doc);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
+		}
+		return failed;
+	}
+
+	fz_var(n);
+	fz_var(failed);
+	fz_var(doc);
+	fz_var(locked);
+
+	fz_try(ctx)
+	{
+		/* Each worker interprets its own copy of the document on a
+		 * private clone of ctx, with its share of the store. */
+		limit = fz_store_limit(ctx) / workers;
+		while (n < workers)
+		{
+			fz_context *clone = fz_clone_context_private(ctx, limit);
+			if (!clone)
+				break;
+			w[n].pipe = &pipe;
+			w[n].ctx = clone;
+			n++;
+			fz_try(clone)
+			{
+				w[n-1].doc = pipeline_open(clone, filename, password);
+			}
+			fz_catch(clone)
+			{
+				fz_throw(ctx, "cannot open document: %s", filename);
+			}
+		}
+		if (n == 0)
+			doc = pipeline_open(ctx, filename, password);
+
+		pipeline_clamp(&pipe, n ? w[0].doc : doc, first, last);
+		if (cookie)
+		{
+			cookie->progress = 0;
+			cookie->progress_max = pipe.count;
+		}
+
+		if (n <= 1 || pipe.count <= 1 || pipeline_init_lock(&pipe))
+		{
+			if (n)
+				failed = pipeline_serial(ctx, w[0].ctx, w[0].doc, &pipe, deliver, cookie);
+			else
+				failed = pipeline_serial(ctx, ctx, doc, &pipe, deliver, cookie);
+			break;
+		}
+		locked = 1;
+
+		if (n > pipe.count)
+			n = pipe.count;
+		pipe.window = n * PIPELINE_AHEAD;
+		pipe.slots = fz_calloc(ctx, pipe.count, sizeof *pipe.slots);
+
+		for (i = 0; i < n; i++)
+		{
+			pipeline_lock(&pipe);
+			pipe.running++;
+			pipeline_unlock(&pipe);
+			w[i].started = !pipeline_start(&w[i]);
+			if (!w[i].started)
+			{
+				pipeline_lock(&pipe);
+				pipe.running--;
+				pipeline_unlock(&pipe);
+				break;
+			}
+		}
+		if (i == 0)
+		{
+			failed = pipeline_serial(ctx, w[0].ctx, w[0].doc, &pipe, deliver, cookie);
+			break;
+		}
+
+		failed = pipe.count;
+		pipeline_lock(&pipe);
+		while (pipe.delivered < pipe.count)
+		{
+			fz_pipeline_slot *slot = &pipe.slots[pipe.delivered];
+			if (cookie && cookie->abort)
+			{
+				pipe.abort = 1;
+				for (i = 0; i < n; i++)
+					w[i].cookie.abort = 1;
+				pipeline_signal(&pipe);
+				break;
+			}
+			if (slot->done)
+			{
+				pipeline_unlock(&pipe);
+				deliver(ctx, arg, pipe.first + pipe.delivered, slot->result, slot->ok);
+				if (slot->ok)
+					failed--;
+				pipeline_lock(&pipe);
+				slot->done = 0;
+				pipe.delivered++;
+				if (cookie)
+					cookie->progress = pipe.delivered;
+				pipeline_signal(&pipe);
+				continue;
+			}
+			if (pipe.running == 0)
+				break;
+			pipeline_wait(&pipe, PIPELINE_POLL);
+		}
+		pipeline_unlock(&pipe);
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < n; i++)
+			if (w[i].started)
+				pipeline_join(&w[i]);
+
+		/* Hand back whatever was finished but not delivered */
+		if (pipe.slots)
+		{
+			for (i = pipe.delivered; i < pipe.count; i++)
+				if (pipe.slots[i].done)
+					deliver(ctx, arg, pipe.first + i, pipe.slots[i].result, 0);
+			fz_free(ctx, pipe.slots);
+		}
+		if (locked)
+			pipeline_fin_lock(&pipe);
+
+		for (i = 0; i < workers; i++)
+		{
+			if (w[i].ctx)
+			{
+				fz_close_document(w[i].doc);
+				fz_free_context(w[i].ctx);
+			}
+		}
+		fz_free(ctx, w);
+		fz_close_document(doc);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return failed;
+}
@@ -120,21 +120,6 @@ float fz_matrix_max_expansion(fz_matrix m);
  * For further encapsulation in filters, or not.
  */
 
-/* md5 digests */
-
-typedef struct fz_md5_s fz_md5;
-
-struct fz_md5_s
-{
-	unsigned int state[4];
-	unsigned int count[2];
-	unsigned char buffer[64];
-};
-
-void fz_md5_init(fz_md5 *state);
-void fz_md5_update(fz_md5 *state, const unsigned char *input, unsigned inlen);
-void fz_md5_final(fz_md5 *state, unsigned char digest[16]);
-
 /* sha-256 digests */
 
 typedef struct fz_sha256_s fz_sha256;
@@ -259,6 +244,18 @@ struct fz_store_hash_s
 			void *ptr;
 			int i;
 		} pi;
+		struct
+		{
+			void *ptr0;
+			void *ptr1;
+			float f[4];
+			int i[2];
+		} ppf;
+		struct
+		{
+			unsigned char digest[16];
+			int i;
+		} di;
 	} u;
 };
 
@@ -291,6 +288,12 @@ void fz_drop_store_context(fz_context *ctx);
 */
 fz_store *fz_keep_store_context(fz_context *ctx);
 
+/*
+	fz_store_limit: Return the maximum size the store in ctx is
+	allowed to grow to, or FZ_STORE_UNLIMITED.
+*/
+unsigned int fz_store_limit(fz_context *ctx);
+
 /*
 	fz_print_store: Dump the contents of the store for debugging.
 */
@@ -536,6 +539,26 @@ fz_stream *fz_open_lzwd(fz_stream *chain, int early_change);
 fz_stream *fz_open_predict(fz_stream *chain, int predictor, int columns, int colors, int bpc);
 fz_stream *fz_open_jbig2d(fz_stream *chain, fz_buffer *global);
 
+/*
+ * Zip archives.
+ *
+ * The central directory is read once when the archive is opened and
+ * kept sorted by name; lookups are case-insensitive. Entries are
+ * opened as streams that inflate incrementally, reading the compressed
+ * data from the shared archive file under FZ_LOCK_FILE as they go.
+ */
+
+typedef struct fz_zip_archive_s fz_zip_archive;
+
+fz_zip_archive *fz_open_zip_archive(fz_context *ctx, fz_stream *file);
+void fz_close_zip_archive(fz_context *ctx, fz_zip_archive *zip);
+int fz_count_zip_entries(fz_zip_archive *zip);
+char *fz_zip_entry_name(fz_zip_archive *zip, int idx);
+int fz_zip_entry_size(fz_zip_archive *zip, int idx);
+int fz_find_zip_entry(fz_zip_archive *zip, char *name);
+fz_stream *fz_open_zip_entry(fz_context *ctx, fz_zip_archive *zip, int idx);
+int fz_read_zip_entry(fz_context *ctx, fz_zip_archive *zip, int idx, unsigned char *buf, int len);
+
 /*
  * Resources and other graphics related objects.
  */
@@ -608,10 +631,23 @@ void fz_clear_pixmap_rect_with_value(fz_context *ctx, fz_pixmap *pix, int value,
 void fz_copy_pixmap_rect(fz_context *ctx, fz_pixmap *dest, fz_pixmap *src, fz_bbox r);
 void fz_premultiply_pixmap(fz_context *ctx, fz_pixmap *pix);
 fz_pixmap *fz_alpha_from_gray(fz_context *ctx, fz_pixmap *gray, int luminosity);
+void fz_subsample_pixmap(fz_context *ctx, fz_pixmap *pix, int factor);
 unsigned int fz_pixmap_size(fz_context *ctx, fz_pixmap *pix);
 
 fz_pixmap *fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_bbox *clip);
 
+/*
+	Scale caches hold recently used filter weight tables for one scaling
+	direction, so that repeatedly scaling to the same size does not
+	recalculate them. A cache must only be used by one thread at a time,
+	and the caches passed for x and y must be distinct (or NULL).
+*/
+typedef struct fz_scale_cache_s fz_scale_cache;
+
+fz_scale_cache *fz_new_scale_cache(fz_context *ctx);
+void fz_free_scale_cache(fz_context *ctx, fz_scale_cache *cache);
+fz_pixmap *fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_bbox *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y);
+
 fz_bbox fz_pixmap_bbox_no_ctx(fz_pixmap *src);
 
 struct fz_image_s
@@ -625,9 +661,17 @@ struct fz_image_s
 
 fz_pixmap *fz_load_jpx(fz_context *ctx, unsigned char *data, int size, fz_colorspace *cs, int indexed);
 fz_pixmap *fz_load_jpeg(fz_context *doc, unsigned char *data, int size);
+fz_pixmap *fz_load_jpeg_scaled(fz_context *doc, unsigned char *data, int size, int factor);
 fz_pixmap *fz_load_png(fz_context *doc, unsigned char *data, int size);
 fz_pixmap *fz_load_tiff(fz_context *doc, unsigned char *data, int size);
 
+/*
+	Read just the dimensions, resolution and output colorspace of an
+	image from its header, without decoding any image data.
+*/
+void fz_load_jpeg_info(fz_context *doc, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
+void fz_load_png_info(fz_context *doc, unsigned char *data, int size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
+
 struct fz_halftone_s
 {
 	int refs;
@@ -793,6 +837,7 @@ void fz_curvetov(fz_context*,fz_path*, float, float, float, float);
 void fz_curvetoy(fz_context*,fz_path*, float, float, float, float);
 void fz_closepath(fz_context*,fz_path*);
 void fz_free_path(fz_context *ctx, fz_path *path);
+void fz_reset_path(fz_context *ctx, fz_path *path);
 
 void fz_transform_path(fz_context *ctx, fz_path *path, fz_matrix transform);
 
@@ -921,6 +966,7 @@ int fz_is_rect_gel(fz_gel *gel);
 
 void fz_scan_convert(fz_gel *gel, int eofill, fz_bbox clip, fz_pixmap *pix, unsigned char *colorbv);
 
+int fz_is_rect_path(fz_path *path, fz_matrix ctm, fz_rect *rect);
 void fz_flatten_fill_path(fz_gel *gel, fz_path *path, fz_matrix ctm, float flatness);
 void fz_flatten_stroke_path(fz_gel *gel, fz_path *path, fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth);
 void fz_flatten_dash_path(fz_gel *gel, fz_path *path, fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth);
@@ -1013,6 +1059,73 @@ void fz_end_tile(fz_device *dev);
 
 fz_device *fz_new_device(fz_context *ctx, void *user);
 
+/*
+ * Profiling
+ */
+
+enum
+{
+	FZ_PROFILE_FILL_PATH,
+	FZ_PROFILE_STROKE_PATH,
+	FZ_PROFILE_CLIP_PATH,
+	FZ_PROFILE_CLIP_STROKE_PATH,
+	FZ_PROFILE_FILL_TEXT,
+	FZ_PROFILE_STROKE_TEXT,
+	FZ_PROFILE_CLIP_TEXT,
+	FZ_PROFILE_CLIP_STROKE_TEXT,
+	FZ_PROFILE_IGNORE_TEXT,
+	FZ_PROFILE_FILL_SHADE,
+	FZ_PROFILE_FILL_IMAGE,
+	FZ_PROFILE_FILL_IMAGE_MASK,
+	FZ_PROFILE_CLIP_IMAGE_MASK,
+	FZ_PROFILE_POP_CLIP,
+	FZ_PROFILE_BEGIN_MASK,
+	FZ_PROFILE_END_MASK,
+	FZ_PROFILE_BEGIN_GROUP,
+	FZ_PROFILE_END_GROUP,
+	FZ_PROFILE_BEGIN_TILE,
+	FZ_PROFILE_END_TILE,
+	FZ_PROFILE_CALLS
+};
+
+#define FZ_PROFILE_OPERATORS 128
+
+typedef struct fz_profile_entry_s fz_profile_entry;
+typedef struct fz_profile_mark_s fz_profile_mark;
+
+struct fz_profile_entry_s
+{
+	int count;
+	double time;
+	double pixels;
+	double alloc_bytes;
+};
+
+struct fz_profile_s
+{
+	fz_profile_entry call[FZ_PROFILE_CALLS];
+	struct {
+		char name[8];
+		fz_profile_entry entry;
+	} op[FZ_PROFILE_OPERATORS];
+	double pixels;
+	double alloc_bytes;
+	int allocs;
+	int store_hits, store_misses;
+	int glyph_hits, glyph_misses;
+};
+
+struct fz_profile_mark_s
+{
+	double time;
+	double pixels;
+	double alloc_bytes;
+};
+
+/* Bracket an operator with these while ctx->profile is set */
+void fz_profile_start(fz_context *ctx, fz_profile_mark *mark);
+void fz_profile_stop_operator(fz_context *ctx, fz_profile_mark *mark, char *name);
+
 
 
 /*
@@ -1078,6 +1191,7 @@ struct fz_document_s
 	fz_link *(*load_links)(fz_document *doc, fz_page *page);
 	fz_rect (*bound_page)(fz_document *doc, fz_page *page);
 	void (*run_page)(fz_document *doc, fz_page *page, fz_device *dev, fz_matrix transform, fz_cookie *cookie);
+	fz_image *(*load_thumbnail)(fz_document *doc, fz_page *page);
 	void (*free_page)(fz_document *doc, fz_page *page);
 	int (*meta)(fz_document *doc, int key, void *ptr, int size);
 };
@@ -131,6 +131,8 @@ typedef struct fz_aa_context_s fz_aa_context;
 typedef struct fz_locks_context_s fz_locks_context;
 typedef struct fz_store_s fz_store;
 typedef struct fz_glyph_cache_s fz_glyph_cache;
+typedef struct fz_profile_s fz_profile;
+typedef struct fz_alloc_stats_context_s fz_alloc_stats_context;
 typedef struct fz_context_s fz_context;
 
 struct fz_alloc_context_s
@@ -202,6 +204,9 @@ struct fz_context_s
 	fz_aa_context *aa;
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
+	fz_profile *profile;
+	fz_alloc_stats_context *alloc_stats;
+	int alloc_tag;
 };
 
 /*
@@ -265,6 +270,24 @@ fz_context *fz_new_context(fz_alloc_context *alloc, fz_locks_context *locks, uns
 */
 fz_context *fz_clone_context(fz_context *ctx);
 
+/*
+	fz_clone_context_private: Make a clone of an existing context
+	for a thread that opens documents of its own.
+
+	As fz_clone_context, but the clone gets its own resource store
+	and glyph cache instead of sharing those of ctx. Objects loaded
+	from a document are tied to it and to the context that loaded
+	them, and the store and glyph cache keep them alive, so sharing
+	either lets one thread free another's objects. Only the
+	allocator, locks and font context are shared.
+
+	max_store: Maximum size in bytes of the clone's store, or
+	FZ_STORE_UNLIMITED.
+
+	Does not throw exceptions, but may return NULL.
+*/
+fz_context *fz_clone_context_private(fz_context *ctx, unsigned int max_store);
+
 /*
 	fz_free_context: Free a context and its global state.
 
@@ -290,6 +313,23 @@ int fz_aa_level(fz_context *ctx);
 */
 void fz_set_aa_level(fz_context *ctx, int bits);
 
+/*
+	fz_aa_analytic: Get whether anti-aliased scan conversion computes
+	exact pixel coverage rather than sub-sampling.
+*/
+int fz_aa_analytic(fz_context *ctx);
+
+/*
+	fz_set_aa_analytic: Choose how anti-aliased paths are scan converted.
+
+	analytic: If non-zero, the area of each pixel covered by a path is
+	calculated exactly, visiting only the pixels its edges cross. This
+	is much faster for dense vector artwork at high resolutions. If
+	zero (the default), paths are sampled at the sub-pixel grid given
+	by fz_set_aa_level. Has no effect when antialiasing is off.
+*/
+void fz_set_aa_analytic(fz_context *ctx, int analytic);
+
 /*
 	Locking functions
 
@@ -485,6 +525,116 @@ void *fz_resize_array_no_throw(fz_context *ctx, void *p, unsigned int count, uns
 */
 char *fz_strdup_no_throw(fz_context *ctx, char *s);
 
+/*
+	Allocation statistics
+
+	Accounting can be enabled for a context to find out where its
+	memory goes. Every allocation made through the context is charged
+	to the context's current allocation tag, and recorded by size
+	class. Accounting is per context; cloned contexts start with it
+	disabled.
+*/
+enum
+{
+	FZ_ALLOC_OTHER,
+	FZ_ALLOC_DOCUMENT,	/* opening documents, parsing objects */
+	FZ_ALLOC_INTERPRET,	/* running pages */
+	FZ_ALLOC_DRAW,	/* replaying display lists */
+	FZ_ALLOC_GLYPH,	/* rendering glyphs into the cache */
+	FZ_ALLOC_IMAGE,	/* decoding images */
+	FZ_ALLOC_ARENA,	/* arena blocks */
+	FZ_ALLOC_TAGS
+};
+
+/* Size classes are powers of 4, from 16 bytes up to 64k and larger */
+enum { FZ_ALLOC_SIZE_CLASSES = 8 };
+
+typedef struct fz_alloc_stats_s fz_alloc_stats;
+
+struct fz_alloc_stats_s
+{
+	int count[FZ_ALLOC_TAGS];
+	double total[FZ_ALLOC_TAGS];
+	double live[FZ_ALLOC_TAGS];
+	double current, peak;
+	int size_class[FZ_ALLOC_SIZE_CLASSES];
+};
+
+/*
+	fz_enable_alloc_stats: Start accounting for the allocations
+	made through a context, with all counters at zero.
+
+	Blocks allocated before accounting was enabled, or through
+	another context, are not tracked and are ignored when freed.
+
+	Does not throw exceptions; returns 0 if the accounting tables
+	could not be allocated.
+*/
+int fz_enable_alloc_stats(fz_context *ctx);
+
+/*
+	fz_disable_alloc_stats: Stop accounting and free the
+	accounting tables.
+*/
+void fz_disable_alloc_stats(fz_context *ctx);
+
+/*
+	fz_get_alloc_stats: Retrieve the counters gathered since
+	accounting was enabled, or NULL if it is not.
+*/
+fz_alloc_stats *fz_get_alloc_stats(fz_context *ctx);
+
+/*
+	fz_set_alloc_tag: Set the tag that subsequent allocations on
+	this context are charged to.
+
+	Returns the previous tag, which the caller should restore.
+*/
+int fz_set_alloc_tag(fz_context *ctx, int tag);
+
+/*
+	fz_print_alloc_stats: Print a summary of the allocation
+	counters of a context.
+*/
+void fz_print_alloc_stats(fz_context *ctx, FILE *out);
+
+/*
+	Arenas
+
+	An arena allocates short-lived objects in bulk from large blocks
+	and frees them all at once, for structures with a common lifetime
+	such as a parsed tree or the state for a single page.
+*/
+typedef struct fz_arena_s fz_arena;
+
+/*
+	fz_new_arena: Create an empty arena.
+
+	block_size: The size of the blocks to allocate from, or 0 for
+	a reasonable default. Larger requests get a block of their own.
+*/
+fz_arena *fz_new_arena(fz_context *ctx, unsigned int block_size);
+
+/*
+	fz_arena_alloc: Allocate a block of memory from an arena.
+
+	The memory is suitably aligned for any type, is not zeroed and
+	must not be passed to fz_free. Throws exception on failure to
+	allocate.
+*/
+void *fz_arena_alloc(fz_context *ctx, fz_arena *arena, unsigned int size);
+
+/*
+	fz_reset_arena: Free everything allocated from an arena at
+	once, keeping one block around for reuse.
+*/
+void fz_reset_arena(fz_context *ctx, fz_arena *arena);
+
+/*
+	fz_free_arena: Free an arena and everything allocated from it.
+*/
+void fz_free_arena(fz_context *ctx, fz_arena *arena);
+
 /*
 	Safe string functions
 */
@@ -1409,6 +1559,54 @@ void fz_write_pbm(fz_context *ctx, fz_bitmap *bitmap, char *filename);
 */
 void fz_write_tiff(fz_context *ctx, fz_bitmap *bitmap, char *filename, int pagenum, int pages);
 
+/*
+	fz_band_writer: Writes an image to file a band of rows at a
+	time, so that the whole image never needs to be held in memory.
+*/
+typedef struct fz_band_writer_s fz_band_writer;
+
+enum { FZ_BAND_PNM, FZ_BAND_PAM, FZ_BAND_PNG, FZ_BAND_PBM };
+
+/*
+	fz_new_band_writer: Open an image file for banded output and
+	write its header.
+
+	filename: The filename to save as (including extension).
+
+	format: One of FZ_BAND_PNM, FZ_BAND_PAM, FZ_BAND_PNG or
+	FZ_BAND_PBM. PBM output is halftoned and requires a greyscale
+	colorspace.
+
+	colorspace, w, h: The colorspace and size of the whole image.
+	Bands passed to fz_write_band must match the colorspace and
+	width.
+
+	savealpha: If non zero, the alpha channel is kept (PAM and PNG
+	only).
+
+	Throws exception on failure to create.
+*/
+fz_band_writer *fz_new_band_writer(fz_context *ctx, char *filename, int format, fz_colorspace *colorspace, int w, int h, int savealpha);
+
+/*
+	fz_write_band: Append the rows of band to the image. Bands must
+	be written top to bottom; band->y is only used for halftoning.
+*/
+void fz_write_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band);
+
+/*
+	fz_close_band_writer: Finish the image and close the file. Throws
+	if fewer rows than the image height were written. The writer is
+	freed whether or not this succeeds.
+*/
+void fz_close_band_writer(fz_context *ctx, fz_band_writer *wri);
+
+/*
+	fz_free_band_writer: Close the file and free the writer without
+	finishing the image. For use on error paths.
+*/
+void fz_free_band_writer(fz_context *ctx, fz_band_writer *wri);
+
 /*
 	fz_md5_pixmap: Return the md5 digest for a pixmap
 
@@ -1416,6 +1614,25 @@ void fz_write_tiff(fz_context *ctx, fz_bitmap *bitmap, char *filename, int pagen
 */
 void fz_md5_pixmap(fz_pixmap *pixmap, unsigned char digest[16]);
 
+/*
+	fz_md5: Incremental md5 digests, for checksumming an image that is
+	produced a band at a time. Feeding the samples of each band to
+	fz_md5_update in order gives the same digest as fz_md5_pixmap on
+	the whole image.
+*/
+typedef struct fz_md5_s fz_md5;
+
+struct fz_md5_s
+{
+	unsigned int state[4];
+	unsigned int count[2];
+	unsigned char buffer[64];
+};
+
+void fz_md5_init(fz_md5 *state);
+void fz_md5_update(fz_md5 *state, const unsigned char *input, unsigned inlen);
+void fz_md5_final(fz_md5 *state, unsigned char digest[16]);
+
 /*
 	Images are storable objects from which we can obtain fz_pixmaps.
 	These may be implemented as simple wrappers around a pixmap, or as
@@ -1518,6 +1735,150 @@ fz_device *fz_new_trace_device(fz_context *ctx);
 */
 fz_device *fz_new_bbox_device(fz_context *ctx, fz_bbox *bboxp);
 
+/*
+	fz_render_cost: Work counted by a cost device, and the predicted
+	cost of drawing it.
+
+	time: predicted render time in milliseconds, at the antialiasing
+	level of the context the device was created in.
+
+	memory: predicted peak memory use in bytes for the destination
+	pixmap, clip and group pixmaps, and decoded images.
+
+	The remaining fields are the raw counts the predictions are
+	based on. Areas are in device pixels, clipped to the render area.
+*/
+typedef struct fz_render_cost_s fz_render_cost;
+
+struct fz_render_cost_s
+{
+	float time;
+	float memory;
+	int paths, segments;
+	int texts, glyphs;
+	int images, shades, groups;
+	float page_area;
+	float fill_area;
+	float image_area;
+	float decode_samples, convert_samples;
+	float group_area;
+};
+
+/*
+	fz_new_cost_device: Create a device to estimate how expensive it
+	will be to draw a page.
+
+	Run a page (or, more cheaply, its display list) through the
+	device with the transform and bounding box it will be drawn
+	with. The estimate is written to *cost when the device is freed.
+
+	bbox: the area that will be rendered, in device space.
+
+	colorspace: the colorspace of the destination pixmap.
+*/
+fz_device *fz_new_cost_device(fz_context *ctx, fz_render_cost *cost, fz_bbox bbox, fz_colorspace *colorspace);
+
+/*
+	fz_estimate_render_time: Predict the time in milliseconds to draw
+	the work counted in cost.
+
+	draft: non-zero for a draw device made with
+	fz_new_draw_device_draft.
+
+	aa_bits: the antialiasing level (see fz_set_aa_level).
+*/
+float fz_estimate_render_time(fz_render_cost *cost, int draft, int aa_bits);
+
+/*
+	fz_fit_render_budget: Choose how to degrade rendering so that a
+	page is drawn within a time budget.
+
+	budget: time allowed for rendering, in milliseconds.
+
+	aa_bits: the antialiasing level to start from. On return, the
+	level to render with.
+
+	Returns 0 if the page fits the budget at full quality, 1 if it
+	should be drawn with fz_new_draw_device_draft and *aa_bits bits of
+	antialiasing. The result may still exceed the budget if no amount
+	of degrading would be enough.
+*/
+int fz_fit_render_budget(fz_render_cost *cost, float budget, int *aa_bits);
+
+/*
+	fz_profile: Statistics about where rendering time goes.
+
+	A profile records the number of calls, the time taken (in
+	microseconds), the pixels touched and the bytes allocated for
+	each device call and for each content stream operator, together
+	with resource store and glyph cache hits and misses. Times and
+	allocations are inclusive of any nested calls.
+*/
+
+/*
+	fz_new_profile: Create an empty profile.
+*/
+fz_profile *fz_new_profile(fz_context *ctx);
+
+/*
+	fz_free_profile: Free a profile, detaching it from ctx if it
+	is attached.
+
+	Does not throw exceptions.
+*/
+void fz_free_profile(fz_context *ctx, fz_profile *prof);
+
+/*
+	fz_reset_profile: Clear the statistics in a profile, e.g. between
+	pages.
+
+	Does not throw exceptions.
+*/
+void fz_reset_profile(fz_context *ctx, fz_profile *prof);
+
+/*
+	fz_begin_profile: Attach a profile to a context.
+
+	While attached, content stream operators, allocations and store
+	and glyph cache lookups made with this context are recorded.
+	Only one profile can be attached to a context at a time; cloned
+	contexts start with none.
+
+	Does not throw exceptions.
+*/
+void fz_begin_profile(fz_context *ctx, fz_profile *prof);
+
+/*
+	fz_end_profile: Detach the profile from a context.
+
+	Does not throw exceptions.
+*/
+void fz_end_profile(fz_context *ctx);
+
+/*
+	fz_new_profile_device: Create a device that forwards all calls
+	to another device and records their cost in a profile.
+
+	target: The device to forward to. Once the profile device has
+	been created, it owns the target and frees it when it is freed.
+
+	bbox: The area being rendered. Pixels touched by each call are
+	counted within it.
+*/
+fz_device *fz_new_profile_device(fz_context *ctx, fz_profile *prof, fz_device *target, fz_bbox bbox);
+
+/*
+	fz_print_profile: Write a report of a profile.
+
+	format: FZ_PROFILE_JSON for a JSON object, or FZ_PROFILE_CSV for
+	lines of "label,kind,name,count,time,pixels,alloc".
+
+	label: Identifies the report, e.g. "file.pdf:3" for a page.
+*/
+enum { FZ_PROFILE_JSON, FZ_PROFILE_CSV };
+
+void fz_print_profile(fz_context *ctx, FILE *out, fz_profile *prof, int format, char *label);
+
 /*
 	fz_new_draw_device: Create a device to draw on a pixmap.
 
@@ -1543,6 +1904,20 @@ fz_device *fz_new_draw_device(fz_context *ctx, fz_pixmap *dest);
 */
 fz_device *fz_new_draw_device_with_bbox(fz_context *ctx, fz_pixmap *dest, fz_bbox clip);
 
+/*
+	fz_new_draw_device_draft: Create a device to draw on a pixmap,
+	trading accuracy for speed. Intended for thumbnails and previews.
+
+	Images are decoded at up to half the resolution they are drawn
+	at, and shadings and soft masks covering only a few pixels are
+	skipped (a skipped soft mask clips to its bounds). Combine with a
+	low fz_set_aa_level for the cheapest rendering.
+
+	dest: Target pixmap for the draw device, as for
+	fz_new_draw_device.
+*/
+fz_device *fz_new_draw_device_draft(fz_context *ctx, fz_pixmap *dest);
+
 /*
 	Text extraction device: Used for searching, format conversion etc.
 
@@ -1664,6 +2039,34 @@ struct fz_text_char_s
 */
 fz_device *fz_new_text_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page);
 
+/*
+	fz_text_sink_fn: Called by a text sink device with each line
+	of text as soon as it is finished.
+
+	line: The finished line. The line and its spans are freed when
+	the callback returns, so anything that is needed later must be
+	copied.
+*/
+typedef void (fz_text_sink_fn)(fz_context *ctx, void *arg, fz_text_line *line);
+
+/*
+	fz_new_text_sink_device: Create a device to extract the text on
+	a page as a stream of lines.
+
+	Lines are built as by fz_new_text_device, but each one is given
+	to a callback as soon as it is finished, instead of being
+	collected into the blocks of a text page. Lines arrive in the
+	order they are drawn and are not grouped into blocks. Memory use
+	is bounded by the longest line rather than the size of the page.
+
+	sheet: The text sheet to which styles should be added.
+
+	sink: The callback to give each line to. It may throw.
+
+	arg: Opaque value passed to the callback.
+*/
+fz_device *fz_new_text_sink_device(fz_context *ctx, fz_text_sheet *sheet, fz_text_sink_fn *sink, void *arg);
+
 /*
 	fz_new_text_sheet: Create an empty style sheet.
 
@@ -1703,6 +2106,12 @@ void fz_print_text_page_xml(fz_context *ctx, FILE *out, fz_text_page *page);
 */ 
 void fz_print_text_page(fz_context *ctx, FILE *out, fz_text_page *page);
 
+/*
+	fz_print_text_line: Output a single line of text to a file in
+	UTF-8 format, followed by a newline.
+*/
+void fz_print_text_line(fz_context *ctx, FILE *out, fz_text_line *line);
+
 /*
 	Cookie support - simple communication channel between app/library.
 */
@@ -2159,6 +2568,18 @@ fz_rect fz_bound_page(fz_document *doc, fz_page *page);
 */
 void fz_run_page(fz_document *doc, fz_page *page, fz_device *dev, fz_matrix transform, fz_cookie *cookie);
 
+/*
+	fz_run_page_thumbnail: Render the thumbnail image embedded in a
+	page, if the document provides one, scaled to cover the page.
+
+	Arguments are as for fz_run_page.
+
+	Returns 1 if a thumbnail was drawn, 0 if the page has none (in
+	which case nothing is sent to the device and the caller should
+	fall back to fz_run_page).
+*/
+int fz_run_page_thumbnail(fz_document *doc, fz_page *page, fz_device *dev, fz_matrix transform, fz_cookie *cookie);
+
 /*
 	fz_free_page: Free a loaded page.
 
@@ -2238,4 +2659,79 @@ enum
 	FZ_META_INFO = 4,
 };
 
+/*
+	Document pipeline - interpret a range of pages concurrently.
+*/
+
+/*
+	fz_pipeline_begin_fn: Device factory for fz_run_pipeline.
+
+	Called on a worker thread, with the worker's cloned context,
+	once for every page in the range. Returns the device that the
+	page should be run through; the pipeline frees it once the
+	page is done. May throw, in which case the page is counted as
+	failed.
+
+	doc, page: The worker's own copy of the document and the
+	loaded page. Neither may be kept beyond the call.
+
+	number: Page number, 0 is the first page of the document.
+
+	ctm: Transform to run the page with. Set to fz_identity on
+	entry.
+
+	result: Set to whatever the device produces (a pixmap, a text
+	page, a display list...). Handed to fz_pipeline_deliver_fn,
+	even if the page fails. Must not reference doc or page.
+*/
+typedef fz_device *(fz_pipeline_begin_fn)(fz_context *ctx, void *arg, fz_document *doc, fz_page *page, int number, fz_matrix *ctm, void **result);
+
+/*
+	fz_pipeline_deliver_fn: Result callback for fz_run_pipeline.
+
+	Called on the thread that called fz_run_pipeline, with its
+	context, once for every page that was started, in page order.
+	The callee takes ownership of result.
+
+	ok: 1 if the page ran to completion, 0 if it threw or was
+	aborted.
+
+	Must not throw.
+*/
+typedef void (fz_pipeline_deliver_fn)(fz_context *ctx, void *arg, int number, void *result, int ok);
+
+/*
+	fz_run_pipeline: Interpret a range of pages of a PDF, XPS or
+	CBZ document on several threads at once, delivering the
+	results in page order.
+
+	Every worker runs on a clone of ctx with its own copy of the
+	document, so ctx must have been created with a set of locks
+	(see fz_clone_context_private). The workers' stores split the
+	limit of the store in ctx evenly between them. Workers stay at
+	most a few pages ahead of the page being delivered, so the
+	number of undelivered results is bounded.
+
+	filename, password: The document to open, as for
+	fz_open_document and fz_authenticate_password. password may
+	be NULL.
+
+	first, last: Page range, inclusive, 0 is the first page.
+	last < 0 means the last page of the document.
+
+	workers: Number of threads to use. With 1 or less, or if ctx
+	has no locks or threads cannot be started, the pages are run
+	one by one on the calling thread.
+
+	cookie: May be NULL. Setting cookie->abort stops all workers
+	soon after; pages already finished are still delivered, with
+	ok set to 0. progress counts delivered pages out of
+	progress_max.
+
+	Returns the number of pages in the range that were not
+	delivered with ok set to 1. Throws if the document cannot be
+	opened.
+*/
+int fz_run_pipeline(fz_context *ctx, char *filename, char *password, int first, int last, int workers, fz_pipeline_begin_fn *begin, fz_pipeline_deliver_fn *deliver, void *arg, fz_cookie *cookie);
+
 #endif
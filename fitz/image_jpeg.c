@@ -46,8 +46,88 @@ static void skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 	}
 }
 
+static void
+jpeg_set_source(j_decompress_ptr cinfo, struct jpeg_source_mgr *src, unsigned char *rbuf, int rlen)
+{
+	cinfo->src = src;
+	src->init_source = init_source;
+	src->fill_input_buffer = fill_input_buffer;
+	src->skip_input_data = skip_input_data;
+	src->resync_to_restart = jpeg_resync_to_restart;
+	src->term_source = term_source;
+	src->next_input_byte = rbuf;
+	src->bytes_in_buffer = rlen;
+}
+
+static void
+jpeg_get_resolution(j_decompress_ptr cinfo, int *xres, int *yres)
+{
+	/* Without a density, use the same default as a new pixmap */
+	*xres = *yres = 96;
+
+	if (cinfo->density_unit == 1)
+	{
+		*xres = cinfo->X_density;
+		*yres = cinfo->Y_density;
+	}
+	else if (cinfo->density_unit == 2)
+	{
+		*xres = cinfo->X_density * 254 / 100;
+		*yres = cinfo->Y_density * 254 / 100;
+	}
+
+	if (*xres <= 0) *xres = 72;
+	if (*yres <= 0) *yres = 72;
+}
+
+void
+fz_load_jpeg_info(fz_context *ctx, unsigned char *rbuf, int rlen, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr_jmp err;
+	struct jpeg_source_mgr src;
+
+	if (setjmp(err.env))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		fz_throw(ctx, "jpeg error: %s", err.msg);
+	}
+
+	cinfo.err = jpeg_std_error(&err.super);
+	err.super.error_exit = error_exit;
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_set_source(&cinfo, &src, rbuf, rlen);
+
+	jpeg_read_header(&cinfo, 1);
+
+	if (cinfo.num_components == 1)
+		*cspacep = fz_device_gray;
+	else if (cinfo.num_components == 3)
+		*cspacep = fz_device_rgb;
+	else if (cinfo.num_components == 4)
+		*cspacep = fz_device_cmyk;
+	else
+	{
+		jpeg_destroy_decompress(&cinfo);
+		fz_throw(ctx, "bad number of components in jpeg: %d", cinfo.num_components);
+	}
+
+	*wp = cinfo.image_width;
+	*hp = cinfo.image_height;
+	jpeg_get_resolution(&cinfo, xresp, yresp);
+
+	jpeg_destroy_decompress(&cinfo);
+}
+
 fz_pixmap *
 fz_load_jpeg(fz_context *ctx, unsigned char *rbuf, int rlen)
+{
+	return fz_load_jpeg_scaled(ctx, rbuf, rlen, 1);
+}
+
+fz_pixmap *
+fz_load_jpeg_scaled(fz_context *ctx, unsigned char *rbuf, int rlen, int factor)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr_jmp err;
@@ -70,18 +150,17 @@ fz_load_jpeg(fz_context *ctx, unsigned char *rbuf, int rlen)
 	err.super.error_exit = error_exit;
 
 	jpeg_create_decompress(&cinfo);
-
-	cinfo.src = &src;
-	src.init_source = init_source;
-	src.fill_input_buffer = fill_input_buffer;
-	src.skip_input_data = skip_input_data;
-	src.resync_to_restart = jpeg_resync_to_restart;
-	src.term_source = term_source;
-	src.next_input_byte = rbuf;
-	src.bytes_in_buffer = rlen;
+	jpeg_set_source(&cinfo, &src, rbuf, rlen);
 
 	jpeg_read_header(&cinfo, 1);
 
+	/* Let the IDCT do the subsampling, as for resized DCTDecode streams */
+	if (factor > 1 && factor <= 8)
+	{
+		cinfo.scale_num = 8/factor;
+		cinfo.scale_denom = 8;
+	}
+
 	jpeg_start_decompress(&cinfo);
 
 	if (cinfo.output_components == 1)
@@ -104,19 +183,7 @@ fz_load_jpeg(fz_context *ctx, unsigned char *rbuf, int rlen)
 		fz_throw(ctx, "out of memory");
 	}
 
-	if (cinfo.density_unit == 1)
-	{
-		image->xres = cinfo.X_density;
-		image->yres = cinfo.Y_density;
-	}
-	else if (cinfo.density_unit == 2)
-	{
-		image->xres = cinfo.X_density * 254 / 100;
-		image->yres = cinfo.Y_density * 254 / 100;
-	}
-
-	if (image->xres <= 0) image->xres = 72;
-	if (image->yres <= 0) image->yres = 72;
+	jpeg_get_resolution(&cinfo, &image->xres, &image->yres);
 
 	fz_clear_pixmap(ctx, image);
 
@@ -579,3 +579,55 @@ fz_load_png(fz_context *ctx, unsigned char *p, int total)
 
 	return image;
 }
+
+void
+fz_load_png_info(fz_context *ctx, unsigned char *p, int total, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
+{
+	struct info png;
+	int size;
+
+	memset(&png, 0, sizeof png);
+	png.ctx = ctx;
+	png.xres = 96;
+	png.yres = 96;
+
+	if (total < 8 + 12 || memcmp(p, png_signature, 8))
+		fz_throw(ctx, "not a png image (wrong signature)");
+
+	p += 8;
+	total -= 8;
+
+	size = getint(p);
+	if (size + 12 > total)
+		fz_throw(ctx, "premature end of data in png image");
+	if (memcmp(p + 4, "IHDR", 4))
+		fz_throw(ctx, "png file must start with IHDR chunk");
+	png_read_ihdr(&png, p + 8, size);
+
+	p += size + 12;
+	total -= size + 12;
+
+	/* pHYs must come before the image data, so stop at the first IDAT */
+	while (total > 8)
+	{
+		size = getint(p);
+		if (size < 0 || size + 12 > total)
+			break;
+		if (!memcmp(p + 4, "pHYs", 4))
+			png_read_phys(&png, p + 8, size);
+		if (!memcmp(p + 4, "IDAT", 4) || !memcmp(p + 4, "IEND", 4))
+			break;
+		p += size + 12;
+		total -= size + 12;
+	}
+
+	if (png.indexed || png.n == 3 || png.n == 4)
+		*cspacep = fz_device_rgb;
+	else
+		*cspacep = fz_device_gray;
+
+	*wp = png.width;
+	*hp = png.height;
+	*xresp = png.xres;
+	*yresp = png.yres;
+}
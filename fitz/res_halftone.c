@@ -196,6 +196,7 @@ fz_bitmap *fz_halftone_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht)
 		o += ostride;
 		p += pstride;
 	}
+	fz_free(ctx, ht_line);
 	if (!ht_orig)
 		fz_drop_halftone(ctx, ht);
 	return out;
@@ -47,6 +47,14 @@ fz_free_path(fz_context *ctx, fz_path *path)
 	fz_free(ctx, path);
 }
 
+/* Empty a path, keeping its storage for reuse */
+void
+fz_reset_path(fz_context *ctx, fz_path *path)
+{
+	path->len = 0;
+	path->last = -1;
+}
+
 static void
 grow_path(fz_context *ctx, fz_path *path, int n)
 {
@@ -348,114 +348,75 @@ fz_gamma_pixmap(fz_context *ctx, fz_pixmap *pix, float gamma)
 }
 
 /*
- * Write pixmap to PNM file (without alpha channel)
+ * Shrink a pixmap in place by averaging factor x factor blocks of pixels.
+ * Partial blocks at the right and bottom edges average what they cover.
  */
-
 void
-fz_write_pnm(fz_context *ctx, fz_pixmap *pixmap, char *filename)
+fz_subsample_pixmap(fz_context *ctx, fz_pixmap *pix, int factor)
 {
-	FILE *fp;
-	unsigned char *p;
-	int len;
-
-	if (pixmap->n != 1 && pixmap->n != 2 && pixmap->n != 4)
-		fz_throw(ctx, "pixmap must be grayscale or rgb to write as pnm");
-
-	fp = fopen(filename, "wb");
-	if (!fp)
-		fz_throw(ctx, "cannot open file '%s': %s", filename, strerror(errno));
-
-	if (pixmap->n == 1 || pixmap->n == 2)
-		fprintf(fp, "P5\n");
-	if (pixmap->n == 4)
-		fprintf(fp, "P6\n");
-	fprintf(fp, "%d %d\n", pixmap->w, pixmap->h);
-	fprintf(fp, "255\n");
-
-	len = pixmap->w * pixmap->h;
-	p = pixmap->samples;
+	int n = pix->n;
+	int w = (pix->w + factor - 1) / factor;
+	int h = (pix->h + factor - 1) / factor;
+	int stride = pix->w * n;
+	unsigned char *d = pix->samples;
+	int sums[FZ_MAX_COLORS + 1];
+	int x, y, xx, yy, k, bw, bh;
+
+	if (factor <= 1)
+		return;
 
-	switch (pixmap->n)
+	for (y = 0; y < h; y++)
 	{
-	case 1:
-		fwrite(p, 1, len, fp);
-		break;
-	case 2:
-		while (len--)
+		bh = MIN(factor, pix->h - y * factor);
+		for (x = 0; x < w; x++)
 		{
-			putc(p[0], fp);
-			p += 2;
-		}
-		break;
-	case 4:
-		while (len--)
-		{
-			putc(p[0], fp);
-			putc(p[1], fp);
-			putc(p[2], fp);
-			p += 4;
+			unsigned char *s = pix->samples + (y * factor) * stride + (x * factor) * n;
+			bw = MIN(factor, pix->w - x * factor);
+			for (k = 0; k < n; k++)
+				sums[k] = 0;
+			for (yy = 0; yy < bh; yy++)
+			{
+				unsigned char *ss = s + yy * stride;
+				for (xx = 0; xx < bw; xx++)
+					for (k = 0; k < n; k++)
+						sums[k] += *ss++;
+			}
+			for (k = 0; k < n; k++)
+				*d++ = sums[k] / (bw * bh);
 		}
 	}
 
-	fclose(fp);
+	pix->w = w;
+	pix->h = h;
+	if (pix->free_samples)
+		pix->samples = fz_resize_array(ctx, pix->samples, w * h, n);
 }
 
 /*
- * Write pixmap to PAM file (with or without alpha channel)
+ * Band writers for PNM, PAM, PNG and PBM files.
+ *
+ * The image is written as it arrives, a band of rows at a time, so that
+ * only one band of it ever needs to be in memory. PNG data goes through
+ * a deflate stream and out in IDAT chunks whenever the output buffer
+ * fills.
  */
 
-void
-fz_write_pam(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
-{
-	unsigned char *sp;
-	int y, w, k;
-	FILE *fp;
-
-	int sn = pixmap->n;
-	int dn = pixmap->n;
-	if (!savealpha && dn > 1)
-		dn--;
-
-	fp = fopen(filename, "wb");
-	if (!fp)
-		fz_throw(ctx, "cannot open file '%s': %s", filename, strerror(errno));
-
-	fprintf(fp, "P7\n");
-	fprintf(fp, "WIDTH %d\n", pixmap->w);
-	fprintf(fp, "HEIGHT %d\n", pixmap->h);
-	fprintf(fp, "DEPTH %d\n", dn);
-	fprintf(fp, "MAXVAL 255\n");
-	if (pixmap->colorspace)
-		fprintf(fp, "# COLORSPACE %s\n", pixmap->colorspace->name);
-	switch (dn)
-	{
-	case 1: fprintf(fp, "TUPLTYPE GRAYSCALE\n"); break;
-	case 2: if (sn == 2) fprintf(fp, "TUPLTYPE GRAYSCALE_ALPHA\n"); break;
-	case 3: if (sn == 4) fprintf(fp, "TUPLTYPE RGB\n"); break;
-	case 4: if (sn == 4) fprintf(fp, "TUPLTYPE RGB_ALPHA\n"); break;
-	}
-	fprintf(fp, "ENDHDR\n");
-
-	sp = pixmap->samples;
-	for (y = 0; y < pixmap->h; y++)
-	{
-		w = pixmap->w;
-		while (w--)
-		{
-			for (k = 0; k < dn; k++)
-				putc(sp[k], fp);
-			sp += sn;
-		}
-	}
-
-	fclose(fp);
-}
+#include <zlib.h>
 
-/*
- * Write pixmap to PNG file (with or without alpha channel)
- */
+#define BAND_ZBUF_SIZE 65536
 
-#include <zlib.h>
+struct fz_band_writer_s
+{
+	int format;
+	int w, h, n, dn;
+	int savealpha;
+	int line;
+	FILE *fp;
+	z_stream z;
+	int z_open;
+	unsigned char *udata;
+	unsigned char *cdata;
+};
 
 static inline void big32(unsigned char *buf, unsigned int v)
 {
@@ -485,32 +446,24 @@ static void putchunk(char *tag, unsigned char *data, int size, FILE *fp)
 	put32(sum, fp);
 }
 
-void
-fz_write_png(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
+static void *zalloc(void *opaque, unsigned int items, unsigned int size)
+{
+	return fz_malloc_array_no_throw(opaque, items, size);
+}
+
+static void zfree(void *opaque, void *ptr)
+{
+	fz_free(opaque, ptr);
+}
+
+static void
+write_png_header(fz_context *ctx, fz_band_writer *wri)
 {
 	static const unsigned char pngsig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
-	FILE *fp;
 	unsigned char head[13];
-	unsigned char *udata = NULL;
-	unsigned char *cdata = NULL;
-	unsigned char *sp, *dp;
-	uLong usize, csize;
-	int y, x, k, sn, dn;
 	int color;
-	int err;
-
-	fz_var(udata);
-	fz_var(cdata);
 
-	if (pixmap->n != 1 && pixmap->n != 2 && pixmap->n != 4)
-		fz_throw(ctx, "pixmap must be grayscale or rgb to write as png");
-
-	sn = pixmap->n;
-	dn = pixmap->n;
-	if (!savealpha && dn > 1)
-		dn--;
-
-	switch (dn)
+	switch (wri->dn)
 	{
 	default:
 	case 1: color = 0; break;
@@ -519,25 +472,66 @@ fz_write_png(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
 	case 4: color = 6; break;
 	}
 
-	usize = (pixmap->w * dn + 1) * pixmap->h;
-	csize = compressBound(usize);
-	fz_try(ctx)
-	{
-		udata = fz_malloc(ctx, usize);
-		cdata = fz_malloc(ctx, csize);
-	}
-	fz_catch(ctx)
+	wri->udata = fz_malloc(ctx, wri->w * wri->dn + 1);
+	wri->cdata = fz_malloc(ctx, BAND_ZBUF_SIZE);
+
+	wri->z.zalloc = zalloc;
+	wri->z.zfree = zfree;
+	wri->z.opaque = ctx;
+	if (deflateInit(&wri->z, Z_DEFAULT_COMPRESSION) != Z_OK)
+		fz_throw(ctx, "cannot compress image data");
+	wri->z_open = 1;
+	wri->z.next_out = wri->cdata;
+	wri->z.avail_out = BAND_ZBUF_SIZE;
+
+	big32(head+0, wri->w);
+	big32(head+4, wri->h);
+	head[8] = 8; /* depth */
+	head[9] = color;
+	head[10] = 0; /* compression */
+	head[11] = 0; /* filter */
+	head[12] = 0; /* interlace */
+
+	fwrite(pngsig, 1, 8, wri->fp);
+	putchunk("IHDR", head, 13, wri->fp);
+}
+
+static void
+deflate_png(fz_context *ctx, fz_band_writer *wri, unsigned char *data, int len, int flush)
+{
+	int err;
+
+	wri->z.next_in = data;
+	wri->z.avail_in = len;
+	do
 	{
-		fz_free(ctx, udata);
-		fz_rethrow(ctx);
+		err = deflate(&wri->z, flush);
+		if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+			fz_throw(ctx, "cannot compress image data");
+		if (wri->z.avail_out == 0 || (flush == Z_FINISH && wri->z.next_out != wri->cdata))
+		{
+			putchunk("IDAT", wri->cdata, wri->z.next_out - wri->cdata, wri->fp);
+			wri->z.next_out = wri->cdata;
+			wri->z.avail_out = BAND_ZBUF_SIZE;
+		}
 	}
+	while (wri->z.avail_in > 0 || (flush == Z_FINISH && err != Z_STREAM_END));
+}
 
-	sp = pixmap->samples;
-	dp = udata;
-	for (y = 0; y < pixmap->h; y++)
+static void
+write_png_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band)
+{
+	unsigned char *sp = band->samples;
+	unsigned char *dp;
+	int y, x, k;
+	int sn = wri->n;
+	int dn = wri->dn;
+
+	for (y = 0; y < band->h; y++)
 	{
+		dp = wri->udata;
 		*dp++ = 1; /* sub prediction filter */
-		for (x = 0; x < pixmap->w; x++)
+		for (x = 0; x < band->w; x++)
 		{
 			for (k = 0; k < dn; k++)
 			{
@@ -549,40 +543,256 @@ fz_write_png(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
 			sp += sn;
 			dp += dn;
 		}
+		deflate_png(ctx, wri, wri->udata, band->w * dn + 1, Z_NO_FLUSH);
 	}
+}
 
-	err = compress(cdata, &csize, udata, usize);
-	if (err != Z_OK)
+static void
+write_pnm_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band)
+{
+	unsigned char *p = band->samples;
+	int len = band->w * band->h;
+
+	switch (wri->n)
 	{
-		fz_free(ctx, udata);
-		fz_free(ctx, cdata);
-		fz_throw(ctx, "cannot compress image data");
+	case 1:
+		fwrite(p, 1, len, wri->fp);
+		break;
+	case 2:
+		while (len--)
+		{
+			putc(p[0], wri->fp);
+			p += 2;
+		}
+		break;
+	case 4:
+		while (len--)
+		{
+			putc(p[0], wri->fp);
+			putc(p[1], wri->fp);
+			putc(p[2], wri->fp);
+			p += 4;
+		}
+	}
+}
+
+static void
+write_pam_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band)
+{
+	unsigned char *sp = band->samples;
+	int len = band->w * band->h;
+	int k;
+
+	if (wri->dn == wri->n)
+	{
+		fwrite(sp, wri->n, len, wri->fp);
+		return;
+	}
+	while (len--)
+	{
+		for (k = 0; k < wri->dn; k++)
+			putc(sp[k], wri->fp);
+		sp += wri->n;
+	}
+}
+
+static void
+write_pbm_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band)
+{
+	fz_bitmap *bit = fz_halftone_pixmap(ctx, band, NULL);
+	unsigned char *p = bit->samples;
+	int h = bit->h;
+	int bytestride = (bit->w + 7) >> 3;
+
+	while (h--)
+	{
+		fwrite(p, 1, bytestride, wri->fp);
+		p += bit->stride;
+	}
+	fz_drop_bitmap(ctx, bit);
+}
+
+fz_band_writer *
+fz_new_band_writer(fz_context *ctx, char *filename, int format, fz_colorspace *colorspace, int w, int h, int savealpha)
+{
+	fz_band_writer *wri;
+	FILE *fp;
+	int n = colorspace ? colorspace->n + 1 : 1;
+
+	if (format == FZ_BAND_PBM)
+	{
+		if (n != 2)
+			fz_throw(ctx, "pixmap must be grayscale to write as pbm");
 	}
+	else if (format != FZ_BAND_PAM && n != 1 && n != 2 && n != 4)
+		fz_throw(ctx, "pixmap must be grayscale or rgb to write as %s", format == FZ_BAND_PNG ? "png" : "pnm");
+
+	wri = fz_malloc_struct(ctx, fz_band_writer);
 
 	fp = fopen(filename, "wb");
 	if (!fp)
 	{
-		fz_free(ctx, udata);
-		fz_free(ctx, cdata);
+		fz_free(ctx, wri);
 		fz_throw(ctx, "cannot open file '%s': %s", filename, strerror(errno));
 	}
 
-	big32(head+0, pixmap->w);
-	big32(head+4, pixmap->h);
-	head[8] = 8; /* depth */
-	head[9] = color;
-	head[10] = 0; /* compression */
-	head[11] = 0; /* filter */
-	head[12] = 0; /* interlace */
+	wri->format = format;
+	wri->w = w;
+	wri->h = h;
+	wri->n = n;
+	wri->dn = n;
+	if ((!savealpha || format == FZ_BAND_PNM) && n > 1)
+		wri->dn--;
+	wri->savealpha = savealpha;
+	wri->fp = fp;
 
-	fwrite(pngsig, 1, 8, fp);
-	putchunk("IHDR", head, 13, fp);
-	putchunk("IDAT", cdata, csize, fp);
-	putchunk("IEND", head, 0, fp);
-	fclose(fp);
+	fz_try(ctx)
+	{
+		switch (format)
+		{
+		case FZ_BAND_PNM:
+			fprintf(fp, wri->dn == 1 ? "P5\n" : "P6\n");
+			fprintf(fp, "%d %d\n", w, h);
+			fprintf(fp, "255\n");
+			break;
+		case FZ_BAND_PAM:
+			fprintf(fp, "P7\n");
+			fprintf(fp, "WIDTH %d\n", w);
+			fprintf(fp, "HEIGHT %d\n", h);
+			fprintf(fp, "DEPTH %d\n", wri->dn);
+			fprintf(fp, "MAXVAL 255\n");
+			if (colorspace)
+				fprintf(fp, "# COLORSPACE %s\n", colorspace->name);
+			switch (wri->dn)
+			{
+			case 1: fprintf(fp, "TUPLTYPE GRAYSCALE\n"); break;
+			case 2: if (n == 2) fprintf(fp, "TUPLTYPE GRAYSCALE_ALPHA\n"); break;
+			case 3: if (n == 4) fprintf(fp, "TUPLTYPE RGB\n"); break;
+			case 4: if (n == 4) fprintf(fp, "TUPLTYPE RGB_ALPHA\n"); break;
+			}
+			fprintf(fp, "ENDHDR\n");
+			break;
+		case FZ_BAND_PNG:
+			write_png_header(ctx, wri);
+			break;
+		case FZ_BAND_PBM:
+			fprintf(fp, "P4\n%d %d\n", w, h);
+			break;
+		default:
+			fz_throw(ctx, "unknown band writer format");
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_free_band_writer(ctx, wri);
+		fz_rethrow(ctx);
+	}
 
-	fz_free(ctx, udata);
-	fz_free(ctx, cdata);
+	return wri;
+}
+
+void
+fz_write_band(fz_context *ctx, fz_band_writer *wri, fz_pixmap *band)
+{
+	if (band->w != wri->w || band->n != wri->n)
+		fz_throw(ctx, "band does not match image");
+	if (wri->line + band->h > wri->h)
+		fz_throw(ctx, "too many rows written to image");
+
+	switch (wri->format)
+	{
+	case FZ_BAND_PNM: write_pnm_band(ctx, wri, band); break;
+	case FZ_BAND_PAM: write_pam_band(ctx, wri, band); break;
+	case FZ_BAND_PNG: write_png_band(ctx, wri, band); break;
+	case FZ_BAND_PBM: write_pbm_band(ctx, wri, band); break;
+	}
+	wri->line += band->h;
+}
+
+void
+fz_close_band_writer(fz_context *ctx, fz_band_writer *wri)
+{
+	fz_try(ctx)
+	{
+		if (wri->line != wri->h)
+			fz_throw(ctx, "image is missing %d rows", wri->h - wri->line);
+		if (wri->format == FZ_BAND_PNG)
+		{
+			deflate_png(ctx, wri, NULL, 0, Z_FINISH);
+			putchunk("IEND", wri->cdata, 0, wri->fp);
+		}
+		if (fflush(wri->fp))
+			fz_throw(ctx, "cannot write image: %s", strerror(errno));
+	}
+	fz_always(ctx)
+	{
+		fz_free_band_writer(ctx, wri);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+void
+fz_free_band_writer(fz_context *ctx, fz_band_writer *wri)
+{
+	if (!wri)
+		return;
+	if (wri->z_open)
+		deflateEnd(&wri->z);
+	fz_free(ctx, wri->udata);
+	fz_free(ctx, wri->cdata);
+	if (wri->fp)
+		fclose(wri->fp);
+	fz_free(ctx, wri);
+}
+
+static void
+write_pixmap_banded(fz_context *ctx, fz_pixmap *pixmap, char *filename, int format, int savealpha)
+{
+	fz_band_writer *wri = fz_new_band_writer(ctx, filename, format, pixmap->colorspace, pixmap->w, pixmap->h, savealpha);
+
+	fz_try(ctx)
+	{
+		fz_write_band(ctx, wri, pixmap);
+	}
+	fz_catch(ctx)
+	{
+		fz_free_band_writer(ctx, wri);
+		fz_rethrow(ctx);
+	}
+	fz_close_band_writer(ctx, wri);
+}
+
+/*
+ * Write pixmap to PNM file (without alpha channel)
+ */
+
+void
+fz_write_pnm(fz_context *ctx, fz_pixmap *pixmap, char *filename)
+{
+	write_pixmap_banded(ctx, pixmap, filename, FZ_BAND_PNM, 0);
+}
+
+/*
+ * Write pixmap to PAM file (with or without alpha channel)
+ */
+
+void
+fz_write_pam(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
+{
+	write_pixmap_banded(ctx, pixmap, filename, FZ_BAND_PAM, savealpha);
+}
+
+/*
+ * Write pixmap to PNG file (with or without alpha channel)
+ */
+
+void
+fz_write_png(fz_context *ctx, fz_pixmap *pixmap, char *filename, int savealpha)
+{
+	write_pixmap_banded(ctx, pixmap, filename, FZ_BAND_PNG, savealpha);
 }
 
 unsigned int
@@ -596,9 +806,26 @@ fz_pixmap_size(fz_context *ctx, fz_pixmap * pix)
 fz_pixmap *
 fz_image_to_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 {
+	fz_pixmap *pix;
+	int tag;
+
 	if (image == NULL)
 		return NULL;
-	return image->get_pixmap(ctx, image, w, h);
+
+	tag = fz_set_alloc_tag(ctx, FZ_ALLOC_IMAGE);
+	fz_try(ctx)
+	{
+		pix = image->get_pixmap(ctx, image, w, h);
+	}
+	fz_always(ctx)
+	{
+		fz_set_alloc_tag(ctx, tag);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+	return pix;
 }
 
 fz_image *
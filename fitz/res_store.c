@@ -112,7 +112,8 @@ evict(fz_context *ctx, fz_item *item)
 	/* Remove from the hash table */
 	if (item->type->make_hash_key)
 	{
-		fz_store_hash hash = { NULL };
+		fz_store_hash hash;
+		memset(&hash, 0, sizeof(hash));
 		hash.free = item->val->free;
 		if (item->type->make_hash_key(&hash, item->key))
 			fz_hash_remove(ctx, store->hash, &hash);
@@ -195,7 +196,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	unsigned int size;
 	fz_storable *val = (fz_storable *)val_;
 	fz_store *store = ctx->store;
-	fz_store_hash hash = { NULL };
+	fz_store_hash hash;
 	int use_hash = 0;
 
 	if (!store)
@@ -217,6 +218,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 
 	if (type->make_hash_key)
 	{
+		memset(&hash, 0, sizeof(hash));
 		hash.free = val->free;
 		use_hash = type->make_hash_key(&hash, key);
 	}
@@ -262,14 +264,18 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 			store->size -= itemsize;
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
 			fz_free(ctx, item);
+			type->drop_key(ctx, key);
 			return NULL;
 		}
 		if (existing)
 		{
-			/* Take a new reference */
+			/* Take a new reference, and undo what we did for our
+			 * own item, which is not going in. */
 			existing->val->refs++;
+			store->size -= itemsize;
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
 			fz_free(ctx, item);
+			type->drop_key(ctx, key);
 			return existing->val;
 		}
 	}
@@ -294,7 +300,7 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
-	fz_store_hash hash = { NULL };
+	fz_store_hash hash;
 	int use_hash = 0;
 
 	if (!store)
@@ -305,6 +311,7 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 
 	if (type->make_hash_key)
 	{
+		memset(&hash, 0, sizeof(hash));
 		hash.free = free;
 		use_hash = type->make_hash_key(&hash, key);
 	}
@@ -348,10 +355,14 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 		if (item->val->refs > 0)
 			item->val->refs++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		if (ctx->profile)
+			ctx->profile->store_hits++;
 		return (void *)item->val;
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
+	if (ctx->profile)
+		ctx->profile->store_misses++;
 	return NULL;
 }
 
@@ -366,6 +377,7 @@ fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type
 
 	if (type->make_hash_key)
 	{
+		memset(&hash, 0, sizeof(hash));
 		hash.free = free;
 		use_hash = type->make_hash_key(&hash, key);
 	}
@@ -434,6 +446,14 @@ fz_keep_store_context(fz_context *ctx)
 	return ctx->store;
 }
 
+unsigned int
+fz_store_limit(fz_context *ctx)
+{
+	if (ctx == NULL || ctx->store == NULL)
+		return FZ_STORE_UNLIMITED;
+	return ctx->store->max;
+}
+
 void
 fz_drop_store_context(fz_context *ctx)
 {
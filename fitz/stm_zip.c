@@ -0,0 +1,524 @@
+#include "fitz-internal.h"
+
+#include <zlib.h>
+
+#define ZIP_LOCAL_FILE_SIG 0x04034b50
+#define ZIP_CENTRAL_DIRECTORY_SIG 0x02014b50
+#define ZIP_END_OF_CENTRAL_DIRECTORY_SIG 0x06054b50
+
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG 0x07064b50
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_SIG 0x06064b50
+#define ZIP64_EXTRA_FIELD_SIG 0x0001
+
+typedef struct fz_zip_entry_s fz_zip_entry;
+
+struct fz_zip_entry_s
+{
+	char *name;
+	int offset;
+	int csize;
+	int usize;
+};
+
+struct fz_zip_archive_s
+{
+	fz_stream *file;
+	int count;
+	fz_zip_entry *table;
+};
+
+static inline int getshort(fz_stream *file)
+{
+	int a = fz_read_byte(file);
+	int b = fz_read_byte(file);
+	return a | b << 8;
+}
+
+static inline int getlong(fz_stream *file)
+{
+	int a = fz_read_byte(file);
+	int b = fz_read_byte(file);
+	int c = fz_read_byte(file);
+	int d = fz_read_byte(file);
+	return a | b << 8 | c << 16 | d << 24;
+}
+
+static inline int getlong64(fz_stream *file)
+{
+	int a = getlong(file);
+	int b = getlong(file);
+	return b != 0 ? -1 : a;
+}
+
+static inline int zip_tolower(int c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + 32;
+	return c;
+}
+
+static int
+zip_strcasecmp(char *a, char *b)
+{
+	while (zip_tolower(*a) == zip_tolower(*b))
+	{
+		if (*a++ == 0)
+			return 0;
+		b++;
+	}
+	return zip_tolower(*a) - zip_tolower(*b);
+}
+
+static int
+zip_compare_entries(const void *a0, const void *b0)
+{
+	fz_zip_entry *a = (fz_zip_entry*) a0;
+	fz_zip_entry *b = (fz_zip_entry*) b0;
+	return zip_strcasecmp(a->name, b->name);
+}
+
+/*
+ * Read the central directory in a zip file.
+ */
+
+static void
+read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int start_offset)
+{
+	fz_stream *file = zip->file;
+	int sig;
+	int offset, count;
+	int namesize, metasize, commentsize;
+	int i;
+
+	fz_seek(file, start_offset, 0);
+
+	sig = getlong(file);
+	if (sig != ZIP_END_OF_CENTRAL_DIRECTORY_SIG)
+		fz_throw(ctx, "wrong zip end of central directory signature (0x%x)", sig);
+
+	(void) getshort(file); /* this disk */
+	(void) getshort(file); /* start disk */
+	(void) getshort(file); /* entries in this disk */
+	count = getshort(file); /* entries in central directory disk */
+	(void) getlong(file); /* size of central directory */
+	offset = getlong(file); /* offset to central directory */
+
+	/* ZIP64 */
+	if (count == 0xFFFF)
+	{
+		fz_seek(file, start_offset - 20, 0);
+
+		sig = getlong(file);
+		if (sig != ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG)
+			fz_throw(ctx, "wrong zip64 end of central directory locator signature (0x%x)", sig);
+
+		(void) getlong(file); /* start disk */
+		offset = getlong64(file); /* offset to end of central directory record */
+		if (offset < 0)
+			fz_throw(ctx, "zip64 files larger than 2 GB aren't supported");
+
+		fz_seek(file, offset, 0);
+
+		sig = getlong(file);
+		if (sig != ZIP64_END_OF_CENTRAL_DIRECTORY_SIG)
+			fz_throw(ctx, "wrong zip64 end of central directory signature (0x%x)", sig);
+
+		(void) getlong64(file); /* size of record */
+		(void) getshort(file); /* version made by */
+		(void) getshort(file); /* version to extract */
+		(void) getlong(file); /* disk number */
+		(void) getlong(file); /* disk number start */
+		count = getlong64(file); /* entries in central directory disk */
+		(void) getlong64(file); /* entries in central directory */
+		(void) getlong64(file); /* size of central directory */
+		offset = getlong64(file); /* offset to central directory */
+
+		if (count < 0 || offset < 0)
+			fz_throw(ctx, "zip64 files larger than 2 GB aren't supported");
+	}
+
+	zip->table = fz_malloc_array(ctx, count, sizeof(fz_zip_entry));
+	memset(zip->table, 0, count * sizeof(fz_zip_entry));
+	zip->count = count;
+
+	fz_seek(file, offset, 0);
+
+	for (i = 0; i < count; i++)
+	{
+		fz_zip_entry *ent = &zip->table[i];
+
+		sig = getlong(file);
+		if (sig != ZIP_CENTRAL_DIRECTORY_SIG)
+			fz_throw(ctx, "wrong zip central directory signature (0x%x)", sig);
+
+		(void) getshort(file); /* version made by */
+		(void) getshort(file); /* version to extract */
+		(void) getshort(file); /* general */
+		(void) getshort(file); /* method */
+		(void) getshort(file); /* last mod file time */
+		(void) getshort(file); /* last mod file date */
+		(void) getlong(file); /* crc-32 */
+		ent->csize = getlong(file);
+		ent->usize = getlong(file);
+		namesize = getshort(file);
+		metasize = getshort(file);
+		commentsize = getshort(file);
+		(void) getshort(file); /* disk number start */
+		(void) getshort(file); /* int file atts */
+		(void) getlong(file); /* ext file atts */
+		ent->offset = getlong(file);
+
+		ent->name = fz_malloc(ctx, namesize + 1);
+		fz_read(file, (unsigned char*)ent->name, namesize);
+		ent->name[namesize] = 0;
+
+		while (metasize > 0)
+		{
+			int type = getshort(file);
+			int size = getshort(file);
+			if (type == ZIP64_EXTRA_FIELD_SIG)
+			{
+				ent->usize = getlong64(file);
+				ent->csize = getlong64(file);
+				ent->offset = getlong64(file);
+				fz_seek(file, -24, 1);
+			}
+			fz_seek(file, size, 1);
+			metasize -= 4 + size;
+		}
+		if (ent->usize < 0 || ent->csize < 0 || ent->offset < 0)
+			fz_throw(ctx, "zip64 files larger than 2 GB aren't supported");
+
+		fz_seek(file, commentsize, 1);
+	}
+
+	qsort(zip->table, count, sizeof(fz_zip_entry), zip_compare_entries);
+}
+
+static void
+read_zip_dir(fz_context *ctx, fz_zip_archive *zip)
+{
+	fz_stream *file = zip->file;
+	unsigned char buf[512];
+	int file_size, back, maxback;
+	int i, n;
+
+	fz_seek(file, 0, SEEK_END);
+	file_size = fz_tell(file);
+
+	maxback = MIN(file_size, 0xFFFF + sizeof buf);
+	back = MIN(maxback, sizeof buf);
+
+	while (back < maxback)
+	{
+		fz_seek(file, file_size - back, 0);
+		n = fz_read(file, buf, sizeof buf);
+		for (i = n - 4; i > 0; i--)
+		{
+			if (!memcmp(buf + i, "PK\5\6", 4))
+			{
+				read_zip_dir_imp(ctx, zip, file_size - back + i);
+				return;
+			}
+		}
+
+		back += sizeof buf - 4;
+	}
+
+	fz_throw(ctx, "cannot find end of central directory");
+}
+
+fz_zip_archive *
+fz_open_zip_archive(fz_context *ctx, fz_stream *file)
+{
+	fz_zip_archive *zip;
+
+	zip = fz_malloc_struct(ctx, fz_zip_archive);
+	zip->file = fz_keep_stream(file);
+
+	fz_lock(ctx, FZ_LOCK_FILE);
+	fz_try(ctx)
+	{
+		read_zip_dir(ctx, zip);
+	}
+	fz_always(ctx)
+	{
+		fz_unlock(ctx, FZ_LOCK_FILE);
+	}
+	fz_catch(ctx)
+	{
+		fz_close_zip_archive(ctx, zip);
+		fz_rethrow(ctx);
+	}
+
+	return zip;
+}
+
+void
+fz_close_zip_archive(fz_context *ctx, fz_zip_archive *zip)
+{
+	int i;
+
+	if (!zip)
+		return;
+
+	for (i = 0; i < zip->count; i++)
+		fz_free(ctx, zip->table[i].name);
+	fz_free(ctx, zip->table);
+	fz_close(zip->file);
+	fz_free(ctx, zip);
+}
+
+int
+fz_count_zip_entries(fz_zip_archive *zip)
+{
+	return zip->count;
+}
+
+char *
+fz_zip_entry_name(fz_zip_archive *zip, int idx)
+{
+	if (idx < 0 || idx >= zip->count)
+		return NULL;
+	return zip->table[idx].name;
+}
+
+int
+fz_zip_entry_size(fz_zip_archive *zip, int idx)
+{
+	if (idx < 0 || idx >= zip->count)
+		return 0;
+	return zip->table[idx].usize;
+}
+
+int
+fz_find_zip_entry(fz_zip_archive *zip, char *name)
+{
+	int l = 0;
+	int r = zip->count - 1;
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		int c = zip_strcasecmp(name, zip->table[m].name);
+		if (c < 0)
+			r = m - 1;
+		else if (c > 0)
+			l = m + 1;
+		else
+			return m;
+	}
+	return -1;
+}
+
+/*
+ * Entry streams read the compressed data in small chunks straight
+ * from the archive file, so only the uncompressed bytes the caller
+ * asks for are ever held in memory. The archive file is shared, so
+ * every chunk is read with an explicit seek under the file lock.
+ */
+
+typedef struct fz_zip_stream_s fz_zip_stream;
+
+struct fz_zip_stream_s
+{
+	fz_stream *file;
+	int method;
+	int pos; /* file offset of the next compressed byte */
+	int remain; /* compressed bytes left to read */
+	int z_open;
+	z_stream z;
+	unsigned char inbuf[4096];
+};
+
+static void *zalloc(void *opaque, unsigned int items, unsigned int size)
+{
+	return fz_malloc_array_no_throw(opaque, items, size);
+}
+
+static void zfree(void *opaque, void *ptr)
+{
+	fz_free(opaque, ptr);
+}
+
+static int
+read_zip_raw(fz_stream *stm, unsigned char *buf, int len)
+{
+	fz_zip_stream *state = stm->state;
+	fz_context *ctx = stm->ctx;
+	int n = 0;
+
+	len = MIN(len, state->remain);
+	if (len == 0)
+		return 0;
+
+	fz_lock(ctx, FZ_LOCK_FILE);
+	fz_try(ctx)
+	{
+		fz_seek(state->file, state->pos, 0);
+		n = fz_read(state->file, buf, len);
+	}
+	fz_always(ctx)
+	{
+		fz_unlock(ctx, FZ_LOCK_FILE);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	state->pos += n;
+	state->remain -= n;
+	if (n == 0)
+		state->remain = 0;
+	return n;
+}
+
+static int
+read_zip_stored(fz_stream *stm, unsigned char *buf, int len)
+{
+	return read_zip_raw(stm, buf, len);
+}
+
+static int
+read_zip_deflated(fz_stream *stm, unsigned char *buf, int len)
+{
+	fz_zip_stream *state = stm->state;
+	z_streamp zp = &state->z;
+	int code;
+
+	zp->next_out = buf;
+	zp->avail_out = len;
+
+	while (zp->avail_out > 0)
+	{
+		if (zp->avail_in == 0)
+		{
+			zp->next_in = state->inbuf;
+			zp->avail_in = read_zip_raw(stm, state->inbuf, sizeof state->inbuf);
+		}
+
+		code = inflate(zp, Z_SYNC_FLUSH);
+
+		if (code == Z_STREAM_END)
+			break;
+		else if (code == Z_BUF_ERROR && zp->avail_in == 0)
+			fz_throw(stm->ctx, "premature end of data in zip entry");
+		else if (code != Z_OK)
+			fz_throw(stm->ctx, "zlib inflate error: %s", zp->msg);
+	}
+
+	return len - zp->avail_out;
+}
+
+static void
+close_zip_stream(fz_context *ctx, void *state_)
+{
+	fz_zip_stream *state = (fz_zip_stream *)state_;
+
+	if (state->z_open)
+		inflateEnd(&state->z);
+	fz_close(state->file);
+	fz_free(ctx, state);
+}
+
+fz_stream *
+fz_open_zip_entry(fz_context *ctx, fz_zip_archive *zip, int idx)
+{
+	fz_zip_stream *state = NULL;
+	fz_stream *file = zip->file;
+	fz_zip_entry *ent;
+	int sig, method, namelength, extralength;
+	int code;
+
+	if (idx < 0 || idx >= zip->count)
+		fz_throw(ctx, "zip entry %d out of range", idx);
+	ent = &zip->table[idx];
+
+	fz_lock(ctx, FZ_LOCK_FILE);
+	fz_try(ctx)
+	{
+		fz_seek(file, ent->offset, 0);
+
+		sig = getlong(file);
+		if (sig != ZIP_LOCAL_FILE_SIG)
+			fz_throw(ctx, "wrong zip local file signature (0x%x)", sig);
+
+		(void) getshort(file); /* version */
+		(void) getshort(file); /* general */
+		method = getshort(file);
+		(void) getshort(file); /* file time */
+		(void) getshort(file); /* file date */
+		(void) getlong(file); /* crc-32 */
+		(void) getlong(file); /* csize */
+		(void) getlong(file); /* usize */
+		namelength = getshort(file);
+		extralength = getshort(file);
+	}
+	fz_always(ctx)
+	{
+		fz_unlock(ctx, FZ_LOCK_FILE);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	if (method != 0 && method != 8)
+		fz_throw(ctx, "unknown compression method (%d)", method);
+
+	fz_var(state);
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, fz_zip_stream);
+		state->method = method;
+		state->pos = ent->offset + 30 + namelength + extralength;
+		state->remain = method == 0 ? ent->usize : ent->csize;
+		if (method == 8)
+		{
+			state->z.zalloc = zalloc;
+			state->z.zfree = zfree;
+			state->z.opaque = ctx;
+			state->z.next_in = NULL;
+			state->z.avail_in = 0;
+			code = inflateInit2(&state->z, -15);
+			if (code != Z_OK)
+				fz_throw(ctx, "zlib inflateInit2 error: %s", state->z.msg);
+			state->z_open = 1;
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
+	}
+
+	state->file = fz_keep_stream(file);
+
+	if (method == 8)
+		return fz_new_stream(ctx, state, read_zip_deflated, close_zip_stream);
+	return fz_new_stream(ctx, state, read_zip_stored, close_zip_stream);
+}
+
+int
+fz_read_zip_entry(fz_context *ctx, fz_zip_archive *zip, int idx, unsigned char *buf, int len)
+{
+	fz_stream *stm;
+	int n = 0;
+
+	stm = fz_open_zip_entry(ctx, zip, idx);
+	fz_try(ctx)
+	{
+		n = fz_read(stm, buf, len);
+	}
+	fz_always(ctx)
+	{
+		fz_close(stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return n;
+}
@@ -939,6 +939,42 @@ pdf_drop_obj(pdf_obj *obj)
 		fz_free(obj->ctx, obj);
 }
 
+/* Approximate memory held by an object and the direct objects it
+ * contains, for store accounting. Shared children are counted once
+ * for every reference. */
+unsigned int
+pdf_obj_memory_size(pdf_obj *obj)
+{
+	unsigned int size;
+	int i;
+
+	if (!obj)
+		return 0;
+
+	switch (obj->kind)
+	{
+	case PDF_STRING:
+		return offsetof(pdf_obj, u.s.buf) + obj->u.s.len + 1;
+	case PDF_NAME:
+		return offsetof(pdf_obj, u.n) + strlen(obj->u.n) + 1;
+	case PDF_ARRAY:
+		size = sizeof(pdf_obj) + obj->u.a.cap * sizeof(pdf_obj *);
+		for (i = 0; i < obj->u.a.len; i++)
+			size += pdf_obj_memory_size(obj->u.a.items[i]);
+		return size;
+	case PDF_DICT:
+		size = sizeof(pdf_obj) + obj->u.d.cap * sizeof(struct keyval);
+		for (i = 0; i < obj->u.d.len; i++)
+		{
+			size += pdf_obj_memory_size(obj->u.d.items[i].k);
+			size += pdf_obj_memory_size(obj->u.d.items[i].v);
+		}
+		return size;
+	default:
+		return sizeof(pdf_obj);
+	}
+}
+
 /* Pretty printing objects */
 
 struct fmt
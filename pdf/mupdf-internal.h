@@ -6,6 +6,7 @@
 
 void pdf_set_str_len(pdf_obj *obj, int newlen);
 void *pdf_get_indirect_document(pdf_obj *obj);
+unsigned int pdf_obj_memory_size(pdf_obj *obj);
 
 /*
  * PDF Images
@@ -127,6 +128,7 @@ struct pdf_lexbuf_large_s
 };
 
 int pdf_lex(fz_stream *f, pdf_lexbuf *lexbuf);
+int pdf_lex_buffer(fz_stream *f, pdf_lexbuf *lexbuf);
 
 pdf_obj *pdf_parse_array(pdf_document *doc, fz_stream *f, pdf_lexbuf *buf);
 pdf_obj *pdf_parse_dict(pdf_document *doc, fz_stream *f, pdf_lexbuf *buf);
@@ -166,6 +168,8 @@ struct pdf_ocg_descriptor_s
 	pdf_obj *intent;
 };
 
+typedef struct pdf_name_table_s pdf_name_table;
+
 struct pdf_document_s
 {
 	fz_document super;
@@ -187,6 +191,12 @@ struct pdf_document_s
 	int page_cap;
 	pdf_obj **page_objs;
 	pdf_obj **page_refs;
+	int page_map_cap;
+	int *page_map;
+
+	pdf_name_table *name_tables;
+
+	int compile_contents;
 
 	pdf_lexbuf_large lexbuf;
 };
@@ -258,6 +268,7 @@ struct pdf_pattern_s
 	fz_rect bbox;
 	pdf_obj *resources;
 	fz_buffer *contents;
+	pdf_obj *me;
 };
 
 pdf_pattern *pdf_load_pattern(pdf_document *doc, pdf_obj *obj);
@@ -496,6 +507,7 @@ fz_link_dest pdf_parse_action(pdf_document *doc, pdf_obj *action);
 pdf_obj *pdf_lookup_dest(pdf_document *doc, pdf_obj *needle);
 pdf_obj *pdf_lookup_name(pdf_document *doc, char *which, pdf_obj *needle);
 pdf_obj *pdf_load_name_tree(pdf_document *doc, char *which);
+void pdf_free_name_tables(fz_context *ctx, pdf_name_table *table);
 
 fz_link *pdf_load_link_annots(pdf_document *, pdf_obj *annots, fz_matrix page_ctm);
 
@@ -513,7 +525,9 @@ struct pdf_page_s
 	int rotate;
 	int transparency;
 	pdf_obj *resources;
+	pdf_obj *thumb;
 	fz_buffer *contents;
+	pdf_obj *me;
 	fz_link *links;
 	pdf_annot *annots;
 };
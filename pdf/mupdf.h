@@ -144,6 +144,16 @@ pdf_document *pdf_open_document_with_stream(fz_stream *file);
 */
 void pdf_close_document(pdf_document *doc);
 
+/*
+	pdf_specifics: Get the PDF document behind a generic document.
+
+	Returns doc as a pdf_document if it was opened as a PDF, or
+	NULL otherwise. No reference is taken.
+
+	Does not throw exceptions.
+*/
+pdf_document *pdf_specifics(fz_document *doc);
+
 int pdf_needs_password(pdf_document *doc);
 int pdf_authenticate_password(pdf_document *doc, char *pw);
 
@@ -193,6 +203,17 @@ fz_link *pdf_load_links(pdf_document *doc, pdf_page *page);
 */
 fz_rect pdf_bound_page(pdf_document *doc, pdf_page *page);
 
+/*
+	pdf_load_page_thumbnail: Load the thumbnail image embedded in
+	a page (the /Thumb entry of the page dictionary).
+
+	Returns NULL if the page has no thumbnail, or if the thumbnail
+	cannot be decoded.
+
+	Does not throw exceptions.
+*/
+fz_image *pdf_load_page_thumbnail(pdf_document *doc, pdf_page *page);
+
 /*
 	pdf_free_page: Frees a page and its resources.
 
@@ -214,4 +235,16 @@ void pdf_run_page(pdf_document *doc, pdf_page *page, fz_device *dev, fz_matrix c
 
 void pdf_run_page_with_usage(pdf_document *doc, pdf_page *page, fz_device *dev, fz_matrix ctm, char *event, fz_cookie *cookie);
 
+/*
+	pdf_set_compile_contents: Choose whether content streams are
+	compiled into the store.
+
+	When enabled, the content streams of pages, forms and patterns
+	are kept in the store in a pre-tokenised form the first time they
+	are run, so that running them again skips lexing. The compiled
+	form is several times the size of the stream, so it is off by
+	default; enable it in viewers that run the same pages again.
+*/
+void pdf_set_compile_contents(pdf_document *doc, int enable);
+
 #endif
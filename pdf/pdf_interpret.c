@@ -83,6 +83,7 @@ struct pdf_csi_s
 
 	/* path object state */
 	fz_path *path;
+	fz_path *spare_path; /* emptied path kept for reuse */
 	int clip;
 	int clip_even_odd;
 
@@ -104,7 +105,7 @@ struct pdf_csi_s
 	fz_cookie *cookie;
 };
 
-static void pdf_run_buffer(pdf_csi *csi, pdf_obj *rdb, fz_buffer *contents);
+static void pdf_run_contents(pdf_csi *csi, pdf_obj *rdb, fz_buffer *contents, pdf_obj *key);
 static void pdf_run_xobject(pdf_csi *csi, pdf_obj *resources, pdf_xobject *xobj, fz_matrix transform);
 static void pdf_show_pattern(pdf_csi *csi, pdf_pattern *pat, fz_rect area, int what);
 
@@ -453,7 +454,13 @@ pdf_show_path(pdf_csi *csi, int doclose, int dofill, int dostroke, int even_odd)
 	}
 
 	path = csi->path;
-	csi->path = fz_new_path(ctx);
+	if (csi->spare_path)
+	{
+		csi->path = csi->spare_path;
+		csi->spare_path = NULL;
+	}
+	else
+		csi->path = fz_new_path(ctx);
 
 	fz_try(ctx)
 	{
@@ -544,7 +551,14 @@ pdf_show_path(pdf_csi *csi, int doclose, int dofill, int dostroke, int even_odd)
 		fz_free_path(ctx, path);
 		fz_rethrow(ctx);
 	}
-	fz_free_path(ctx, path);
+
+	if (csi->spare_path)
+		fz_free_path(ctx, path);
+	else
+	{
+		fz_reset_path(ctx, path);
+		csi->spare_path = path;
+	}
 }
 
 /*
@@ -961,6 +975,7 @@ pdf_new_csi(pdf_document *xref, fz_device *dev, fz_matrix ctm, char *event, fz_c
 		csi->in_hidden_ocg = 0;
 
 		csi->path = fz_new_path(ctx);
+		csi->spare_path = NULL;
 		csi->clip = 0;
 		csi->clip_even_odd = 0;
 
@@ -1091,6 +1106,7 @@ pdf_free_csi(pdf_csi *csi)
 		fz_pop_clip(csi->dev);
 
 	if (csi->path) fz_free_path(ctx, csi->path);
+	if (csi->spare_path) fz_free_path(ctx, csi->spare_path);
 	if (csi->text) fz_free_text(ctx, csi->text);
 
 	pdf_clear_stack(csi);
@@ -1291,7 +1307,7 @@ pdf_show_pattern(pdf_csi *csi, pdf_pattern *pat, fz_rect area, int what)
 		gstate->ctm = ptm;
 		csi->top_ctm = gstate->ctm;
 		pdf_gsave(csi);
-		pdf_run_buffer(csi, pat->resources, pat->contents);
+		pdf_run_contents(csi, pat->resources, pat->contents, pat->me);
 		/* RJW: "cannot render pattern tile" */
 		pdf_grestore(csi);
 		while (oldtop < csi->gtop)
@@ -1310,7 +1326,7 @@ pdf_show_pattern(pdf_csi *csi, pdf_pattern *pat, fz_rect area, int what)
 				pdf_gsave(csi);
 				fz_try(ctx)
 				{
-					pdf_run_buffer(csi, pat->resources, pat->contents);
+					pdf_run_contents(csi, pat->resources, pat->contents, pat->me);
 				}
 				fz_catch(ctx)
 				{
@@ -1407,7 +1423,7 @@ pdf_run_xobject(pdf_csi *csi, pdf_obj *resources, pdf_xobject *xobj, fz_matrix t
 		if (xobj->resources)
 			resources = xobj->resources;
 
-		pdf_run_buffer(csi, resources, xobj->contents);
+		pdf_run_contents(csi, resources, xobj->contents, xobj->me);
 		/* RJW: "cannot interpret XObject stream" */
 	}
 	fz_always(ctx)
@@ -2531,11 +2547,191 @@ pdf_run_keyword(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, char *buf)
 	fz_assert_lock_not_held(ctx, FZ_LOCK_FILE);
 }
 
+/*
+ * Compiled content streams
+ *
+ * The first time a content stream is run, its tokens are recorded into
+ * a flat array of operations, together with the arrays and dictionaries
+ * that were parsed from it. This goes in the store keyed by the stream
+ * object, so that running the same page, form or pattern again replays
+ * the operations instead of lexing the bytes. Streams with inline images
+ * are not compiled, since how much image data follows BI depends on the
+ * resources the stream is run with; the store remembers them with an
+ * empty entry so that they are not recorded again.
+ */
+
+typedef struct pdf_content_op_s pdf_content_op;
+typedef struct pdf_content_s pdf_content;
+
+struct pdf_content_op_s
+{
+	int tok;
+	int len;
+	union
+	{
+		int i;
+		float f;
+		int ofs; /* of names, strings and keywords in data */
+		pdf_obj *obj; /* parsed array or dictionary */
+	} u;
+};
+
+struct pdf_content_s
+{
+	fz_storable storable;
+	int compiled;
+	int failed;
+	int len;
+	int cap;
+	pdf_content_op *ops;
+	int data_len;
+	int data_cap;
+	char *data;
+};
+
+static void
+pdf_empty_content(fz_context *ctx, pdf_content *content)
+{
+	int i;
+
+	for (i = 0; i < content->len; i++)
+		if (content->ops[i].tok == PDF_TOK_OPEN_ARRAY || content->ops[i].tok == PDF_TOK_OPEN_DICT)
+			pdf_drop_obj(content->ops[i].u.obj);
+	fz_free(ctx, content->ops);
+	fz_free(ctx, content->data);
+	content->ops = NULL;
+	content->data = NULL;
+	content->len = content->cap = 0;
+	content->data_len = content->data_cap = 0;
+}
+
+static void
+pdf_free_content_imp(fz_context *ctx, fz_storable *content_)
+{
+	pdf_content *content = (pdf_content *)content_;
+
+	pdf_empty_content(ctx, content);
+	fz_free(ctx, content);
+}
+
+/* Counts the arrays and dictionaries the program keeps alive too */
+static unsigned int
+pdf_content_size(pdf_content *content)
+{
+	unsigned int size = sizeof(*content) + content->cap * sizeof(pdf_content_op) + content->data_cap;
+	int i;
+
+	for (i = 0; i < content->len; i++)
+		if (content->ops[i].tok == PDF_TOK_OPEN_ARRAY || content->ops[i].tok == PDF_TOK_OPEN_DICT)
+			size += pdf_obj_memory_size(content->ops[i].u.obj);
+	return size;
+}
+
+/* Recording never throws; running out of memory just stops it */
+static void
+pdf_record_token(fz_context *ctx, pdf_content *rec, int tok, pdf_lexbuf *buf)
+{
+	pdf_content_op *op;
+
+	if (rec->failed || !rec->compiled)
+		return;
+
+	if (rec->len == rec->cap)
+	{
+		int cap = rec->cap ? rec->cap * 2 : 256;
+		pdf_content_op *ops = fz_resize_array_no_throw(ctx, rec->ops, cap, sizeof(pdf_content_op));
+		if (!ops)
+		{
+			rec->failed = 1;
+			return;
+		}
+		rec->ops = ops;
+		rec->cap = cap;
+	}
+
+	op = &rec->ops[rec->len++];
+	op->tok = tok;
+	op->len = 0;
+	op->u.obj = NULL;
+
+	switch (tok)
+	{
+	case PDF_TOK_INT:
+		op->u.i = buf->i;
+		break;
+	case PDF_TOK_REAL:
+		op->u.f = buf->f;
+		break;
+	case PDF_TOK_NAME:
+	case PDF_TOK_STRING:
+	case PDF_TOK_KEYWORD:
+		if (rec->data_len + buf->len + 1 > rec->data_cap)
+		{
+			int cap = rec->data_cap ? rec->data_cap : 1024;
+			char *data;
+			while (rec->data_len + buf->len + 1 > cap)
+				cap *= 2;
+			data = fz_resize_array_no_throw(ctx, rec->data, cap, 1);
+			if (!data)
+			{
+				rec->failed = 1;
+				return;
+			}
+			rec->data = data;
+			rec->data_cap = cap;
+		}
+		memcpy(rec->data + rec->data_len, buf->scratch, buf->len);
+		rec->data[rec->data_len + buf->len] = 0;
+		op->u.ofs = rec->data_len;
+		op->len = buf->len;
+		rec->data_len += buf->len + 1;
+		break;
+	}
+}
+
+static void
+pdf_record_object(pdf_content *rec, pdf_obj *obj)
+{
+	if (rec->failed || !rec->compiled)
+		return;
+	rec->ops[rec->len - 1].u.obj = pdf_keep_obj(obj);
+}
+
 static void
-pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
+pdf_store_content(fz_context *ctx, pdf_obj *key, pdf_content *rec)
+{
+	pdf_content *existing;
+
+	/* A form may have been stored while running itself */
+	existing = pdf_find_item(ctx, pdf_free_content_imp, key);
+	if (existing)
+	{
+		fz_drop_storable(ctx, &existing->storable);
+		return;
+	}
+
+	if (!rec->compiled)
+		pdf_empty_content(ctx, rec);
+	pdf_store_item(ctx, key, rec, pdf_content_size(rec));
+}
+
+/*
+ * Run a content stream, either lexing it from file (and recording it
+ * into rec, if given) or replaying a compiled program. Returns 1 if
+ * the end of the stream was reached, 0 if the cookie aborted it.
+ */
+
+static int
+pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf, pdf_content *prog, pdf_content *rec)
 {
 	fz_context *ctx = csi->dev->ctx;
+	pdf_content_op *op = NULL;
 	int tok, in_array;
+	int pc = 0;
+	char *s = NULL;
+	int len = 0;
+	int i = 0;
+	float f = 0;
 
 	/* make sure we have a clean slate if we come here from flush_text */
 	pdf_clear_stack(csi);
@@ -2560,8 +2756,33 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
 			csi->cookie->progress++;
 		}
 
-		tok = pdf_lex(file, buf);
-		/* RJW: "lexical error in content stream" */
+		if (prog)
+		{
+			if (pc == prog->len)
+				return 1;
+			op = &prog->ops[pc++];
+			tok = op->tok;
+			if (tok == PDF_TOK_INT)
+				i = op->u.i;
+			else if (tok == PDF_TOK_REAL)
+				f = op->u.f;
+			else if (tok == PDF_TOK_NAME || tok == PDF_TOK_STRING || tok == PDF_TOK_KEYWORD)
+			{
+				s = prog->data + op->u.ofs;
+				len = op->len;
+			}
+		}
+		else
+		{
+			tok = pdf_lex_buffer(file, buf);
+			/* RJW: "lexical error in content stream" */
+			i = buf->i;
+			f = buf->f;
+			s = buf->scratch;
+			len = buf->len;
+			if (rec)
+				pdf_record_token(ctx, rec, tok, buf);
+		}
 
 		if (in_array)
 		{
@@ -2572,26 +2793,26 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
 			else if (tok == PDF_TOK_REAL)
 			{
 				pdf_gstate *gstate = csi->gstate + csi->gtop;
-				pdf_show_space(csi, -buf->f * gstate->size * 0.001f);
+				pdf_show_space(csi, -f * gstate->size * 0.001f);
 			}
 			else if (tok == PDF_TOK_INT)
 			{
 				pdf_gstate *gstate = csi->gstate + csi->gtop;
-				pdf_show_space(csi, -buf->i * gstate->size * 0.001f);
+				pdf_show_space(csi, -i * gstate->size * 0.001f);
 			}
 			else if (tok == PDF_TOK_STRING)
 			{
-				pdf_show_string(csi, (unsigned char *)buf->scratch, buf->len);
+				pdf_show_string(csi, (unsigned char *)s, len);
 			}
 			else if (tok == PDF_TOK_KEYWORD)
 			{
-				if (!strcmp(buf->scratch, "Tw") || !strcmp(buf->scratch, "Tc"))
-					fz_warn(ctx, "ignoring keyword '%s' inside array", buf->scratch);
+				if (!strcmp(s, "Tw") || !strcmp(s, "Tc"))
+					fz_warn(ctx, "ignoring keyword '%s' inside array", s);
 				else
 					fz_throw(ctx, "syntax error in array");
 			}
 			else if (tok == PDF_TOK_EOF)
-				return;
+				return 1;
 			else
 				fz_throw(ctx, "syntax error in array");
 		}
@@ -2600,13 +2821,20 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
 		{
 		case PDF_TOK_ENDSTREAM:
 		case PDF_TOK_EOF:
-			return;
+			return 1;
 
 		case PDF_TOK_OPEN_ARRAY:
 			if (!csi->in_text)
 			{
-				csi->obj = pdf_parse_array(csi->xref, file, buf);
-				/* RJW: "cannot parse array" */
+				if (prog)
+					csi->obj = pdf_keep_obj(op->u.obj);
+				else
+				{
+					csi->obj = pdf_parse_array(csi->xref, file, buf);
+					/* RJW: "cannot parse array" */
+					if (rec)
+						pdf_record_object(rec, csi->obj);
+				}
 			}
 			else
 			{
@@ -2615,38 +2843,58 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
 			break;
 
 		case PDF_TOK_OPEN_DICT:
-			csi->obj = pdf_parse_dict(csi->xref, file, buf);
-			/* RJW: "cannot parse dictionary" */
+			if (prog)
+				csi->obj = pdf_keep_obj(op->u.obj);
+			else
+			{
+				csi->obj = pdf_parse_dict(csi->xref, file, buf);
+				/* RJW: "cannot parse dictionary" */
+				if (rec)
+					pdf_record_object(rec, csi->obj);
+			}
 			break;
 
 		case PDF_TOK_NAME:
-			fz_strlcpy(csi->name, buf->scratch, sizeof(csi->name));
+			fz_strlcpy(csi->name, s, sizeof(csi->name));
 			break;
 
 		case PDF_TOK_INT:
-			csi->stack[csi->top] = buf->i;
+			csi->stack[csi->top] = i;
 			csi->top ++;
 			break;
 
 		case PDF_TOK_REAL:
-			csi->stack[csi->top] = buf->f;
+			csi->stack[csi->top] = f;
 			csi->top ++;
 			break;
 
 		case PDF_TOK_STRING:
-			if (buf->len <= sizeof(csi->string))
+			if (len <= sizeof(csi->string))
 			{
-				memcpy(csi->string, buf->scratch, buf->len);
-				csi->string_len = buf->len;
+				memcpy(csi->string, s, len);
+				csi->string_len = len;
 			}
 			else
 			{
-				csi->obj = pdf_new_string(ctx, buf->scratch, buf->len);
+				csi->obj = pdf_new_string(ctx, s, len);
 			}
 			break;
 
 		case PDF_TOK_KEYWORD:
-			pdf_run_keyword(csi, rdb, file, buf->scratch);
+			if (rec && s[0] == 'B' && s[1] == 'I' && s[2] == 0)
+			{
+				/* Inline images can't be compiled */
+				rec->compiled = 0;
+			}
+			if (ctx->profile)
+			{
+				fz_profile_mark mark;
+				fz_profile_start(ctx, &mark);
+				pdf_run_keyword(csi, rdb, file, s);
+				fz_profile_stop_operator(ctx, &mark, s);
+			}
+			else
+				pdf_run_keyword(csi, rdb, file, s);
 			/* RJW: "cannot run keyword" */
 			pdf_clear_stack(csi);
 			break;
@@ -2655,6 +2903,8 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
 			fz_throw(ctx, "syntax error in content stream");
 		}
 	}
+
+	return 0;
 }
 
 /*
@@ -2662,40 +2912,76 @@ pdf_run_stream(pdf_csi *csi, pdf_obj *rdb, fz_stream *file, pdf_lexbuf *buf)
  */
 
 static void
-pdf_run_buffer(pdf_csi *csi, pdf_obj *rdb, fz_buffer *contents)
+pdf_run_contents(pdf_csi *csi, pdf_obj *rdb, fz_buffer *contents, pdf_obj *key)
 {
 	fz_context *ctx = csi->dev->ctx;
-	pdf_lexbuf_large *buf;
-	fz_stream * file = NULL;
+	pdf_lexbuf_large *buf = NULL;
+	fz_stream *file = NULL;
+	pdf_content *prog = NULL;
+	pdf_content *rec = NULL;
 	int save_in_text;
+	int done = 0;
 
 	fz_var(buf);
 	fz_var(file);
+	fz_var(prog);
+	fz_var(rec);
+	fz_var(done);
 
 	if (contents == NULL)
 		return;
 
+	if (key && pdf_is_indirect(key) && csi->xref->compile_contents)
+	{
+		prog = pdf_find_item(ctx, pdf_free_content_imp, key);
+		if (prog && !prog->compiled)
+		{
+			fz_drop_storable(ctx, &prog->storable);
+			prog = NULL;
+		}
+		else if (!prog)
+		{
+			rec = fz_calloc_no_throw(ctx, 1, sizeof(pdf_content));
+			if (rec)
+			{
+				FZ_INIT_STORABLE(rec, 1, pdf_free_content_imp);
+				rec->compiled = 1;
+			}
+		}
+	}
+
 	fz_try(ctx)
 	{
-		buf = fz_malloc(ctx, sizeof(*buf)); /* we must be re-entrant for type3 fonts */
-		buf->base.size = PDF_LEXBUF_LARGE;
-		file = fz_open_buffer(ctx, contents);
+		if (!prog)
+		{
+			buf = fz_malloc(ctx, sizeof(*buf)); /* we must be re-entrant for type3 fonts */
+			buf->base.size = PDF_LEXBUF_LARGE;
+			file = fz_open_buffer(ctx, contents);
+		}
 		save_in_text = csi->in_text;
 		csi->in_text = 0;
 		fz_try(ctx)
 		{
-			pdf_run_stream(csi, rdb, file, &buf->base);
+			done = pdf_run_stream(csi, rdb, file, buf ? &buf->base : NULL, prog, rec);
 		}
 		fz_catch(ctx)
 		{
 			fz_warn(ctx, "Content stream parsing error - rendering truncated");
 		}
 		csi->in_text = save_in_text;
+
+		/* Only keep complete recordings */
+		if (rec && done && !rec->failed)
+			pdf_store_content(ctx, key, rec);
 	}
 	fz_always(ctx)
 	{
 		fz_close(file);
 		fz_free(ctx, buf);
+		if (prog)
+			fz_drop_storable(ctx, &prog->storable);
+		if (rec)
+			fz_drop_storable(ctx, &rec->storable);
 	}
 	fz_catch(ctx)
 	{
@@ -2703,6 +2989,12 @@ pdf_run_buffer(pdf_csi *csi, pdf_obj *rdb, fz_buffer *contents)
 	}
 }
 
+void
+pdf_set_compile_contents(pdf_document *xref, int enable)
+{
+	xref->compile_contents = enable;
+}
+
 void
 pdf_run_page_with_usage(pdf_document *xref, pdf_page *page, fz_device *dev, fz_matrix ctm, char *event, fz_cookie *cookie)
 {
@@ -2719,7 +3011,7 @@ pdf_run_page_with_usage(pdf_document *xref, pdf_page *page, fz_device *dev, fz_m
 	csi = pdf_new_csi(xref, dev, ctm, event, cookie, NULL);
 	fz_try(ctx)
 	{
-		pdf_run_buffer(csi, page->resources, page->contents);
+		pdf_run_contents(csi, page->resources, page->contents, page->me);
 	}
 	fz_catch(ctx)
 	{
@@ -2792,7 +3084,7 @@ pdf_run_glyph(pdf_document *xref, pdf_obj *resources, fz_buffer *contents, fz_de
 
 	fz_try(ctx)
 	{
-		pdf_run_buffer(csi, resources, contents);
+		pdf_run_contents(csi, resources, contents, NULL);
 	}
 	fz_catch(ctx)
 	{
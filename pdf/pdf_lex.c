@@ -461,3 +461,189 @@ pdf_lex(fz_stream *f, pdf_lexbuf *buf)
 		}
 	}
 }
+
+/*
+ * Fast path for content streams, whose bytes are all in memory.
+ * Tokens are scanned with pointer arithmetic straight out of the
+ * stream's buffer, classifying characters with a table. Anything
+ * rare (strings, escaped names, over-long tokens) or running into
+ * the end of the buffered data is handed back to pdf_lex, which
+ * leaves the stream in the same state as if it had lexed it all.
+ */
+
+enum
+{
+	WHITE = 1,
+	DELIM = 2,
+	NUMBER = 4, /* can start a number */
+	DIGIT = 8
+};
+
+static const unsigned char lex_class[256] =
+{
+	WHITE, 0, 0, 0, 0, 0, 0, 0,
+	0, WHITE, WHITE, 0, WHITE, WHITE, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	WHITE, 0, 0, 0, 0, DELIM, 0, 0,
+	DELIM, DELIM, 0, NUMBER, 0, NUMBER, NUMBER, DELIM,
+	NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT, NUMBER|DIGIT,
+	NUMBER|DIGIT, NUMBER|DIGIT, 0, 0, DELIM, 0, DELIM, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, DELIM, 0, DELIM, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, DELIM, 0, DELIM, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+int
+pdf_lex_buffer(fz_stream *f, pdf_lexbuf *buf)
+{
+	unsigned char *p = f->rp;
+	unsigned char *e = f->wp;
+	unsigned char *s;
+	int c;
+
+	/* Skip white space and comments */
+	while (1)
+	{
+		while (p < e && (lex_class[*p] & WHITE))
+			p++;
+		if (p < e && *p == '%')
+		{
+			while (p < e && *p != '\012' && *p != '\015')
+				p++;
+			continue;
+		}
+		break;
+	}
+
+	s = p;
+	if (p == e)
+		goto slow;
+	c = *p++;
+
+	if (lex_class[c] & NUMBER)
+	{
+		int neg = 0;
+		int i = 0;
+		int n = 0;
+		int d = 1;
+		float v;
+
+		if (c == '-')
+			neg = 1;
+		else if (c >= '0' && c <= '9')
+			i = c - '0';
+
+		if (c != '.')
+		{
+			while (p < e && (lex_class[*p] & DIGIT))
+				i = 10*i + *p++ - '0';
+			if (p == e)
+				goto slow;
+			if (*p != '.')
+			{
+				f->rp = p;
+				buf->i = neg ? -i : i;
+				return PDF_TOK_INT;
+			}
+			p++;
+		}
+
+		while (p < e && (lex_class[*p] & DIGIT))
+		{
+			/* Ignore any digits that are too small to matter */
+			if (d < INT_MAX/10)
+			{
+				n = n*10 + (*p - '0');
+				d *= 10;
+			}
+			p++;
+		}
+		if (p == e)
+			goto slow;
+
+		f->rp = p;
+		v = (float)i + ((float)n / (float)d);
+		buf->f = neg ? -v : v;
+		return PDF_TOK_REAL;
+	}
+
+	switch (c)
+	{
+	case '/':
+	case '(': case ')': case '<': case '>':
+		break;
+	case '[':
+		f->rp = p;
+		return PDF_TOK_OPEN_ARRAY;
+	case ']':
+		f->rp = p;
+		return PDF_TOK_CLOSE_ARRAY;
+	case '{':
+		f->rp = p;
+		return PDF_TOK_OPEN_BRACE;
+	case '}':
+		f->rp = p;
+		return PDF_TOK_CLOSE_BRACE;
+	default:
+		/* Back up to the start of the keyword */
+		p--;
+		break;
+	}
+
+	if (c == '/' || !(lex_class[c] & DELIM))
+	{
+		unsigned char *name = p;
+		int len;
+
+		while (p < e && !(lex_class[*p] & (WHITE|DELIM)) && *p != '#')
+			p++;
+		len = p - name;
+		if (p == e || *p == '#' || len >= buf->size - 1)
+			goto slow;
+
+		memcpy(buf->scratch, name, len);
+		buf->scratch[len] = 0;
+		buf->len = len;
+		f->rp = p;
+		if (c == '/')
+			return PDF_TOK_NAME;
+		return pdf_token_from_keyword(buf->scratch);
+	}
+
+	if (c == '<' && p < e && *p == '<')
+	{
+		f->rp = p + 1;
+		return PDF_TOK_OPEN_DICT;
+	}
+	if (c == '>' && p < e && *p == '>')
+	{
+		f->rp = p + 1;
+		return PDF_TOK_CLOSE_DICT;
+	}
+
+slow:
+	f->rp = s;
+	return pdf_lex(f, buf);
+}
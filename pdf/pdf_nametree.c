@@ -1,95 +1,223 @@
 #include "fitz-internal.h"
 #include "mupdf-internal.h"
 
-static pdf_obj *
-pdf_lookup_name_imp(fz_context *ctx, pdf_obj *node, pdf_obj *needle)
+/*
+ * Name trees are compiled, the first time they are used, into an
+ * array of their entries sorted by key bytes, so that lookups are a
+ * binary search with no walking of the tree or resolving of objects.
+ * The spec says names should be sorted, but Acrobat copes with
+ * non-sorted trees and so does this. Keys that occur more than once
+ * resolve to the first in tree order. The compiled trees are kept
+ * with the document, one for each kind of name tree looked up.
+ */
+
+typedef struct pdf_name_entry_s pdf_name_entry;
+
+struct pdf_name_entry_s
+{
+	char *key;
+	int len;
+	int seq;
+	pdf_obj *keyobj;
+	pdf_obj *val;
+};
+
+struct pdf_name_table_s
+{
+	char *which;
+	int len;
+	int cap;
+	pdf_name_entry *items;
+	pdf_name_table *next;
+};
+
+static int
+pdf_name_key(pdf_obj *obj, char **key)
+{
+	if (pdf_is_string(obj))
+	{
+		*key = pdf_to_str_buf(obj);
+		return pdf_to_str_len(obj);
+	}
+	if (pdf_is_name(obj))
+	{
+		*key = pdf_to_name(obj);
+		return strlen(*key);
+	}
+	return -1;
+}
+
+static int
+pdf_cmp_name_key(char *a, int alen, char *b, int blen)
+{
+	int c = memcmp(a, b, MIN(alen, blen));
+	if (c)
+		return c;
+	return alen - blen;
+}
+
+static int
+pdf_cmp_name_entry(const void *a_, const void *b_)
+{
+	const pdf_name_entry *a = a_;
+	const pdf_name_entry *b = b_;
+	int c = pdf_cmp_name_key(a->key, a->len, b->key, b->len);
+	if (c)
+		return c;
+	return a->seq - b->seq;
+}
+
+static void
+pdf_load_name_table_imp(fz_context *ctx, pdf_name_table *table, pdf_obj *node)
 {
 	pdf_obj *kids = pdf_dict_gets(node, "Kids");
 	pdf_obj *names = pdf_dict_gets(node, "Names");
+	pdf_name_entry *item;
+	int i, n;
 
-	if (pdf_is_array(kids))
+	if (kids && !pdf_dict_mark(node))
 	{
-		int l = 0;
-		int r = pdf_array_len(kids) - 1;
-
-		while (l <= r)
+		fz_try(ctx)
 		{
-			int m = (l + r) >> 1;
-			pdf_obj *kid = pdf_array_get(kids, m);
-			pdf_obj *limits = pdf_dict_gets(kid, "Limits");
-			pdf_obj *first = pdf_array_get(limits, 0);
-			pdf_obj *last = pdf_array_get(limits, 1);
-
-			if (pdf_objcmp(needle, first) < 0)
-				r = m - 1;
-			else if (pdf_objcmp(needle, last) > 0)
-				l = m + 1;
-			else
-			{
-				pdf_obj *obj;
-
-				if (pdf_dict_mark(node))
-					break;
-				obj = pdf_lookup_name_imp(ctx, kid, needle);
-				pdf_dict_unmark(node);
-				return obj;
-			}
+			n = pdf_array_len(kids);
+			for (i = 0; i < n; i++)
+				pdf_load_name_table_imp(ctx, table, pdf_array_get(kids, i));
+		}
+		fz_always(ctx)
+		{
+			pdf_dict_unmark(node);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
 		}
 	}
 
-	if (pdf_is_array(names))
+	n = pdf_array_len(names);
+	for (i = 0; i + 1 < n; i += 2)
 	{
-		int l = 0;
-		int r = (pdf_array_len(names) / 2) - 1;
+		pdf_obj *key = pdf_resolve_indirect(pdf_array_get(names, i));
+		char *buf;
+		int len = pdf_name_key(key, &buf);
 
-		while (l <= r)
+		if (len < 0)
+			continue;
+
+		if (table->len == table->cap)
 		{
-			int m = (l + r) >> 1;
-			int c;
-			pdf_obj *key = pdf_array_get(names, m * 2);
-			pdf_obj *val = pdf_array_get(names, m * 2 + 1);
-
-			c = pdf_objcmp(needle, key);
-			if (c < 0)
-				r = m - 1;
-			else if (c > 0)
-				l = m + 1;
-			else
-				return val;
+			int cap = table->cap ? table->cap * 2 : 64;
+			table->items = fz_resize_array(ctx, table->items, cap, sizeof(pdf_name_entry));
+			table->cap = cap;
 		}
 
-		/* Spec says names should be sorted (hence the binary search,
-		 * above), but Acrobat copes with non-sorted. Drop back to a
-		 * simple search if the binary search fails. */
-		r = pdf_array_len(names)/2;
-		for (l = 0; l < r; l++)
-			if (!pdf_objcmp(needle, pdf_array_get(names, l * 2)))
-				return pdf_array_get(names, l * 2 + 1);
+		item = &table->items[table->len];
+		item->key = buf;
+		item->len = len;
+		item->seq = table->len;
+		item->keyobj = pdf_keep_obj(key);
+		item->val = pdf_keep_obj(pdf_array_get(names, i + 1));
+		table->len++;
 	}
+}
 
-	return NULL;
+static void
+pdf_free_name_table(fz_context *ctx, pdf_name_table *table)
+{
+	int i;
+
+	for (i = 0; i < table->len; i++)
+	{
+		pdf_drop_obj(table->items[i].keyobj);
+		pdf_drop_obj(table->items[i].val);
+	}
+	fz_free(ctx, table->items);
+	fz_free(ctx, table->which);
+	fz_free(ctx, table);
+}
+
+void
+pdf_free_name_tables(fz_context *ctx, pdf_name_table *table)
+{
+	pdf_name_table *next;
+
+	while (table)
+	{
+		next = table->next;
+		pdf_free_name_table(ctx, table);
+		table = next;
+	}
+}
+
+static pdf_name_table *
+pdf_load_name_table(pdf_document *xref, char *which)
+{
+	fz_context *ctx = xref->ctx;
+	pdf_name_table *table;
+	pdf_obj *root, *names, *tree;
+
+	for (table = xref->name_tables; table; table = table->next)
+		if (!strcmp(table->which, which))
+			return table;
+
+	root = pdf_dict_gets(xref->trailer, "Root");
+	names = pdf_dict_gets(root, "Names");
+	tree = pdf_dict_gets(names, which);
+
+	table = fz_malloc_struct(ctx, pdf_name_table);
+	fz_try(ctx)
+	{
+		table->which = fz_strdup(ctx, which);
+		pdf_load_name_table_imp(ctx, table, tree);
+	}
+	fz_catch(ctx)
+	{
+		pdf_free_name_table(ctx, table);
+		fz_rethrow(ctx);
+	}
+
+	qsort(table->items, table->len, sizeof(pdf_name_entry), pdf_cmp_name_entry);
+
+	table->next = xref->name_tables;
+	xref->name_tables = table;
+	return table;
 }
 
 pdf_obj *
 pdf_lookup_name(pdf_document *xref, char *which, pdf_obj *needle)
 {
-	fz_context *ctx = xref->ctx;
+	pdf_name_table *table;
+	char *key;
+	int len = pdf_name_key(needle, &key);
+	int l, r;
 
-	pdf_obj *root = pdf_dict_gets(xref->trailer, "Root");
-	pdf_obj *names = pdf_dict_gets(root, "Names");
-	pdf_obj *tree = pdf_dict_gets(names, which);
-	return pdf_lookup_name_imp(ctx, tree, needle);
+	if (len < 0)
+		return NULL;
+
+	table = pdf_load_name_table(xref, which);
+
+	/* Find the first entry not less than the needle */
+	l = 0;
+	r = table->len;
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (pdf_cmp_name_key(table->items[m].key, table->items[m].len, key, len) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	if (l < table->len && !pdf_cmp_name_key(table->items[l].key, table->items[l].len, key, len))
+		return table->items[l].val;
+	return NULL;
 }
 
 pdf_obj *
 pdf_lookup_dest(pdf_document *xref, pdf_obj *needle)
 {
-	fz_context *ctx = xref->ctx;
-
 	pdf_obj *root = pdf_dict_gets(xref->trailer, "Root");
 	pdf_obj *dests = pdf_dict_gets(root, "Dests");
 	pdf_obj *names = pdf_dict_gets(root, "Names");
-	pdf_obj *dest = NULL;
 
 	/* PDF 1.1 has destinations in a dictionary */
 	if (dests)
@@ -101,63 +229,60 @@ pdf_lookup_dest(pdf_document *xref, pdf_obj *needle)
 	}
 
 	/* PDF 1.2 has destinations in a name tree */
-	if (names && !dest)
-	{
-		pdf_obj *tree = pdf_dict_gets(names, "Dests");
-		return pdf_lookup_name_imp(ctx, tree, needle);
-	}
+	if (names)
+		return pdf_lookup_name(xref, "Dests", needle);
 
 	return NULL;
 }
 
-static void
-pdf_load_name_tree_imp(pdf_obj *dict, pdf_document *xref, pdf_obj *node)
+pdf_obj *
+pdf_load_name_tree(pdf_document *xref, char *which)
 {
 	fz_context *ctx = xref->ctx;
-	pdf_obj *kids = pdf_dict_gets(node, "Kids");
-	pdf_obj *names = pdf_dict_gets(node, "Names");
+	pdf_name_table *table;
+	pdf_obj *dict, *key;
 	int i;
 
-	if (kids && !pdf_dict_mark(node))
-	{
-		for (i = 0; i < pdf_array_len(kids); i++)
-			pdf_load_name_tree_imp(dict, xref, pdf_array_get(kids, i));
-		pdf_dict_unmark(node);
-	}
+	pdf_obj *root = pdf_dict_gets(xref->trailer, "Root");
+	pdf_obj *names = pdf_dict_gets(root, "Names");
+	pdf_obj *tree = pdf_dict_gets(names, which);
+	if (!pdf_is_dict(tree))
+		return NULL;
 
-	if (names)
+	table = pdf_load_name_table(xref, which);
+
+	/* Later entries for the same key replace earlier ones, as when
+	 * the tree was walked directly into the dictionary. */
+	dict = pdf_new_dict(ctx, MAX(table->len, 100));
+	fz_try(ctx)
 	{
-		for (i = 0; i + 1 < pdf_array_len(names); i += 2)
+		for (i = 0; i < table->len; i++)
 		{
-			pdf_obj *key = pdf_array_get(names, i);
-			pdf_obj *val = pdf_array_get(names, i + 1);
+			key = table->items[i].keyobj;
 			if (pdf_is_string(key))
 			{
 				key = pdf_to_utf8_name(ctx, key);
-				fz_dict_put(dict, key, val);
-				pdf_drop_obj(key);
-			}
-			else if (pdf_is_name(key))
-			{
-				fz_dict_put(dict, key, val);
+				fz_try(ctx)
+				{
+					fz_dict_put(dict, key, table->items[i].val);
+				}
+				fz_always(ctx)
+				{
+					pdf_drop_obj(key);
+				}
+				fz_catch(ctx)
+				{
+					fz_rethrow(ctx);
+				}
 			}
+			else
+				fz_dict_put(dict, key, table->items[i].val);
 		}
 	}
-}
-
-pdf_obj *
-pdf_load_name_tree(pdf_document *xref, char *which)
-{
-	fz_context *ctx = xref->ctx;
-
-	pdf_obj *root = pdf_dict_gets(xref->trailer, "Root");
-	pdf_obj *names = pdf_dict_gets(root, "Names");
-	pdf_obj *tree = pdf_dict_gets(names, which);
-	if (pdf_is_dict(tree))
+	fz_catch(ctx)
 	{
-		pdf_obj *dict = pdf_new_dict(ctx, 100);
-		pdf_load_name_tree_imp(dict, xref, tree);
-		return dict;
+		pdf_drop_obj(dict);
+		fz_rethrow(ctx);
 	}
-	return NULL;
+	return dict;
 }
@@ -182,15 +182,57 @@ pdf_count_pages(pdf_document *xref)
 	return xref->page_len;
 }
 
+/*
+ * Map object numbers to page numbers with an open addressed hash
+ * table of page indices (plus one, so that zero marks an empty slot),
+ * built the first time a page is looked up. Where a page object is
+ * used more than once the first page that uses it wins, as before.
+ */
+
+static void
+pdf_load_page_map(pdf_document *xref)
+{
+	fz_context *ctx = xref->ctx;
+	int *map;
+	int cap = 16;
+	int i, h, num;
+
+	while (cap < xref->page_len * 2)
+		cap <<= 1;
+
+	map = fz_malloc_array(ctx, cap, sizeof(int));
+	memset(map, 0, cap * sizeof(int));
+
+	for (i = 0; i < xref->page_len; i++)
+	{
+		num = pdf_to_num(xref->page_refs[i]);
+		h = num & (cap - 1);
+		while (map[h] && pdf_to_num(xref->page_refs[map[h] - 1]) != num)
+			h = (h + 1) & (cap - 1);
+		if (!map[h])
+			map[h] = i + 1;
+	}
+
+	xref->page_map = map;
+	xref->page_map_cap = cap;
+}
+
 int
 pdf_lookup_page_number(pdf_document *xref, pdf_obj *page)
 {
-	int i, num = pdf_to_num(page);
+	int h, num = pdf_to_num(page);
 
 	pdf_load_page_tree(xref);
-	for (i = 0; i < xref->page_len; i++)
-		if (num == pdf_to_num(xref->page_refs[i]))
-			return i;
+	if (!xref->page_map)
+		pdf_load_page_map(xref);
+
+	h = num & (xref->page_map_cap - 1);
+	while (xref->page_map[h])
+	{
+		if (num == pdf_to_num(xref->page_refs[xref->page_map[h] - 1]))
+			return xref->page_map[h] - 1;
+		h = (h + 1) & (xref->page_map_cap - 1);
+	}
 	return -1;
 }
 
@@ -364,10 +406,12 @@ pdf_load_page(pdf_document *xref, int number)
 
 	page = fz_malloc_struct(ctx, pdf_page);
 	page->resources = NULL;
+	page->thumb = NULL;
 	page->contents = NULL;
 	page->transparency = 0;
 	page->links = NULL;
 	page->annots = NULL;
+	page->me = pdf_keep_obj(pageref);
 
 	mediabox = pdf_to_rect(ctx, pdf_dict_gets(pageobj, "MediaBox"));
 	if (fz_is_empty_rect(mediabox))
@@ -419,6 +463,10 @@ pdf_load_page(pdf_document *xref, int number)
 	if (page->resources)
 		pdf_keep_obj(page->resources);
 
+	page->thumb = pdf_dict_gets(pageobj, "Thumb");
+	if (page->thumb)
+		pdf_keep_obj(page->thumb);
+
 	obj = pdf_dict_gets(pageobj, "Contents");
 	fz_try(ctx)
 	{
@@ -450,6 +498,28 @@ pdf_bound_page(pdf_document *xref, pdf_page *page)
 	return bounds;
 }
 
+fz_image *
+pdf_load_page_thumbnail(pdf_document *xref, pdf_page *page)
+{
+	fz_context *ctx = xref->ctx;
+	fz_image *image = NULL;
+
+	if (!page->thumb)
+		return NULL;
+
+	fz_try(ctx)
+	{
+		image = pdf_load_image(xref, page->thumb);
+	}
+	fz_catch(ctx)
+	{
+		fz_warn(ctx, "ignoring broken page thumbnail (%d 0 R)", pdf_to_num(page->thumb));
+		image = NULL;
+	}
+
+	return image;
+}
+
 fz_link *
 pdf_load_links(pdf_document *xref, pdf_page *page)
 {
@@ -461,11 +531,14 @@ pdf_free_page(pdf_document *xref, pdf_page *page)
 {
 	if (page->resources)
 		pdf_drop_obj(page->resources);
+	if (page->thumb)
+		pdf_drop_obj(page->thumb);
 	if (page->contents)
 		fz_drop_buffer(xref->ctx, page->contents);
 	if (page->links)
 		fz_drop_link(xref->ctx, page->links);
 	if (page->annots)
 		pdf_free_annot(xref->ctx, page->annots);
+	pdf_drop_obj(page->me);
 	fz_free(xref->ctx, page);
 }
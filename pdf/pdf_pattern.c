@@ -22,6 +22,7 @@ pdf_free_pattern_imp(fz_context *ctx, fz_storable *pat_)
 		pdf_drop_obj(pat->resources);
 	if (pat->contents)
 		fz_drop_buffer(ctx, pat->contents);
+	pdf_drop_obj(pat->me);
 	fz_free(ctx, pat);
 }
 
@@ -49,6 +50,7 @@ pdf_load_pattern(pdf_document *xref, pdf_obj *dict)
 	FZ_INIT_STORABLE(pat, 1, pdf_free_pattern_imp);
 	pat->resources = NULL;
 	pat->contents = NULL;
+	pat->me = pdf_keep_obj(dict);
 
 	/* Store pattern now, to avoid possible recursion if objects refer back to this one */
 	pdf_store_item(ctx, dict, pat, pdf_pattern_size(pat));
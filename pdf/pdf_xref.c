@@ -839,6 +839,9 @@ pdf_close_document(pdf_document *xref)
 		fz_free(ctx, xref->page_refs);
 	}
 
+	fz_free(ctx, xref->page_map);
+	pdf_free_name_tables(ctx, xref->name_tables);
+
 	if (xref->file)
 		fz_close(xref->file);
 	if (xref->trailer)
@@ -1148,6 +1151,14 @@ static void pdf_close_document_shim(fz_document *doc)
 	pdf_close_document((pdf_document*)doc);
 }
 
+pdf_document *
+pdf_specifics(fz_document *doc)
+{
+	if (doc && doc->close == pdf_close_document_shim)
+		return (pdf_document *)doc;
+	return NULL;
+}
+
 static int pdf_needs_password_shim(fz_document *doc)
 {
 	return pdf_needs_password((pdf_document*)doc);
@@ -1188,6 +1199,11 @@ static void pdf_run_page_shim(fz_document *doc, fz_page *page, fz_device *dev, f
 	pdf_run_page((pdf_document*)doc, (pdf_page*)page, dev, transform, cookie);
 }
 
+static fz_image *pdf_load_thumbnail_shim(fz_document *doc, fz_page *page)
+{
+	return pdf_load_page_thumbnail((pdf_document*)doc, (pdf_page*)page);
+}
+
 static void pdf_free_page_shim(fz_document *doc, fz_page *page)
 {
 	pdf_free_page((pdf_document*)doc, (pdf_page*)page);
@@ -1280,6 +1296,7 @@ pdf_init_document(pdf_document *doc)
 	doc->super.load_links = pdf_load_links_shim;
 	doc->super.bound_page = pdf_bound_page_shim;
 	doc->super.run_page = pdf_run_page_shim;
+	doc->super.load_thumbnail = pdf_load_thumbnail_shim;
 	doc->super.free_page = pdf_free_page_shim;
 	doc->super.meta = pdf_meta;
 }
@@ -34,6 +34,26 @@ int xps_has_part(xps_document *doc, char *partname);
 xps_part *xps_read_part(xps_document *doc, char *partname);
 void xps_free_part(xps_document *doc, xps_part *part);
 
+/*
+ * Interned part names.
+ *
+ * Resources decoded from parts are cached in the fz_store with keys
+ * that point at the document's interned copy of the part name, so they
+ * hash and compare by pointer. Names are matched case insensitively.
+ * Freeing the names removes the document's resources from the store.
+ */
+
+typedef struct xps_part_name_s xps_part_name;
+
+struct xps_part_name_s
+{
+	char *name;
+	xps_part_name *next;
+};
+
+char *xps_intern_part_name(xps_document *doc, char *name);
+void xps_free_part_names(xps_document *doc);
+
 /*
  * Document structure.
  */
@@ -85,14 +105,8 @@ void xps_add_link(xps_document *doc, fz_rect area, char *base_uri, char *target_
  * Images, fonts, and colorspaces.
  */
 
-typedef struct xps_font_cache_s xps_font_cache;
-
-struct xps_font_cache_s
-{
-	char *name;
-	fz_font *font;
-	xps_font_cache *next;
-};
+void xps_uncache_image(xps_document *doc, char *name);
+void xps_uncache_font(xps_document *doc, char *name);
 
 typedef struct xps_glyph_metrics_s xps_glyph_metrics;
 
@@ -171,25 +185,13 @@ xml_element *xps_lookup_alternate_content(xml_element *node);
  * The interpreter context.
  */
 
-typedef struct xps_entry_s xps_entry;
-
-struct xps_entry_s
-{
-	char *name;
-	int offset;
-	int csize;
-	int usize;
-};
-
 struct xps_document_s
 {
 	fz_document super;
 
 	fz_context *ctx;
 	char *directory;
-	fz_stream *file;
-	int zip_count;
-	xps_entry *zip_table;
+	fz_zip_archive *zip;
 
 	char *start_part; /* fixed document sequence */
 	xps_fixdoc *first_fixdoc; /* first fixed document */
@@ -203,8 +205,10 @@ struct xps_document_s
 	char *base_uri; /* base uri for parsing XML and resolving relative paths */
 	char *part_uri; /* part uri for parsing metadata relations */
 
-	/* We cache font resources */
-	xps_font_cache *font_table;
+	/* Interned part names, for keying cached fonts and images */
+	xps_part_name **part_names;
+	int part_names_size;
+	int part_names_count;
 
 	/* Opacity attribute stack */
 	float opacity[64];
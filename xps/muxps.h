@@ -8,6 +8,11 @@ typedef struct xps_page_s xps_page;
 
 /*
  * XML document model
+ *
+ * xml_parse_document parses buf in place and takes ownership of it,
+ * also when it throws; buf must be null terminated and allocated with
+ * fz_malloc. xml_free_element frees the whole tree that item belongs
+ * to, so any element of a tree may be used to free it.
  */
 
 typedef struct element xml_element;
@@ -19,7 +24,6 @@ char *xml_tag(xml_element *item);
 char *xml_att(xml_element *item, const char *att);
 void xml_free_element(fz_context *doc, xml_element *item);
 void xml_print_element(xml_element *item, int level);
-void xml_detach(xml_element *node);
 
 /*
 	xps_open_document: Open a document.
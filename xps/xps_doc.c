@@ -336,6 +336,7 @@ xps_parse_metadata(xps_document *doc, xps_part *part, xps_fixdoc *fixdoc)
 {
 	xml_element *root;
 	char buf[1024];
+	byte *data;
 	char *s;
 
 	/* Save directory name part */
@@ -355,7 +356,9 @@ xps_parse_metadata(xps_document *doc, xps_part *part, xps_fixdoc *fixdoc)
 	doc->base_uri = buf;
 	doc->part_uri = part->name;
 
-	root = xml_parse_document(doc->ctx, part->data, part->size);
+	data = part->data;
+	part->data = NULL;
+	root = xml_parse_document(doc->ctx, data, part->size);
 	xps_parse_metadata_imp(doc, root, fixdoc);
 	xml_free_element(doc->ctx, root);
 
@@ -413,12 +416,17 @@ xps_load_fixed_page(xps_document *doc, xps_page *page)
 {
 	xps_part *part;
 	xml_element *root;
+	byte *data;
+	int size;
 	char *width_att;
 	char *height_att;
 
 	part = xps_read_part(doc, page->name);
-	root = xml_parse_document(doc->ctx, part->data, part->size);
+	data = part->data;
+	part->data = NULL;
+	size = part->size;
 	xps_free_part(doc, part);
+	root = xml_parse_document(doc->ctx, data, size);
 	if (!root)
 		fz_throw(doc->ctx, "FixedPage missing root element");
 
@@ -430,8 +438,7 @@ xps_load_fixed_page(xps_document *doc, xps_page *page)
 			xml_free_element(doc->ctx, root);
 			fz_throw(doc->ctx, "FixedPage missing alternate root element");
 		}
-		xml_detach(node);
-		xml_free_element(doc->ctx, root);
+		/* the page keeps the whole tree; freeing node frees it all */
 		root = node;
 	}
 
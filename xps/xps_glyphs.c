@@ -70,24 +70,243 @@ xps_measure_font_glyph(xps_document *doc, fz_font *font, int gid, xps_glyph_metr
 	mtx->vorg = face->ascender / (float) face->units_per_EM;
 }
 
+/*
+ * Loaded fonts are held in the fz_store under a digest of the font data,
+ * so that identical fonts embedded in several parts share one fz_font.
+ * The interned name of the part (plus style simulation) maps to that
+ * digest through a small alias entry, which does not hold the font, so
+ * the font can still be evicted.
+ */
+
+typedef struct xps_font_s xps_font;
+
+struct xps_font_s
+{
+	fz_storable storable;
+	fz_font *font;
+};
+
+typedef struct xps_font_alias_s xps_font_alias;
+
+struct xps_font_alias_s
+{
+	fz_storable storable;
+	unsigned char digest[16];
+	int index;
+};
+
+typedef struct xps_font_name_key_s xps_font_name_key;
+
+struct xps_font_name_key_s
+{
+	int refs;
+	char *name; /* interned part name */
+};
+
+typedef struct xps_font_data_key_s xps_font_data_key;
+
+struct xps_font_data_key_s
+{
+	int refs;
+	unsigned char digest[16];
+	int index; /* subfont index and style simulation */
+};
+
+static void
+xps_free_font(fz_context *ctx, fz_storable *font_)
+{
+	xps_font *font = (xps_font *)font_;
+
+	fz_drop_font(ctx, font->font);
+	fz_free(ctx, font);
+}
+
+static void
+xps_free_font_alias(fz_context *ctx, fz_storable *alias)
+{
+	fz_free(ctx, alias);
+}
+
+static int
+xps_make_hash_font_name_key(fz_store_hash *hash, void *key_)
+{
+	xps_font_name_key *key = (xps_font_name_key *)key_;
+
+	hash->u.pi.ptr = key->name;
+	hash->u.pi.i = 0;
+	return 1;
+}
+
+static void *
+xps_keep_font_name_key(fz_context *ctx, void *key_)
+{
+	xps_font_name_key *key = (xps_font_name_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+xps_drop_font_name_key(fz_context *ctx, void *key_)
+{
+	xps_font_name_key *key = (xps_font_name_key *)key_;
+	int drop;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+		fz_free(ctx, key);
+}
+
+static int
+xps_cmp_font_name_key(void *k0_, void *k1_)
+{
+	xps_font_name_key *k0 = (xps_font_name_key *)k0_;
+	xps_font_name_key *k1 = (xps_font_name_key *)k1_;
+
+	return k0->name != k1->name;
+}
+
+static void
+xps_debug_font_name(void *key_)
+{
+	xps_font_name_key *key = (xps_font_name_key *)key_;
+
+	printf("(xps font %s) ", key->name);
+}
+
+static fz_store_type xps_font_name_store_type =
+{
+	xps_make_hash_font_name_key,
+	xps_keep_font_name_key,
+	xps_drop_font_name_key,
+	xps_cmp_font_name_key,
+	xps_debug_font_name
+};
+
+static int
+xps_make_hash_font_data_key(fz_store_hash *hash, void *key_)
+{
+	xps_font_data_key *key = (xps_font_data_key *)key_;
+
+	memcpy(hash->u.di.digest, key->digest, 16);
+	hash->u.di.i = key->index;
+	return 1;
+}
+
+static void *
+xps_keep_font_data_key(fz_context *ctx, void *key_)
+{
+	xps_font_data_key *key = (xps_font_data_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+xps_drop_font_data_key(fz_context *ctx, void *key_)
+{
+	xps_font_data_key *key = (xps_font_data_key *)key_;
+	int drop;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+		fz_free(ctx, key);
+}
+
+static int
+xps_cmp_font_data_key(void *k0_, void *k1_)
+{
+	xps_font_data_key *k0 = (xps_font_data_key *)k0_;
+	xps_font_data_key *k1 = (xps_font_data_key *)k1_;
+
+	return memcmp(k0->digest, k1->digest, 16) || k0->index != k1->index;
+}
+
+static void
+xps_debug_font_data(void *key_)
+{
+	xps_font_data_key *key = (xps_font_data_key *)key_;
+	int i;
+
+	printf("(xps font data ");
+	for (i = 0; i < 16; i++)
+		printf("%02x", key->digest[i]);
+	printf(" %d) ", key->index);
+}
+
+static fz_store_type xps_font_data_store_type =
+{
+	xps_make_hash_font_data_key,
+	xps_keep_font_data_key,
+	xps_drop_font_data_key,
+	xps_cmp_font_data_key,
+	xps_debug_font_data
+};
+
+void
+xps_uncache_font(xps_document *doc, char *name)
+{
+	xps_font_name_key key;
+
+	key.refs = 1;
+	key.name = name;
+	fz_remove_item(doc->ctx, xps_free_font_alias, &key, &xps_font_name_store_type);
+}
+
 static fz_font *
 xps_lookup_font(xps_document *doc, char *name)
 {
-	xps_font_cache *cache;
-	for (cache = doc->font_table; cache; cache = cache->next)
-		if (!xps_strcasecmp(cache->name, name))
-			return fz_keep_font(doc->ctx, cache->font);
-	return NULL;
+	fz_context *ctx = doc->ctx;
+	xps_font_name_key name_key;
+	xps_font_data_key data_key;
+	xps_font_alias *alias;
+	xps_font *cached;
+	fz_font *font;
+
+	name_key.refs = 1;
+	name_key.name = name;
+	alias = fz_find_item(ctx, xps_free_font_alias, &name_key, &xps_font_name_store_type);
+	if (!alias)
+		return NULL;
+	data_key.refs = 1;
+	memcpy(data_key.digest, alias->digest, 16);
+	data_key.index = alias->index;
+	fz_drop_storable(ctx, &alias->storable);
+
+	/* The font may have been evicted while its alias was not */
+	cached = fz_find_item(ctx, xps_free_font, &data_key, &xps_font_data_store_type);
+	if (!cached)
+		return NULL;
+	font = fz_keep_font(ctx, cached->font);
+	fz_drop_storable(ctx, &cached->storable);
+	return font;
 }
 
 static void
-xps_insert_font(xps_document *doc, char *name, fz_font *font)
+xps_insert_font(xps_document *doc, void *key, fz_storable *val, unsigned int size, fz_store_type *type)
 {
-	xps_font_cache *cache = fz_malloc_struct(doc->ctx, xps_font_cache);
-	cache->name = fz_strdup(doc->ctx, name);
-	cache->font = fz_keep_font(doc->ctx, font);
-	cache->next = doc->font_table;
-	doc->font_table = cache;
+	fz_storable *existing;
+
+	/* Failing to cache the font is not an error */
+	fz_try(doc->ctx)
+	{
+		existing = fz_store_item(doc->ctx, key, val, size, type);
+		if (existing)
+			fz_drop_storable(doc->ctx, existing);
+	}
+	fz_catch(doc->ctx)
+	{
+	}
 }
 
 /*
@@ -164,6 +383,97 @@ xps_select_best_font_encoding(xps_document *doc, fz_font *font)
 	fz_warn(doc->ctx, "cannot find a suitable cmap");
 }
 
+/*
+ * Load a font from a (deobfuscated) part, sharing an already loaded
+ * font with the same data, and cache it under its interned name.
+ * The part is freed.
+ */
+static fz_font *
+xps_load_font(xps_document *doc, char *name, xps_part *part, int subfontid, char *style_att)
+{
+	fz_context *ctx = doc->ctx;
+	xps_font_data_key *data_key = NULL;
+	xps_font_name_key *name_key = NULL;
+	xps_font_alias *alias = NULL;
+	xps_font *cached = NULL;
+	fz_font *font = NULL;
+	fz_md5 md5;
+	int style = 0;
+
+	fz_var(data_key);
+	fz_var(name_key);
+	fz_var(alias);
+	fz_var(cached);
+	fz_var(font);
+
+	if (style_att)
+		style = (strstr(style_att, "Bold") ? 1 : 0) | (strstr(style_att, "Italic") ? 2 : 0);
+
+	fz_try(ctx)
+	{
+		data_key = fz_malloc_struct(ctx, xps_font_data_key);
+		data_key->refs = 1;
+		fz_md5_init(&md5);
+		fz_md5_update(&md5, part->data, part->size);
+		fz_md5_final(&md5, data_key->digest);
+		data_key->index = (subfontid << 2) | style;
+
+		cached = fz_find_item(ctx, xps_free_font, data_key, &xps_font_data_store_type);
+		if (!cached)
+		{
+			font = fz_new_font_from_memory(ctx, part->data, part->size, subfontid, 1);
+
+			/* NOTE: we keep part->data in the font */
+			font->ft_data = part->data;
+			font->ft_size = part->size;
+			part->data = NULL;
+
+			font->ft_bold = style & 1;
+			font->ft_italic = (style & 2) >> 1;
+
+			xps_select_best_font_encoding(doc, font);
+
+			cached = fz_malloc_struct(ctx, xps_font);
+			FZ_INIT_STORABLE(cached, 1, xps_free_font);
+			cached->font = font;
+			font = NULL;
+
+			xps_insert_font(doc, data_key, &cached->storable, cached->font->ft_size, &xps_font_data_store_type);
+		}
+
+		alias = fz_malloc_struct(ctx, xps_font_alias);
+		FZ_INIT_STORABLE(alias, 1, xps_free_font_alias);
+		memcpy(alias->digest, data_key->digest, 16);
+		alias->index = data_key->index;
+
+		name_key = fz_malloc_struct(ctx, xps_font_name_key);
+		name_key->refs = 1;
+		name_key->name = name;
+		xps_insert_font(doc, name_key, &alias->storable, sizeof *alias, &xps_font_name_store_type);
+
+		font = fz_keep_font(ctx, cached->font);
+	}
+	fz_always(ctx)
+	{
+		if (alias)
+			fz_drop_storable(ctx, &alias->storable);
+		if (cached)
+			fz_drop_storable(ctx, &cached->storable);
+		if (data_key)
+			xps_drop_font_data_key(ctx, data_key);
+		if (name_key)
+			xps_drop_font_name_key(ctx, name_key);
+		xps_free_part(doc, part);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_font(ctx, font);
+		fz_rethrow(ctx);
+	}
+
+	return font;
+}
+
 /*
  * Parse and draw an XPS <Glyphs> element.
  *
@@ -404,6 +714,7 @@ xps_parse_glyphs(xps_document *doc, fz_matrix ctm,
 	char partname[1024];
 	char fakename[1024];
 	char *subfont;
+	char *name;
 
 	float font_size = 10;
 	int subfontid = 0;
@@ -496,7 +807,17 @@ xps_parse_glyphs(xps_document *doc, fz_matrix ctm,
 			fz_strlcat(fakename, "#BoldItalic", sizeof fakename);
 	}
 
-	font = xps_lookup_font(doc, fakename);
+	fz_try(doc->ctx)
+	{
+		name = xps_intern_part_name(doc, fakename);
+	}
+	fz_catch(doc->ctx)
+	{
+		fz_warn(doc->ctx, "cannot load font resource '%s'", partname);
+		return;
+	}
+
+	font = xps_lookup_font(doc, name);
 	if (!font)
 	{
 		fz_try(doc->ctx)
@@ -517,30 +838,13 @@ xps_parse_glyphs(xps_document *doc, fz_matrix ctm,
 
 		fz_try(doc->ctx)
 		{
-			font = fz_new_font_from_memory(doc->ctx, part->data, part->size, subfontid, 1);
+			font = xps_load_font(doc, name, part, subfontid, style_att);
 		}
 		fz_catch(doc->ctx)
 		{
 			fz_warn(doc->ctx, "cannot load font resource '%s'", partname);
-			xps_free_part(doc, part);
 			return;
 		}
-
-		if (style_att)
-		{
-			font->ft_bold = !!strstr(style_att, "Bold");
-			font->ft_italic = !!strstr(style_att, "Italic");
-		}
-
-		xps_select_best_font_encoding(doc, font);
-
-		xps_insert_font(doc, fakename, font);
-
-		/* NOTE: we keep part->data in the font */
-		font->ft_data = part->data;
-		font->ft_size = part->size;
-		fz_free(doc->ctx, part->name);
-		fz_free(doc->ctx, part);
 	}
 
 	/*
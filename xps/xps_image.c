@@ -31,6 +31,85 @@ xps_image_to_pixmap(fz_context *ctx, fz_image *image_, int x, int w)
 	return fz_keep_pixmap(ctx, image->pix);
 }
 
+typedef struct xps_image_key_s xps_image_key;
+
+struct xps_image_key_s
+{
+	int refs;
+	char *name; /* interned part name */
+};
+
+static int
+xps_make_hash_image_key(fz_store_hash *hash, void *key_)
+{
+	xps_image_key *key = (xps_image_key *)key_;
+
+	hash->u.pi.ptr = key->name;
+	hash->u.pi.i = 0;
+	return 1;
+}
+
+static void *
+xps_keep_image_key(fz_context *ctx, void *key_)
+{
+	xps_image_key *key = (xps_image_key *)key_;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	key->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return (void *)key;
+}
+
+static void
+xps_drop_image_key(fz_context *ctx, void *key_)
+{
+	xps_image_key *key = (xps_image_key *)key_;
+	int drop;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	drop = --key->refs;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop == 0)
+		fz_free(ctx, key);
+}
+
+static int
+xps_cmp_image_key(void *k0_, void *k1_)
+{
+	xps_image_key *k0 = (xps_image_key *)k0_;
+	xps_image_key *k1 = (xps_image_key *)k1_;
+
+	return k0->name != k1->name;
+}
+
+static void
+xps_debug_image(void *key_)
+{
+	xps_image_key *key = (xps_image_key *)key_;
+
+	printf("(xps image %s) ", key->name);
+}
+
+static fz_store_type xps_image_store_type =
+{
+	xps_make_hash_image_key,
+	xps_keep_image_key,
+	xps_drop_image_key,
+	xps_cmp_image_key,
+	xps_debug_image
+};
+
+void
+xps_uncache_image(xps_document *doc, char *name)
+{
+	xps_image_key key;
+
+	key.refs = 1;
+	key.name = name;
+	fz_remove_item(doc->ctx, xps_free_image, &key, &xps_image_store_type);
+}
+
 static fz_image *
 xps_load_image(fz_context *ctx, byte *buf, int len)
 {
@@ -89,12 +168,11 @@ xps_paint_image_brush(xps_document *doc, fz_matrix ctm, fz_rect area, char *base
 	fz_fill_image(doc->dev, &image->base, ctm, doc->opacity[doc->opacity_top]);
 }
 
-static xps_part *
-xps_find_image_brush_source_part(xps_document *doc, char *base_uri, xml_element *root)
+static void
+xps_find_image_brush_source_name(xps_document *doc, char *base_uri, xml_element *root, char *partname, int partname_size)
 {
 	char *image_source_att;
 	char buf[1024];
-	char partname[1024];
 	char *image_name;
 	char *profile_name;
 	char *p;
@@ -134,21 +212,71 @@ xps_find_image_brush_source_part(xps_document *doc, char *base_uri, xml_element
 	if (!image_name)
 		fz_throw(doc->ctx, "cannot find image source");
 
-	xps_resolve_url(partname, base_uri, image_name, sizeof partname);
+	xps_resolve_url(partname, base_uri, image_name, partname_size);
+}
+
+static fz_image *
+xps_load_image_part(xps_document *doc, char *partname)
+{
+	fz_context *ctx = doc->ctx;
+	xps_image_key *key;
+	xps_image_key stack_key;
+	xps_image *image;
+	xps_image *existing;
+	xps_part *part;
+
+	stack_key.refs = 1;
+	stack_key.name = xps_intern_part_name(doc, partname);
+
+	image = fz_find_item(ctx, xps_free_image, &stack_key, &xps_image_store_type);
+	if (image)
+		return &image->base;
+
+	part = xps_read_part(doc, partname);
+	fz_try(ctx)
+	{
+		image = (xps_image *)xps_load_image(ctx, part->data, part->size);
+	}
+	fz_always(ctx)
+	{
+		xps_free_part(doc, part);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	/* Failing to cache the image is not an error */
+	fz_try(ctx)
+	{
+		key = fz_malloc_struct(ctx, xps_image_key);
+		key->refs = 1;
+		key->name = stack_key.name;
+		existing = fz_store_item(ctx, key, image, fz_pixmap_size(ctx, image->pix) + sizeof *image, &xps_image_store_type);
+		xps_drop_image_key(ctx, key);
+		if (existing)
+		{
+			fz_drop_image(ctx, &image->base);
+			image = existing;
+		}
+	}
+	fz_catch(ctx)
+	{
+	}
 
-	return xps_read_part(doc, partname);
+	return &image->base;
 }
 
 void
 xps_parse_image_brush(xps_document *doc, fz_matrix ctm, fz_rect area,
 	char *base_uri, xps_resource *dict, xml_element *root)
 {
-	xps_part *part;
+	char partname[1024];
 	fz_image *image;
 
 	fz_try(doc->ctx)
 	{
-		part = xps_find_image_brush_source_part(doc, base_uri, root);
+		xps_find_image_brush_source_name(doc, base_uri, root, partname, sizeof partname);
 	}
 	fz_catch(doc->ctx)
 	{
@@ -158,15 +286,13 @@ xps_parse_image_brush(xps_document *doc, fz_matrix ctm, fz_rect area,
 
 	fz_try(doc->ctx)
 	{
-		image = xps_load_image(doc->ctx, part->data, part->size);
+		image = xps_load_image_part(doc, partname);
 	}
 	fz_catch(doc->ctx)
 	{
-		fz_warn(doc->ctx, "cannot decode image resource");
-		xps_free_part(doc, part);
+		fz_warn(doc->ctx, "cannot load image resource '%s'", partname);
 		return;
 	}
-	xps_free_part(doc, part);
 
 	xps_parse_tiling_brush(doc, ctm, area, base_uri, dict, root, xps_paint_image_brush, image);
 
@@ -82,18 +82,15 @@ xps_load_document_structure(xps_document *doc, xps_fixdoc *fixdoc)
 	xps_part *part;
 	xml_element *root;
 	fz_outline *outline;
+	byte *data;
+	int size;
 
 	part = xps_read_part(doc, fixdoc->outline);
-	fz_try(doc->ctx)
-	{
-		root = xml_parse_document(doc->ctx, part->data, part->size);
-	}
-	fz_catch(doc->ctx)
-	{
-		xps_free_part(doc, part);
-		fz_rethrow(doc->ctx);
-	}
+	data = part->data;
+	part->data = NULL;
+	size = part->size;
 	xps_free_part(doc, part);
+	root = xml_parse_document(doc->ctx, data, size);
 	if (!root)
 		return NULL;
 
@@ -59,13 +59,18 @@ xps_parse_remote_resource_dictionary(xps_document *doc, char *base_uri, char *so
 	xps_resource *dict;
 	xps_part *part;
 	xml_element *xml;
+	byte *data;
+	int size;
 	char *s;
 
 	/* External resource dictionaries MUST NOT reference other resource dictionaries */
 	xps_resolve_url(part_name, base_uri, source_att, sizeof part_name);
 	part = xps_read_part(doc, part_name);
-	xml = xml_parse_document(doc->ctx, part->data, part->size);
+	data = part->data;
+	part->data = NULL;
+	size = part->size;
 	xps_free_part(doc, part);
+	xml = xml_parse_document(doc->ctx, data, size);
 
 	if (!xml)
 		return NULL;
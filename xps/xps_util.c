@@ -19,6 +19,93 @@ xps_strcasecmp(char *a, char *b)
 	return xps_tolower(*a) - xps_tolower(*b);
 }
 
+static unsigned int
+xps_hash_part_name(char *s)
+{
+	unsigned int h = 0;
+	while (*s)
+		h = h * 31 + xps_tolower(*s++);
+	return h;
+}
+
+char *
+xps_intern_part_name(xps_document *doc, char *name)
+{
+	fz_context *ctx = doc->ctx;
+	xps_part_name **table;
+	xps_part_name *entry, *next;
+	unsigned int pos;
+	int i, size;
+
+	if (doc->part_names)
+	{
+		pos = xps_hash_part_name(name) % doc->part_names_size;
+		for (entry = doc->part_names[pos]; entry; entry = entry->next)
+			if (!xps_strcasecmp(entry->name, name))
+				return entry->name;
+	}
+
+	/* Grow the table to keep the chains short */
+	if (doc->part_names_count >= doc->part_names_size)
+	{
+		size = doc->part_names_size ? doc->part_names_size * 2 : 64;
+		table = fz_malloc_array(ctx, size, sizeof *table);
+		memset(table, 0, size * sizeof *table);
+		for (i = 0; i < doc->part_names_size; i++)
+		{
+			for (entry = doc->part_names[i]; entry; entry = next)
+			{
+				next = entry->next;
+				pos = xps_hash_part_name(entry->name) % size;
+				entry->next = table[pos];
+				table[pos] = entry;
+			}
+		}
+		fz_free(ctx, doc->part_names);
+		doc->part_names = table;
+		doc->part_names_size = size;
+	}
+
+	entry = fz_malloc_struct(ctx, xps_part_name);
+	fz_try(ctx)
+	{
+		entry->name = fz_strdup(ctx, name);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, entry);
+		fz_rethrow(ctx);
+	}
+	pos = xps_hash_part_name(name) % doc->part_names_size;
+	entry->next = doc->part_names[pos];
+	doc->part_names[pos] = entry;
+	doc->part_names_count++;
+	return entry->name;
+}
+
+void
+xps_free_part_names(xps_document *doc)
+{
+	xps_part_name *entry, *next;
+	int i;
+
+	for (i = 0; i < doc->part_names_size; i++)
+	{
+		for (entry = doc->part_names[i]; entry; entry = next)
+		{
+			next = entry->next;
+			xps_uncache_image(doc, entry->name);
+			xps_uncache_font(doc, entry->name);
+			fz_free(doc->ctx, entry->name);
+			fz_free(doc->ctx, entry);
+		}
+	}
+	fz_free(doc->ctx, doc->part_names);
+	doc->part_names = NULL;
+	doc->part_names_size = 0;
+	doc->part_names_count = 0;
+}
+
 /* A URL is defined as consisting of a:
  * SCHEME (e.g. http:)
  * AUTHORITY (username, password, hostname, port, eg //test:passwd@mupdf.com:999)
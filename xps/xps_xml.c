@@ -1,25 +1,48 @@
 #include "muxps-internal.h"
 
+/*
+ * The tree is parsed in place: element names and attribute names and
+ * values are null-terminated and entity-decoded inside the text buffer,
+ * which the tree owns. Elements and attributes are allocated from an
+ * arena, so freeing the tree is a handful of frees however large the
+ * document.
+ */
+
 struct attribute
 {
-	char name[40];
+	char *name;
 	char *value;
 	struct attribute *next;
 };
 
 struct element
 {
-	char name[40];
+	char *name;
 	struct attribute *atts;
 	struct element *up, *down, *next;
 };
 
+/* The root of every tree is the sentinel element of its document */
+struct document
+{
+	struct element root;
+	char *text;
+	fz_arena *arena;
+};
+
 struct parser
 {
 	struct element *head;
+	struct element *last; /* last child of head */
+	struct document *doc;
 	fz_context *ctx;
 };
 
+static void *xml_alloc(struct parser *parser, int size)
+{
+	return fz_arena_alloc(parser->ctx, parser->doc->arena, size);
+}
+
 static inline void indent(int n)
 {
 	while (n--) putchar(' ');
@@ -70,34 +93,20 @@ char *xml_att(struct element *item, const char *name)
 	return NULL;
 }
 
-static void xml_free_attribute(fz_context *ctx, struct attribute *att)
+static void xml_free_document(fz_context *ctx, struct document *doc)
 {
-	while (att) {
-		struct attribute *next = att->next;
-		if (att->value)
-			fz_free(ctx, att->value);
-		fz_free(ctx, att);
-		att = next;
-	}
+	fz_free_arena(ctx, doc->arena);
+	fz_free(ctx, doc->text);
+	fz_free(ctx, doc);
 }
 
 void xml_free_element(fz_context *ctx, struct element *item)
 {
-	while (item) {
-		struct element *next = item->next;
-		if (item->atts)
-			xml_free_attribute(ctx, item->atts);
-		if (item->down)
-			xml_free_element(ctx, item->down);
-		fz_free(ctx, item);
-		item = next;
-	}
-}
-
-void xml_detach(xml_element *node)
-{
-	if (node->up)
-		node->up->down = NULL;
+	if (!item)
+		return;
+	while (item->up)
+		item = item->up;
+	xml_free_document(ctx, (struct document *)item);
 }
 
 static int xml_parse_entity(int *c, char *a)
@@ -137,30 +146,22 @@ static int xml_parse_entity(int *c, char *a)
 
 static void xml_emit_open_tag(struct parser *parser, char *a, char *b)
 {
-	struct element *head, *tail;
-
-	head = fz_malloc_struct(parser->ctx, struct element);
-	if (b - a > sizeof(head->name))
-		b = a + sizeof(head->name);
-	memcpy(head->name, a, b - a);
-	head->name[b - a] = 0;
+	struct element *head;
 
+	head = xml_alloc(parser, sizeof *head);
+	head->name = a;
 	head->atts = NULL;
 	head->up = parser->head;
 	head->down = NULL;
 	head->next = NULL;
 
-	if (!parser->head->down) {
+	if (parser->last)
+		parser->last->next = head;
+	else
 		parser->head->down = head;
-	}
-	else {
-		tail = parser->head->down;
-		while (tail->next)
-			tail = tail->next;
-		tail->next = head;
-	}
 
 	parser->head = head;
+	parser->last = NULL;
 }
 
 static void xml_emit_att_name(struct parser *parser, char *a, char *b)
@@ -168,11 +169,8 @@ static void xml_emit_att_name(struct parser *parser, char *a, char *b)
 	struct element *head = parser->head;
 	struct attribute *att;
 
-	att = fz_malloc_struct(parser->ctx, struct attribute);
-	if (b - a > sizeof(att->name))
-		b = a + sizeof(att->name);
-	memcpy(att->name, a, b - a);
-	att->name[b - a] = 0;
+	att = xml_alloc(parser, sizeof *att);
+	att->name = a;
 	att->value = NULL;
 	att->next = head->atts;
 	head->atts = att;
@@ -185,8 +183,8 @@ static void xml_emit_att_value(struct parser *parser, char *a, char *b)
 	char *s;
 	int c;
 
-	/* entities are all longer than UTFmax so runetochar is safe */
-	s = att->value = fz_malloc(parser->ctx, b - a + 1);
+	/* entities are all longer than UTFmax so decoding in place is safe */
+	s = att->value = a;
 	while (a < b) {
 		if (*a == '&') {
 			a += xml_parse_entity(&c, a);
@@ -201,8 +199,10 @@ static void xml_emit_att_value(struct parser *parser, char *a, char *b)
 
 static void xml_emit_close_tag(struct parser *parser)
 {
-	if (parser->head->up)
+	if (parser->head->up) {
+		parser->last = parser->head;
 		parser->head = parser->head->up;
+	}
 }
 
 static inline int isname(int c)
@@ -220,7 +220,7 @@ static inline int iswhite(int c)
 
 static char *xml_parse_document_imp(struct parser *x, char *p)
 {
-	char *mark;
+	char *mark, *end;
 	int quote;
 
 parse_text:
@@ -291,14 +291,17 @@ parse_element_name:
 	mark = p;
 	while (isname(*p)) ++p;
 	xml_emit_open_tag(x, mark, p);
-	if (*p == '>') { ++p; goto parse_text; }
+	if (*p == '>') { *p++ = 0; goto parse_text; }
 	if (p[0] == '/' && p[1] == '>') {
+		*p = 0;
 		xml_emit_close_tag(x);
 		p += 2;
 		goto parse_text;
 	}
-	if (iswhite(*p))
+	if (iswhite(*p)) {
+		*p++ = 0;
 		goto parse_attributes;
+	}
 	return "syntax error after element name";
 
 parse_attributes:
@@ -317,8 +320,9 @@ parse_attribute_name:
 	mark = p;
 	while (isname(*p)) ++p;
 	xml_emit_att_name(x, mark, p);
+	end = p;
 	while (iswhite(*p)) ++p;
-	if (*p == '=') { ++p; goto parse_attribute_value; }
+	if (*p == '=') { *end = 0; ++p; goto parse_attribute_value; }
 	return "syntax error after attribute name";
 
 parse_attribute_value:
@@ -370,23 +374,66 @@ struct element *
 xml_parse_document(fz_context *ctx, unsigned char *s, int n)
 {
 	struct parser parser;
-	struct element root;
+	struct document *doc;
 	char *p, *error;
 
 	/* s is already null-terminated (see xps_new_part) */
 
-	memset(&root, 0, sizeof(root));
-	parser.head = &root;
-	parser.ctx = ctx;
+	fz_try(ctx)
+	{
+		p = convert_to_utf8(ctx, s, n);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, s);
+		fz_rethrow(ctx);
+	}
+	if (p != (char*)s)
+		fz_free(ctx, s);
 
-	p = convert_to_utf8(ctx, s, n);
+	fz_try(ctx)
+	{
+		doc = fz_malloc_struct(ctx, struct document);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, p);
+		fz_rethrow(ctx);
+	}
+	doc->text = p;
 
-	error = xml_parse_document_imp(&parser, p);
-	if (error)
-		fz_throw(ctx, "%s", error);
+	fz_try(ctx)
+	{
+		doc->arena = fz_new_arena(ctx, 0);
+	}
+	fz_catch(ctx)
+	{
+		xml_free_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
 
-	if (p != (char*)s)
-		fz_free(ctx, p);
+	parser.head = &doc->root;
+	parser.last = NULL;
+	parser.doc = doc;
+	parser.ctx = ctx;
+
+	fz_try(ctx)
+	{
+		error = xml_parse_document_imp(&parser, p);
+		if (error)
+			fz_throw(ctx, "%s", error);
+	}
+	fz_catch(ctx)
+	{
+		xml_free_document(ctx, doc);
+		fz_rethrow(ctx);
+	}
+
+	if (!doc->root.down)
+	{
+		xml_free_document(ctx, doc);
+		return NULL;
+	}
 
-	return root.down;
+	return doc->root.down;
 }